@@ -20,6 +20,7 @@
 #include <epicsString.h>
 #include <ellLib.h>
 #include <cantProceed.h>
+#include <epicsAtomic.h>
 
 #include <epicsExport.h>
 
@@ -28,7 +29,7 @@
 /** NDArray constructor, no parameters.
   * Initializes all fields to 0.  Creates the attribute linked list and linked list mutex. */
 NDArray::NDArray()
-  : referenceCount(0), pNDArrayPool(NULL),  
+  : referenceCount(0), bufferType_(0), pViewParent_(NULL), pContiguous_(NULL), pNDArrayPool(NULL),
     uniqueId(0), timeStamp(0.0), ndims(0), dataType(NDInt8),
     dataSize(0),  pData(NULL)
 {
@@ -43,7 +44,7 @@ NDArray::NDArray()
   * Frees the data array, deletes all attributes, frees the attribute list and destroys the mutex. */
 NDArray::~NDArray()
 {
-  if (this->pData) free(this->pData);
+  if (this->pData) NDArrayPool::freeBuffer(this->pData, this->dataSize, this->bufferType_);
   delete this->pAttributeList;
 }
 
@@ -160,6 +161,7 @@ int NDArray::initDimension(NDDimension_t *pDimension, size_t size)
   pDimension->binning = 1;
   pDimension->offset = 0;
   pDimension->reverse = 0;
+  pDimension->stride = 0;
   return ND_SUCCESS;
 }
 
@@ -187,6 +189,37 @@ int NDArray::release()
   return(pNDArrayPool->release(this));
 }
 
+/** Returns the current reference count for this array.
+  * The value can change as soon as it is returned if other threads hold references to the array. */
+int NDArray::getReferenceCount()
+{
+  return epicsAtomicGetIntT(&this->referenceCount);
+}
+
+/** Returns true if this array is a view, which references the data of another array.
+  * Views are created with NDArrayPool::createView(). */
+bool NDArray::isView()
+{
+  return (this->pViewParent_ != NULL);
+}
+
+/** Returns true if the data of this array is stored contiguously in pData, in the order of the dimensions.
+  * This is true for all arrays except views whose dimensions do not span the full dimensions of
+  * the array they reference. Code which accesses pData directly must either handle the per-dimension
+  * strides (NDDimension_t::stride) or call NDArrayPool::makeContiguous() if this returns false.
+  */
+bool NDArray::isContiguous()
+{
+  size_t stride = 1;
+  int i;
+
+  for (i=0; i<this->ndims; i++) {
+    if ((this->dims[i].stride != 0) && (this->dims[i].size > 1) && (this->dims[i].stride != stride)) return false;
+    stride *= this->dims[i].size;
+  }
+  return true;
+}
+
 /** Reports on the properties of the array.
   * \param[in] fp File pointer for the report output.
   * \param[in] details Level of report details desired; if >5 calls NDAttributeList::report().
@@ -204,7 +237,13 @@ int NDArray::report(FILE *fp, int details)
   fprintf(fp, "  dataType=%d, dataSize=%d, pData=%p\n",
         this->dataType, (int)this->dataSize, this->pData);
   fprintf(fp, "  uniqueId=%d, timeStamp=%f, referenceCount=%d\n",
-        this->uniqueId, this->timeStamp, this->referenceCount);
+        this->uniqueId, this->timeStamp, this->getReferenceCount());
+  if (this->pViewParent_) {
+    fprintf(fp, "  view of array=%p, contiguous=%d, strides=[",
+      this->pViewParent_, this->isContiguous());
+    for (dim=0; dim<this->ndims; dim++) fprintf(fp, "%d ", (int)this->dims[dim].stride);
+    fprintf(fp, "]\n");
+  }
   fprintf(fp, "  number of attributes=%d\n", this->pAttributeList->count());
   if (details > 5) {
     this->pAttributeList->report(fp, details);
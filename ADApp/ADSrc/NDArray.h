@@ -13,6 +13,7 @@
 #define NDArray_H
 
 #include <epicsMutex.h>
+#include <epicsEvent.h>
 #include <epicsTime.h>
 #include <stdio.h>
 
@@ -22,6 +23,15 @@
 /** The maximum number of dimensions in an NDArray */
 #define ND_ARRAY_MAX_DIMS 10
 
+/** The number of buffer size classes in an NDArrayPool.
+  * Size class 0 holds NDArrays with no data buffer, size class n>0 holds NDArrays with
+  * data buffers of more than 2^(n-2) and at most 2^(n-1) bytes. */
+#define ND_ARRAY_POOL_SIZE_CLASSES ((int)(8*sizeof(size_t)) + 2)
+
+/** The alignment in bytes of the data buffers that NDArrayPool allocates.
+  * This is sufficient for aligned loads of SIMD registers up to 512 bits (AVX-512). */
+#define ND_ARRAY_ALIGNMENT 64
+
 /** Enumeration of color modes for NDArray attribute "colorMode" */
 typedef enum
 {
@@ -47,6 +57,17 @@ typedef enum
     NDBayerBGGR        = 3     /**< First line BGBG, second line GRGR... */
 } NDBayerPattern_t;
 
+/** Enumeration of the methods that NDArrayPool uses to allocate NDArray data buffers.
+  * All of them return buffers aligned to at least ND_ARRAY_ALIGNMENT bytes. */
+typedef enum
+{
+    NDAllocAligned,     /**< Buffers are aligned to ND_ARRAY_ALIGNMENT bytes */
+    NDAllocHugePage,    /**< Buffers of 2 MB or more are aligned to 2 MB and advised to use transparent huge pages.
+                          *  Transparent huge pages are only supported on Linux, on other systems this is NDAllocAligned. */
+    NDAllocHugeTLB      /**< Buffers of 2 MB or more are allocated from explicit huge pages with mmap(MAP_HUGETLB).
+                          *  If no huge pages are available, or on systems other than Linux, this is NDAllocHugePage. */
+} NDAllocPolicy_t;
+
 /** Structure defining a dimension of an NDArray */
 typedef struct NDDimension {
     size_t size;    /**< The number of elements in this dimension of the array */
@@ -63,6 +84,9 @@ typedef struct NDDimension {
                       * This value is cumulative, so if a plugin such as NDPluginROI reverses the data, the value must
                       * reflect the orientation relative to the original detector, and not to the possibly
                       * reversed data passed to NDPluginROI. */
+    size_t stride;  /**< The number of elements in pData between successive elements of this dimension.
+                      * This is 0 for arrays whose data is stored contiguously, and is only set for views
+                      * created with NDArrayPool::createView(), which reference the data of another array. */
 } NDDimension_t;
 
 /** Structure returned by NDArray::getInfo */
@@ -96,12 +120,20 @@ public:
     int          getInfo         (NDArrayInfo_t *pInfo);
     int          reserve();
     int          release();
+    int          getReferenceCount();
+    bool         isView();
+    bool         isContiguous();
     int          report(FILE *fp, int details);
     friend class NDArrayPool;
     
 private:
     ELLNODE      node;              /**< This must come first because ELLNODE must have the same address as NDArray object */
-    int          referenceCount;    /**< Reference count for this NDArray=number of clients who are using it */
+    int          referenceCount;    /**< Reference count for this NDArray=number of clients who are using it.
+                                      *  Only accessed with epicsAtomic functions */
+    int          bufferType_;       /**< How pData was allocated, so that it can be freed the same way */
+    NDArray      *pViewParent_;     /**< For a view, the array which owns the data, which is reserved by the view */
+    void         *pContiguous_;     /**< For a non-contiguous view, the contiguous copy made by NDArrayPool::makeContiguous().
+                                      *  Only accessed with epicsAtomic functions */
 
 public:
     class NDArrayPool *pNDArrayPool; /**< The NDArrayPool object that created this array */
@@ -121,18 +153,49 @@ public:
     NDAttributeList *pAttributeList;  /**< Linked list of attributes */
 };
 
+/** Number of bins in the latency histograms of NDArrayPoolStats_t.  Bin 0 counts times of less than
+  * 1 microsecond, bin n counts times from 2^(n-1) to 2^n microseconds, and the last bin all longer times. */
+#define ND_ARRAY_POOL_HIST_BINS 20
+
+/** Statistics of an NDArrayPool, returned by NDArrayPool::getStats() */
+typedef struct NDArrayPoolStats {
+    int    numAllocs;         /**< Number of arrays allocated with alloc() and createView() */
+    int    numMallocs;        /**< Number of data buffers allocated from the system */
+    int    numEvictions;      /**< Number of times free data buffers were freed to stay within maxMemory */
+    int    numAllocFailures;  /**< Number of allocations which failed */
+    int    peakBuffersInUse;  /**< Maximum number of arrays in use at the same time */
+    size_t peakMemory;        /**< Maximum number of bytes of memory allocated at the same time */
+    int    maxAllocTimeNs;    /**< Longest time in alloc() in nanoseconds, if timing is enabled */
+    int    maxLockWaitNs;     /**< Longest time alloc() waited for the pool lock in nanoseconds, if timing is enabled */
+    int    allocTimeHist[ND_ARRAY_POOL_HIST_BINS];  /**< Histogram of the time in alloc() */
+    int    lockWaitHist[ND_ARRAY_POOL_HIST_BINS];   /**< Histogram of the time alloc() waited for the pool lock */
+} NDArrayPoolStats_t;
+
+struct NDArrayMagazine;
+struct NDArrayPoolListNode;
+
 /** The NDArrayPool class manages a free list (pool) of NDArray objects.
   * Drivers allocate NDArray objects from the pool, and pass these objects to plugins.
   * Plugins increase the reference count on the object when they place the object on
   * their queue, and decrease the reference count when they are done processing the
   * array. When the reference count reaches 0 again the NDArray object is placed back
   * on the free list. This mechanism minimizes the copying of array data in plugins.
+  * The free list is segregated into size classes by the size of the data buffer, so that
+  * arrays of different sizes allocated from the same pool each reuse a buffer of a suitable size.
+  * Threads which enable the thread cache with setThreadCache() also keep a small per-thread cache
+  * ("magazine") of free NDArrays for each pool, which alloc() and release() use without taking the pool lock.
   */
 class epicsShareClass NDArrayPool {
 public:
     NDArrayPool  (int maxBuffers, size_t maxMemory);
+    ~NDArrayPool ();
+    friend class NDArray;
     NDArray*     alloc     (int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData);
+    int          preAllocate(int numArrays, int ndims, size_t *dims, NDDataType_t dataType, int lockMemory);
     NDArray*     copy      (NDArray *pIn, NDArray *pOut, int copyData);
+    NDArray*     createView     (NDArray *pParent, NDDimension_t *dims);
+    NDArray*     makeContiguous (NDArray *pArray);
+    NDArray*     makeWritable   (NDArray *pArray, int numOwned, int copyData);
 
     int          reserve   (NDArray *pArray);
     int          release   (NDArray *pArray);
@@ -149,14 +212,67 @@ public:
     size_t       maxMemory  ();
     size_t       memorySize ();
     int          numFree    ();
+    int          numFree    (int sizeClass);
+    size_t       memorySize (int sizeClass);
+    static int   sizeClass  (size_t dataSize);
+    NDAllocPolicy_t allocPolicy   ();
+    int          setAllocPolicy    (NDAllocPolicy_t allocPolicy);
+    double       allocTimeout      ();
+    int          setAllocTimeout   (double timeout);
+    int          numAllocWaits     ();
+    int          numAllocTimeouts  ();
+    void         getStats          (NDArrayPoolStats_t *pStats);
+    void         resetStats        ();
+    int          collectTiming     ();
+    void         setCollectTiming  (int enable);
+    double       memoryWeight      ();
+    void         setMemoryWeight   (double weight);
+    static size_t totalMemorySize  ();
+    static void  setThreadCache    (int enable);
+    static void  flushThreadCache  ();
 private:
-    ELLLIST      freeList_;      /**< Linked list of free NDArray objects that form the pool */
+    NDArray*     allocArray         (int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize,
+                                     void *pData, int bufferType, double timeout);
+    NDArray*     doAllocArray       (int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize,
+                                     void *pData, int bufferType, double timeout);
+    void         releaseView        (NDArray *pArray);
+    void*        allocBuffer        (size_t dataSize, int *pBufferType);
+    static void  freeBuffer         (void *pData, size_t dataSize, int bufferType);
+    void         addToFreeList      (NDArray *pArray);
+    void         removeFromFreeList (NDArray *pArray);
+    NDArray*     findFreeArray      (size_t dataSize, bool bestFitOnly);
+    void         freeArrayData      (NDArray *pArray);
+    NDArrayMagazine* getMagazine    (bool create);
+    NDArray*     allocFromMagazine  (NDArrayMagazine *pMagazine, size_t dataSize);
+    void         releaseToMagazine  (NDArrayMagazine *pMagazine, NDArray *pArray);
+    void         refillMagazine     (NDArrayMagazine *pMagazine, NDArray *pArray);
+    void         drainMagazine      (NDArrayMagazine *pMagazine);
+    void         reclaimMagazines   ();
+    size_t       freeUnusedMemory   (size_t numBytes);
+    void         reclaimGlobalMemory(size_t dataSize);
+    ELLLIST      freeList_[ND_ARRAY_POOL_SIZE_CLASSES]; /**< Linked lists of free NDArray objects that form the pool,
+                                                         *  one per size class, each sorted by increasing dataSize */
+    int          numFreeClass_[ND_ARRAY_POOL_SIZE_CLASSES];      /**< Number of NDArray objects in each free list */
+    size_t       memorySizeClass_[ND_ARRAY_POOL_SIZE_CLASSES];   /**< Number of bytes of memory currently allocated
+                                                                   *  in each size class, including arrays in use */
     epicsMutexId listLock_;      /**< Mutex to protect the free list */
     int          maxBuffers_;    /**< Maximum number of buffers this object is allowed to allocate; -1=unlimited */
     int          numBuffers_;    /**< Number of buffers this object has currently allocated */
     size_t       maxMemory_;     /**< Maximum bytes of memory this object is allowed to allocate; -1=unlimited */
     size_t       memorySize_;    /**< Number of bytes of memory this object has currently allocated */
-    int          numFree_;       /**< Number of NDArray objects in the free list */
+    int          numFree_;       /**< Number of NDArray objects in the free list, excluding the thread caches */
+    ELLLIST      magazineList_;  /**< The thread caches (NDArrayMagazine) for this pool */
+    NDAllocPolicy_t allocPolicy_; /**< How data buffers are allocated */
+    double       allocTimeout_;  /**< Time in seconds that alloc() waits for a free array at the limits; 0=no wait */
+    epicsEventId freeEvent_;     /**< Signalled by release() when threads are waiting in alloc() */
+    int          numWaiting_;    /**< Number of threads in alloc() which need freeEvent_ to be signalled */
+    int          numAllocWaits_; /**< Number of allocations which have had to wait */
+    int          numAllocTimeouts_; /**< Number of allocations which have failed after waiting */
+    int          numInUse_;      /**< Number of arrays currently in use */
+    int          collectTiming_; /**< Measure the latency of alloc() in stats_ */
+    NDArrayPoolStats_t stats_;   /**< Allocation statistics */
+    double       memoryWeight_;  /**< Weight of this pool in the sharing of NDArrayPoolMemoryBudget */
+    NDArrayPoolListNode *pListNode_; /**< Node of this pool in the list of all pools */
 };
 
 #endif
@@ -7,37 +7,769 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <limits>
+#ifdef _WIN32
+  #include <malloc.h>
+#endif
+#ifdef vxWorks
+  #include <memLib.h>
+#endif
+#ifdef __linux__
+  #include <sys/mman.h>
+#endif
+#ifdef __GLIBC__
+  #include <malloc.h>
+#endif
 
 #include <cantProceed.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsMessageQueue.h>
+#include <epicsStdio.h>
 #include <epicsExport.h>
 
 #include "NDArray.h"
 
 static const char *driverName = "NDArrayPool";
 
+/** Size of a huge page, buffers of this size or larger are eligible for huge pages */
+#define HUGE_PAGE_SIZE (2*1024*1024)
+/** The smallest page size of the supported architectures, used to touch every page of a buffer */
+#define SMALL_PAGE_SIZE 4096
 
-/** eraseNDAttributes is a global flag the controls whether NDArray::clearAttributes() is called
+/** How the data buffer of an NDArray was allocated, which determines how it must be freed */
+typedef enum {
+  NDBufferMalloc,     /**< Allocated with malloc() or passed by the caller of alloc(), freed with free() */
+  NDBufferAligned,    /**< Allocated with alignedMalloc(), freed with alignedFree() */
+  NDBufferMmap,       /**< Allocated with mmap(), freed with munmap() */
+  NDBufferView        /**< Owned by another array, of which this array is a view; not freed */
+} NDBufferType_t;
+
+
+/** eraseNDAttributes is a global flag the controls whether NDAttributeList::reset() is called
   * each time a new array is allocated with NDArrayPool->alloc().
-  * The default value is 0, meaning that clearAttributes() is not called.  This mode is efficient
+  * The default value is 0, meaning that reset() is not called.  This mode is efficient
   * because it saves lots of allocation/deallocation, and it is fine when the attributes for a driver
   * are set once and not changed.  If driver attributes are deleted however, the allocated arrays
   * will still have the old attributes if this flag is 0.  Set this flag to force attributes to be
-  * removed each time an NDArray is allocated.
+  * removed each time an NDArray is allocated.  The removed attributes are kept by the list and reused
+  * when the driver adds them again, so this does not allocate memory for each array either.
   */
 
 volatile int eraseNDAttributes=0;
 extern "C" {epicsExportAddress(int, eraseNDAttributes);}
 
+/** NDArrayPoolAllocPolicy is a global variable that sets the NDAllocPolicy_t that each
+  * NDArrayPool uses when it is created.  The default value is 0 (NDAllocAligned).
+  * It must be set before the drivers and plugins are created, for example to use transparent
+  * huge pages for large arrays:
+  *   var NDArrayPoolAllocPolicy 1
+  * The policy of an existing pool can be changed with NDArrayPool::setAllocPolicy().
+  */
+volatile int NDArrayPoolAllocPolicy=NDAllocAligned;
+extern "C" {epicsExportAddress(int, NDArrayPoolAllocPolicy);}
+
+/** NDArrayPoolThreadCacheSize is a global variable that sets the maximum number of free NDArrays
+  * that each thread which has enabled the thread cache with NDArrayPool::setThreadCache() keeps for each pool.
+  * The default value is 8.  A value of 0 disables the thread caches.  Changes only affect
+  * thread caches which are created afterwards.
+  */
+volatile int NDArrayPoolThreadCacheSize=8;
+extern "C" {epicsExportAddress(int, NDArrayPoolThreadCacheSize);}
+
+/** NDArrayPoolConvertThreads is a global variable that sets the number of threads that
+  * NDArrayPool::convert() uses for arrays with at least NDArrayPoolConvertThreshold elements.
+  * The default value is 1, which does the conversion in the calling thread.  The convert threads
+  * are shared by all pools, and are created when they are first needed. For example:
+  *   var NDArrayPoolConvertThreads 4
+  */
+volatile int NDArrayPoolConvertThreads=1;
+extern "C" {epicsExportAddress(int, NDArrayPoolConvertThreads);}
+
+/** NDArrayPoolConvertThreshold is a global variable that sets the minimum number of elements in the output
+  * array for NDArrayPool::convert() to use NDArrayPoolConvertThreads threads.  The default value is 4194304.
+  */
+volatile int NDArrayPoolConvertThreshold=4194304;
+extern "C" {epicsExportAddress(int, NDArrayPoolConvertThreshold);}
+
+/** NDArrayPoolCollectTiming is a global variable that sets whether each NDArrayPool measures the latency
+  * of alloc() when it is created.  The default value is 0 because this reads the time twice for each
+  * allocation. The setting of an existing pool can be changed with NDArrayPool::setCollectTiming().
+  */
+volatile int NDArrayPoolCollectTiming=0;
+extern "C" {epicsExportAddress(int, NDArrayPoolCollectTiming);}
+
+/** NDArrayPoolMemoryBudget is a global variable that sets the maximum memory in MB that all of the
+  * NDArrayPools in the IOC may allocate together.  The default value is 0, which is unlimited.
+  * When the budget is reached a pool frees the unused buffers in its own free list, and then those of the
+  * other pools, starting with the pools which exceed their share of the budget (see
+  * NDArrayPool::setMemoryWeight()) by the most, before an allocation fails.  Arrays in use are never freed.
+  * For example:
+  *   var NDArrayPoolMemoryBudget 8192
+  */
+volatile int NDArrayPoolMemoryBudget=0;
+extern "C" {epicsExportAddress(int, NDArrayPoolMemoryBudget);}
+
+/** NDArrayPoolMallocTrim is a global variable that sets whether malloc_trim() is called to return memory
+  * to the operating system after the buffers of other pools have been freed to stay within
+  * NDArrayPoolMemoryBudget.  This is only supported with glibc. The default value is 0.
+  */
+volatile int NDArrayPoolMallocTrim=0;
+extern "C" {epicsExportAddress(int, NDArrayPoolMallocTrim);}
+
+/** Allocates memory aligned to a power of 2 alignment */
+static void *alignedMalloc(size_t size, size_t alignment)
+{
+#if defined(_WIN32)
+  return _aligned_malloc(size, alignment);
+#elif defined(vxWorks)
+  return memalign(alignment, size);
+#else
+  void *ptr;
+  if (posix_memalign(&ptr, alignment, size)) return NULL;
+  return ptr;
+#endif
+}
+
+/** Frees memory allocated with alignedMalloc() */
+static void alignedFree(void *ptr)
+{
+#if defined(_WIN32)
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+/** A free data buffer is only reused for a request that needs less than 1/4 of its size
+  * if the pool cannot allocate another NDArray for the request. */
+static const int maxOversizeClasses = 2;
+
+/** A per-thread cache of free NDArrays for one NDArrayPool.
+  * Only the owning thread adds arrays to the magazine or takes them from it, other threads only
+  * reclaim the arrays to the free list of the pool.  lock is therefore almost never contended.
+  * Lock order: NDArrayPool::listLock_ before NDArrayMagazine::lock. */
+struct NDArrayMagazine {
+  ELLNODE          poolNode;        /**< Node in NDArrayPool::magazineList_, must come first */
+  NDArrayPool      *pPool;          /**< The pool that the arrays belong to */
+  NDArrayMagazine  *pNextInThread;  /**< Next magazine of the owning thread */
+  epicsMutexId     lock;            /**< Protects count and arrays */
+  int              size;            /**< Maximum number of arrays */
+  int              count;           /**< Number of arrays, arrays[count-1] is the most recently released */
+  NDArray          **arrays;        /**< The free arrays */
+};
+
+/** The thread private data of a thread which has enabled the thread cache */
+typedef struct {
+  NDArrayMagazine *pMagazines;      /**< The magazines of this thread, one per pool used */
+} NDArrayThreadCache;
+
+static epicsThreadOnceId threadCacheOnce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId threadCacheId = 0;
+
+static void threadCacheInit(void *)
+{
+  threadCacheId = epicsThreadPrivateCreate();
+}
+
+/** The node of an NDArrayPool in the list of all pools, which is used to share NDArrayPoolMemoryBudget */
+struct NDArrayPoolListNode {
+  ELLNODE          node;            /**< Node in poolList, must come first */
+  NDArrayPool      *pPool;          /**< The pool */
+};
+
+static epicsThreadOnceId poolListOnce = EPICS_THREAD_ONCE_INIT;
+static epicsMutexId poolListLock;   /* Protects poolList. Lock order: poolListLock before NDArrayPool::listLock_ */
+static ELLLIST poolList;            /* All NDArrayPools */
+static size_t allPoolsMemorySize;  /* Sum of the memory allocated by all NDArrayPools, changed atomically */
+
+static void poolListInit(void *)
+{
+  poolListLock = epicsMutexCreate();
+  ellInit(&poolList);
+}
+
+/** Returns NDArrayPoolMemoryBudget in bytes, 0 if there is no budget */
+static size_t memoryBudget()
+{
+  return (NDArrayPoolMemoryBudget > 0) ? (size_t)NDArrayPoolMemoryBudget * 1048576 : 0;
+}
+
+/** Adds size bytes to allPoolsMemorySize if this does not exceed NDArrayPoolMemoryBudget.
+  * \return 1 if the memory was added, 0 if it would exceed the budget. */
+static int reserveMemory(size_t size)
+{
+  size_t budget = memoryBudget();
+  size_t total;
+
+  do {
+    total = epicsAtomicGetSizeT(&allPoolsMemorySize);
+    if ((budget > 0) && (total + size > budget)) return 0;
+  } while (epicsAtomicCmpAndSwapSizeT(&allPoolsMemorySize, total, total + size) != total);
+  return 1;
+}
+
 /** NDArrayPool constructor
   * \param[in] maxBuffers Maximum number of NDArray objects that the pool is allowed to contain; 0=unlimited.
   * \param[in] maxMemory Maxiumum number of bytes of memory the the pool is allowed to use, summed over
   * all of the NDArray objects; 0=unlimited.
   */
 NDArrayPool::NDArrayPool(int maxBuffers, size_t maxMemory)
-  : maxBuffers_(maxBuffers), numBuffers_(0), maxMemory_(maxMemory), memorySize_(0), numFree_(0)
+  : maxBuffers_(maxBuffers), numBuffers_(0), maxMemory_(maxMemory), memorySize_(0), numFree_(0),
+    allocPolicy_(NDAllocAligned), allocTimeout_(0.), numWaiting_(0), numAllocWaits_(0), numAllocTimeouts_(0),
+    numInUse_(0), collectTiming_(NDArrayPoolCollectTiming), memoryWeight_(1.)
 {
-  ellInit(&freeList_);
+  int i;
+
+  for (i=0; i<ND_ARRAY_POOL_SIZE_CLASSES; i++) {
+    ellInit(&freeList_[i]);
+    numFreeClass_[i] = 0;
+    memorySizeClass_[i] = 0;
+  }
+  ellInit(&magazineList_);
+  memset(&stats_, 0, sizeof(stats_));
   listLock_ = epicsMutexCreate();
+  freeEvent_ = epicsEventCreate(epicsEventEmpty);
+  setAllocPolicy((NDAllocPolicy_t)NDArrayPoolAllocPolicy);
+
+  epicsThreadOnce(&poolListOnce, poolListInit, NULL);
+  pListNode_ = (NDArrayPoolListNode *)calloc(1, sizeof(NDArrayPoolListNode));
+  pListNode_->pPool = this;
+  epicsMutexLock(poolListLock);
+  ellAdd(&poolList, &pListNode_->node);
+  epicsMutexUnlock(poolListLock);
+}
+
+/** NDArrayPool destructor.  This removes the pool from the list of pools which share NDArrayPoolMemoryBudget,
+  * and its memory from the memory allocated by all pools.
+  * The magazines of the threads for this pool are drained and detached from the pool; the threads
+  * delete them when they disable their thread cache.  The NDArrays on the free list are deleted;
+  * NDArrays which are still in use are not, and must not be released after the pool is deleted.
+  */
+NDArrayPool::~NDArrayPool()
+{
+  NDArrayMagazine *pMagazine;
+  NDArray *pArray;
+  int sc;
+
+  /* Other pools must not free the buffers of this pool in reclaimGlobalMemory() while it is deleted */
+  epicsMutexLock(poolListLock);
+  ellDelete(&poolList, &pListNode_->node);
+  epicsMutexUnlock(poolListLock);
+  free(pListNode_);
+
+  epicsMutexLock(listLock_);
+  while ((pMagazine = (NDArrayMagazine *)ellGet(&magazineList_))) {
+    drainMagazine(pMagazine);
+    epicsMutexLock(pMagazine->lock);
+    pMagazine->pPool = NULL;
+    epicsMutexUnlock(pMagazine->lock);
+  }
+  for (sc=0; sc<ND_ARRAY_POOL_SIZE_CLASSES; sc++) {
+    while ((pArray = (NDArray *)ellFirst(&freeList_[sc]))) {
+      removeFromFreeList(pArray);
+      freeArrayData(pArray);
+      delete pArray;
+    }
+  }
+  epicsMutexUnlock(listLock_);
+  epicsAtomicSubSizeT(&allPoolsMemorySize, memorySize_);
+  epicsMutexDestroy(listLock_);
+  epicsEventDestroy(freeEvent_);
+}
+
+/** Returns the size class for a data buffer of dataSize bytes.
+  * Size class 0 is for arrays with no data buffer. Size class n>0 is for data buffers
+  * of more than 2^(n-2) and at most 2^(n-1) bytes.
+  * \param[in] dataSize The size of the data buffer in bytes.
+  */
+int NDArrayPool::sizeClass(size_t dataSize)
+{
+  int sizeClass = 0;
+
+  if (dataSize == 0) return 0;
+  dataSize--;
+  sizeClass = 1;
+  while (dataSize) {
+    dataSize >>= 1;
+    sizeClass++;
+  }
+  return sizeClass;
+}
+
+/** Adds an NDArray to the free list for its size class, keeping that list sorted by increasing dataSize.
+  * Must be called with listLock_ held. */
+void NDArrayPool::addToFreeList(NDArray *pArray)
+{
+  int sc = sizeClass(pArray->dataSize);
+  NDArray *pPrev = (NDArray *)ellLast(&freeList_[sc]);
+
+  /* Arrays of equal size are kept in the order in which they were released */
+  while (pPrev && (pPrev->dataSize > pArray->dataSize)) {
+    pPrev = (NDArray *)ellPrevious(&pPrev->node);
+  }
+  ellInsert(&freeList_[sc], pPrev ? &pPrev->node : NULL, &pArray->node);
+  numFreeClass_[sc]++;
+  numFree_++;
+}
+
+/** Removes an NDArray from the free list for its size class.
+  * Must be called with listLock_ held. */
+void NDArrayPool::removeFromFreeList(NDArray *pArray)
+{
+  int sc = sizeClass(pArray->dataSize);
+
+  ellDelete(&freeList_[sc], &pArray->node);
+  numFreeClass_[sc]--;
+  numFree_--;
+}
+
+/** Finds the free NDArray with the smallest data buffer that can hold dataSize bytes.
+  * \param[in] dataSize The number of bytes required.
+  * \param[in] bestFitOnly If true only buffers at most maxOversizeClasses size classes larger than
+  *            required are considered, if false any larger buffer is considered.
+  * \return The NDArray, or NULL if there is no free array with a large enough buffer.
+  * Must be called with listLock_ held. */
+NDArray* NDArrayPool::findFreeArray(size_t dataSize, bool bestFitOnly)
+{
+  int sc = sizeClass(dataSize);
+  int lastClass = ND_ARRAY_POOL_SIZE_CLASSES - 1;
+  NDArray *pArray;
+
+  if (bestFitOnly && (sc + maxOversizeClasses < lastClass)) lastClass = sc + maxOversizeClasses;
+  for (; sc<=lastClass; sc++) {
+    pArray = (NDArray *)ellFirst(&freeList_[sc]);
+    while (pArray) {
+      if (pArray->dataSize >= dataSize) return pArray;
+      pArray = (NDArray *)ellNext(&pArray->node);
+    }
+  }
+  return NULL;
+}
+
+/** Enables or disables the thread cache for the calling thread.
+  * \param[in] enable 1 to enable, 0 to disable.
+  *
+  * When the thread cache is enabled the thread keeps a small cache ("magazine") of free NDArrays for
+  * each NDArrayPool that it allocates from.  release() puts the arrays it returns to the pool into the
+  * magazine, and alloc() takes arrays from it, without taking the pool lock. The magazines are refilled
+  * from and drained to the free list of the pool in batches.  The arrays in the magazines are still
+  * counted as free by the pool, and are reclaimed if the pool would otherwise exceed maxBuffers or maxMemory.
+  * Disabling the thread cache returns all arrays in the magazines of the thread to their pools.
+  * Threads which enable the thread cache must disable it before they exit.
+  */
+void NDArrayPool::setThreadCache(int enable)
+{
+  NDArrayThreadCache *pCache;
+  NDArrayMagazine *pMagazine;
+
+  epicsThreadOnce(&threadCacheOnce, threadCacheInit, NULL);
+  pCache = (NDArrayThreadCache *)epicsThreadPrivateGet(threadCacheId);
+  if (enable) {
+    if (!pCache) {
+      pCache = new NDArrayThreadCache;
+      pCache->pMagazines = NULL;
+      epicsThreadPrivateSet(threadCacheId, pCache);
+    }
+    return;
+  }
+  if (!pCache) return;
+  while ((pMagazine = pCache->pMagazines)) {
+    NDArrayPool *pPool = pMagazine->pPool;
+    pCache->pMagazines = pMagazine->pNextInThread;
+    /* The magazine of a pool which has been deleted is already empty */
+    if (pPool) {
+      epicsMutexLock(pPool->listLock_);
+      pPool->drainMagazine(pMagazine);
+      ellDelete(&pPool->magazineList_, &pMagazine->poolNode);
+      epicsMutexUnlock(pPool->listLock_);
+    }
+    epicsMutexDestroy(pMagazine->lock);
+    delete [] pMagazine->arrays;
+    delete pMagazine;
+  }
+  epicsThreadPrivateSet(threadCacheId, NULL);
+  delete pCache;
+}
+
+/** Returns all arrays in the magazines of the calling thread to the free lists of their pools.
+  * The thread cache remains enabled. */
+void NDArrayPool::flushThreadCache()
+{
+  NDArrayThreadCache *pCache;
+  NDArrayMagazine *pMagazine;
+
+  if (!threadCacheId) return;
+  pCache = (NDArrayThreadCache *)epicsThreadPrivateGet(threadCacheId);
+  if (!pCache) return;
+  for (pMagazine=pCache->pMagazines; pMagazine; pMagazine=pMagazine->pNextInThread) {
+    NDArrayPool *pPool = pMagazine->pPool;
+    if (!pPool) continue;
+    epicsMutexLock(pPool->listLock_);
+    pPool->drainMagazine(pMagazine);
+    epicsMutexUnlock(pPool->listLock_);
+  }
+}
+
+/** Returns the magazine of the calling thread for this pool.
+  * \param[in] create If true the magazine is created if the thread does not have one yet.
+  * alloc() creates magazines but release() does not, so that threads which only release arrays,
+  * e.g. plugins which do not allocate from this pool, do not keep free arrays of it.
+  * \return The magazine, or NULL if the calling thread has not enabled the thread cache
+  * or has no magazine for this pool and create is false.
+  * Must be called without listLock_ held. */
+NDArrayMagazine* NDArrayPool::getMagazine(bool create)
+{
+  NDArrayThreadCache *pCache;
+  NDArrayMagazine *pMagazine;
+  int size = NDArrayPoolThreadCacheSize;
+
+  if (!threadCacheId) return NULL;
+  pCache = (NDArrayThreadCache *)epicsThreadPrivateGet(threadCacheId);
+  if (!pCache) return NULL;
+  for (pMagazine=pCache->pMagazines; pMagazine; pMagazine=pMagazine->pNextInThread) {
+    if (pMagazine->pPool == this) return pMagazine;
+  }
+  if (!create || (size <= 0)) return NULL;
+  pMagazine = new NDArrayMagazine;
+  pMagazine->pPool = this;
+  pMagazine->lock = epicsMutexCreate();
+  pMagazine->size = size;
+  pMagazine->count = 0;
+  pMagazine->arrays = new NDArray*[size];
+  pMagazine->pNextInThread = pCache->pMagazines;
+  pCache->pMagazines = pMagazine;
+  epicsMutexLock(listLock_);
+  ellAdd(&magazineList_, &pMagazine->poolNode);
+  epicsMutexUnlock(listLock_);
+  return pMagazine;
+}
+
+/** Takes the most recently released array from a magazine which has a buffer that can hold dataSize bytes
+  * and is at most maxOversizeClasses size classes larger than required.
+  * \return The array, or NULL if the magazine contains no such array. */
+NDArray* NDArrayPool::allocFromMagazine(NDArrayMagazine *pMagazine, size_t dataSize)
+{
+  NDArray *pArray = NULL;
+  int lastClass = sizeClass(dataSize) + maxOversizeClasses;
+  int i;
+
+  epicsMutexLock(pMagazine->lock);
+  for (i=pMagazine->count-1; i>=0; i--) {
+    if ((pMagazine->arrays[i]->dataSize >= dataSize) &&
+        (sizeClass(pMagazine->arrays[i]->dataSize) <= lastClass)) {
+      pArray = pMagazine->arrays[i];
+      pMagazine->count--;
+      for (; i<pMagazine->count; i++) pMagazine->arrays[i] = pMagazine->arrays[i+1];
+      break;
+    }
+  }
+  epicsMutexUnlock(pMagazine->lock);
+  return pArray;
+}
+
+/** Puts an array whose reference count has dropped to 0 into a magazine.
+  * If the magazine is full the older half of it is first returned to the free list.
+  * Must be called without listLock_ held. */
+void NDArrayPool::releaseToMagazine(NDArrayMagazine *pMagazine, NDArray *pArray)
+{
+  ELLLIST drainList;
+  NDArray *pDrain;
+  int numDrain = 0;
+  int i;
+
+  ellInit(&drainList);
+  epicsMutexLock(pMagazine->lock);
+  if (pMagazine->count == pMagazine->size) {
+    numDrain = (pMagazine->size + 1) / 2;
+    for (i=0; i<numDrain; i++) {
+      ellAdd(&drainList, &pMagazine->arrays[i]->node);
+    }
+    pMagazine->count -= numDrain;
+    for (i=0; i<pMagazine->count; i++) pMagazine->arrays[i] = pMagazine->arrays[i+numDrain];
+  }
+  pMagazine->arrays[pMagazine->count++] = pArray;
+  epicsMutexUnlock(pMagazine->lock);
+
+  if (numDrain > 0) {
+    epicsMutexLock(listLock_);
+    while ((pDrain = (NDArray *)ellGet(&drainList))) {
+      addToFreeList(pDrain);
+    }
+    epicsMutexUnlock(listLock_);
+  }
+}
+
+/** Moves free arrays which follow pArray in its free list into a magazine until the magazine is half full.
+  * These are the next best fitting arrays for the size that pArray was chosen for.
+  * Must be called with listLock_ held, pArray is not moved. */
+void NDArrayPool::refillMagazine(NDArrayMagazine *pMagazine, NDArray *pArray)
+{
+  NDArray *pNext;
+  int sc = sizeClass(pArray->dataSize);
+
+  epicsMutexLock(pMagazine->lock);
+  while ((pMagazine->count < pMagazine->size/2) &&
+         ((pNext = (NDArray *)ellNext(&pArray->node)) != NULL) &&
+         (sizeClass(pNext->dataSize) == sc)) {
+    removeFromFreeList(pNext);
+    pMagazine->arrays[pMagazine->count++] = pNext;
+  }
+  epicsMutexUnlock(pMagazine->lock);
+}
+
+/** Returns all arrays in a magazine to the free list.
+  * Must be called with listLock_ held. */
+void NDArrayPool::drainMagazine(NDArrayMagazine *pMagazine)
+{
+  int i;
+
+  epicsMutexLock(pMagazine->lock);
+  for (i=0; i<pMagazine->count; i++) {
+    addToFreeList(pMagazine->arrays[i]);
+  }
+  pMagazine->count = 0;
+  epicsMutexUnlock(pMagazine->lock);
+}
+
+/** Returns the arrays in the magazines of all threads to the free list, so that they can be reused
+  * or their buffers freed when the pool reaches maxBuffers or maxMemory.
+  * Must be called with listLock_ held. */
+void NDArrayPool::reclaimMagazines()
+{
+  NDArrayMagazine *pMagazine;
+
+  for (pMagazine = (NDArrayMagazine *)ellFirst(&magazineList_); pMagazine;
+       pMagazine = (NDArrayMagazine *)ellNext(&pMagazine->poolNode)) {
+    drainMagazine(pMagazine);
+  }
+}
+
+/** Allocates a data buffer using the allocation policy of this pool.
+  * \param[in] dataSize The size of the buffer in bytes.
+  * \param[out] pBufferType How the buffer was allocated, must be passed to freeBuffer().
+  * \return A pointer to the buffer, which is aligned to at least ND_ARRAY_ALIGNMENT bytes, or NULL on failure.
+  */
+void* NDArrayPool::allocBuffer(size_t dataSize, int *pBufferType)
+{
+  void *pData;
+  size_t hugeSize = ((dataSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+
+  *pBufferType = NDBufferAligned;
+  if ((allocPolicy_ == NDAllocAligned) || (dataSize < HUGE_PAGE_SIZE)) {
+    return alignedMalloc(dataSize, ND_ARRAY_ALIGNMENT);
+  }
+#if defined(MAP_HUGETLB)
+  if (allocPolicy_ == NDAllocHugeTLB) {
+    pData = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pData != MAP_FAILED) {
+      *pBufferType = NDBufferMmap;
+      return pData;
+    }
+    // No huge pages are available, fall back to transparent huge pages
+  }
+#endif
+  pData = alignedMalloc(hugeSize, HUGE_PAGE_SIZE);
+#if defined(MADV_HUGEPAGE)
+  if (pData) madvise(pData, hugeSize, MADV_HUGEPAGE);
+#endif
+  return pData;
+}
+
+/** Frees a data buffer.
+  * \param[in] pData The buffer to free.
+  * \param[in] dataSize The size that was passed to allocBuffer().
+  * \param[in] bufferType The buffer type returned by allocBuffer().
+  */
+void NDArrayPool::freeBuffer(void *pData, size_t dataSize, int bufferType)
+{
+  switch (bufferType) {
+    case NDBufferAligned:
+      alignedFree(pData);
+      break;
+#if defined(MAP_HUGETLB)
+    case NDBufferMmap:
+      munmap(pData, ((dataSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE);
+      break;
+#endif
+    case NDBufferView:
+      /* The buffer is owned by the parent of the view */
+      break;
+    default:
+      free(pData);
+      break;
+  }
+}
+
+/** Frees the data buffer of an NDArray which is not on the free list.
+  * Must be called with listLock_ held. */
+void NDArrayPool::freeArrayData(NDArray *pArray)
+{
+  if (pArray->pData && (pArray->bufferType_ != NDBufferView)) {
+    memorySize_ -= pArray->dataSize;
+    memorySizeClass_[sizeClass(pArray->dataSize)] -= pArray->dataSize;
+    epicsAtomicSubSizeT(&allPoolsMemorySize, pArray->dataSize);
+    freeBuffer(pArray->pData, pArray->dataSize, pArray->bufferType_);
+  }
+  pArray->pData = NULL;
+  pArray->dataSize = 0;
+  pArray->bufferType_ = NDBufferMalloc;
+}
+
+/** Frees the data buffers of free arrays, including those in the thread caches, starting with the
+  * largest ones, until at least numBytes bytes have been freed or there are no more free buffers.
+  * Must be called with listLock_ held.
+  * \return The number of bytes freed.
+  */
+size_t NDArrayPool::freeUnusedMemory(size_t numBytes)
+{
+  NDArray *pArray;
+  size_t freed = 0;
+  int sc;
+
+  reclaimMagazines();
+  for (sc=ND_ARRAY_POOL_SIZE_CLASSES-1; (sc>0) && (freed < numBytes); sc--) {
+    while ((freed < numBytes) && ((pArray = (NDArray *)ellLast(&freeList_[sc])) != NULL)) {
+      removeFromFreeList(pArray);
+      freed += pArray->dataSize;
+      freeArrayData(pArray);
+      addToFreeList(pArray);
+    }
+  }
+  return freed;
+}
+
+typedef struct {
+  NDArrayPool *pPool;
+  double      excess;   /* Memory of the pool in excess of its share of the budget */
+} NDPoolExcess_t;
+
+static int compareExcess(const void *p1, const void *p2)
+{
+  double excess1 = ((const NDPoolExcess_t *)p1)->excess;
+  double excess2 = ((const NDPoolExcess_t *)p2)->excess;
+
+  return (excess1 > excess2) ? -1 : ((excess1 < excess2) ? 1 : 0);
+}
+
+/** Frees unused data buffers of the other pools so that this pool can allocate dataSize bytes within
+  * NDArrayPoolMemoryBudget.  The share of the budget of each pool is proportional to its memory weight.
+  * Buffers are freed first in the pools which exceed their share by the most, so pools with a higher
+  * weight keep their free buffers longer.
+  * Must be called without listLock_ held.
+  */
+void NDArrayPool::reclaimGlobalMemory(size_t dataSize)
+{
+  NDArrayPoolListNode *pNode;
+  NDPoolExcess_t *pCandidates;
+  size_t budget = memoryBudget();
+  size_t total, freed = 0;
+  double sumWeights = 0.;
+  int numCandidates = 0, i;
+
+  if (budget == 0) return;
+  epicsMutexLock(poolListLock);
+  pCandidates = (NDPoolExcess_t *)calloc(ellCount(&poolList), sizeof(NDPoolExcess_t));
+  if (!pCandidates) {
+    epicsMutexUnlock(poolListLock);
+    return;
+  }
+  for (pNode = (NDArrayPoolListNode *)ellFirst(&poolList); pNode;
+       pNode = (NDArrayPoolListNode *)ellNext(&pNode->node)) {
+    sumWeights += pNode->pPool->memoryWeight_;
+  }
+  if (sumWeights <= 0.) sumWeights = 1.;
+  for (pNode = (NDArrayPoolListNode *)ellFirst(&poolList); pNode;
+       pNode = (NDArrayPoolListNode *)ellNext(&pNode->node)) {
+    NDArrayPool *pPool = pNode->pPool;
+    size_t memorySize;
+    if (pPool == this) continue;
+    epicsMutexLock(pPool->listLock_);
+    memorySize = pPool->memorySize_;
+    epicsMutexUnlock(pPool->listLock_);
+    double excess = (double)memorySize - budget * pPool->memoryWeight_ / sumWeights;
+    pCandidates[numCandidates].pPool = pPool;
+    pCandidates[numCandidates].excess = excess;
+    numCandidates++;
+  }
+  qsort(pCandidates, numCandidates, sizeof(NDPoolExcess_t), compareExcess);
+  for (i=0; i<numCandidates; i++) {
+    NDArrayPool *pPool = pCandidates[i].pPool;
+    total = epicsAtomicGetSizeT(&allPoolsMemorySize);
+    if (total + dataSize <= budget) break;
+    epicsMutexLock(pPool->listLock_);
+    freed += pPool->freeUnusedMemory(total + dataSize - budget);
+    epicsMutexUnlock(pPool->listLock_);
+  }
+  epicsMutexUnlock(poolListLock);
+  free(pCandidates);
+#ifdef __GLIBC__
+  if (freed && NDArrayPoolMallocTrim) malloc_trim(0);
+#endif
+}
+
+/** Returns the number of bytes required to hold an array with the specified dimensions and data type. */
+static size_t arrayBytes(int ndims, size_t *dims, NDDataType_t dataType)
+{
+  size_t totalBytes;
+  int i;
+
+  switch(dataType) {
+    case NDInt8:
+      totalBytes = sizeof(epicsInt8);
+      break;
+    case NDUInt8:
+      totalBytes = sizeof(epicsUInt8);
+      break;
+    case NDInt16:
+      totalBytes = sizeof(epicsInt16);
+      break;
+    case NDUInt16:
+      totalBytes = sizeof(epicsUInt16);
+      break;
+    case NDInt32:
+      totalBytes = sizeof(epicsInt32);
+      break;
+    case NDUInt32:
+      totalBytes = sizeof(epicsUInt32);
+      break;
+    case NDFloat32:
+      totalBytes = sizeof(epicsFloat32);
+      break;
+    case NDFloat64:
+      totalBytes = sizeof(epicsFloat64);
+      break;
+    default:
+      return 0;
+  }
+  for (i=0; i<ndims && i<ND_ARRAY_MAX_DIMS; i++) totalBytes *= dims[i];
+  return totalBytes;
+}
+
+/** Initializes the fields of an NDArray which is being allocated, except for the data buffer */
+static void initArray(NDArray *pArray, NDArrayPool *pPool, int ndims, size_t *dims, NDDataType_t dataType)
+{
+  int i;
+
+  pArray->pNDArrayPool = pPool;
+  pArray->dataType = dataType;
+  pArray->ndims = ndims;
+  memset(pArray->dims, 0, sizeof(pArray->dims));
+  for (i=0; i<ndims && i<ND_ARRAY_MAX_DIMS; i++) {
+    pArray->dims[i].size = dims[i];
+    pArray->dims[i].offset = 0;
+    pArray->dims[i].binning = 1;
+    pArray->dims[i].reverse = 0;
+  }
+  /* Erase the attributes if that global flag is set */
+  if (eraseNDAttributes) pArray->pAttributeList->reset();
 }
 
 /** Allocates a new NDArray object; the first 3 arguments are required.
@@ -51,122 +783,374 @@ NDArrayPool::NDArrayPool(int maxBuffers, size_t maxMemory)
   * 
   * If pData is not NULL then dataSize must contain the actual number of bytes in the existing
   * array, and this array must be large enough to hold the array data. 
-  * alloc() searches
-  * its free list to find a free NDArray buffer. If is cannot find one then it will
-  * allocate a new one and add it to the free list. If doing so would exceed maxBuffers
-  * then alloc() will return an error. Similarly if allocating the memory required for
+  * alloc() searches the free list of the size class for dataSize, and the next
+  * larger size classes, for the NDArray with the smallest buffer which is large enough.
+  * If it cannot find one then it will use a free NDArray without a buffer, or
+  * allocate a new one. If doing so would exceed maxBuffers
+  * then alloc() will reuse the free NDArray with the best fitting buffer, freeing it if it
+  * is too small, and will return an error if there is no free NDArray. 
+  * Similarly if allocating the memory required for
   * this NDArray would cause the cumulative memory allocated for the pool to exceed
-  * maxMemory then an error will be returned. alloc() sets the reference count for the
-  * returned NDArray to 1.
+  * maxMemory then the buffers of other free NDArrays are freed, and if that is not sufficient
+  * an error will be returned. If an allocation timeout has been set (see setAllocTimeout()) then
+  * instead of returning these errors alloc() waits up to that time for other threads to release arrays.
+  * alloc() sets the reference count for the returned NDArray to 1.
+  * Data buffers allocated by alloc() are aligned to at least ND_ARRAY_ALIGNMENT bytes,
+  * and are allocated according to the allocation policy of the pool (see setAllocPolicy()).
+  * If the calling thread has enabled the thread cache (see setThreadCache()) alloc() first looks
+  * for a suitable array in the magazine of the thread, without taking the pool lock.
   */
 NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData)
 {
-  NDArray *pArray;
-  NDArrayInfo_t arrayInfo;
-  int i;
-  const char* functionName = "NDArrayPool::alloc:";
+  return allocArray(ndims, dims, dataType, dataSize, pData, NDBufferMalloc, allocTimeout_);
+}
 
-  epicsMutexLock(listLock_);
+/** This method allocates NDArrays and touches every page of their data buffers, and then releases them
+  * to the free list.  The first arrays which are allocated with this shape and data type after this
+  * will therefore not have to allocate memory or wait for page faults.
+  * \param[in] numArrays The number of arrays to allocate.
+  * \param[in] ndims The number of dimensions of the arrays.
+  * \param[in] dims Array of dimensions, whose size must be at least ndims.
+  * \param[in] dataType Data type of the arrays.
+  * \param[in] lockMemory If 1 then the data buffers are also locked in physical memory with mlock().
+  * This is only supported on Linux, and requires sufficient RLIMIT_MEMLOCK or CAP_IPC_LOCK.
+  * \return Returns ND_ERROR if numArrays arrays could not be allocated, for example because maxBuffers or
+  * maxMemory would be exceeded, otherwise ND_SUCCESS.
+  */
+int NDArrayPool::preAllocate(int numArrays, int ndims, size_t *dims, NDDataType_t dataType, int lockMemory)
+{
+  const char *functionName = "preAllocate";
+  NDArray **pArrays;
+  volatile char *pData;
+  size_t offset;
+  int i, numAllocated;
+  int status = ND_SUCCESS;
+
+  if (numArrays <= 0) return ND_SUCCESS;
+  pArrays = (NDArray **)calloc(numArrays, sizeof(NDArray *));
+  if (!pArrays) return ND_ERROR;
+  for (numAllocated=0; numAllocated<numArrays; numAllocated++) {
+    /* Do not wait for free arrays, they would only be released by this loop */
+    pArrays[numAllocated] = allocArray(ndims, dims, dataType, 0, NULL, NDBufferMalloc, 0.);
+    if (!pArrays[numAllocated]) {
+      printf("%s:%s: ERROR, could only allocate %d of %d arrays\n",
+             driverName, functionName, numAllocated, numArrays);
+      status = ND_ERROR;
+      break;
+    }
+    /* Write to each page so the operating system maps it now */
+    pData = (volatile char *)pArrays[numAllocated]->pData;
+    for (offset=0; offset<pArrays[numAllocated]->dataSize; offset+=SMALL_PAGE_SIZE) {
+      pData[offset] = 0;
+    }
+#ifdef __linux__
+    if (lockMemory && mlock(pArrays[numAllocated]->pData, pArrays[numAllocated]->dataSize)) {
+      printf("%s:%s: ERROR, mlock failed: %s\n", driverName, functionName, strerror(errno));
+      lockMemory = 0;
+      status = ND_ERROR;
+    }
+#endif
+  }
+  for (i=0; i<numAllocated; i++) {
+    pArrays[i]->release();
+  }
+  free(pArrays);
+  return status;
+}
+
+/** Adds a latency to a histogram of NDArrayPoolStats_t and updates its maximum. */
+static void addLatency(int *hist, int *pMaxNs, const epicsTimeStamp *pStart, const epicsTimeStamp *pEnd)
+{
+  double us = epicsTimeDiffInSeconds(pEnd, pStart) * 1e6;
+  int ns, maxNs, bin = 0;
+
+  if (us < 0.) us = 0.;
+  ns = (us < 2e6) ? (int)(us * 1e3) : 2000000000;
+  for (bin=0; (bin < ND_ARRAY_POOL_HIST_BINS-1) && (us >= 1.); bin++) us *= 0.5;
+  epicsAtomicIncrIntT(&hist[bin]);
+  /* Replace the maximum unless another thread has stored a larger one */
+  maxNs = epicsAtomicGetIntT(pMaxNs);
+  while ((ns > maxNs) && (epicsAtomicCmpAndSwapIntT(pMaxNs, maxNs, ns) != maxNs)) {
+    maxNs = epicsAtomicGetIntT(pMaxNs);
+  }
+}
 
-  /* Find a free image */
-  pArray = (NDArray *)ellFirst(&freeList_);
+/** Implements alloc() and createView(), and maintains the allocation statistics, see doAllocArray(). */
+NDArray* NDArrayPool::allocArray(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize,
+                                 void *pData, int bufferType, double timeout)
+{
+  NDArray *pArray;
+  epicsTimeStamp tStart, tEnd;
+  int timing = collectTiming_;
+  int inUse, peak;
 
+  if (timing) epicsTimeGetCurrent(&tStart);
+  pArray = doAllocArray(ndims, dims, dataType, dataSize, pData, bufferType, timeout);
+  if (timing) {
+    epicsTimeGetCurrent(&tEnd);
+    addLatency(stats_.allocTimeHist, &stats_.maxAllocTimeNs, &tStart, &tEnd);
+  }
   if (!pArray) {
-    /* We did not find a free image.
-     * Allocate a new one if we have not exceeded the limit */
-    if ((maxBuffers_ > 0) && (numBuffers_ >= maxBuffers_)) {
-      printf("%s: error: reached limit of %d buffers (memory use=%ld/%ld bytes)\n",
-             functionName, maxBuffers_, (long)memorySize_, (long)maxMemory_);
-    } else {
-      numBuffers_++;
-      pArray = new NDArray;
-      ellAdd(&freeList_, &pArray->node);
-      numFree_++;
-    }
+    epicsAtomicIncrIntT(&stats_.numAllocFailures);
+    return NULL;
   }
+  epicsAtomicIncrIntT(&stats_.numAllocs);
+  inUse = epicsAtomicIncrIntT(&numInUse_);
+  peak = epicsAtomicGetIntT(&stats_.peakBuffersInUse);
+  while ((inUse > peak) && (epicsAtomicCmpAndSwapIntT(&stats_.peakBuffersInUse, peak, inUse) != peak)) {
+    peak = epicsAtomicGetIntT(&stats_.peakBuffersInUse);
+  }
+  return pArray;
+}
 
-  if (pArray) {
-    /* We have a frame */
-    /* Initialize fields */
-    pArray->pNDArrayPool = this;
-    pArray->dataType = dataType;
-    pArray->ndims = ndims;
-    memset(pArray->dims, 0, sizeof(pArray->dims));
-    for (i=0; i<ndims && i<ND_ARRAY_MAX_DIMS; i++) {
-      pArray->dims[i].size = dims[i];
-      pArray->dims[i].offset = 0;
-      pArray->dims[i].binning = 1;
-      pArray->dims[i].reverse = 0;
-    }
-    /* Erase the attributes if that global flag is set */
-    if (eraseNDAttributes) pArray->pAttributeList->clear();
-    pArray->getInfo(&arrayInfo);
-    if (dataSize == 0) dataSize = arrayInfo.totalBytes;
-    if (arrayInfo.totalBytes > dataSize) {
-      printf("%s: ERROR: required size=%d passed size=%d is too small\n",
-      functionName, (int)arrayInfo.totalBytes, (int)dataSize);
-      pArray=NULL;
+/** Allocates an array for allocArray().  The additional argument bufferType is the NDBufferType_t of pData if pData
+  * is not NULL.  Buffers of type NDBufferView are not counted in the memory used by the pool.
+  * If maxBuffers or maxMemory has been reached and timeout is greater than 0 then this waits up to
+  * timeout seconds for other threads to release arrays before returning an error. */
+NDArray* NDArrayPool::doAllocArray(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize,
+                                 void *pData, int bufferType, double timeout)
+{
+  NDArray *pArray;
+  NDArrayMagazine *pMagazine;
+  size_t totalBytes;
+  int sc;
+  int limitReached;
+  int waited = 0;
+  int reclaimedGlobal = 0;
+  double remaining;
+  epicsTimeStamp tStart, tNow, tLock;
+  const char* functionName = "NDArrayPool::alloc:";
+
+  /* Compute the required size before searching the free list */
+  totalBytes = arrayBytes(ndims, dims, dataType);
+  if (dataSize == 0) dataSize = totalBytes;
+  if (totalBytes > dataSize) {
+    printf("%s: ERROR: required size=%d passed size=%d is too small\n",
+    functionName, (int)totalBytes, (int)dataSize);
+    return NULL;
+  }
+
+  /* Try the magazine of this thread first, it does not need the pool lock */
+  pMagazine = pData ? NULL : getMagazine(true);
+  if (pMagazine) {
+    pArray = allocFromMagazine(pMagazine, dataSize);
+    if (pArray) {
+      initArray(pArray, this, ndims, dims, dataType);
+      epicsAtomicSetIntT(&pArray->referenceCount, 1);
+      return pArray;
     }
   }
 
-  if (pArray) {
-    /* If the caller passed a valid buffer use that, trust that its size is correct */
-    if (pData) {
-      pArray->pData = pData;
-    } else {
-      /* See if the current buffer is big enough */
-      if (pArray->dataSize < dataSize) {
-        /* No, we need to free the current buffer and allocate a new one */
-        /* See if there is enough room */
-        if (pArray->pData) {
-          memorySize_ -= pArray->dataSize;
-          free(pArray->pData);
-          pArray->pData = NULL;
-          pArray->dataSize = 0;
+  if (collectTiming_) {
+    epicsTimeGetCurrent(&tLock);
+    epicsMutexLock(listLock_);
+    epicsTimeGetCurrent(&tNow);
+    addLatency(stats_.lockWaitHist, &stats_.maxLockWaitNs, &tLock, &tNow);
+  } else {
+    epicsMutexLock(listLock_);
+  }
+  /* While numWaiting_ is non-zero release() signals freeEvent_.  It is incremented before the
+   * first attempt so that an array released to a thread cache after reclaimMagazines() below
+   * is not missed */
+  if (timeout > 0.) epicsAtomicIncrIntT(&numWaiting_);
+
+  while (1) {
+    limitReached = 0;
+
+    /* Find a free image with a buffer of the right size.
+     * If the caller passed a buffer we prefer an image without a buffer */
+    pArray = pData ? NULL : findFreeArray(dataSize, true);
+    /* Move the next best fitting images to the magazine of this thread for its next calls */
+    if (pArray && pMagazine) refillMagazine(pMagazine, pArray);
+
+    if (!pArray) {
+      pArray = (NDArray *)ellFirst(&freeList_[0]);
+    }
+
+    if (!pArray) {
+      /* We did not find a free image that we can use without freeing a buffer.
+       * Allocate a new one if we have not exceeded the limit */
+      if ((maxBuffers_ > 0) && (numBuffers_ >= maxBuffers_)) {
+        /* Use the image with the smallest buffer which is large enough.  If there is none
+         * use the image with the largest buffer, which will be freed below.
+         * Free images in the thread caches are candidates too */
+        reclaimMagazines();
+        if (!pData) pArray = findFreeArray(dataSize, false);
+        if (!pArray) pArray = (NDArray *)ellFirst(&freeList_[0]);
+        for (sc=ND_ARRAY_POOL_SIZE_CLASSES-1; !pArray && (sc>0); sc--) {
+          pArray = (NDArray *)ellLast(&freeList_[sc]);
         }
-        if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
-          // We don't have enough memory to allocate the array
-          // See if we can get memory by deleting arrays
-          NDArray *freeArray = (NDArray *)ellFirst(&freeList_);
-          while (freeArray && ((memorySize_ + dataSize) > maxMemory_)) {
-            if (freeArray->pData) {
-              memorySize_ -= freeArray->dataSize;
-              free(freeArray->pData);
-              freeArray->pData = NULL;
-              freeArray->dataSize = 0;
-            }
-            // Next array
-            freeArray = (NDArray *)ellNext(&freeArray->node);
-          }
+        if (!pArray) {
+          limitReached = 1;
         }
-        if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
-          printf("%s: error: reached limit of %ld memory (%d/%d buffers)\n",
-                 functionName, (long)maxMemory_, numBuffers_, maxBuffers_);
-          pArray = NULL;
-        } else {
-          pArray->pData = malloc(dataSize);
-          if (pArray->pData) {
-            pArray->dataSize = dataSize;
-            memorySize_ += dataSize;
-          } else {
-            pArray = NULL;
+      } else {
+        numBuffers_++;
+        pArray = new NDArray;
+        addToFreeList(pArray);
+      }
+    }
+
+    if (pArray) {
+      /* We have a frame, remove it from the free list while we work on it */
+      removeFromFreeList(pArray);
+      initArray(pArray, this, ndims, dims, dataType);
+    }
+
+    if (pArray) {
+      /* If the caller passed a valid buffer use that, trust that its size is correct */
+      if (pData) {
+        freeArrayData(pArray);
+        pArray->pData = pData;
+        pArray->dataSize = dataSize;
+        pArray->bufferType_ = bufferType;
+        if (bufferType != NDBufferView) {
+          memorySize_ += dataSize;
+          memorySizeClass_[sizeClass(dataSize)] += dataSize;
+          epicsAtomicAddSizeT(&allPoolsMemorySize, dataSize);
+          if (memorySize_ > stats_.peakMemory) stats_.peakMemory = memorySize_;
+        }
+      } else {
+        /* See if the current buffer is big enough */
+        if (pArray->dataSize < dataSize) {
+          /* No, we need to free the current buffer and allocate a new one */
+          freeArrayData(pArray);
+          /* See if there is enough room */
+          if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
+            // We don't have enough memory to allocate the array
+            // See if we can get memory by deleting arrays, starting with the largest ones,
+            // including those in the thread caches
+            stats_.numEvictions++;
+            freeUnusedMemory(memorySize_ + dataSize - maxMemory_);
+          }
+          if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
+            limitReached = 2;
+          } else if (!reserveMemory(dataSize)) {
+            // The IOC-wide memory budget is reached, free our own unused buffers first
+            stats_.numEvictions++;
+            freeUnusedMemory(dataSize);
+            if (!reserveMemory(dataSize)) limitReached = 3;
+          }
+          if (!limitReached) {
+            pArray->pData = allocBuffer(dataSize, &pArray->bufferType_);
+            if (pArray->pData) {
+              pArray->dataSize = dataSize;
+              memorySize_ += dataSize;
+              memorySizeClass_[sizeClass(dataSize)] += dataSize;
+              if (memorySize_ > stats_.peakMemory) stats_.peakMemory = memorySize_;
+              stats_.numMallocs++;
+            } else {
+              epicsAtomicSubSizeT(&allPoolsMemorySize, dataSize);
+            }
           }
         }
       }
+      // If we don't have a valid memory buffer put the array back on the free list and
+      // set pArray to NULL to indicate error
+      if (pArray->pData == NULL) {
+        addToFreeList(pArray);
+        pArray = NULL;
+      }
+    }
+    if ((limitReached == 3) && !reclaimedGlobal) {
+      /* Free unused buffers of the other pools and try again */
+      reclaimedGlobal = 1;
+      epicsMutexUnlock(listLock_);
+      reclaimGlobalMemory(dataSize);
+      epicsMutexLock(listLock_);
+      continue;
     }
-    // If we don't have a valid memory buffer see pArray to NULL to indicate error
-    if (pArray && (pArray->pData == NULL)) pArray = NULL;
+    if (pArray || !limitReached || (timeout <= 0.)) break;
+    /* Wait for another thread to release an array and try again */
+    if (!waited) {
+      waited = 1;
+      numAllocWaits_++;
+      epicsTimeGetCurrent(&tStart);
+    }
+    epicsTimeGetCurrent(&tNow);
+    remaining = timeout - epicsTimeDiffInSeconds(&tNow, &tStart);
+    if (remaining <= 0.) {
+      numAllocTimeouts_++;
+      break;
+    }
+    epicsMutexUnlock(listLock_);
+    /* Arrays released to other pools do not signal freeEvent_, so poll while waiting for the budget */
+    if ((limitReached == 3) && (remaining > 0.01)) remaining = 0.01;
+    epicsEventWaitWithTimeout(freeEvent_, remaining);
+    epicsMutexLock(listLock_);
+    reclaimedGlobal = 0;
+  }
+  if (timeout > 0.) epicsAtomicDecrIntT(&numWaiting_);
+
+  if (limitReached == 1) {
+    printf("%s: error: reached limit of %d buffers (memory use=%ld/%ld bytes)\n",
+           functionName, maxBuffers_, (long)memorySize_, (long)maxMemory_);
+  } else if (limitReached == 2) {
+    printf("%s: error: reached limit of %ld memory (%d/%d buffers)\n",
+           functionName, (long)maxMemory_, numBuffers_, maxBuffers_);
+  } else if (limitReached == 3) {
+    printf("%s: error: reached IOC memory budget of %ld bytes (all pools=%ld, this pool=%ld bytes)\n",
+           functionName, (long)memoryBudget(), (long)epicsAtomicGetSizeT(&allPoolsMemorySize), (long)memorySize_);
   }
   if (pArray) {
-    /* Set the reference count to 1, remove from free list */
-    pArray->referenceCount = 1;
-    ellDelete(&freeList_, &pArray->node);
-    numFree_--;
+    /* Set the reference count to 1 */
+    epicsAtomicSetIntT(&pArray->referenceCount, 1);
+    /* Pass the wakeup on in case more than one array was released */
+    if (waited && (epicsAtomicGetIntT(&numWaiting_) > 0)) epicsEventSignal(freeEvent_);
   }
   epicsMutexUnlock(listLock_);
   return (pArray);
 }
 
+/** Copies the data of a view which is not contiguous to a contiguous buffer.
+  * \param[in] pIn The input view.
+  * \param[out] pOut The output buffer.
+  * \param[in] outBytes The size of the output buffer.
+  */
+static void copyStridedData(NDArray *pIn, void *pOut, size_t outBytes)
+{
+  NDArrayInfo_t arrayInfo;
+  size_t index[ND_ARRAY_MAX_DIMS];
+  size_t runBytes, numRuns, run, offset;
+  char *pDataOut = (char *)pOut;
+  int first, i;
+
+  pIn->getInfo(&arrayInfo);
+  if (pIn->ndims <= 0) return;
+  memset(index, 0, sizeof(index));
+  /* If the first dimension is contiguous copy it in one memcpy */
+  first = (pIn->dims[0].stride == 1) ? 1 : 0;
+  runBytes = first ? pIn->dims[0].size * arrayInfo.bytesPerElement : arrayInfo.bytesPerElement;
+  numRuns = first ? arrayInfo.nElements / pIn->dims[0].size : arrayInfo.nElements;
+  for (run=0; (run<numRuns) && (outBytes>=runBytes); run++) {
+    offset = 0;
+    for (i=first; i<pIn->ndims; i++) offset += index[i] * pIn->dims[i].stride;
+    memcpy(pDataOut, (char *)pIn->pData + offset*arrayInfo.bytesPerElement, runBytes);
+    pDataOut += runBytes;
+    outBytes -= runBytes;
+    for (i=first; i<pIn->ndims; i++) {
+      if (++index[i] < pIn->dims[i].size) break;
+      index[i] = 0;
+    }
+  }
+}
+
+/** If the array is an RGBx array whose color dimension no longer has 3 elements, change its ColorMode attribute to mono */
+static void fixColorMode(NDArray *pArray)
+{
+  NDAttribute *pAttribute;
+  int colorMode, colorModeMono = NDColorModeMono;
+
+  pAttribute = pArray->pAttributeList->find("ColorMode");
+  if (pAttribute && pAttribute->getValue(NDAttrInt32, &colorMode)) {
+    if      ((colorMode == NDColorModeRGB1) && (pArray->dims[0].size != 3)) 
+      pAttribute->setValue(&colorModeMono);
+    else if ((colorMode == NDColorModeRGB2) && (pArray->dims[1].size != 3)) 
+      pAttribute->setValue(&colorModeMono);
+    else if ((colorMode == NDColorModeRGB3) && (pArray->dims[2].size != 3))
+      pAttribute->setValue(&colorModeMono);
+  }
+}
+
 /** This method makes a copy of an NDArray object.
   * \param[in] pIn The input array to be copied.
   * \param[in] pOut The output array that will be copied to.
@@ -177,6 +1161,7 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
   * If pOut is NULL then it is first allocated. If the output array
   * object already exists (pOut!=NULL) then it must have sufficient memory allocated to
   * it to hold the data.
+  * If pIn is a view the output array is not a view, its data is stored contiguously.
   */
 NDArray* NDArrayPool::copy(NDArray *pIn, NDArray *pOut, int copyData)
 {
@@ -197,27 +1182,170 @@ NDArray* NDArrayPool::copy(NDArray *pIn, NDArray *pOut, int copyData)
   pOut->epicsTS = pIn->epicsTS;
   pOut->ndims = pIn->ndims;
   memcpy(pOut->dims, pIn->dims, sizeof(pIn->dims));
+  for (i=0; i<ND_ARRAY_MAX_DIMS; i++) pOut->dims[i].stride = 0;
   pOut->dataType = pIn->dataType;
   if (copyData) {
     pIn->getInfo(&arrayInfo);
     numCopy = arrayInfo.totalBytes;
     if (pOut->dataSize < numCopy) numCopy = pOut->dataSize;
-    memcpy(pOut->pData, pIn->pData, numCopy);
+    if (pIn->isContiguous()) {
+      memcpy(pOut->pData, pIn->pData, numCopy);
+    } else {
+      copyStridedData(pIn, pOut->pData, numCopy);
+    }
   }
-  pOut->pAttributeList->clear();
-  pIn->pAttributeList->copy(pOut->pAttributeList);
+  pIn->pAttributeList->copy(pOut->pAttributeList, true);
   return(pOut);
 }
 
+/** This method creates a view of a region of an NDArray, which references the data of the array
+  * rather than copying it.
+  * \param[in] pParent The array to create a view of; this can itself be a view.
+  * \param[in] dims The region of the array, one element for each of the pParent->ndims dimensions.
+  * Only the offset and size of each dimension are used, relative to pParent. The binning must be 1
+  * and reverse must be 0.
+  * \return Returns a pointer to the view, or NULL if the view cannot be created.
+  *
+  * The view has the same data type, number of dimensions, uniqueId, time stamps and attributes as pParent.
+  * Its pData points to the first element of the region in the data of pParent, and NDDimension_t::stride
+  * of each dimension is the number of elements between successive elements of that dimension.
+  * Unless the region spans the full size of all but the last dimension it selects, the data of the
+  * view is not contiguous (NDArray::isContiguous() returns false).
+  * The view keeps the array which owns the data reserved until the view is released.
+  * The reference count of the view is 1.
+  */
+NDArray* NDArrayPool::createView(NDArray *pParent, NDDimension_t *dims)
+{
+  const char *functionName = "createView";
+  NDArray *pView, *pOwner;
+  NDArrayInfo_t arrayInfo;
+  size_t strides[ND_ARRAY_MAX_DIMS];
+  size_t sizes[ND_ARRAY_MAX_DIMS];
+  size_t stride = 1, offset = 0, span = 0;
+  int i;
+
+  for (i=0; i<pParent->ndims; i++) {
+    if ((dims[i].size < 1) || (dims[i].offset + dims[i].size > pParent->dims[i].size) ||
+        (dims[i].binning > 1) || dims[i].reverse) {
+      printf("%s:%s: ERROR, invalid view dimension %d, offset=%d, size=%d, binning=%d, reverse=%d\n",
+             driverName, functionName, i, (int)dims[i].offset, (int)dims[i].size,
+             dims[i].binning, dims[i].reverse);
+      return NULL;
+    }
+    strides[i] = pParent->dims[i].stride ? pParent->dims[i].stride : stride;
+    stride *= pParent->dims[i].size;
+    sizes[i] = dims[i].size;
+    offset += dims[i].offset * strides[i];
+    span += (dims[i].size - 1) * strides[i];
+  }
+  pParent->getInfo(&arrayInfo);
+  pView = allocArray(pParent->ndims, sizes, pParent->dataType, (span + 1) * arrayInfo.bytesPerElement,
+                     (char *)pParent->pData + offset * arrayInfo.bytesPerElement, NDBufferView, allocTimeout_);
+  if (!pView) return NULL;
+  pView->uniqueId = pParent->uniqueId;
+  pView->timeStamp = pParent->timeStamp;
+  pView->epicsTS = pParent->epicsTS;
+  for (i=0; i<pParent->ndims; i++) {
+    pView->dims[i].offset = pParent->dims[i].offset + dims[i].offset;
+    pView->dims[i].binning = pParent->dims[i].binning;
+    pView->dims[i].reverse = pParent->dims[i].reverse;
+    pView->dims[i].stride = strides[i];
+  }
+  pParent->pAttributeList->copy(pView->pAttributeList, true);
+  fixColorMode(pView);
+  /* A view of a view references the array which owns the data */
+  pOwner = pParent->pViewParent_ ? pParent->pViewParent_ : pParent;
+  pOwner->reserve();
+  pView->pViewParent_ = pOwner;
+  return pView;
+}
+
+/** This method returns a contiguous version of an NDArray, for code which cannot handle views
+  * whose data is not contiguous.
+  * \param[in] pArray The input array.
+  * \return If pArray is contiguous then pArray, otherwise a contiguous copy of it. In both cases the
+  * returned array is reserved, and the caller must release it. Returns NULL if the copy cannot be allocated.
+  *
+  * The copy is made only once for each view, and is shared by all callers.
+  */
+NDArray* NDArrayPool::makeContiguous(NDArray *pArray)
+{
+  NDArray *pCopy, *pPrev;
+
+  if (pArray->isContiguous()) {
+    pArray->reserve();
+    return pArray;
+  }
+  pCopy = (NDArray *)epicsAtomicGetPtrT(&pArray->pContiguous_);
+  if (!pCopy) {
+    pCopy = this->copy(pArray, NULL, 1);
+    if (!pCopy) return NULL;
+    /* Another thread may have made a copy at the same time, if so use that one */
+    pPrev = (NDArray *)epicsAtomicCmpAndSwapPtrT(&pArray->pContiguous_, NULL, pCopy);
+    if (pPrev) {
+      pCopy->release();
+      pCopy = pPrev;
+    }
+  }
+  pCopy->reserve();
+  return pCopy;
+}
+
+/** This method returns a version of an NDArray which the caller may modify ("copy on write").
+  * \param[in] pArray The input array.
+  * \param[in] numOwned The number of references to pArray which are held by the caller.
+  * \param[in] copyData If 1 the caller will modify the data, if 0 it will only modify the other
+  * fields of the NDArray (dimensions, uniqueId, time stamps, attributes, etc.)
+  * \return If no other code holds a reference to pArray then pArray, otherwise a view of pArray if copyData=0,
+  * or a copy of pArray if copyData=1.  In all cases the returned array is reserved, and the caller must release it.
+  * Returns NULL if the view or copy cannot be allocated.
+  *
+  * The data of a view is never modified in place, because it belongs to another array.
+  */
+NDArray* NDArrayPool::makeWritable(NDArray *pArray, int numOwned, int copyData)
+{
+  NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+  int i;
+
+  if ((pArray->getReferenceCount() <= numOwned) && !(copyData && pArray->isView())) {
+    pArray->reserve();
+    return pArray;
+  }
+  if (copyData) return this->copy(pArray, NULL, 1);
+  for (i=0; i<pArray->ndims; i++) {
+    pArray->initDimension(&dims[i], pArray->dims[i].size);
+  }
+  return this->createView(pArray, dims);
+}
+
+/** Called by release() when the reference count of a view reaches 0.  Releases the array which
+  * owns the data and the contiguous copy, and resets the view to an array without a buffer.
+  * Must be called without listLock_ held. */
+void NDArrayPool::releaseView(NDArray *pArray)
+{
+  NDArray *pOwner = pArray->pViewParent_;
+  NDArray *pCopy = (NDArray *)epicsAtomicGetPtrT(&pArray->pContiguous_);
+
+  pArray->pViewParent_ = NULL;
+  epicsAtomicSetPtrT(&pArray->pContiguous_, NULL);
+  pArray->pData = NULL;
+  pArray->dataSize = 0;
+  pArray->bufferType_ = NDBufferMalloc;
+  pOwner->release();
+  if (pCopy) pCopy->release();
+}
+
 /** This method increases the reference count for the NDArray object.
   * \param[in] pArray The array on which to increase the reference count.
   *
   * Plugins must call reserve() when an NDArray is placed on a queue for later
   * processing.
+  * The reference count is incremented atomically, so this method does not take the pool lock.
   */
 int NDArrayPool::reserve(NDArray *pArray)
 {
   const char *functionName = "reserve";
+  int count;
 
   /* Make sure we own this array */
   if (pArray->pNDArrayPool != this) {
@@ -225,15 +1353,13 @@ int NDArrayPool::reserve(NDArray *pArray)
          driverName, functionName, pArray->pNDArrayPool, this);
     return(ND_ERROR);
   }
-  //printf("NDArrayPool::reserve pArray=%p, count=%d\n", pArray, pArray->referenceCount);
-  epicsMutexLock(listLock_);
-  // If the reference count is less than 1 then something is wrong, this NDArray has been released.
-  if (pArray->referenceCount < 1) {
+  count = epicsAtomicIncrIntT(&pArray->referenceCount);
+  //printf("NDArrayPool::reserve pArray=%p, count=%d\n", pArray, count);
+  // If the reference count was less than 1 then something is wrong, this NDArray has been released.
+  if (count <= 1) {
     cantProceed("%s:reserve ERROR, reference count = %d, should be >= 1, pArray=%p\n",
-           driverName, pArray->referenceCount, pArray);
+           driverName, count-1, pArray);
   }
-  pArray->referenceCount++;
-  epicsMutexUnlock(listLock_);
   return ND_SUCCESS;
 }
 
@@ -244,10 +1370,14 @@ int NDArrayPool::reserve(NDArray *pArray)
   * Plugins must call release() when an NDArray is removed from the queue and
   * processing on it is complete. Drivers must call release() after calling all
   * plugins.
+  * The reference count is decremented atomically; the pool lock is only taken by the
+  * caller that releases the last reference and returns the array to the free list,
+  * and not at all if the calling thread has enabled the thread cache (see setThreadCache()).
   */
 int NDArrayPool::release(NDArray *pArray)
 {
   const char *functionName = "release";
+  int count;
 
   /* Make sure we own this array */
   if (pArray->pNDArrayPool != this) {
@@ -255,63 +1385,90 @@ int NDArrayPool::release(NDArray *pArray)
            driverName, functionName, pArray->pNDArrayPool, this);
     return(ND_ERROR);
   }
-  //printf("NDArrayPool::release pArray=%p, count=%d\n", pArray, pArray->referenceCount);
-  epicsMutexLock(listLock_);
-  pArray->referenceCount--;
-  if (pArray->referenceCount == 0) {
-    /* The last user has released this image, add it back to the free list */
-    ellAdd(&freeList_, &pArray->node);
-    numFree_++;
+  count = epicsAtomicDecrIntT(&pArray->referenceCount);
+  //printf("NDArrayPool::release pArray=%p, count=%d\n", pArray, count);
+  if (count == 0) {
+    epicsAtomicDecrIntT(&numInUse_);
+    /* The last user has released this image, add it back to the magazine of this thread
+     * if it has allocated from this pool, otherwise to the free list */
+    NDArrayMagazine *pMagazine = getMagazine(false);
+    if (pArray->pViewParent_) releaseView(pArray);
+    if (pMagazine) {
+      releaseToMagazine(pMagazine, pArray);
+    } else {
+      epicsMutexLock(listLock_);
+      addToFreeList(pArray);
+      epicsMutexUnlock(listLock_);
+    }
+    /* Wake up a thread waiting in alloc() for a free array */
+    if (epicsAtomicGetIntT(&numWaiting_) > 0) epicsEventSignal(freeEvent_);
   }
-  if (pArray->referenceCount < 0) {
+  else if (count < 0) {
     cantProceed("%s:release ERROR, reference count < 0 pArray=%p\n",
            driverName, pArray);
   }
-  epicsMutexUnlock(listLock_);
   return ND_SUCCESS;
 }
 
-template <typename dataTypeIn, typename dataTypeOut> void convertType(NDArray *pIn, NDArray *pOut)
+/** Converts one element. Conversions from floating point to integer types saturate at the limits of the
+  * output type, and NaN converts to 0; other conversions are C casts. */
+template <typename dataTypeIn, typename dataTypeOut> inline dataTypeOut convertValue(dataTypeIn value)
+{
+  if (std::numeric_limits<dataTypeIn>::is_integer || !std::numeric_limits<dataTypeOut>::is_integer) {
+    return (dataTypeOut)value;
+  }
+  /* The limits of all of the integer types are exact in double.  This is written with selects rather than
+   * branches so that it vectorizes. */
+  double dvalue = (double)value;
+  const double minValue = (double)(std::numeric_limits<dataTypeOut>::min)();
+  const double maxValue = (double)(std::numeric_limits<dataTypeOut>::max)();
+  dvalue = (dvalue == dvalue) ? dvalue : 0.;
+  dvalue = (dvalue < minValue) ? minValue : dvalue;
+  dvalue = (dvalue > maxValue) ? maxValue : dvalue;
+  return (dataTypeOut)dvalue;
+}
+
+/* The loops below are written over contiguous arrays with a simple index so that the compiler can vectorize them */
+template <typename dataTypeIn, typename dataTypeOut> void convertType(NDArray *pIn, NDArray *pOut,
+                                                                     size_t start, size_t end)
 {
   size_t i;
-  dataTypeIn *pDataIn = (dataTypeIn *)pIn->pData;
+  const dataTypeIn *pDataIn = (const dataTypeIn *)pIn->pData;
   dataTypeOut *pDataOut = (dataTypeOut *)pOut->pData;
-  NDArrayInfo_t arrayInfo;
 
-  pOut->getInfo(&arrayInfo);
-  for (i=0; i<arrayInfo.nElements; i++) {
-    *pDataOut++ = (dataTypeOut)(*pDataIn++);
+  for (i=start; i<end; i++) {
+    pDataOut[i] = convertValue<dataTypeIn, dataTypeOut>(pDataIn[i]);
   }
 }
 
-template <typename dataTypeOut> int convertTypeSwitch (NDArray *pIn, NDArray *pOut)
+template <typename dataTypeOut> int convertTypeSwitch (NDArray *pIn, NDArray *pOut, size_t start, size_t end)
 {
   int status = ND_SUCCESS;
 
   switch(pIn->dataType) {
     case NDInt8:
-      convertType<epicsInt8, dataTypeOut> (pIn, pOut);
+      convertType<epicsInt8, dataTypeOut> (pIn, pOut, start, end);
       break;
     case NDUInt8:
-      convertType<epicsUInt8, dataTypeOut> (pIn, pOut);
+      convertType<epicsUInt8, dataTypeOut> (pIn, pOut, start, end);
       break;
     case NDInt16:
-      convertType<epicsInt16, dataTypeOut> (pIn, pOut);
+      convertType<epicsInt16, dataTypeOut> (pIn, pOut, start, end);
       break;
     case NDUInt16:
-      convertType<epicsUInt16, dataTypeOut> (pIn, pOut);
+      convertType<epicsUInt16, dataTypeOut> (pIn, pOut, start, end);
       break;
     case NDInt32:
-      convertType<epicsInt32, dataTypeOut> (pIn, pOut);
+      convertType<epicsInt32, dataTypeOut> (pIn, pOut, start, end);
       break;
     case NDUInt32:
-      convertType<epicsUInt32, dataTypeOut> (pIn, pOut);
+      convertType<epicsUInt32, dataTypeOut> (pIn, pOut, start, end);
       break;
     case NDFloat32:
-      convertType<epicsFloat32, dataTypeOut> (pIn, pOut);
+      convertType<epicsFloat32, dataTypeOut> (pIn, pOut, start, end);
       break;
     case NDFloat64:
-      convertType<epicsFloat64, dataTypeOut> (pIn, pOut);
+      convertType<epicsFloat64, dataTypeOut> (pIn, pOut, start, end);
       break;
     default:
       status = ND_ERROR;
@@ -321,8 +1478,57 @@ template <typename dataTypeOut> int convertTypeSwitch (NDArray *pIn, NDArray *pO
 }
 
 
+/** Converts one row (dimension 0) of the input array and adds it to one row of the output array,
+  * summing binning input elements into each output element. Each element is added in the output data type,
+  * in the same order as the general loop, so the fast paths give identical results. */
+template <typename dataTypeIn, typename dataTypeOut> void convertRow(const dataTypeIn *pDIn, dataTypeOut *pDOut,
+                                                                    size_t size, int binning, ptrdiff_t inc)
+{
+  size_t out;
+  int bin;
+  dataTypeOut sum;
+
+  if (inc == 1) {
+    switch (binning) {
+      case 1:
+        for (out=0; out<size; out++) {
+          pDOut[out] += convertValue<dataTypeIn, dataTypeOut>(pDIn[out]);
+        }
+        return;
+      case 2:
+        for (out=0; out<size; out++) {
+          sum = pDOut[out];
+          sum += convertValue<dataTypeIn, dataTypeOut>(pDIn[2*out]);
+          sum += convertValue<dataTypeIn, dataTypeOut>(pDIn[2*out+1]);
+          pDOut[out] = sum;
+        }
+        return;
+      case 4:
+        for (out=0; out<size; out++) {
+          sum = pDOut[out];
+          sum += convertValue<dataTypeIn, dataTypeOut>(pDIn[4*out]);
+          sum += convertValue<dataTypeIn, dataTypeOut>(pDIn[4*out+1]);
+          sum += convertValue<dataTypeIn, dataTypeOut>(pDIn[4*out+2]);
+          sum += convertValue<dataTypeIn, dataTypeOut>(pDIn[4*out+3]);
+          pDOut[out] = sum;
+        }
+        return;
+    }
+  }
+  for (out=0; out<size; out++) {
+    sum = pDOut[out];
+    for (bin=0; bin<binning; bin++) {
+      sum += convertValue<dataTypeIn, dataTypeOut>(*pDIn);
+      pDIn += inc;
+    }
+    pDOut[out] = sum;
+  }
+}
+
+/** Converts elements outStart to outEnd-1 of dimension dim of the output array */
 template <typename dataTypeIn, typename dataTypeOut> void convertDim(NDArray *pIn, NDArray *pOut,
-                                                     void *pDataIn, void *pDataOut, int dim)
+                                                     void *pDataIn, void *pDataOut, int dim,
+                                                     size_t outStart, size_t outEnd)
 {
   dataTypeOut *pDOut = (dataTypeOut *)pDataOut;
   dataTypeIn *pDIn = (dataTypeIn *)pDataIn;
@@ -331,7 +1537,8 @@ template <typename dataTypeIn, typename dataTypeOut> void convertDim(NDArray *pI
   size_t inStep, outStep, inOffset;
   int inDir;
   int i, bin;
-  size_t inc, in, out;
+  size_t out;
+  ptrdiff_t inc;
 
   inStep = 1;
   outStep = 1;
@@ -341,19 +1548,23 @@ template <typename dataTypeIn, typename dataTypeOut> void convertDim(NDArray *pI
     inStep  *= pInDims[i].size;
     outStep *= pOutDims[i].size;
   }
+  /* The input can be a view whose data is not contiguous */
+  if (pInDims[dim].stride) inStep = pInDims[dim].stride;
   if (pOutDims[dim].reverse) {
     inOffset += pOutDims[dim].size * pOutDims[dim].binning - 1;
     inDir = -1;
   }
-  inc = inDir * inStep;
-  pDIn += inOffset*inStep;
-  for (in=0, out=0; out<pOutDims[dim].size; out++, in++) {
+  inc = inDir * (ptrdiff_t)inStep;
+  pDIn += inOffset*inStep + outStart*pOutDims[dim].binning*inc;
+  pDOut += outStart*outStep;
+  /* The innermost dimension is converted by convertRow() rather than element by element */
+  if (dim == 0) {
+    convertRow<dataTypeIn, dataTypeOut>(pDIn, pDOut, outEnd-outStart, pOutDims[0].binning, inc);
+    return;
+  }
+  for (out=outStart; out<outEnd; out++) {
     for (bin=0; bin<pOutDims[dim].binning; bin++) {
-      if (dim > 0) {
-        convertDim <dataTypeIn, dataTypeOut> (pIn, pOut, pDIn, pDOut, dim-1);
-      } else {
-        *pDOut += (dataTypeOut)*pDIn;
-      }
+      convertDim <dataTypeIn, dataTypeOut> (pIn, pOut, pDIn, pDOut, dim-1, 0, pOutDims[dim-1].size);
       pDIn += inc;
     }
     pDOut += outStep;
@@ -361,34 +1572,35 @@ template <typename dataTypeIn, typename dataTypeOut> void convertDim(NDArray *pI
 }
 
 template <typename dataTypeOut> int convertDimensionSwitch(NDArray *pIn, NDArray *pOut,
-                                                           void *pDataIn, void *pDataOut, int dim)
+                                                           void *pDataIn, void *pDataOut, int dim,
+                                                           size_t outStart, size_t outEnd)
 {
   int status = ND_SUCCESS;
 
   switch(pIn->dataType) {
     case NDInt8:
-      convertDim <epicsInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDUInt8:
-      convertDim <epicsUInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsUInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDInt16:
-      convertDim <epicsInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDUInt16:
-      convertDim <epicsUInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsUInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDInt32:
-      convertDim <epicsInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDUInt32:
-      convertDim <epicsUInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsUInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDFloat32:
-      convertDim <epicsFloat32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsFloat32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDFloat64:
-      convertDim <epicsFloat64, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDim <epicsFloat64, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     default:
       status = ND_ERROR;
@@ -401,7 +1613,9 @@ static int convertDimension(NDArray *pIn,
                             NDArray *pOut,
                             void *pDataIn,
                             void *pDataOut,
-                            int dim)
+                            int dim,
+                            size_t outStart,
+                            size_t outEnd)
 {
   int status = ND_SUCCESS;
   /* This routine is passed:
@@ -411,28 +1625,28 @@ static int convertDimension(NDArray *pIn,
    * A dimension index */
   switch(pOut->dataType) {
     case NDInt8:
-      convertDimensionSwitch <epicsInt8>(pIn, pOut, pDataIn, pDataOut, dim);
+      convertDimensionSwitch <epicsInt8> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDUInt8:
-      convertDimensionSwitch <epicsUInt8> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDimensionSwitch <epicsUInt8> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDInt16:
-      convertDimensionSwitch <epicsInt16> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDimensionSwitch <epicsInt16> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDUInt16:
-      convertDimensionSwitch <epicsUInt16> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDimensionSwitch <epicsUInt16> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDInt32:
-      convertDimensionSwitch <epicsInt32> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDimensionSwitch <epicsInt32> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDUInt32:
-      convertDimensionSwitch <epicsUInt32> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDimensionSwitch <epicsUInt32> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDFloat32:
-      convertDimensionSwitch <epicsFloat32> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDimensionSwitch <epicsFloat32> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     case NDFloat64:
-      convertDimensionSwitch <epicsFloat64> (pIn, pOut, pDataIn, pDataOut, dim);
+      convertDimensionSwitch <epicsFloat64> (pIn, pOut, pDataIn, pDataOut, dim, outStart, outEnd);
       break;
     default:
       status = ND_ERROR;
@@ -441,6 +1655,156 @@ static int convertDimension(NDArray *pIn,
   return(status);
 }
 
+/** Converts part of the output array.  If dimsUnchanged then this converts the data type of
+  * elements start to end-1, otherwise it clears and converts elements start to end-1 of the
+  * slowest varying output dimension. */
+static void convertBlock(NDArray *pIn, NDArray *pOut, int dimsUnchanged, size_t start, size_t end)
+{
+  NDArrayInfo_t arrayInfo;
+  int dim = pOut->ndims-1;
+  size_t outStep;
+
+  if (dimsUnchanged) {
+    switch(pOut->dataType) {
+      case NDInt8:
+        convertTypeSwitch <epicsInt8> (pIn, pOut, start, end);
+        break;
+      case NDUInt8:
+        convertTypeSwitch <epicsUInt8> (pIn, pOut, start, end);
+        break;
+      case NDInt16:
+        convertTypeSwitch <epicsInt16> (pIn, pOut, start, end);
+        break;
+      case NDUInt16:
+        convertTypeSwitch <epicsUInt16> (pIn, pOut, start, end);
+        break;
+      case NDInt32:
+        convertTypeSwitch <epicsInt32> (pIn, pOut, start, end);
+        break;
+      case NDUInt32:
+        convertTypeSwitch <epicsUInt32> (pIn, pOut, start, end);
+        break;
+      case NDFloat32:
+        convertTypeSwitch <epicsFloat32> (pIn, pOut, start, end);
+        break;
+      case NDFloat64:
+        convertTypeSwitch <epicsFloat64> (pIn, pOut, start, end);
+        break;
+      default:
+        break;
+    }
+  } else {
+    /* Clear this part of the output array, because binned values are added to it */
+    pOut->getInfo(&arrayInfo);
+    outStep = arrayInfo.nElements / pOut->dims[dim].size;
+    memset((char *)pOut->pData + start*outStep*arrayInfo.bytesPerElement, 0,
+           (end-start)*outStep*arrayInfo.bytesPerElement);
+    convertDimension(pIn, pOut, pIn->pData, pOut->pData, dim, start, end);
+  }
+}
+
+/** Part of a conversion done by a convert thread */
+typedef struct {
+  NDArray *pIn;
+  NDArray *pOut;
+  int dimsUnchanged;
+  size_t start;
+  size_t end;
+  int *pNumRemaining;
+  epicsEventId doneEvent;
+} NDConvertTask_t;
+
+#define MAX_CONVERT_THREADS 64
+
+static epicsThreadOnceId convertOnce = EPICS_THREAD_ONCE_INIT;
+static epicsMutexId convertLock;
+static epicsMessageQueueId convertQueue;
+static int numConvertWorkers;
+
+static void convertWorker(void *)
+{
+  NDConvertTask_t *pTask;
+
+  while (1) {
+    if (epicsMessageQueueReceive(convertQueue, &pTask, sizeof(pTask)) != sizeof(pTask)) continue;
+    convertBlock(pTask->pIn, pTask->pOut, pTask->dimsUnchanged, pTask->start, pTask->end);
+    if (epicsAtomicDecrIntT(pTask->pNumRemaining) == 0) epicsEventSignal(pTask->doneEvent);
+  }
+}
+
+static void convertInit(void *)
+{
+  convertLock = epicsMutexMustCreate();
+  convertQueue = epicsMessageQueueCreate(MAX_CONVERT_THREADS, sizeof(NDConvertTask_t *));
+}
+
+/** Starts convert threads until there are numWorkers of them, and returns the number running */
+static int startConvertWorkers(int numWorkers)
+{
+  const char *functionName = "startConvertWorkers";
+  char threadName[32];
+
+  epicsThreadOnce(&convertOnce, convertInit, NULL);
+  if (!convertQueue) return 0;
+  epicsMutexLock(convertLock);
+  while (numConvertWorkers < numWorkers) {
+    epicsSnprintf(threadName, sizeof(threadName), "NDConvert%d", numConvertWorkers);
+    if (!epicsThreadCreate(threadName, epicsThreadPriorityMedium,
+                           epicsThreadGetStackSize(epicsThreadStackMedium),
+                           convertWorker, NULL)) {
+      printf("%s:%s: ERROR, cannot create thread %s\n", driverName, functionName, threadName);
+      break;
+    }
+    numConvertWorkers++;
+  }
+  numWorkers = numConvertWorkers;
+  epicsMutexUnlock(convertLock);
+  return numWorkers;
+}
+
+/** Does the conversion for NDArrayPool::convert(), splitting the slowest varying dimension of the output
+  * array (or the elements if dimsUnchanged) into numThreads parts.  All but one part are converted
+  * by the convert threads, and the last by the calling thread.  Each output element is computed
+  * by one thread in the same way as without threads, so the result does not depend on numThreads. */
+static void convertParallel(NDArray *pIn, NDArray *pOut, int dimsUnchanged, int numThreads)
+{
+  NDConvertTask_t tasks[MAX_CONVERT_THREADS];
+  NDConvertTask_t *pTask;
+  NDArrayInfo_t arrayInfo;
+  epicsEventId doneEvent;
+  size_t size, start;
+  int numRemaining;
+  int i;
+
+  pOut->getInfo(&arrayInfo);
+  size = dimsUnchanged ? arrayInfo.nElements : pOut->dims[pOut->ndims-1].size;
+  if (numThreads > MAX_CONVERT_THREADS) numThreads = MAX_CONVERT_THREADS;
+  if ((size_t)numThreads > size) numThreads = (int)size;
+  if (numThreads > 1) numThreads = startConvertWorkers(numThreads-1) + 1;
+  if ((numThreads <= 1) || !(doneEvent = epicsEventCreate(epicsEventEmpty))) {
+    convertBlock(pIn, pOut, dimsUnchanged, 0, size);
+    return;
+  }
+  numRemaining = numThreads-1;
+  for (i=0, start=0; i<numThreads; i++) {
+    tasks[i].pIn = pIn;
+    tasks[i].pOut = pOut;
+    tasks[i].dimsUnchanged = dimsUnchanged;
+    tasks[i].start = start;
+    tasks[i].end = start = size * (i+1) / numThreads;
+    tasks[i].pNumRemaining = &numRemaining;
+    tasks[i].doneEvent = doneEvent;
+  }
+  for (i=0; i<numThreads-1; i++) {
+    pTask = &tasks[i];
+    epicsMessageQueueSend(convertQueue, &pTask, sizeof(pTask));
+  }
+  pTask = &tasks[numThreads-1];
+  convertBlock(pIn, pOut, dimsUnchanged, pTask->start, pTask->end);
+  epicsEventMustWait(doneEvent);
+  epicsEventDestroy(doneEvent);
+}
+
 /** Creates a new output NDArray from an input NDArray, performing
   * conversion operations.
   * This form of the function is for changing the data type only, not the dimensions,
@@ -462,6 +1826,7 @@ int NDArrayPool::convert(NDArray *pIn,
     dims[i].offset  = 0;
     dims[i].binning = 1;
     dims[i].reverse = 0;
+    dims[i].stride = 0;
   }
   return this->convert(pIn, ppOut, dataTypeOut, dims);
 }             
@@ -483,13 +1848,12 @@ int NDArrayPool::convert(NDArray *pIn,
                          NDDimension_t *dimsOut)
 {
   int dimsUnchanged;
+  int numThreads;
   size_t dimSizeOut[ND_ARRAY_MAX_DIMS];
   NDDimension_t dimsOutCopy[ND_ARRAY_MAX_DIMS];
   int i;
   NDArray *pOut;
   NDArrayInfo_t arrayInfo;
-  NDAttribute *pAttribute;
-  int colorMode, colorModeMono = NDColorModeMono;
   const char *functionName = "convert";
 
   /* Initialize failure */
@@ -508,11 +1872,14 @@ int NDArrayPool::convert(NDArray *pIn,
       return(ND_ERROR);
     }
     dimSizeOut[i] = dimsOutCopy[i].size;
+    dimsOutCopy[i].stride = 0;
     if ((pIn->dims[i].size  != dimsOutCopy[i].size) ||
       (dimsOutCopy[i].offset != 0) ||
       (dimsOutCopy[i].binning != 1) ||
       (dimsOutCopy[i].reverse != 0)) dimsUnchanged = 0;
   }
+  /* If the input is a view which is not contiguous then we need to use the strides */
+  if (!pIn->isContiguous()) dimsUnchanged = 0;
 
   /* We now know the datatype and dimensions of the output array.
    * Allocate it */
@@ -533,51 +1900,16 @@ int NDArrayPool::convert(NDArray *pIn,
 
   pOut->getInfo(&arrayInfo);
 
-  if (dimsUnchanged) {
-    if (pIn->dataType == pOut->dataType) {
-      /* The dimensions are the same and the data type is the same,
-       * then just copy the input image to the output image */
-      memcpy(pOut->pData, pIn->pData, arrayInfo.totalBytes);
-      return ND_SUCCESS;
-    } else {
-      /* We need to convert data types */
-      switch(pOut->dataType) {
-        case NDInt8:
-          convertTypeSwitch <epicsInt8> (pIn, pOut);
-          break;
-        case NDUInt8:
-          convertTypeSwitch <epicsUInt8> (pIn, pOut);
-          break;
-        case NDInt16:
-          convertTypeSwitch <epicsInt16> (pIn, pOut);
-          break;
-        case NDUInt16:
-          convertTypeSwitch <epicsUInt16> (pIn, pOut);
-          break;
-        case NDInt32:
-          convertTypeSwitch <epicsInt32> (pIn, pOut);
-          break;
-        case NDUInt32:
-          convertTypeSwitch <epicsUInt32> (pIn, pOut);
-          break;
-        case NDFloat32:
-          convertTypeSwitch <epicsFloat32> (pIn, pOut);
-          break;
-        case NDFloat64:
-          convertTypeSwitch <epicsFloat64> (pIn, pOut);
-          break;
-        default:
-          //status = ND_ERROR;
-          break;
-      }
-    }
-  } else {
-    /* The input and output dimensions are not the same, so we are extracting a region
-     * and/or binning */
-    /* Clear entire output array */
-    memset(pOut->pData, 0, arrayInfo.totalBytes);
-    convertDimension(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1);
+  if (dimsUnchanged && (pIn->dataType == pOut->dataType)) {
+    /* The dimensions are the same and the data type is the same,
+     * then just copy the input image to the output image */
+    memcpy(pOut->pData, pIn->pData, arrayInfo.totalBytes);
+    return ND_SUCCESS;
   }
+  /* If the dimensions are the same we need to convert data types, otherwise we are
+   * extracting a region and/or binning */
+  numThreads = (arrayInfo.nElements >= (size_t)NDArrayPoolConvertThreshold) ? NDArrayPoolConvertThreads : 1;
+  convertParallel(pIn, pOut, dimsUnchanged, numThreads);
 
   /* Set fields in the output array */
   for (i=0; i<pIn->ndims; i++) {
@@ -587,15 +1919,7 @@ int NDArrayPool::convert(NDArray *pIn,
   }
 
   /* If the frame is an RGBx frame and we have collapsed that dimension then change the colorMode */
-  pAttribute = pOut->pAttributeList->find("ColorMode");
-  if (pAttribute && pAttribute->getValue(NDAttrInt32, &colorMode)) {
-    if      ((colorMode == NDColorModeRGB1) && (pOut->dims[0].size != 3)) 
-      pAttribute->setValue(&colorModeMono);
-    else if ((colorMode == NDColorModeRGB2) && (pOut->dims[1].size != 3)) 
-      pAttribute->setValue(&colorModeMono);
-    else if ((colorMode == NDColorModeRGB3) && (pOut->dims[2].size != 3))
-      pAttribute->setValue(&colorModeMono);
-  }
+  fixColorMode(pOut);
   return ND_SUCCESS;
 }
 
@@ -623,27 +1947,232 @@ size_t NDArrayPool::memorySize()
   return memorySize_;
 }
 
-/** Returns number of NDArray objects in the free list */
+/** Returns the policy this object uses to allocate data buffers */
+NDAllocPolicy_t NDArrayPool::allocPolicy()
+{
+  return allocPolicy_;
+}
+
+/** Sets the policy this object uses to allocate data buffers.
+  * This only affects buffers allocated after it is called.
+  * \param[in] allocPolicy The allocation policy (NDAllocPolicy_t).
+  */
+int NDArrayPool::setAllocPolicy(NDAllocPolicy_t allocPolicy)
+{
+  const char *functionName = "setAllocPolicy";
+
+  switch (allocPolicy) {
+    case NDAllocAligned:
+    case NDAllocHugePage:
+    case NDAllocHugeTLB:
+      break;
+    default:
+      printf("%s:%s: ERROR, invalid allocation policy=%d\n",
+             driverName, functionName, allocPolicy);
+      return ND_ERROR;
+  }
+  epicsMutexLock(listLock_);
+  allocPolicy_ = allocPolicy;
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Returns the time in seconds that alloc() waits for a free array when maxBuffers or maxMemory is reached */
+double NDArrayPool::allocTimeout()
+{
+  return allocTimeout_;
+}
+
+/** Sets the time that alloc() and createView() wait for other threads to release arrays when maxBuffers or
+  * maxMemory has been reached, before they return an error.
+  * \param[in] timeout The timeout in seconds; 0 (the default) returns an error immediately.
+  */
+int NDArrayPool::setAllocTimeout(double timeout)
+{
+  if (timeout < 0.) timeout = 0.;
+  epicsMutexLock(listLock_);
+  allocTimeout_ = timeout;
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Returns the number of allocations which have had to wait for a free array */
+int NDArrayPool::numAllocWaits()
+{
+  return numAllocWaits_;
+}
+
+/** Returns the number of allocations which have failed after waiting for a free array */
+int NDArrayPool::numAllocTimeouts()
+{
+  return numAllocTimeouts_;
+}
+
+/** Returns the weight of this pool in the sharing of NDArrayPoolMemoryBudget */
+double NDArrayPool::memoryWeight()
+{
+  return memoryWeight_;
+}
+
+/** Sets the weight of this pool in the sharing of NDArrayPoolMemoryBudget.  The share of the budget of each
+  * pool is the budget times its weight divided by the sum of the weights of all pools.  When the budget is
+  * reached the unused buffers of the pools which exceed their share by the most are freed first.
+  * \param[in] weight The weight, the default is 1.
+  */
+void NDArrayPool::setMemoryWeight(double weight)
+{
+  if (weight < 0.) weight = 0.;
+  memoryWeight_ = weight;
+}
+
+/** Returns the number of bytes of memory allocated by all NDArrayPools in the IOC */
+size_t NDArrayPool::totalMemorySize()
+{
+  return epicsAtomicGetSizeT(&allPoolsMemorySize);
+}
+
+/** Returns the allocation statistics of this pool.
+  * \param[out] pStats Structure which receives the statistics.
+  */
+void NDArrayPool::getStats(NDArrayPoolStats_t *pStats)
+{
+  epicsMutexLock(listLock_);
+  *pStats = stats_;
+  epicsMutexUnlock(listLock_);
+}
+
+/** Resets the allocation statistics of this pool.  The peak values are set to the current values. */
+void NDArrayPool::resetStats()
+{
+  epicsMutexLock(listLock_);
+  memset(&stats_, 0, sizeof(stats_));
+  stats_.peakMemory = memorySize_;
+  stats_.peakBuffersInUse = epicsAtomicGetIntT(&numInUse_);
+  epicsMutexUnlock(listLock_);
+}
+
+/** Returns 1 if this pool measures the latency of alloc(), otherwise 0 */
+int NDArrayPool::collectTiming()
+{
+  return collectTiming_;
+}
+
+/** Sets whether this pool measures the latency of alloc() and the time it waits for the pool lock
+  * in the histograms of NDArrayPoolStats_t.
+  * \param[in] enable 1 to measure the latency, 0 not to.
+  */
+void NDArrayPool::setCollectTiming(int enable)
+{
+  collectTiming_ = enable ? 1 : 0;
+}
+
+/** Returns number of NDArray objects in the free list, including those in the thread caches */
 int NDArrayPool::numFree()
 {
-  return numFree_;
+  NDArrayMagazine *pMagazine;
+  int numFree;
+
+  epicsMutexLock(listLock_);
+  numFree = numFree_;
+  for (pMagazine = (NDArrayMagazine *)ellFirst(&magazineList_); pMagazine;
+       pMagazine = (NDArrayMagazine *)ellNext(&pMagazine->poolNode)) {
+    epicsMutexLock(pMagazine->lock);
+    numFree += pMagazine->count;
+    epicsMutexUnlock(pMagazine->lock);
+  }
+  epicsMutexUnlock(listLock_);
+  return numFree;
+}
+
+/** Returns number of NDArray objects in the free list for one size class
+  * \param[in] sizeClass The size class, as returned by NDArrayPool::sizeClass(). */
+int NDArrayPool::numFree(int sizeClass)
+{
+  if ((sizeClass < 0) || (sizeClass >= ND_ARRAY_POOL_SIZE_CLASSES)) return 0;
+  return numFreeClass_[sizeClass];
+}
+
+/** Returns number of bytes of memory this object has currently allocated for one size class
+  * \param[in] sizeClass The size class, as returned by NDArrayPool::sizeClass(). */
+size_t NDArrayPool::memorySize(int sizeClass)
+{
+  if ((sizeClass < 0) || (sizeClass >= ND_ARRAY_POOL_SIZE_CLASSES)) return 0;
+  return memorySizeClass_[sizeClass];
+}
+
+/** Prints a latency histogram of NDArrayPoolStats_t, omitting the empty bins */
+static void reportLatency(FILE *fp, const char *name, const int *hist, int maxNs)
+{
+  int bin;
+
+  fprintf(fp, "  %s: max=%.3f us\n", name, maxNs / 1e3);
+  for (bin=0; bin<ND_ARRAY_POOL_HIST_BINS; bin++) {
+    if (hist[bin] == 0) continue;
+    if (bin == 0) {
+      fprintf(fp, "    < 1 us: %d\n", hist[bin]);
+    } else if (bin == ND_ARRAY_POOL_HIST_BINS-1) {
+      fprintf(fp, "    >= %.0f us: %d\n", ldexp(1.0, bin-1), hist[bin]);
+    } else {
+      fprintf(fp, "    %.0f-%.0f us: %d\n", ldexp(1.0, bin-1), ldexp(1.0, bin), hist[bin]);
+    }
+  }
 }
 
 /** Reports on the free list size and other properties of the NDArrayPool
-  * object.
+  * object, including numFree and memorySize for each size class which is in use,
+  * and the allocation statistics.
   * \param[in] fp File pointer for the report output.
   * \param[in] details Level of report details desired; does nothing at present.
   */
 int NDArrayPool::report(FILE *fp, int details)
 {
+  int sc;
+  NDArrayMagazine *pMagazine;
+  int numMagazineFree = 0;
+
+  epicsMutexLock(listLock_);
   fprintf(fp, "\n");
   fprintf(fp, "NDArrayPool:\n");
   fprintf(fp, "  numBuffers=%d, maxBuffers=%d\n",
          numBuffers_, maxBuffers_);
   fprintf(fp, "  memorySize=%ld, maxMemory=%ld\n",
         (long)memorySize_, (long)maxMemory_);
+  fprintf(fp, "  memory of all pools=%ld, memory budget=%ld, memoryWeight=%f\n",
+        (long)epicsAtomicGetSizeT(&allPoolsMemorySize), (long)memoryBudget(), memoryWeight_);
+  for (pMagazine = (NDArrayMagazine *)ellFirst(&magazineList_); pMagazine;
+       pMagazine = (NDArrayMagazine *)ellNext(&pMagazine->poolNode)) {
+    epicsMutexLock(pMagazine->lock);
+    numMagazineFree += pMagazine->count;
+    epicsMutexUnlock(pMagazine->lock);
+  }
   fprintf(fp, "  numFree=%d\n",
-         numFree_);
+         numFree_ + numMagazineFree);
+  fprintf(fp, "  threadCaches=%d, numFree in thread caches=%d\n",
+         ellCount(&magazineList_), numMagazineFree);
+  fprintf(fp, "  allocPolicy=%d\n",
+         allocPolicy_);
+  fprintf(fp, "  allocTimeout=%f, numAllocWaits=%d, numAllocTimeouts=%d\n",
+         allocTimeout_, numAllocWaits_, numAllocTimeouts_);
+  fprintf(fp, "  numAllocs=%d, numMallocs=%d, numEvictions=%d, numAllocFailures=%d\n",
+         stats_.numAllocs, stats_.numMallocs, stats_.numEvictions, stats_.numAllocFailures);
+  fprintf(fp, "  numInUse=%d, peakBuffersInUse=%d, peakMemory=%ld\n",
+         numInUse_, stats_.peakBuffersInUse, (long)stats_.peakMemory);
+  if (collectTiming_) {
+    reportLatency(fp, "alloc time", stats_.allocTimeHist, stats_.maxAllocTimeNs);
+    reportLatency(fp, "lock wait", stats_.lockWaitHist, stats_.maxLockWaitNs);
+  }
+  fprintf(fp, "  Size classes:\n");
+  for (sc=0; sc<ND_ARRAY_POOL_SIZE_CLASSES; sc++) {
+    if ((numFreeClass_[sc] == 0) && (memorySizeClass_[sc] == 0)) continue;
+    if (sc == 0) {
+      fprintf(fp, "    class=%2d dataSize=0, numFree=%d\n",
+              sc, numFreeClass_[sc]);
+    } else {
+      fprintf(fp, "    class=%2d dataSize<=%.0f, numFree=%d, memorySize=%ld\n",
+              sc, ldexp(1.0, sc-1), numFreeClass_[sc], (long)memorySizeClass_[sc]);
+    }
+  }
+  epicsMutexUnlock(listLock_);
       
   return ND_SUCCESS;
 }
@@ -71,6 +71,7 @@ const char *NDAttribute::attrSourceString(NDAttrSource_t type)
     this->setValue(pValue);
   }
   this->listNode_.pNDAttribute = this;
+  this->listNode_.key = -1;
 }
 
 /** NDAttribute copy constructor
@@ -90,6 +91,8 @@ NDAttribute::NDAttribute(NDAttribute& attribute)
   else pValue = &attribute.value_;
   this->setValue(pValue);
   this->listNode_.pNDAttribute = this;
+  this->listNode_.key = attribute.listNode_.key;
+  this->listNode_.hash = attribute.listNode_.hash;
 }
 
 
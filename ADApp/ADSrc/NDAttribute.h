@@ -75,12 +75,24 @@ typedef union {
 
 /** Structure used by the EPICS ellLib library for linked lists of C++ objects.
   * This is needed for ellLists of C++ objects, for which making the first data element the ELLNODE 
-  * does not work if the class has virtual functions or derived classes. */
+  * does not work if the class has virtual functions or derived classes.
+  * It is also the entry in the hash index of NDAttributeList. */
 typedef struct NDAttributeListNode {
     ELLNODE node;
     class NDAttribute *pNDAttribute;
+    struct NDAttributeListNode *pHashNext;  /**< Next node in the same hash bucket of the NDAttributeList */
+    unsigned int hash;                      /**< Hash of the attribute name, valid when key has been assigned */
+    int key;                                /**< Id of the attribute name from NDAttributeList::getKey(), -1 if not yet assigned */
 } NDAttributeListNode;
 
+/** A handle to an attribute name, returned by NDAttributeList::getKey().
+  * Code that reads the same attribute from every NDArray gets the key once and then uses
+  * NDAttributeList::find(NDAttributeKey), which is an indexed load rather than a search by name.
+  * Keys are the same for all attribute lists and remain valid for the life of the IOC. */
+typedef struct NDAttributeKey {
+    int id;                                 /**< Index of the name in the table of attribute names, -1 for no name */
+} NDAttributeKey;
+
 /** NDAttribute class; an attribute has a name, description, source type, source string,
   * data type, and value.
   */
@@ -7,7 +7,11 @@
  */
  
 #include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <map>
 
+#include <epicsThread.h>
 #include <epicsExport.h>
 
 #include "NDAttributeList.h"
@@ -15,6 +19,8 @@
 /** NDAttributeList constructor
   */
 NDAttributeList::NDAttributeList()
+  : hashTable_(NULL), retiredHash_(NULL), hashSize_(0), slots_(NULL), retired_(NULL), numSlots_(0),
+    updateFunc_(NULL), updatePvt_(NULL)
 {
   ellInit(&this->list_);
   this->lock_ = epicsMutexCreate();
@@ -26,9 +32,301 @@ NDAttributeList::~NDAttributeList()
 {
   this->clear();
   ellFree(&this->list_);
+  free(this->hashTable_);
+  free(this->retiredHash_);
+  free(this->slots_);
+  free(this->retired_);
   epicsMutexDestroy(this->lock_);
 }
 
+/** The number of hash buckets allocated when the first attribute is added */
+#define MIN_HASH_SIZE 32
+/** The minimum number of elements in the table of attributes indexed by key */
+#define MIN_NUM_SLOTS 32
+
+/** The table of attribute names that have been given keys, shared by all attribute lists */
+static std::map<std::string, int> *attributeKeys;
+static epicsMutexId attributeKeysLock;
+static epicsThreadOnceId attributeKeysOnceId = EPICS_THREAD_ONCE_INIT;
+static long attributeKeyLookups;
+
+static void attributeKeysInit(void *)
+{
+  attributeKeysLock = epicsMutexMustCreate();
+  attributeKeys = new std::map<std::string, int>;
+}
+
+/** Returns the key for an attribute name, for use with find(NDAttributeKey).
+  * The first call for a name assigns it the next free key, later calls return the same key.
+  * The key is the same for every attribute list and remains valid for the life of the IOC,
+  * so plugins can get the keys of the attributes they use when they are configured rather than for each NDArray.
+  * \param[in] pName The name of the attribute.
+  * \return Returns the key; its id is -1 if pName is NULL or empty.
+  */
+NDAttributeKey NDAttributeList::getKey(const char *pName)
+{
+  NDAttributeKey key;
+  std::map<std::string, int>::iterator it;
+
+  key.id = -1;
+  if (!pName || !*pName) return key;
+  epicsThreadOnce(&attributeKeysOnceId, attributeKeysInit, NULL);
+  epicsMutexLock(attributeKeysLock);
+  attributeKeyLookups++;
+  it = attributeKeys->find(pName);
+  if (it == attributeKeys->end()) {
+    it = attributeKeys->insert(std::make_pair(std::string(pName), (int)attributeKeys->size())).first;
+  }
+  key.id = it->second;
+  epicsMutexUnlock(attributeKeysLock);
+  return key;
+}
+
+/** Returns the number of times getKey() has looked up a name in the table of keys.
+  * add(pName, ...) does not look up the names of attributes it reuses after reset(), so this does not
+  * increase when arrays get the same attributes for each frame. */
+long NDAttributeList::numKeyLookups()
+{
+  long numLookups = 0;
+
+  epicsThreadOnce(&attributeKeysOnceId, attributeKeysInit, NULL);
+  epicsMutexLock(attributeKeysLock);
+  numLookups = attributeKeyLookups;
+  epicsMutexUnlock(attributeKeysLock);
+  return numLookups;
+}
+
+/** Returns the FNV-1a hash of an attribute name */
+unsigned int NDAttributeList::hashName(const char *pName)
+{
+  unsigned int hash = 2166136261u;
+
+  while (*pName) {
+    hash ^= (unsigned char)*pName++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/** Returns the list node of the attribute with this name, NULL if there is none.
+  * Must be called with lock_ held.
+  * \param[in] pName The name of the attribute.
+  * \param[in] hash The hash of pName from hashName(). */
+NDAttributeListNode* NDAttributeList::hashFind(const char *pName, unsigned int hash)
+{
+  NDAttributeListNode *pListNode;
+
+  if (this->hashSize_ == 0) {
+    /* The hash index could not be allocated, search the list */
+    pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
+    while (pListNode && (pListNode->pNDAttribute->name_ != pName)) {
+      pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+    }
+    return pListNode;
+  }
+  pListNode = this->hashTable_[hash & (this->hashSize_-1)];
+  while (pListNode) {
+    if ((pListNode->hash == hash) && (pListNode->pNDAttribute->name_ == pName)) break;
+    pListNode = pListNode->pHashNext;
+  }
+  return pListNode;
+}
+
+/** Adds the list node of an attribute to the hash index and to the table indexed by key, growing them
+  * as needed.  Must be called with lock_ held, before the node is added to list_. */
+void NDAttributeList::hashAdd(NDAttributeListNode *pListNode)
+{
+  size_t bucket;
+  int key;
+
+  /* The key and hash are copied with the attribute, so they are only computed when an attribute is first created */
+  if (pListNode->key < 0) {
+    pListNode->key = getKey(pListNode->pNDAttribute->name_.c_str()).id;
+    pListNode->hash = hashName(pListNode->pNDAttribute->name_.c_str());
+  }
+  key = pListNode->key;
+  if (key >= this->numSlots_) {
+    slotResize(key >= 2*this->numSlots_ ? key+MIN_NUM_SLOTS : 2*this->numSlots_);
+  }
+  if ((key >= 0) && (key < this->numSlots_)) this->slots_[key] = pListNode;
+
+  if ((size_t)ellCount(&this->list_) >= this->hashSize_) {
+    hashResize(this->hashSize_ ? 2*this->hashSize_ : MIN_HASH_SIZE);
+  }
+  if (this->hashSize_ == 0) return;
+  bucket = pListNode->hash & (this->hashSize_-1);
+  pListNode->pHashNext = this->hashTable_[bucket];
+  this->hashTable_[bucket] = pListNode;
+}
+
+/** Removes the list node of an attribute from the hash index.  Must be called with lock_ held. */
+void NDAttributeList::hashRemove(NDAttributeListNode *pListNode)
+{
+  NDAttributeListNode **ppNode;
+  int key = pListNode->key;
+
+  if ((key >= 0) && (key < this->numSlots_) && (this->slots_[key] == pListNode)) this->slots_[key] = NULL;
+  if (this->hashSize_ == 0) return;
+  ppNode = &this->hashTable_[pListNode->hash & (this->hashSize_-1)];
+  while (*ppNode && (*ppNode != pListNode)) ppNode = &(*ppNode)->pHashNext;
+  if (*ppNode) *ppNode = pListNode->pHashNext;
+  pListNode->pHashNext = NULL;
+}
+
+/** Changes the number of hash buckets and rebuilds the hash indexes of the attributes in the list
+  * and of the attributes kept by retire().  Must be called with lock_ held.
+  * \param[in] hashSize The new number of buckets, which must be a power of 2. */
+void NDAttributeList::hashResize(size_t hashSize)
+{
+  NDAttributeListNode **hashTable, **retiredHash;
+  NDAttributeListNode *pListNode;
+  size_t bucket;
+  int i;
+
+  hashTable = (NDAttributeListNode **)calloc(hashSize, sizeof(NDAttributeListNode *));
+  retiredHash = (NDAttributeListNode **)calloc(hashSize, sizeof(NDAttributeListNode *));
+  if (!hashTable || !retiredHash) {
+    free(hashTable);
+    free(retiredHash);
+    return;
+  }
+  free(this->hashTable_);
+  free(this->retiredHash_);
+  this->hashTable_ = hashTable;
+  this->retiredHash_ = retiredHash;
+  this->hashSize_ = hashSize;
+  pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
+  while (pListNode) {
+    bucket = pListNode->hash & (hashSize-1);
+    pListNode->pHashNext = hashTable[bucket];
+    hashTable[bucket] = pListNode;
+    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+  }
+  for (i=0; i<this->numSlots_; i++) {
+    if (!this->retired_[i]) continue;
+    pListNode = &this->retired_[i]->listNode_;
+    bucket = pListNode->hash & (hashSize-1);
+    pListNode->pHashNext = retiredHash[bucket];
+    retiredHash[bucket] = pListNode;
+  }
+}
+
+/** Changes the number of elements in the tables of attributes indexed by key and rebuilds them.
+  * Must be called with lock_ held.  If the tables cannot be allocated the old ones are kept,
+  * and find(NDAttributeKey) searches the list for keys beyond their end.
+  * \param[in] numSlots The new number of elements. */
+void NDAttributeList::slotResize(int numSlots)
+{
+  NDAttributeListNode **slots;
+  NDAttribute **retired;
+  NDAttributeListNode *pListNode;
+
+  slots = (NDAttributeListNode **)calloc(numSlots, sizeof(NDAttributeListNode *));
+  retired = (NDAttribute **)calloc(numSlots, sizeof(NDAttribute *));
+  if (!slots || !retired) {
+    free(slots);
+    free(retired);
+    return;
+  }
+  if (this->numSlots_) memcpy(retired, this->retired_, this->numSlots_ * sizeof(NDAttribute *));
+  free(this->slots_);
+  free(this->retired_);
+  this->slots_ = slots;
+  this->retired_ = retired;
+  this->numSlots_ = numSlots;
+  pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
+  while (pListNode) {
+    if ((pListNode->key >= 0) && (pListNode->key < numSlots)) slots[pListNode->key] = pListNode;
+    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+  }
+}
+
+/** Removes an attribute from the list and keeps it for reuse by takeRetired(), deleting any attribute
+  * with the same key which was already kept.  Must be called with lock_ held. */
+void NDAttributeList::retire(NDAttributeListNode *pListNode)
+{
+  NDAttribute *pAttribute = pListNode->pNDAttribute;
+  int key = pListNode->key;
+  size_t bucket;
+
+  hashRemove(pListNode);
+  ellDelete(&this->list_, &pListNode->node);
+  if ((key >= 0) && (key < this->numSlots_)) {
+    if (this->retired_[key]) {
+      retiredRemove(&this->retired_[key]->listNode_);
+      delete this->retired_[key];
+    }
+    this->retired_[key] = pAttribute;
+    if (this->hashSize_) {
+      bucket = pListNode->hash & (this->hashSize_-1);
+      pListNode->pHashNext = this->retiredHash_[bucket];
+      this->retiredHash_[bucket] = pListNode;
+    }
+  } else {
+    delete pAttribute;
+  }
+}
+
+/** Removes the list node of an attribute kept by retire() from the hash index of retired attributes.
+  * Must be called with lock_ held. */
+void NDAttributeList::retiredRemove(NDAttributeListNode *pListNode)
+{
+  NDAttributeListNode **ppNode;
+
+  if (this->hashSize_ == 0) return;
+  ppNode = &this->retiredHash_[pListNode->hash & (this->hashSize_-1)];
+  while (*ppNode && (*ppNode != pListNode)) ppNode = &(*ppNode)->pHashNext;
+  if (*ppNode) *ppNode = pListNode->pHashNext;
+  pListNode->pHashNext = NULL;
+}
+
+/** Returns an attribute kept by retire() which can be reused for a new attribute, NULL if there is none.
+  * If the attribute kept for this key is of a different class or data type it is deleted.
+  * \param[in] key The key of the attribute name.
+  * \param[in] type The class of the new attribute.
+  * \param[in] dataType The data type of the new attribute. */
+NDAttribute* NDAttributeList::takeRetired(int key, const std::type_info& type, NDAttrDataType_t dataType)
+{
+  NDAttribute *pAttribute = NULL;
+
+  epicsMutexLock(this->lock_);
+  if ((key >= 0) && (key < this->numSlots_) && this->retired_[key]) {
+    pAttribute = this->retired_[key];
+    this->retired_[key] = NULL;
+    retiredRemove(&pAttribute->listNode_);
+    if ((typeid(*pAttribute) != type) || (pAttribute->dataType_ != dataType)) {
+      delete pAttribute;
+      pAttribute = NULL;
+    }
+  }
+  epicsMutexUnlock(this->lock_);
+  return pAttribute;
+}
+
+/** Returns an attribute kept by retire() with this name which can be reused for a new attribute,
+  * NULL if there is none.  The attribute is found by the hash of its name, so unlike
+  * takeRetired(int key, ...) this does not need the key of the name from getKey().
+  * If the attribute kept for this name is of a different class or data type it is deleted.
+  * Must be called with lock_ held.
+  * \param[in] pName The name of the attribute.
+  * \param[in] hash The hash of pName from hashName().
+  * \param[in] type The class of the new attribute.
+  * \param[in] dataType The data type of the new attribute. */
+NDAttribute* NDAttributeList::takeRetired(const char *pName, unsigned int hash,
+                                          const std::type_info& type, NDAttrDataType_t dataType)
+{
+  NDAttributeListNode *pListNode;
+
+  if (this->hashSize_ == 0) return NULL;
+  pListNode = this->retiredHash_[hash & (this->hashSize_-1)];
+  while (pListNode) {
+    if ((pListNode->hash == hash) && (pListNode->pNDAttribute->name_ == pName)) break;
+    pListNode = pListNode->pHashNext;
+  }
+  if (!pListNode) return NULL;
+  return takeRetired(pListNode->key, type, dataType);
+}
+
 /** Adds an attribute to the list.
   * If an attribute of the same name already exists then
   * the existing attribute is deleted and replaced with the new one.
@@ -41,6 +339,7 @@ int NDAttributeList::add(NDAttribute *pAttribute)
   epicsMutexLock(this->lock_);
   /* Remove any existing attribute with this name */
   this->remove(pAttribute->name_.c_str());
+  hashAdd(&pAttribute->listNode_);
   ellAdd(&this->list_, &pAttribute->listNode_.node);
   epicsMutexUnlock(this->lock_);
   return(ND_SUCCESS);
@@ -56,6 +355,7 @@ int NDAttributeList::add(NDAttribute *pAttribute)
   * of the NDAttribute base class type, not derived class attributes.
   * To add attributes of a derived class to a list the NDAttributeList::add(NDAttribute*)
   * method must be used.
+  * If an attribute of this name was removed by reset() it is reused rather than allocating a new one.
   * \param[in] pName The name of the attribute to be added. 
   * \param[in] pDescription The description of the attribute.
   * \param[in] dataType The data type of the attribute.
@@ -65,14 +365,41 @@ int NDAttributeList::add(NDAttribute *pAttribute)
 NDAttribute* NDAttributeList::add(const char *pName, const char *pDescription, NDAttrDataType_t dataType, void *pValue)
 {
   //const char *functionName = "NDAttributeList::add";
-  NDAttribute *pAttribute;
+  NDAttribute *pAttribute = NULL;
+  NDAttributeListNode *pListNode;
+  NDAttrDataType_t newDataType = pValue ? dataType : NDAttrUndefined;
+  unsigned int hash = hashName(pName);
+  bool haveKey = false;
+  NDAttributeKey key;
 
   epicsMutexLock(this->lock_);
-  pAttribute = this->find(pName);
-  if (pAttribute) {
+  pListNode = hashFind(pName, hash);
+  if (pListNode) {
+    pAttribute = pListNode->pNDAttribute;
     pAttribute->setValue(pValue);
   } else {
-    pAttribute = new NDAttribute(pName, pDescription, NDAttrSourceDriver, "Driver", dataType, pValue);
+    /* Look for an attribute removed by reset() by the hash of its name first, so that reusing it does not
+     * need getKey(), which takes a lock shared by all attribute lists */
+    pAttribute = takeRetired(pName, hash, typeid(NDAttribute), newDataType);
+    if (!pAttribute && (this->hashSize_ == 0)) {
+      /* The hash index of retired attributes could not be allocated, look them up by key */
+      key = getKey(pName);
+      haveKey = true;
+      pAttribute = takeRetired(key.id, typeid(NDAttribute), newDataType);
+    }
+    if (pAttribute) {
+      pAttribute->description_ = pDescription ? pDescription : "";
+      pAttribute->sourceType_ = NDAttrSourceDriver;
+      pAttribute->sourceTypeString_ = "NDAttrSourceDriver";
+      pAttribute->source_ = "Driver";
+      pAttribute->setValue(pValue);
+    } else {
+      if (!haveKey) key = getKey(pName);
+      pAttribute = new NDAttribute(pName, pDescription, NDAttrSourceDriver, "Driver", dataType, pValue);
+      pAttribute->listNode_.key = key.id;
+      pAttribute->listNode_.hash = hash;
+    }
+    hashAdd(&pAttribute->listNode_);
     ellAdd(&this->list_, &pAttribute->listNode_.node);
   }
   epicsMutexUnlock(this->lock_);
@@ -81,26 +408,46 @@ NDAttribute* NDAttributeList::add(const char *pName, const char *pDescription, N
 
 
 
-/** Finds an attribute by name; the search is now case sensitive (R1-10)
+/** Finds an attribute by name; the search is now case sensitive (R1-10).
+  * The attribute is looked up in the hash index, so the time does not depend on the number of attributes.
   * \param[in] pName The name of the attribute to be found.
   * \return Returns a pointer to the attribute if found, NULL if not found. 
   */
 NDAttribute* NDAttributeList::find(const char *pName)
 {
-  NDAttribute *pAttribute;
+  NDAttribute *pAttribute = NULL;
   NDAttributeListNode *pListNode;
   //const char *functionName = "NDAttributeList::find";
 
   epicsMutexLock(this->lock_);
-  pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
-  while (pListNode) {
-    pAttribute = pListNode->pNDAttribute;
-    if (pAttribute->name_ == pName) goto done;
-    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
-  }
-  pAttribute = NULL;
+  pListNode = hashFind(pName, hashName(pName));
+  if (pListNode) pAttribute = pListNode->pNDAttribute;
+  epicsMutexUnlock(this->lock_);
+  return(pAttribute);
+}
 
-  done:
+/** Finds an attribute by key.
+  * This does not look at the attribute name, so it is the fastest way to find the same attribute in each NDArray.
+  * \param[in] key The key of the attribute name, from getKey().
+  * \return Returns a pointer to the attribute if found, NULL if not found.
+  */
+NDAttribute* NDAttributeList::find(NDAttributeKey key)
+{
+  NDAttribute *pAttribute = NULL;
+  NDAttributeListNode *pListNode = NULL;
+
+  if (key.id < 0) return NULL;
+  epicsMutexLock(this->lock_);
+  if (key.id < this->numSlots_) {
+    pListNode = this->slots_[key.id];
+  } else {
+    /* Either no attribute has this key or the table could not be grown for it, search the list */
+    pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
+    while (pListNode && (pListNode->key != key.id)) {
+      pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+    }
+  }
+  if (pListNode) pAttribute = pListNode->pNDAttribute;
   epicsMutexUnlock(this->lock_);
   return(pAttribute);
 }
@@ -150,6 +497,7 @@ int NDAttributeList::remove(const char *pName)
   epicsMutexLock(this->lock_);
   pAttribute = this->find(pName);
   if (!pAttribute) goto done;
+  hashRemove(&pAttribute->listNode_);
   ellDelete(&this->list_, &pAttribute->listNode_.node);
   delete pAttribute;
   status = ND_SUCCESS;
@@ -159,11 +507,12 @@ int NDAttributeList::remove(const char *pName)
   return(status);
 }
 
-/** Deletes all attributes from the list. */
+/** Deletes all attributes from the list, including the attributes kept for reuse by reset(). */
 int NDAttributeList::clear()
 {
   NDAttribute *pAttribute;
   NDAttributeListNode *pListNode;
+  int i;
   //const char *functionName = "NDAttributeList::clear";
 
   epicsMutexLock(this->lock_);
@@ -174,57 +523,154 @@ int NDAttributeList::clear()
     delete pAttribute;
     pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
   }
+  if (this->hashSize_) {
+    memset(this->hashTable_, 0, this->hashSize_ * sizeof(NDAttributeListNode *));
+    memset(this->retiredHash_, 0, this->hashSize_ * sizeof(NDAttributeListNode *));
+  }
+  if (this->numSlots_) memset(this->slots_, 0, this->numSlots_ * sizeof(NDAttributeListNode *));
+  for (i=0; i<this->numSlots_; i++) {
+    delete this->retired_[i];
+    this->retired_[i] = NULL;
+  }
   epicsMutexUnlock(this->lock_);
   return(ND_SUCCESS);
 }
 
+/** Removes all attributes from the list.
+  * Unlike clear() the attributes are not deleted, they are kept by the list and reused when attributes
+  * with the same names, classes and data types are added again with add(pName, ...) or copy().
+  * This is what NDArrayPool::alloc() uses when eraseNDAttributes is set, so that arrays which get the
+  * same attributes for each frame do not allocate or free memory for them.
+  */
+int NDAttributeList::reset()
+{
+  NDAttributeListNode *pListNode;
+  //const char *functionName = "NDAttributeList::reset";
+
+  epicsMutexLock(this->lock_);
+  while ((pListNode = (NDAttributeListNode *)ellFirst(&this->list_))) {
+    retire(pListNode);
+  }
+  epicsMutexUnlock(this->lock_);
+  return(ND_SUCCESS);
+}
+
+/** Returns pListNode, or the first node after it, whose key is set in pKeyMask; all nodes if pKeyMask is NULL */
+static NDAttributeListNode* wantedNode(NDAttributeListNode *pListNode, const std::vector<bool> *pKeyMask)
+{
+  if (!pKeyMask) return pListNode;
+  while (pListNode && ((pListNode->key < 0) || ((size_t)pListNode->key >= pKeyMask->size()) ||
+                       !(*pKeyMask)[pListNode->key])) {
+    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+  }
+  return pListNode;
+}
+
 /** Copies all attributes from one attribute list to another.
   * It is efficient so that if the attribute already exists in the output
   * list it just copies the properties, and memory allocation is minimized.
-  * The attributes are added to any existing attributes already present in the output list.
+  * The attributes are looked up by key in the output list, so the time is
+  * proportional to the number of attributes.
   * \param[out] pListOut A pointer to the output attribute list to copy to.
+  * \param[in] replace If false the attributes are added to any existing attributes already present in the output list.
+  * If true the output list is made to contain only the attributes in this list, in the same order.
+  * The attributes at the start of the output list which have the same names and data types as the attributes in
+  * this list are reused, so when the same list is copied to an NDArray from the pool each time no attributes
+  * are created or deleted and only the values are copied.
+  * \param[in] pKeyMask If not NULL only the attributes whose NDAttributeKey.id is set in this mask are copied.
   */
-int NDAttributeList::copy(NDAttributeList *pListOut)
+int NDAttributeList::copy(NDAttributeList *pListOut, bool replace, const std::vector<bool> *pKeyMask)
 {
   NDAttribute *pAttrIn, *pAttrOut, *pFound;
-  NDAttributeListNode *pListNode;
+  NDAttributeListNode *pListNode, *pOutNode=NULL;
+  NDAttributeKey key;
   //const char *functionName = "NDAttributeList::copy";
 
+  if (pListOut == this) return(ND_SUCCESS);
   epicsMutexLock(this->lock_);
-  pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
+  pListNode = wantedNode((NDAttributeListNode *)ellFirst(&this->list_), pKeyMask);
+  if (replace) {
+    epicsMutexLock(pListOut->lock_);
+    pOutNode = (NDAttributeListNode *)ellFirst(&pListOut->list_);
+    /* Copy the values of the attributes which are already in the same place in the output list */
+    while (pListNode && pOutNode && (pOutNode->key == pListNode->key) && (pOutNode->key >= 0) &&
+           (pOutNode->pNDAttribute->dataType_ == pListNode->pNDAttribute->dataType_)) {
+      pListNode->pNDAttribute->copy(pOutNode->pNDAttribute);
+      pListNode = wantedNode((NDAttributeListNode *)ellNext(&pListNode->node), pKeyMask);
+      pOutNode = (NDAttributeListNode *)ellNext(&pOutNode->node);
+    }
+    /* Remove the rest of the output list, the remaining attributes are added to the end,
+     * reusing the removed attributes where possible */
+    while (pOutNode) {
+      pAttrOut = pOutNode->pNDAttribute;
+      pOutNode = (NDAttributeListNode *)ellNext(&pOutNode->node);
+      pListOut->retire(&pAttrOut->listNode_);
+    }
+  }
   while (pListNode) {
     pAttrIn = pListNode->pNDAttribute;
     /* See if there is already an attribute of this name in the output list */
-    pFound = pListOut->find(pAttrIn->name_.c_str());
-    /* The copy function will copy the properties, and will create the attribute if pFound is NULL */
-    pAttrOut = pAttrIn->copy(pFound);
-    /* If pFound is NULL, then a copy created a new attribute, need to add it to the list */
-    if (!pFound) pListOut->add(pAttrOut);
-    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+    key.id = pListNode->key;
+    if (replace) pFound = NULL;
+    else if (key.id >= 0) pFound = pListOut->find(key);
+    else pFound = pListOut->find(pAttrIn->name_.c_str());
+    if (pFound) {
+      /* The copy function will copy the properties */
+      pAttrIn->copy(pFound);
+    } else {
+      /* Reuse an attribute which was removed from the output list, or copy will create a new attribute */
+      pAttrOut = pListOut->takeRetired(key.id, typeid(*pAttrIn), pAttrIn->dataType_);
+      pAttrOut = pAttrIn->copy(pAttrOut);
+      /* The attribute is not in the output list, so this does not need add() to remove it */
+      epicsMutexLock(pListOut->lock_);
+      pListOut->hashAdd(&pAttrOut->listNode_);
+      ellAdd(&pListOut->list_, &pAttrOut->listNode_.node);
+      epicsMutexUnlock(pListOut->lock_);
+    }
+    pListNode = wantedNode((NDAttributeListNode *)ellNext(&pListNode->node), pKeyMask);
   }
+  if (replace) epicsMutexUnlock(pListOut->lock_);
   epicsMutexUnlock(this->lock_);
   return(ND_SUCCESS);
 }
 
 /** Updates all attribute values in the list; calls NDAttribute::updateValue() for each attribute in the list.
+  * If a function was set with setUpdateFunction() it is called first, with the lock of the list held.
+  * \param[in] pKeyMask If not NULL only the attributes whose NDAttributeKey.id is set in this mask are updated.
   */
-int NDAttributeList::updateValues()
+int NDAttributeList::updateValues(const std::vector<bool> *pKeyMask)
 {
   NDAttribute *pAttribute;
   NDAttributeListNode *pListNode;
   //const char *functionName = "NDAttributeList::updateValues";
 
   epicsMutexLock(this->lock_);
-  pListNode = (NDAttributeListNode *)ellFirst(&this->list_);
+  if (this->updateFunc_) this->updateFunc_(this->updatePvt_);
+  pListNode = wantedNode((NDAttributeListNode *)ellFirst(&this->list_), pKeyMask);
   while (pListNode) {
     pAttribute = pListNode->pNDAttribute;
     pAttribute->updateValue();
-    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
+    pListNode = wantedNode((NDAttributeListNode *)ellNext(&pListNode->node), pKeyMask);
   }
   epicsMutexUnlock(this->lock_);
   return(ND_SUCCESS);
 }
 
+/** Sets a function which updateValues() calls before it updates the attributes.
+  * The function is called with the lock of the list held, so it can prepare state which the
+  * NDAttribute::updateValue() methods of the attributes then read without any other lock.
+  * asynNDArrayDriver uses this to snapshot the values of its PVAttributes, see PVAttributeGroup::update().
+  * \param[in] pFunc The function, or NULL for none.
+  * \param[in] userPvt The argument passed to pFunc.
+  */
+void NDAttributeList::setUpdateFunction(NDAttributeListUpdateFunc pFunc, void *userPvt)
+{
+  epicsMutexLock(this->lock_);
+  this->updateFunc_ = pFunc;
+  this->updatePvt_ = userPvt;
+  epicsMutexUnlock(this->lock_);
+}
+
 /** Reports on the properties of the attribute list.
   * \param[in] fp File pointer for the report output.
   * \param[in] details Level of report details desired; if >10 calls NDAttribute::report() for each attribute.
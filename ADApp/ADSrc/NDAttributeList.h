@@ -10,13 +10,25 @@
 #define NDAttributeList_H
 
 #include <stdio.h>
+#include <typeinfo>
+#include <vector>
 #include <ellLib.h>
 #include <epicsMutex.h>
  
 #include "NDAttribute.h"
 
+/** Function which NDAttributeList::updateValues() calls before it updates the attributes, see
+  * NDAttributeList::setUpdateFunction().
+  * \param[in] userPvt The pointer which was passed to setUpdateFunction(). */
+typedef void (*NDAttributeListUpdateFunc)(void *userPvt);
 
 /** NDAttributeList class; this is a linked list of attributes.
+  * The list keeps the order in which the attributes were added, and a hash index of the attribute
+  * names so that find() does not need to search the list.
+  * It also keeps a table indexed by NDAttributeKey, so that an attribute can be found with a key
+  * from getKey() without looking at its name.
+  * Attributes removed by reset() are kept by the list and reused for attributes with the same name,
+  * so that arrays which get the same attributes for each frame do not allocate memory for them.
   */
 class epicsShareClass NDAttributeList {
 public:
@@ -26,17 +38,40 @@ public:
     NDAttribute* add(const char *pName, const char *pDescription="", 
                      NDAttrDataType_t dataType=NDAttrUndefined, void *pValue=NULL);
     NDAttribute* find(const char *pName);
+    NDAttribute* find(NDAttributeKey key);
+    static NDAttributeKey getKey(const char *pName);
+    static long  numKeyLookups();
     NDAttribute* next(NDAttribute *pAttribute);
     int          count();
     int          remove(const char *pName);
     int          clear();
-    int          copy(NDAttributeList *pOut);
-    int          updateValues();
+    int          reset();
+    int          copy(NDAttributeList *pOut, bool replace=false, const std::vector<bool> *pKeyMask=NULL);
+    int          updateValues(const std::vector<bool> *pKeyMask=NULL);
+    void         setUpdateFunction(NDAttributeListUpdateFunc pFunc, void *userPvt);
     int          report(FILE *fp, int details);
     
 private:
+    static unsigned int hashName(const char *pName);
+    NDAttributeListNode* hashFind(const char *pName, unsigned int hash);
+    void         hashAdd(NDAttributeListNode *pListNode);
+    void         hashRemove(NDAttributeListNode *pListNode);
+    void         hashResize(size_t hashSize);
+    void         slotResize(int numSlots);
+    void         retire(NDAttributeListNode *pListNode);
+    void         retiredRemove(NDAttributeListNode *pListNode);
+    NDAttribute* takeRetired(int key, const std::type_info& type, NDAttrDataType_t dataType);
+    NDAttribute* takeRetired(const char *pName, unsigned int hash, const std::type_info& type, NDAttrDataType_t dataType);
     ELLLIST      list_;   /**< The EPICS ELLLIST  */
     epicsMutexId lock_;  /**< Mutex to protect the ELLLIST */
+    NDAttributeListNode **hashTable_;  /**< Hash buckets of the attributes, indexed by hash & (hashSize_-1) */
+    NDAttributeListNode **retiredHash_; /**< Hash buckets of the attributes in retired_, the same size as hashTable_ */
+    size_t       hashSize_;            /**< Number of hash buckets in hashTable_ and retiredHash_, 0 or a power of 2 */
+    NDAttributeListNode **slots_;      /**< The attributes indexed by NDAttributeKey.id, NULL if not in the list */
+    NDAttribute  **retired_;           /**< Attributes removed by reset() which can be reused, indexed by key */
+    int          numSlots_;            /**< Number of elements in slots_ and retired_ */
+    NDAttributeListUpdateFunc updateFunc_; /**< Called by updateValues() with lock_ held, may be NULL */
+    void         *updatePvt_;          /**< Argument for updateFunc_ */
 };
 
 #endif
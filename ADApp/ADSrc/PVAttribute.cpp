@@ -11,6 +11,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 
 #include <ellLib.h>
 #include <epicsMutex.h>
@@ -34,6 +35,54 @@ static void connectCallbackC(struct connection_handler_args cha);
 
 static asynUser *pasynUserSelf = NULL;
 
+/** Constructor for a group of PVAttributes which are snapshotted together */
+PVAttributeGroup::PVAttributeGroup()
+{
+    this->lock = epicsMutexCreate();
+}
+
+/** Destructor for a group of PVAttributes.
+  * The PVAttributes in the group must be deleted before the group. */
+PVAttributeGroup::~PVAttributeGroup()
+{
+    epicsMutexDestroy(this->lock);
+}
+
+/** Takes a snapshot of the values that the PVAttributes in this group have received.
+  * Locks the group once and moves the pending value of each attribute which changed since the last call
+  * to the value that PVAttribute::updateValue() uses; string values are swapped, not copied.
+  * PVAttribute::updateValue() reads those values without a lock, so this must not be called
+  * while updateValue() may be running for an attribute in the group in another thread.
+  * When the attributes are in an NDAttributeList use updateFunction() as its update function,
+  * so that NDAttributeList::updateValues() calls this with the lock of the list held.
+  */
+void PVAttributeGroup::update()
+{
+    std::vector<PVAttribute *>::iterator it;
+    PVAttribute *pAttribute;
+    char *pString;
+
+    epicsMutexLock(this->lock);
+    for (it = this->changed.begin(); it != this->changed.end(); ++it) {
+        pAttribute = *it;
+        pAttribute->snapshotValue = pAttribute->callbackValue;
+        pString = pAttribute->snapshotString;
+        pAttribute->snapshotString = pAttribute->callbackString;
+        pAttribute->callbackString = pString;
+        pAttribute->callbackPending = false;
+        pAttribute->snapshotChanged = true;
+    }
+    this->changed.clear();
+    epicsMutexUnlock(this->lock);
+}
+
+/** Calls update() for a group; an NDAttributeListUpdateFunc for NDAttributeList::setUpdateFunction().
+  * \param[in] pGroup A pointer to the PVAttributeGroup. */
+void PVAttributeGroup::updateFunction(void *pGroup)
+{
+    ((PVAttributeGroup *)pGroup)->update();
+}
+
 /** Constructor for an EPICS PV attribute
   * \param[in] pName The name of the attribute to be created; case-insensitive. 
   * \param[in] pDescription The description of the attribute.
@@ -41,11 +90,14 @@ static asynUser *pasynUserSelf = NULL;
   * \param[in] dbrType The EPICS DBR_XXX type to be used (DBR_STRING, DBR_DOUBLE, etc).
   *                    In addition to the normal DBR types a special type, DBR_NATIVE, may be used,
   *                    which means to use the native data type returned by Channel Access for this PV.
+  * \param[in] pGroup The PVAttributeGroup which snapshots the value of this attribute.
+  *                   If NULL the attribute creates its own group, and updateValue() locks it each time it is called.
   */
 PVAttribute::PVAttribute(const char *pName, const char *pDescription,
-                         const char *pSource, chtype dbrType)
+                         const char *pSource, chtype dbrType, PVAttributeGroup *pGroup)
     : NDAttribute(pName, pDescription, NDAttrSourceEPICSPV, pSource, NDAttrUndefined, 0),
-    dbrType(dbrType), callbackString(0), connectedOnce(false)
+    dbrType(dbrType), callbackString(0), callbackPending(false), snapshotString(0), snapshotChanged(false),
+    pGroup(pGroup), ownGroup(false), connectedOnce(false)
 {
     static const char *functionName = "PVAttribute";
     
@@ -64,6 +116,10 @@ PVAttribute::PVAttribute(const char *pName, const char *pDescription,
      * that which created the context */
     ca_attach_context(pCaInputContext);
     this->lock = epicsMutexCreate();
+    if (!this->pGroup) {
+        this->pGroup = new PVAttributeGroup();
+        this->ownGroup = true;
+    }
     if (!pSource) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
             "%s:%s: ERROR, must specify source string\n",
@@ -86,13 +142,31 @@ PVAttribute::PVAttribute(PVAttribute& attribute)
     eventId = 0;
     chanId = 0;
     lock = 0;
+    callbackString = 0;
+    callbackPending = false;
+    snapshotString = 0;
+    snapshotChanged = false;
+    pGroup = 0;
+    ownGroup = false;
+    connectedOnce = false;
 }
 
 
 PVAttribute::~PVAttribute()
 {
     if (this->chanId) SEVCHK(ca_clear_channel(this->chanId),"ca_clear_channel");
+    if (this->pGroup) {
+        epicsMutexLock(this->pGroup->lock);
+        if (this->callbackPending) {
+            std::vector<PVAttribute *> &changed = this->pGroup->changed;
+            changed.erase(std::find(changed.begin(), changed.end(), this));
+        }
+        epicsMutexUnlock(this->pGroup->lock);
+        if (this->ownGroup) delete this->pGroup;
+    }
     if (this->lock) epicsMutexDestroy(this->lock);
+    free(this->callbackString);
+    free(this->snapshotString);
 }
 
 
@@ -117,16 +191,18 @@ static void monitorCallbackC(struct event_handler_args cha)
 }
 
 /** Monitor callback called whenever an EPICS PV changes value.
-  * Calls NDAttribute::setValue to store the new value.
+  * Stores the new value as the pending value of this attribute in its PVAttributeGroup;
+  * updateValue() passes it to NDAttribute::setValue after the next PVAttributeGroup::update().
   * \param[in] eha Event handler argument structure passed by channel access. 
   */
 void PVAttribute::monitorCallback(struct event_handler_args eha)
 {
     //chid  chanId = eha.chid;
     NDAttrDataType_t dataType = this->getDataType();
+    NDAttrValue value;
+    char *pString = 0;
     const char *functionName = "monitorCallback";
 
-    epicsMutexLock(this->lock);
     asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
         "%s:%s: PV=%s\n", 
         driverName, functionName, this->getSource());
@@ -135,48 +211,62 @@ void PVAttribute::monitorCallback(struct event_handler_args eha)
         asynPrint(pasynUserSelf,  ASYN_TRACE_ERROR,
         "%s:%s: CA returns eha.status=%d\n",
         driverName, functionName, eha.status);
-        goto done;
-    }
-    /* Treat strings specially */
-    if (dataType == NDAttrString) {
-      if (this->callbackString) free(this->callbackString);
-      this->callbackString = epicsStrDup((char *)eha.dbr);
-      goto done;
+        return;
     }
+    memset(&value, 0, sizeof(value));
     switch (dataType) {
+      /* Treat strings specially, copy the string before taking the group lock */
+      case NDAttrString:
+        pString = epicsStrDup((char *)eha.dbr);
+        break;
       case NDAttrInt8:
-        callbackValue.i8 = *(epicsInt8 *)eha.dbr;
+        value.i8 = *(epicsInt8 *)eha.dbr;
         break;
       case NDAttrUInt8:
-        callbackValue.ui8 = *(epicsUInt8 *)eha.dbr;
+        value.ui8 = *(epicsUInt8 *)eha.dbr;
         break;
       case NDAttrInt16:
-        callbackValue.i16 = *(epicsInt16 *)eha.dbr;
+        value.i16 = *(epicsInt16 *)eha.dbr;
         break;
       case NDAttrUInt16:
-        callbackValue.ui16 = *(epicsUInt16 *)eha.dbr;
+        value.ui16 = *(epicsUInt16 *)eha.dbr;
         break;
       case NDAttrInt32:
-        callbackValue.i32 = *(epicsInt32*)eha.dbr;
+        value.i32 = *(epicsInt32*)eha.dbr;
         break;
       case NDAttrUInt32:
-        callbackValue.ui32 = *(epicsUInt32 *)eha.dbr;
+        value.ui32 = *(epicsUInt32 *)eha.dbr;
         break;
       case NDAttrFloat32:
-        callbackValue.f32 = *(epicsFloat32 *)eha.dbr;
+        value.f32 = *(epicsFloat32 *)eha.dbr;
         break;
       case NDAttrFloat64:
-        callbackValue.f64 = *(epicsFloat64 *)eha.dbr;
+        value.f64 = *(epicsFloat64 *)eha.dbr;
         break;
       case NDAttrUndefined:
-        break;
+        return;
       default:
-        break;
+        return;
     }
-    done:
-    epicsMutexUnlock(this->lock);
+    epicsMutexLock(this->pGroup->lock);
+    if (dataType == NDAttrString)
+        std::swap(this->callbackString, pString);
+    else
+        this->callbackValue = value;
+    if (!this->callbackPending) {
+        this->callbackPending = true;
+        this->pGroup->changed.push_back(this);
+    }
+    epicsMutexUnlock(this->pGroup->lock);
+    /* Free the previous pending string, if any */
+    free(pString);
 }
 
+/** Updates the value of this attribute from the last snapshot taken by its PVAttributeGroup.
+  * If the attribute owns its group (it was constructed with pGroup=NULL) this takes the snapshot first.
+  * Otherwise PVAttributeGroup::update() must be called first; for asynNDArrayDriver this is done
+  * by NDAttributeList::updateValues(), with the lock of the attribute list held.
+  */
 int PVAttribute::updateValue()
 {
     //static const char *functionName = "updateValue"
@@ -184,13 +274,14 @@ int PVAttribute::updateValue()
     void *pValue;
     NDAttrDataType_t dataType = this->getDataType();
     
-    epicsMutexLock(this->lock);
+    if (this->ownGroup) this->pGroup->update();
+    if (!this->snapshotChanged) return asynSuccess;
+    this->snapshotChanged = false;
     if (dataType == NDAttrString)
-        pValue = callbackString;
+        pValue = snapshotString;
     else
-        pValue = &callbackValue;
+        pValue = &snapshotValue;
     this->setValue(pValue);
-    epicsMutexUnlock(this->lock);
     return asynSuccess;
 }
 
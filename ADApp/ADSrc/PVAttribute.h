@@ -11,6 +11,8 @@
 #ifndef INCPVAttributeH
 #define INCPVAttributeH
 
+#include <vector>
+
 #include <cadef.h>
 #include <epicsMutex.h>
 #include <epicsEvent.h>
@@ -20,11 +22,36 @@
 /** Use native type for channel access */
 #define DBR_NATIVE -1
 
+class PVAttribute;
+
+/** Collects the values which a set of PVAttributes receive in their monitor callbacks so that
+  * they can all be snapshotted with a single mutex lock.
+  * The monitor callbacks store new values as pending values and record which attributes changed.
+  * update() moves the pending values of the changed attributes to the values that
+  * PVAttribute::updateValue() reads, which it then does without locking.
+  * asynNDArrayDriver uses one group for all of its PVAttributes, and sets updateFunction() as the
+  * update function of its NDAttributeList so that NDAttributeList::updateValues() calls update() once
+  * per frame with the lock of the list held.
+  */
+class PVAttributeGroup {
+public:
+    PVAttributeGroup();
+    ~PVAttributeGroup();
+    void update();
+    static void updateFunction(void *pGroup);
+
+private:
+    friend class PVAttribute;
+    epicsMutexId lock;
+    std::vector<PVAttribute *> changed;  /**< Attributes with pending values, protected by lock */
+};
+
 /** Attribute that gets its value from an EPICS PV.
   */
 class PVAttribute : public NDAttribute {
 public:
-    PVAttribute(const char *pName, const char *pDescription, const char *pSource, chtype dbrType);
+    PVAttribute(const char *pName, const char *pDescription, const char *pSource, chtype dbrType,
+                PVAttributeGroup *pGroup=0);
     PVAttribute(PVAttribute& attribute);
     ~PVAttribute();
     PVAttribute* copy(NDAttribute *pAttribute);
@@ -38,10 +65,18 @@ private:
     chid        chanId;
     evid        eventId;
     chtype      dbrType;
-    NDAttrValue callbackValue;
-    char        *callbackString;
+    NDAttrValue callbackValue;       /**< Pending value, protected by the group lock */
+    char        *callbackString;     /**< Pending string value, protected by the group lock */
+    bool        callbackPending;     /**< True if this attribute is in the group's changed list */
+    NDAttrValue snapshotValue;       /**< Value from the last PVAttributeGroup::update() */
+    char        *snapshotString;     /**< String value from the last PVAttributeGroup::update() */
+    bool        snapshotChanged;     /**< True if the snapshot has not yet been passed to setValue() */
+    PVAttributeGroup *pGroup;
+    bool        ownGroup;
     bool        connectedOnce;
     epicsMutexId lock;
+
+    friend class PVAttributeGroup;
 };
 
 #endif /*INCPVAttributeH*/
@@ -24,6 +24,7 @@
 #include <epicsMutex.h>
 #include <macLib.h>
 #include <cantProceed.h>
+#include <iocsh.h>
 
 #include <asynDriver.h>
 
@@ -34,6 +35,7 @@
 #include "paramAttribute.h"
 #include "functAttribute.h"
 #include "asynNDArrayDriver.h"
+#include <epicsExport.h>
 
 #define MAX_PATH_PARTS 32
 
@@ -55,6 +57,16 @@
 
 static const char *driverName = "asynNDArrayDriver";
 
+/** NDAttributesOnDemand is a global flag that controls whether asynNDArrayDriver::getAttributes() only
+  * updates and copies the attributes which the plugins connected to the driver use, see
+  * asynNDArrayDriver::setAttributeInterest().
+  * The default value is 0, meaning that all attributes are updated and copied for each array.
+  * It should only be set if all clients of the drivers are plugins derived from NDPluginDriver,
+  * because other clients do not say which attributes they use.
+  */
+volatile int NDAttributesOnDemand=0;
+extern "C" {epicsExportAddress(int, NDAttributesOnDemand);}
+
 /** Checks whether the directory specified exists.
   * 
   * This is a convenience function that determines the directory specified exists.
@@ -439,7 +451,8 @@ done_macros:
                 "%s:%s: Name=%s, PVName=%s, pDBRType=%s, dbrType=%d, pDescription=%s\n",
                 driverName, functionName, pName, pSource, pDBRType, dbrType, pDescription);
 #ifndef EPICS_LIBCOM_ONLY
-            PVAttribute *pPVAttribute = new PVAttribute(pName, pDescription, pSource, dbrType);
+            PVAttribute *pPVAttribute = new PVAttribute(pName, pDescription, pSource, dbrType,
+                                                        this->pPVAttributeGroup_);
             this->pAttributeList->add(pPVAttribute);
 #endif
         } else if (strcmp(pAttrType, NDAttribute::attrSourceString(NDAttrSourceParam)) == 0) {
@@ -484,6 +497,9 @@ done_macros:
   * list to pList, appending the values to that output attribute list.
   * \param[out] pList  The NDAttributeList to copy the attributes to.
   *
+  * If NDAttributesOnDemand is set and all of the clients of this driver have said which attributes
+  * they use with setAttributeInterest() then only those attributes are updated and copied.
+  *
   * NOTE: Plugins must never call this function with a pointer to the attribute
   * list from the NDArray they were passed in NDPluginDriver::processCallbacks, because
   * that modifies the original NDArray which is forbidden.
@@ -493,11 +509,105 @@ asynStatus asynNDArrayDriver::getAttributes(NDAttributeList *pList)
     //const char *functionName = "getAttributes";
     int status = asynSuccess;
     
+    if (NDAttributesOnDemand) {
+        epicsMutexLock(this->attributeInterestLock_);
+        if (!this->attributeInterest_.empty() && !this->allAttributesWanted_) {
+            status = this->pAttributeList->updateValues(&this->attributeKeyMask_);
+            status = this->pAttributeList->copy(pList, false, &this->attributeKeyMask_);
+            epicsMutexUnlock(this->attributeInterestLock_);
+            return (asynStatus) status;
+        }
+        epicsMutexUnlock(this->attributeInterestLock_);
+    }
     status = this->pAttributeList->updateValues();
     status = this->pAttributeList->copy(pList);
     return (asynStatus) status;
 }
 
+/** Sets the attributes which a client of this driver uses.
+  * NDPluginDriver calls this for the driver it gets arrays from, with the attributes that it and the plugins
+  * connected to it use.  When NDAttributesOnDemand is set getAttributes() only updates and copies the attributes
+  * used by at least one client, so attributes which no client reads cost nothing.
+  * \param[in] pClient An address which identifies the client, normally its this pointer.
+  * \param[in] allAttributes True if the client uses all attributes, in which case keys is ignored.
+  * \param[in] keys The keys of the attributes the client uses, see NDAttributeList::getKey().
+  */
+asynStatus asynNDArrayDriver::setAttributeInterest(void *pClient, bool allAttributes,
+                                                   const std::vector<NDAttributeKey> &keys)
+{
+    NDAttributeInterest_t interest;
+
+    interest.allAttributes = allAttributes;
+    if (!allAttributes) interest.keys = keys;
+    epicsMutexLock(this->attributeInterestLock_);
+    this->attributeInterest_[pClient] = interest;
+    updateAttributeKeyMask();
+    epicsMutexUnlock(this->attributeInterestLock_);
+    attributeInterestChanged();
+    return asynSuccess;
+}
+
+/** Removes a client set with setAttributeInterest(), for example when a plugin connects to a different driver.
+  * \param[in] pClient The address which identifies the client.
+  */
+asynStatus asynNDArrayDriver::clearAttributeInterest(void *pClient)
+{
+    epicsMutexLock(this->attributeInterestLock_);
+    this->attributeInterest_.erase(pClient);
+    updateAttributeKeyMask();
+    epicsMutexUnlock(this->attributeInterestLock_);
+    attributeInterestChanged();
+    return asynSuccess;
+}
+
+/** Computes allAttributesWanted_ and attributeKeyMask_ from the interest of all clients.
+  * Must be called with attributeInterestLock_ held. */
+void asynNDArrayDriver::updateAttributeKeyMask()
+{
+    std::map<void *, NDAttributeInterest_t>::iterator it;
+    size_t i;
+
+    this->allAttributesWanted_ = false;
+    this->attributeKeyMask_.assign(this->attributeKeyMask_.size(), false);
+    for (it = this->attributeInterest_.begin(); it != this->attributeInterest_.end(); ++it) {
+        if (it->second.allAttributes) this->allAttributesWanted_ = true;
+        for (i=0; i<it->second.keys.size(); i++) {
+            if (it->second.keys[i].id < 0) continue;
+            if ((size_t)it->second.keys[i].id >= this->attributeKeyMask_.size()) {
+                this->attributeKeyMask_.resize(it->second.keys[i].id + 1, false);
+            }
+            this->attributeKeyMask_[it->second.keys[i].id] = true;
+        }
+    }
+}
+
+/** Returns the union of the attributes used by the clients of this driver.
+  * \param[out] pAllAttributes Set to true if any client uses all attributes.
+  * \param[out] keys The keys of the attributes used by any client.
+  */
+void asynNDArrayDriver::getAttributeInterest(bool *pAllAttributes, std::vector<NDAttributeKey> &keys)
+{
+    NDAttributeKey key;
+    size_t i;
+
+    keys.clear();
+    epicsMutexLock(this->attributeInterestLock_);
+    *pAllAttributes = this->allAttributesWanted_;
+    for (i=0; i<this->attributeKeyMask_.size(); i++) {
+        if (!this->attributeKeyMask_[i]) continue;
+        key.id = (int)i;
+        keys.push_back(key);
+    }
+    epicsMutexUnlock(this->attributeInterestLock_);
+}
+
+/** Called when the attributes used by the clients of this driver change.
+  * The default does nothing; NDPluginDriver passes the change on to the driver it gets arrays from.
+  */
+void asynNDArrayDriver::attributeInterestChanged()
+{
+}
+
 /** Called when asyn clients call pasynOctet->write().
   * This function performs actions for some parameters, including NDAttributesFile.
   * For all parameters it sets the value in the parameter library and calls any registered callbacks..
@@ -573,10 +683,10 @@ asynStatus asynNDArrayDriver::readGenericPointer(asynUser *pasynUser, void *gene
                     driverName, functionName, pArray->pData);
         status = asynError;
     } else {
-        this->pNDArrayPool->copy(myArray, pArray, 0);
+        /* copy() also handles views whose data is not contiguous */
+        this->pNDArrayPool->copy(myArray, pArray, 1);
         myArray->getInfo(&arrayInfo);
         if (arrayInfo.totalBytes > pArray->dataSize) arrayInfo.totalBytes = pArray->dataSize;
-        memcpy(pArray->pData, myArray->pData, arrayInfo.totalBytes);
         pasynUser->timestamp = myArray->epicsTS;
     }
     if (!status)
@@ -603,10 +713,82 @@ asynStatus asynNDArrayDriver::writeGenericPointer(asynUser *pasynUser, void *gen
     return status;
 }
 
+/** Pre-allocates NDPoolPreAllocBuffers arrays in the NDArrayPool with the current ArraySizeX, ArraySizeY,
+  * ArraySizeZ and DataType, see NDArrayPool::preAllocate().  This is done when POOL_PREALLOCATE is written,
+  * which the database does when ArraySize changes.  Drivers can also call it when they change the array
+  * dimensions, so that the first arrays of an acquisition do not have to allocate memory.
+  * This does nothing if NDPoolPreAllocBuffers is 0. */
+asynStatus asynNDArrayDriver::preAllocateArrays()
+{
+    int numArrays, lockMemory, dataType;
+    int sizes[3];
+    size_t dims[3];
+    int ndims=0;
+    int i;
+
+    getIntegerParam(NDPoolPreAllocBuffers, &numArrays);
+    getIntegerParam(NDPoolLockMemory, &lockMemory);
+    getIntegerParam(NDDataType, &dataType);
+    getIntegerParam(NDArraySizeX, &sizes[0]);
+    getIntegerParam(NDArraySizeY, &sizes[1]);
+    getIntegerParam(NDArraySizeZ, &sizes[2]);
+    for (i=0; i<3; i++) {
+        if (sizes[i] > 0) dims[ndims++] = sizes[i];
+    }
+    if ((numArrays <= 0) || (ndims == 0)) return asynSuccess;
+    return preAllocateArrays(numArrays, ndims, dims, (NDDataType_t)dataType, lockMemory != 0);
+}
+
+/** Pre-allocates arrays with the specified dimensions in the NDArrayPool of this driver, see NDArrayPool::preAllocate().
+  * \param[in] numArrays The number of arrays to allocate.
+  * \param[in] ndims The number of dimensions.
+  * \param[in] dims Array of dimensions.
+  * \param[in] dataType The NDDataType_t of the arrays.
+  * \param[in] lockMemory If true lock the arrays in physical memory with mlock(). */
+asynStatus asynNDArrayDriver::preAllocateArrays(int numArrays, int ndims, size_t *dims, NDDataType_t dataType,
+                                                bool lockMemory)
+{
+    static const char *functionName = "preAllocateArrays";
+
+    if (this->pNDArrayPool->preAllocate(numArrays, ndims, dims, dataType, lockMemory)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error pre-allocating %d arrays\n",
+            driverName, functionName, numArrays);
+        return asynError;
+    }
+    return asynSuccess;
+}
+
+asynStatus asynNDArrayDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+
+    status = asynPortDriver::writeInt32(pasynUser, value);
+    if ((function == NDPoolPreAllocate) && value) {
+        status = preAllocateArrays();
+        setIntegerParam(NDPoolPreAllocate, 0);
+        callParamCallbacks();
+    } else if (function == NDPoolCollectTiming) {
+        this->pNDArrayPool->setCollectTiming(value);
+    } else if ((function == NDPoolResetStats) && value) {
+        this->pNDArrayPool->resetStats();
+        setIntegerParam(NDPoolResetStats, 0);
+        callParamCallbacks();
+    } else if ((function == NDPoolReport) && value) {
+        printf("%s: NDArrayPool report\n", this->portName);
+        this->pNDArrayPool->report(stdout, 1);
+        setIntegerParam(NDPoolReport, 0);
+        callParamCallbacks();
+    }
+    return status;
+}
+
 asynStatus asynNDArrayDriver::readInt32(asynUser *pasynUser, epicsInt32 *value)
 {
     int function = pasynUser->reason;
     asynStatus status = asynSuccess;
+    NDArrayPoolStats_t stats;
 
     // Just read the status of the NDArrayPool
     if (function == NDPoolMaxBuffers) {
@@ -615,6 +797,25 @@ asynStatus asynNDArrayDriver::readInt32(asynUser *pasynUser, epicsInt32 *value)
         setIntegerParam(function, this->pNDArrayPool->numBuffers());
     } else if (function == NDPoolFreeBuffers) {
         setIntegerParam(function, this->pNDArrayPool->numFree());
+    } else if (function == NDPoolAllocWaits) {
+        setIntegerParam(function, this->pNDArrayPool->numAllocWaits());
+    } else if (function == NDPoolAllocTimeouts) {
+        setIntegerParam(function, this->pNDArrayPool->numAllocTimeouts());
+    } else if (function == NDPoolNumAllocs) {
+        this->pNDArrayPool->getStats(&stats);
+        setIntegerParam(function, stats.numAllocs);
+    } else if (function == NDPoolNumMallocs) {
+        this->pNDArrayPool->getStats(&stats);
+        setIntegerParam(function, stats.numMallocs);
+    } else if (function == NDPoolNumEvictions) {
+        this->pNDArrayPool->getStats(&stats);
+        setIntegerParam(function, stats.numEvictions);
+    } else if (function == NDPoolNumAllocFailures) {
+        this->pNDArrayPool->getStats(&stats);
+        setIntegerParam(function, stats.numAllocFailures);
+    } else if (function == NDPoolPeakBuffers) {
+        this->pNDArrayPool->getStats(&stats);
+        setIntegerParam(function, stats.peakBuffersInUse);
     }
 
     // Call base class
@@ -622,17 +823,43 @@ asynStatus asynNDArrayDriver::readInt32(asynUser *pasynUser, epicsInt32 *value)
     return status;
 }
 
+asynStatus asynNDArrayDriver::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+
+    status = asynPortDriver::writeFloat64(pasynUser, value);
+    if (function == NDPoolAllocTimeout) {
+        this->pNDArrayPool->setAllocTimeout(value);
+    } else if (function == NDPoolMemoryWeight) {
+        this->pNDArrayPool->setMemoryWeight(value);
+    }
+    return status;
+}
+
 #define MEGABYTE_DBL 1048576.
 asynStatus asynNDArrayDriver::readFloat64(asynUser *pasynUser, epicsFloat64 *value)
 {
     int function = pasynUser->reason;
     asynStatus status = asynSuccess;
+    NDArrayPoolStats_t stats;
 
     // Just read the status of the NDArrayPool
     if (function == NDPoolMaxMemory) {
         setDoubleParam(function, this->pNDArrayPool->maxMemory() / MEGABYTE_DBL);
     } else if (function == NDPoolUsedMemory) {
         setDoubleParam(function, this->pNDArrayPool->memorySize() / MEGABYTE_DBL);
+    } else if (function == NDPoolPeakMemory) {
+        this->pNDArrayPool->getStats(&stats);
+        setDoubleParam(function, stats.peakMemory / MEGABYTE_DBL);
+    } else if (function == NDPoolMaxAllocTime) {
+        this->pNDArrayPool->getStats(&stats);
+        setDoubleParam(function, stats.maxAllocTimeNs / 1000.);
+    } else if (function == NDPoolMaxLockWait) {
+        this->pNDArrayPool->getStats(&stats);
+        setDoubleParam(function, stats.maxLockWaitNs / 1000.);
+    } else if (function == NDPoolTotalMemory) {
+        setDoubleParam(function, NDArrayPool::totalMemorySize() / MEGABYTE_DBL);
     }
 
     // Call base class
@@ -640,6 +867,27 @@ asynStatus asynNDArrayDriver::readFloat64(asynUser *pasynUser, epicsFloat64 *val
     return status;
 }
 
+/** Returns the latency histograms of the NDArrayPool, see NDArrayPoolStats_t.
+  * Other parameters are passed to asynPortDriver::readInt32Array(). */
+asynStatus asynNDArrayDriver::readInt32Array(asynUser *pasynUser, epicsInt32 *value,
+                                             size_t nElements, size_t *nIn)
+{
+    int function = pasynUser->reason;
+    NDArrayPoolStats_t stats;
+    int *pHist;
+    size_t i;
+
+    if ((function != NDPoolAllocTimeHist) && (function != NDPoolLockWaitHist)) {
+        return asynPortDriver::readInt32Array(pasynUser, value, nElements, nIn);
+    }
+    this->pNDArrayPool->getStats(&stats);
+    pHist = (function == NDPoolAllocTimeHist) ? stats.allocTimeHist : stats.lockWaitHist;
+    if (nElements > ND_ARRAY_POOL_HIST_BINS) nElements = ND_ARRAY_POOL_HIST_BINS;
+    for (i=0; i<nElements; i++) value[i] = pHist[i];
+    *nIn = nElements;
+    return asynSuccess;
+}
+
 
 /** Report status of the driver.
   * This method calls the report function in the asynPortDriver base class. It then
@@ -694,7 +942,8 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
                      interfaceMask | asynInt32Mask | asynFloat64Mask | asynOctetMask | asynInt32ArrayMask | asynGenericPointerMask | asynDrvUserMask, 
                      interruptMask | asynInt32Mask | asynFloat64Mask | asynOctetMask | asynInt32ArrayMask | asynGenericPointerMask,
                      asynFlags, autoConnect, priority, stackSize),
-      pNDArrayPool(NULL)
+      pNDArrayPool(NULL),
+      allAttributesWanted_(false)
 {
     char versionString[20];
 
@@ -709,6 +958,14 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     /* Allocate pArray pointer array */
     this->pArrays = (NDArray **)calloc(maxAddr, sizeof(NDArray *));
     this->pAttributeList = new NDAttributeList();
+    this->attributeInterestLock_ = epicsMutexCreate();
+#ifndef EPICS_LIBCOM_ONLY
+    // updateValues() snapshots the values of all of the PVAttributes with a single lock
+    this->pPVAttributeGroup_ = new PVAttributeGroup();
+    this->pAttributeList->setUpdateFunction(PVAttributeGroup::updateFunction, this->pPVAttributeGroup_);
+#else
+    this->pPVAttributeGroup_ = 0;
+#endif
     
     createParam(NDPortNameSelfString,         asynParamOctet,           &NDPortNameSelf);
     createParam(NDADCoreVersionString,        asynParamOctet,           &NDADCoreVersion);
@@ -758,6 +1015,27 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     createParam(NDPoolFreeBuffersString,      asynParamInt32,           &NDPoolFreeBuffers);
     createParam(NDPoolMaxMemoryString,        asynParamFloat64,         &NDPoolMaxMemory);
     createParam(NDPoolUsedMemoryString,       asynParamFloat64,         &NDPoolUsedMemory);
+    createParam(NDPoolPreAllocBuffersString,  asynParamInt32,           &NDPoolPreAllocBuffers);
+    createParam(NDPoolLockMemoryString,       asynParamInt32,           &NDPoolLockMemory);
+    createParam(NDPoolPreAllocateString,      asynParamInt32,           &NDPoolPreAllocate);
+    createParam(NDPoolAllocTimeoutString,     asynParamFloat64,         &NDPoolAllocTimeout);
+    createParam(NDPoolAllocWaitsString,       asynParamInt32,           &NDPoolAllocWaits);
+    createParam(NDPoolAllocTimeoutsString,    asynParamInt32,           &NDPoolAllocTimeouts);
+    createParam(NDPoolNumAllocsString,        asynParamInt32,           &NDPoolNumAllocs);
+    createParam(NDPoolNumMallocsString,       asynParamInt32,           &NDPoolNumMallocs);
+    createParam(NDPoolNumEvictionsString,     asynParamInt32,           &NDPoolNumEvictions);
+    createParam(NDPoolNumAllocFailuresString, asynParamInt32,           &NDPoolNumAllocFailures);
+    createParam(NDPoolPeakBuffersString,      asynParamInt32,           &NDPoolPeakBuffers);
+    createParam(NDPoolPeakMemoryString,       asynParamFloat64,         &NDPoolPeakMemory);
+    createParam(NDPoolMaxAllocTimeString,     asynParamFloat64,         &NDPoolMaxAllocTime);
+    createParam(NDPoolMaxLockWaitString,      asynParamFloat64,         &NDPoolMaxLockWait);
+    createParam(NDPoolAllocTimeHistString,    asynParamInt32Array,      &NDPoolAllocTimeHist);
+    createParam(NDPoolLockWaitHistString,     asynParamInt32Array,      &NDPoolLockWaitHist);
+    createParam(NDPoolCollectTimingString,    asynParamInt32,           &NDPoolCollectTiming);
+    createParam(NDPoolResetStatsString,       asynParamInt32,           &NDPoolResetStats);
+    createParam(NDPoolReportString,           asynParamInt32,           &NDPoolReport);
+    createParam(NDPoolMemoryWeightString,     asynParamFloat64,         &NDPoolMemoryWeight);
+    createParam(NDPoolTotalMemoryString,      asynParamFloat64,         &NDPoolTotalMemory);
 
     /* Here we set the values of read-only parameters and of read/write parameters that cannot
      * or should not get their values from the database.  Note that values set here will override
@@ -807,6 +1085,16 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     setIntegerParam(NDPoolMaxBuffers, this->pNDArrayPool->maxBuffers());
     setIntegerParam(NDPoolAllocBuffers, this->pNDArrayPool->numBuffers());
     setIntegerParam(NDPoolFreeBuffers, this->pNDArrayPool->numFree());
+    setIntegerParam(NDPoolPreAllocBuffers, 0);
+    setIntegerParam(NDPoolLockMemory, 0);
+    setIntegerParam(NDPoolPreAllocate, 0);
+    setDoubleParam (NDPoolAllocTimeout, this->pNDArrayPool->allocTimeout());
+    setIntegerParam(NDPoolAllocWaits, 0);
+    setIntegerParam(NDPoolAllocTimeouts, 0);
+    setIntegerParam(NDPoolCollectTiming, this->pNDArrayPool->collectTiming());
+    setIntegerParam(NDPoolResetStats, 0);
+    setIntegerParam(NDPoolReport, 0);
+    setDoubleParam (NDPoolMemoryWeight, this->pNDArrayPool->memoryWeight());
 
 }
 
@@ -816,5 +1104,70 @@ asynNDArrayDriver::~asynNDArrayDriver()
     delete this->pNDArrayPool;
     free(this->pArrays);
     delete this->pAttributeList;
+#ifndef EPICS_LIBCOM_ONLY
+    delete this->pPVAttributeGroup_;
+#endif
+    epicsMutexDestroy(this->attributeInterestLock_);
 }    
 
+/** Configuration command to pre-allocate arrays in the NDArrayPool of a driver or plugin, see NDArrayPool::preAllocate().
+  * \param[in] portName The name of the asyn port of the driver or plugin.
+  * \param[in] numArrays The number of arrays to allocate.
+  * \param[in] sizeX The size of the first dimension of the arrays.
+  * \param[in] sizeY The size of the second dimension of the arrays, 0 if the arrays have 1 dimension.
+  * \param[in] sizeZ The size of the third dimension of the arrays, 0 if the arrays have 1 or 2 dimensions.
+  * \param[in] dataType The NDDataType_t of the arrays.
+  * \param[in] lockMemory If 1 then lock the arrays in physical memory with mlock().
+  */
+extern "C" int NDArrayPoolPreAllocate(const char *portName, int numArrays, int sizeX, int sizeY, int sizeZ,
+                                      int dataType, int lockMemory)
+{
+    asynPortDriver *pPort = (asynPortDriver *)findAsynPortDriver(portName);
+    asynNDArrayDriver *pDriver = dynamic_cast<asynNDArrayDriver *>(pPort);
+    size_t dims[3];
+    int ndims=0;
+
+    if (!pDriver) {
+        printf("NDArrayPoolPreAllocate: cannot find NDArray driver or plugin port %s\n", portName);
+        return asynError;
+    }
+    if (sizeX > 0) dims[ndims++] = sizeX;
+    if (sizeY > 0) dims[ndims++] = sizeY;
+    if (sizeZ > 0) dims[ndims++] = sizeZ;
+    if (ndims == 0) {
+        printf("NDArrayPoolPreAllocate: invalid array size\n");
+        return asynError;
+    }
+    return pDriver->preAllocateArrays(numArrays, ndims, dims, (NDDataType_t)dataType, lockMemory != 0);
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg preAllocArg0 = { "portName", iocshArgString };
+static const iocshArg preAllocArg1 = { "numArrays", iocshArgInt };
+static const iocshArg preAllocArg2 = { "sizeX", iocshArgInt };
+static const iocshArg preAllocArg3 = { "sizeY", iocshArgInt };
+static const iocshArg preAllocArg4 = { "sizeZ", iocshArgInt };
+static const iocshArg preAllocArg5 = { "dataType", iocshArgInt };
+static const iocshArg preAllocArg6 = { "lockMemory", iocshArgInt };
+static const iocshArg * const preAllocArgs[] = {&preAllocArg0,
+                                                &preAllocArg1,
+                                                &preAllocArg2,
+                                                &preAllocArg3,
+                                                &preAllocArg4,
+                                                &preAllocArg5,
+                                                &preAllocArg6};
+static const iocshFuncDef preAllocFuncDef = {"NDArrayPoolPreAllocate", 7, preAllocArgs};
+static void preAllocCallFunc(const iocshArgBuf *args)
+{
+    NDArrayPoolPreAllocate(args[0].sval, args[1].ival, args[2].ival, args[3].ival, args[4].ival,
+                           args[5].ival, args[6].ival);
+}
+
+static void asynNDArrayDriverRegister(void)
+{
+    iocshRegister(&preAllocFuncDef, preAllocCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(asynNDArrayDriverRegister);
+}
@@ -1,6 +1,9 @@
 #ifndef asynNDArrayDriver_H
 #define asynNDArrayDriver_H
 
+#include <map>
+#include <vector>
+
 #include "asynPortDriver.h"
 #include "NDArray.h"
 #include "ADCoreVersion.h"
@@ -101,6 +104,27 @@ typedef enum {
 #define NDPoolFreeBuffersString     "POOL_FREE_BUFFERS"
 #define NDPoolMaxMemoryString       "POOL_MAX_MEMORY"
 #define NDPoolUsedMemoryString      "POOL_USED_MEMORY"
+#define NDPoolPreAllocBuffersString "POOL_PREALLOC_BUFFERS" /**< (asynInt32,    r/w) Number of arrays to pre-allocate */
+#define NDPoolLockMemoryString      "POOL_LOCK_MEMORY"      /**< (asynInt32,    r/w) Lock pre-allocated arrays in memory (0=No, 1=Yes) */
+#define NDPoolPreAllocateString     "POOL_PREALLOCATE"      /**< (asynInt32,    r/w) Pre-allocate arrays now */
+#define NDPoolAllocTimeoutString    "POOL_ALLOC_TIMEOUT"    /**< (asynFloat64,  r/w) Time to wait for a free array when the pool is exhausted */
+#define NDPoolAllocWaitsString      "POOL_ALLOC_WAITS"      /**< (asynInt32,    r/o) Number of allocations which have waited */
+#define NDPoolAllocTimeoutsString   "POOL_ALLOC_TIMEOUTS"   /**< (asynInt32,    r/o) Number of allocations which have timed out */
+#define NDPoolNumAllocsString       "POOL_NUM_ALLOCS"       /**< (asynInt32,    r/o) Number of arrays allocated */
+#define NDPoolNumMallocsString      "POOL_NUM_MALLOCS"      /**< (asynInt32,    r/o) Number of data buffers allocated from the system */
+#define NDPoolNumEvictionsString    "POOL_NUM_EVICTIONS"    /**< (asynInt32,    r/o) Number of times free buffers were freed for maxMemory */
+#define NDPoolNumAllocFailuresString "POOL_NUM_ALLOC_FAILURES" /**< (asynInt32, r/o) Number of allocations which failed */
+#define NDPoolPeakBuffersString     "POOL_PEAK_BUFFERS"     /**< (asynInt32,    r/o) Maximum number of arrays in use */
+#define NDPoolPeakMemoryString      "POOL_PEAK_MEMORY"      /**< (asynFloat64,  r/o) Maximum memory allocated in MB */
+#define NDPoolMaxAllocTimeString    "POOL_MAX_ALLOC_TIME"   /**< (asynFloat64,  r/o) Longest time in alloc() in microseconds */
+#define NDPoolMaxLockWaitString     "POOL_MAX_LOCK_WAIT"    /**< (asynFloat64,  r/o) Longest wait for the pool lock in microseconds */
+#define NDPoolAllocTimeHistString   "POOL_ALLOC_TIME_HIST"  /**< (asynInt32Array, r/o) Histogram of the time in alloc() */
+#define NDPoolLockWaitHistString    "POOL_LOCK_WAIT_HIST"   /**< (asynInt32Array, r/o) Histogram of the wait for the pool lock */
+#define NDPoolCollectTimingString   "POOL_COLLECT_TIMING"   /**< (asynInt32,    r/w) Measure the latency of alloc() (0=No, 1=Yes) */
+#define NDPoolResetStatsString      "POOL_RESET_STATS"      /**< (asynInt32,    r/w) Reset the pool statistics */
+#define NDPoolReportString          "POOL_REPORT"           /**< (asynInt32,    r/w) Print the pool report */
+#define NDPoolMemoryWeightString    "POOL_MEMORY_WEIGHT"    /**< (asynFloat64,  r/w) Weight of the pool in the IOC memory budget */
+#define NDPoolTotalMemoryString     "POOL_TOTAL_MEMORY"     /**< (asynFloat64,  r/o) Memory allocated by all pools in the IOC in MB */
 
 /** This is the class from which NDArray drivers are derived; implements the asynGenericPointer functions 
   * for NDArray objects. 
@@ -118,7 +142,11 @@ public:
                           size_t *nActual);
     virtual asynStatus readGenericPointer(asynUser *pasynUser, void *genericPointer);
     virtual asynStatus writeGenericPointer(asynUser *pasynUser, void *genericPointer);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     virtual asynStatus readInt32(asynUser *pasynUser, epicsInt32 *value);
+    virtual asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *value,
+                                      size_t nElements, size_t *nIn);
+    virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
     virtual asynStatus readFloat64(asynUser *pasynUser, epicsFloat64 *value);
     virtual void report(FILE *fp, int details);
 
@@ -130,6 +158,11 @@ public:
     virtual asynStatus createFileName(int maxChars, char *filePath, char *fileName);
     virtual asynStatus readNDAttributesFile();
     virtual asynStatus getAttributes(NDAttributeList *pAttributeList);
+    virtual asynStatus preAllocateArrays();
+    asynStatus preAllocateArrays(int numArrays, int ndims, size_t *dims, NDDataType_t dataType, bool lockMemory);
+    virtual asynStatus setAttributeInterest(void *pClient, bool allAttributes,
+                                            const std::vector<NDAttributeKey> &keys);
+    virtual asynStatus clearAttributeInterest(void *pClient);
 
 protected:
     int NDPortNameSelf;
@@ -181,6 +214,27 @@ protected:
     int NDPoolFreeBuffers;
     int NDPoolMaxMemory;
     int NDPoolUsedMemory;
+    int NDPoolPreAllocBuffers;
+    int NDPoolLockMemory;
+    int NDPoolPreAllocate;
+    int NDPoolAllocTimeout;
+    int NDPoolAllocWaits;
+    int NDPoolAllocTimeouts;
+    int NDPoolNumAllocs;
+    int NDPoolNumMallocs;
+    int NDPoolNumEvictions;
+    int NDPoolNumAllocFailures;
+    int NDPoolPeakBuffers;
+    int NDPoolPeakMemory;
+    int NDPoolMaxAllocTime;
+    int NDPoolMaxLockWait;
+    int NDPoolAllocTimeHist;
+    int NDPoolLockWaitHist;
+    int NDPoolCollectTiming;
+    int NDPoolResetStats;
+    int NDPoolReport;
+    int NDPoolMemoryWeight;
+    int NDPoolTotalMemory;
 
     NDArray **pArrays;             /**< An array of NDArray pointers used to store data in the driver */
     NDArrayPool *pNDArrayPool;     /**< An NDArrayPool object used to allocate and manipulate NDArray objects */
@@ -188,7 +242,22 @@ protected:
                                           *  attributes */
     int threadStackSize_;
     int threadPriority_;
+    epicsMutexId attributeInterestLock_;  /**< Protects the attribute interest of the clients of this driver */
+
+    virtual void attributeInterestChanged();
+    void getAttributeInterest(bool *pAllAttributes, std::vector<NDAttributeKey> &keys);
 
+private:
+    void updateAttributeKeyMask();
+    /** The attributes which one client of this driver uses, see setAttributeInterest() */
+    typedef struct {
+        bool allAttributes;
+        std::vector<NDAttributeKey> keys;
+    } NDAttributeInterest_t;
+    std::map<void *, NDAttributeInterest_t> attributeInterest_;  /**< The attribute interest of each client */
+    bool allAttributesWanted_;             /**< True if any client uses all attributes */
+    std::vector<bool> attributeKeyMask_;   /**< The keys of the attributes used by any client, indexed by NDAttributeKey.id */
+    class PVAttributeGroup *pPVAttributeGroup_;  /**< Snapshots the values of the PVAttributes in pAttributeList */
 };
 
 #endif
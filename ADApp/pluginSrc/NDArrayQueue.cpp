@@ -0,0 +1,179 @@
+/*
+ * NDArrayQueue.cpp
+ *
+ * Bounded queue of NDArray pointers which does not take a lock to send or receive.
+ * The ring of cells with sequence numbers is the bounded MPMC queue of Dmitry Vyukov.
+ *
+ * Created October 18, 2026
+ */
+
+#include <stdlib.h>
+
+#include <epicsAtomic.h>
+#include <epicsEvent.h>
+#include <cantProceed.h>
+
+#include <epicsExport.h>
+#include "NDArrayQueue.h"
+
+/** Constructor for NDArrayQueue.
+  * \param[in] capacity The maximum number of NDArrays in the queue; values less than 1 are treated as 1.
+  */
+NDArrayQueue::NDArrayQueue(int capacity)
+  : capacity_(capacity), sendPos_(0), receivePos_(0), numWaiting_(0)
+{
+  size_t numCells = 1;
+  size_t i;
+
+  if (capacity_ < 1) capacity_ = 1;
+  while (numCells < (size_t)capacity_) numCells <<= 1;
+  mask_ = numCells - 1;
+  cells_ = (NDArrayQueueCell_t *)callocMustSucceed(numCells, sizeof(NDArrayQueueCell_t),
+                                                   "NDArrayQueue::NDArrayQueue");
+  for (i=0; i<numCells; i++) cells_[i].sequence = i;
+  event_ = epicsEventMustCreate(epicsEventEmpty);
+}
+
+/** Destructor for NDArrayQueue.
+  * The NDArrays still in the queue are not released. */
+NDArrayQueue::~NDArrayQueue()
+{
+  epicsEventDestroy(event_);
+  free(cells_);
+}
+
+/** Writes an NDArray pointer to the next free cell.
+  * \return Returns false if the queue is full. */
+bool NDArrayQueue::push(NDArray *pArray, const epicsTimeStamp *pSendTime)
+{
+  NDArrayQueueCell_t *pCell;
+  size_t pos, sequence;
+  ptrdiff_t diff;
+
+  while (1) {
+    pos = epicsAtomicGetSizeT(&sendPos_);
+    if (pos - epicsAtomicGetSizeT(&receivePos_) >= (size_t)capacity_) return false;
+    pCell = &cells_[pos & mask_];
+    sequence = epicsAtomicGetSizeT(&pCell->sequence);
+    diff = (ptrdiff_t)(sequence - pos);
+    if (diff == 0) {
+      if (epicsAtomicCmpAndSwapSizeT(&sendPos_, pos, pos+1) == pos) break;
+    } else if (diff < 0) {
+      // The cell has not been read yet
+      return false;
+    }
+    // Otherwise another thread has written this cell, try the next one
+  }
+  pCell->pArray = pArray;
+  if (pSendTime) {
+    pCell->sendTime = *pSendTime;
+  } else {
+    pCell->sendTime.secPastEpoch = 0;
+    pCell->sendTime.nsec = 0;
+  }
+  // The pointer must be visible before the sequence number which says the cell can be read
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetSizeT(&pCell->sequence, pos+1);
+  return true;
+}
+
+/** Reads an NDArray pointer from the next full cell.
+  * \return Returns false if the queue is empty. */
+bool NDArrayQueue::pop(NDArray **ppArray, epicsTimeStamp *pSendTime)
+{
+  NDArrayQueueCell_t *pCell;
+  size_t pos, sequence;
+  ptrdiff_t diff;
+
+  while (1) {
+    pos = epicsAtomicGetSizeT(&receivePos_);
+    pCell = &cells_[pos & mask_];
+    sequence = epicsAtomicGetSizeT(&pCell->sequence);
+    diff = (ptrdiff_t)(sequence - (pos+1));
+    if (diff == 0) {
+      if (epicsAtomicCmpAndSwapSizeT(&receivePos_, pos, pos+1) == pos) break;
+    } else if (diff < 0) {
+      return false;
+    }
+    // Otherwise another thread has read this cell, try the next one
+  }
+  // The compare and swap is a full barrier, so this reads the pointer written before the sequence number
+  *ppArray = pCell->pArray;
+  if (pSendTime) *pSendTime = pCell->sendTime;
+  // The loads of the cell must complete before the store of the sequence number which lets a sender write the
+  // cell again, the release which pairs with the acquire in push().  A write barrier alone only orders stores,
+  // and epicsAtomic has no load-store barrier, so the read and write barriers are used together as a full barrier.
+  epicsAtomicReadMemoryBarrier();
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetSizeT(&pCell->sequence, pos + mask_ + 1);
+  return true;
+}
+
+/** Sends an NDArray pointer to the queue if it is not full.
+  * Signals a waiting receiver, if there is one.
+  * \param[in] pArray The NDArray pointer; the queue does not change its reference count.
+  * \param[in] pSendTime The time to return to the receiver, or NULL.
+  * \return Returns false if the queue is full.
+  */
+bool NDArrayQueue::trySend(NDArray *pArray, const epicsTimeStamp *pSendTime)
+{
+  if (!push(pArray, pSendTime)) return false;
+  // The compare and swap of sendPos_ in push() is a full barrier, and so is the increment of numWaiting_
+  // in receive().  So either a receiver which is about to wait sees the new sendPos_, or this sees that
+  // the receiver is waiting.
+  if (epicsAtomicGetIntT(&numWaiting_) > 0) epicsEventSignal(event_);
+  return true;
+}
+
+/** Receives an NDArray pointer from the queue without waiting.
+  * \param[out] ppArray The NDArray pointer.
+  * \param[out] pSendTime The time passed to trySend(), or NULL.
+  * \return Returns false if the queue is empty.
+  */
+bool NDArrayQueue::tryReceive(NDArray **ppArray, epicsTimeStamp *pSendTime)
+{
+  return pop(ppArray, pSendTime);
+}
+
+/** Receives an NDArray pointer from the queue, waiting until one is sent if the queue is empty.
+  * \param[out] pSendTime The time passed to trySend(), or NULL.
+  * \return Returns the NDArray pointer.
+  */
+NDArray* NDArrayQueue::receive(epicsTimeStamp *pSendTime)
+{
+  NDArray *pArray;
+
+  while (1) {
+    if (pop(&pArray, pSendTime)) break;
+    epicsAtomicIncrIntT(&numWaiting_);
+    // Check again after saying we are waiting, a sender may not have seen numWaiting_.
+    // If an NDArray has been sent but its cell is not yet written pop() will get it next time round.
+    if (epicsAtomicGetSizeT(&sendPos_) == epicsAtomicGetSizeT(&receivePos_)) {
+      epicsEventWait(event_);
+    }
+    epicsAtomicDecrIntT(&numWaiting_);
+  }
+  // The event only remembers one signal, so if more NDArrays were sent while several threads
+  // were waiting wake another one
+  if ((epicsAtomicGetIntT(&numWaiting_) > 0) && (pending() > 0)) {
+    epicsEventSignal(event_);
+  }
+  return pArray;
+}
+
+/** Returns the number of NDArrays in the queue.
+  * This may include NDArrays which are being sent or received. */
+int NDArrayQueue::pending()
+{
+  size_t receivePos = epicsAtomicGetSizeT(&receivePos_);
+  size_t sendPos = epicsAtomicGetSizeT(&sendPos_);
+
+  // receivePos_ is read first and never passes sendPos_
+  return (int)(sendPos - receivePos);
+}
+
+/** Returns the maximum number of NDArrays in the queue */
+int NDArrayQueue::capacity()
+{
+  return capacity_;
+}
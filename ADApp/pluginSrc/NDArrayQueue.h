@@ -0,0 +1,54 @@
+#ifndef NDARRAYQUEUE_H
+#define NDARRAYQUEUE_H
+
+#include <stddef.h>
+
+#include <epicsEvent.h>
+#include <epicsTime.h>
+
+#include "NDArray.h"
+
+/** A bounded queue of NDArray pointers for any number of sending and receiving threads.
+  * Sending and receiving do not take a lock; they use epicsAtomic operations on a ring of cells,
+  * each with a sequence number that says whether it is ready to be written or read.
+  * A receiving thread only waits on an epicsEvent when the queue is empty, and a sending thread
+  * only signals the event when a receiving thread is waiting.
+  * NULL may be sent, NDPluginDriver uses it to tell its threads to exit.
+  * Each NDArray can carry the time it was sent, from which the receiver can compute how long it waited.
+  * The capacity is exact when there is one sending thread at a time, as in NDPluginDriver::driverCallback();
+  * concurrent senders may briefly exceed it, but never the number of cells.
+  */
+class epicsShareClass NDArrayQueue {
+public:
+  NDArrayQueue(int capacity);
+  ~NDArrayQueue();
+  bool trySend(NDArray *pArray, const epicsTimeStamp *pSendTime=NULL);
+  NDArray* receive(epicsTimeStamp *pSendTime=NULL);
+  bool tryReceive(NDArray **ppArray, epicsTimeStamp *pSendTime=NULL);
+  int pending();
+  int capacity();
+
+private:
+  bool push(NDArray *pArray, const epicsTimeStamp *pSendTime);
+  bool pop(NDArray **ppArray, epicsTimeStamp *pSendTime);
+
+  typedef struct {
+    size_t sequence;  /**< Equal to the position when ready to write, position+1 when ready to read */
+    NDArray *pArray;
+    epicsTimeStamp sendTime;  /**< The time passed to trySend(), 0 if none */
+  } NDArrayQueueCell_t;
+
+  NDArrayQueueCell_t *cells_;
+  size_t mask_;         /**< The number of cells, a power of 2 >= capacity_, minus 1 */
+  int capacity_;
+  epicsEventId event_;
+  /* The positions are written by different threads, so keep them in different cache lines */
+  char pad0_[64];
+  size_t sendPos_;      /**< The position of the next cell to write */
+  char pad1_[64];
+  size_t receivePos_;   /**< The position of the next cell to read */
+  char pad2_[64];
+  int numWaiting_;      /**< Number of threads waiting in receive() */
+};
+
+#endif
@@ -0,0 +1,269 @@
+/*
+ * NDFrameTrace.cpp
+ *
+ * Ring buffer of the timestamps of sampled NDArrays as they pass through the plugins,
+ * which can be written as Chrome trace event JSON.
+ *
+ * Created October 18, 2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <epicsAtomic.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <cantProceed.h>
+#include <iocsh.h>
+
+#include <epicsExport.h>
+#include "NDFrameTrace.h"
+
+static const char *driverName = "NDFrameTrace";
+
+/** NDFrameTraceSample is a global variable that enables tracing of the NDArrays processed by the plugins.
+  * The default value is 0, which traces nothing.  A value N greater than 0 traces the NDArrays whose uniqueId
+  * is a multiple of N, so 1 traces every NDArray.  It can be changed at any time. For example:
+  *   var NDFrameTraceSample 100
+  * Each plugin then records when it queues, receives, starts and finishes processing each traced NDArray,
+  * and when it passes an output NDArray downstream.  The events are written with NDFrameTraceDump.
+  */
+volatile int NDFrameTraceSample=0;
+extern "C" {epicsExportAddress(int, NDFrameTraceSample);}
+
+/** NDFrameTraceSize is a global variable that sets the number of events in the trace ring buffer.
+  * It is rounded up to a power of 2.  The ring is allocated when the first event is recorded, so this must be
+  * set before that.  The default is 65536 events, which uses about 5 MB. */
+volatile int NDFrameTraceSize=65536;
+extern "C" {epicsExportAddress(int, NDFrameTraceSize);}
+
+typedef struct {
+  size_t sequence;    /**< The position of the event plus 1, 0 while it is being written */
+  epicsTimeStamp time;
+  int uniqueId;
+  int event;          /**< NDFrameTraceEvent_t */
+  int thread;         /**< Index of the thread in threadNames */
+  char portName[ND_FRAME_TRACE_NAME_LEN];
+} traceEntry_t;
+
+static traceEntry_t *pRing;
+static size_t ringMask;
+static size_t nextPos;
+static epicsThreadOnceId traceOnce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId threadIndexId;
+static epicsMutexId threadLock;
+static std::vector<std::string> threadNames;
+
+static void traceInit(void *)
+{
+  size_t numEntries = 16;
+
+  while (numEntries < (size_t)NDFrameTraceSize) numEntries <<= 1;
+  pRing = (traceEntry_t *)callocMustSucceed(numEntries, sizeof(traceEntry_t), "NDFrameTrace::traceInit");
+  ringMask = numEntries - 1;
+  threadIndexId = epicsThreadPrivateCreate();
+  threadLock = epicsMutexMustCreate();
+}
+
+/** Returns the index of the current thread in threadNames, adding it the first time */
+static int threadIndex()
+{
+  size_t index = (size_t)epicsThreadPrivateGet(threadIndexId);
+
+  if (index == 0) {
+    epicsMutexLock(threadLock);
+    threadNames.push_back(epicsThreadGetNameSelf());
+    index = threadNames.size();
+    epicsMutexUnlock(threadLock);
+    epicsThreadPrivateSet(threadIndexId, (void *)index);
+  }
+  return (int)index - 1;
+}
+
+/** Returns true if the NDArray with this uniqueId is to be traced, see NDFrameTraceSample */
+bool NDFrameTrace::sampled(int uniqueId)
+{
+  int sample = NDFrameTraceSample;
+
+  return (sample > 0) && (uniqueId % sample == 0);
+}
+
+/** Records an event of a traced NDArray.
+  * \param[in] event The event.
+  * \param[in] portName The port name of the plugin.
+  * \param[in] uniqueId The NDArray::uniqueId.
+  * \param[in] pTime The time of the event, or NULL for the current time.
+  */
+void NDFrameTrace::record(NDFrameTraceEvent_t event, const char *portName, int uniqueId,
+                          const epicsTimeStamp *pTime)
+{
+  traceEntry_t *pEntry;
+  size_t pos;
+
+  epicsThreadOnce(&traceOnce, traceInit, NULL);
+  pos = epicsAtomicIncrSizeT(&nextPos) - 1;
+  pEntry = &pRing[pos & ringMask];
+  // A reader which sees the sequence change while it copies the entry ignores it
+  epicsAtomicSetSizeT(&pEntry->sequence, 0);
+  epicsAtomicWriteMemoryBarrier();
+  if (pTime) pEntry->time = *pTime;
+  else epicsTimeGetCurrent(&pEntry->time);
+  pEntry->uniqueId = uniqueId;
+  pEntry->event = event;
+  pEntry->thread = threadIndex();
+  strncpy(pEntry->portName, portName, sizeof(pEntry->portName)-1);
+  pEntry->portName[sizeof(pEntry->portName)-1] = 0;
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetSizeT(&pEntry->sequence, pos+1);
+}
+
+/** Empties the ring.  Events which are being recorded at the same time may be kept. */
+void NDFrameTrace::clear()
+{
+  size_t i;
+
+  epicsThreadOnce(&traceOnce, traceInit, NULL);
+  for (i=0; i<=ringMask; i++) epicsAtomicSetSizeT(&pRing[i].sequence, 0);
+}
+
+static bool earlier(const traceEntry_t &left, const traceEntry_t &right)
+{
+  if (left.time.secPastEpoch != right.time.secPastEpoch) return left.time.secPastEpoch < right.time.secPastEpoch;
+  return left.time.nsec < right.time.nsec;
+}
+
+/** Writes a string as a JSON string */
+static void writeString(FILE *fp, const char *str)
+{
+  fputc('"', fp);
+  for (; *str; str++) {
+    if ((*str == '"') || (*str == '\\')) fputc('\\', fp);
+    if ((unsigned char)*str >= ' ') fputc(*str, fp);
+  }
+  fputc('"', fp);
+}
+
+/** Writes the events in the ring as a Chrome trace event JSON object.
+  * Each thread is a row of the timeline, with the processing of each NDArray by each plugin as a span named after
+  * the plugin port.  The time each NDArray waited in the queue of each plugin is an async span, and each output
+  * NDArray an instant event.  All events have the uniqueId as an argument.  The times are in microseconds
+  * from the first event.  The events may be written while plugins are recording more.
+  * \param[in] fp The file to write to.
+  * \return Returns the number of events written. */
+int NDFrameTrace::dump(FILE *fp)
+{
+  static const char *phases[] = {"b", "e", "B", "E", "i"};
+  std::vector<traceEntry_t> entries;
+  std::vector<std::string> names;
+  std::vector<bool> threadUsed;
+  traceEntry_t entry;
+  size_t pos, endPos, startPos, sequence, i;
+  char timeString[64];
+  double ts;
+
+  epicsThreadOnce(&traceOnce, traceInit, NULL);
+  endPos = epicsAtomicGetSizeT(&nextPos);
+  startPos = (endPos > ringMask+1) ? endPos - (ringMask+1) : 0;
+  for (pos=startPos; pos<endPos; pos++) {
+    traceEntry_t *pEntry = &pRing[pos & ringMask];
+    sequence = epicsAtomicGetSizeT(&pEntry->sequence);
+    if (sequence != pos+1) continue;
+    epicsAtomicReadMemoryBarrier();
+    entry = *pEntry;
+    epicsAtomicReadMemoryBarrier();
+    if (epicsAtomicGetSizeT(&pEntry->sequence) != sequence) continue;
+    entries.push_back(entry);
+  }
+  // The events are claimed in about the order they happened, a stable sort keeps the order of equal times
+  std::stable_sort(entries.begin(), entries.end(), earlier);
+
+  epicsMutexLock(threadLock);
+  names = threadNames;
+  epicsMutexUnlock(threadLock);
+  threadUsed.resize(names.size(), false);
+  for (i=0; i<entries.size(); i++) threadUsed[entries[i].thread] = true;
+
+  fprintf(fp, "{\"traceEvents\":[\n");
+  fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"areaDetector\"}}");
+  for (i=0; i<names.size(); i++) {
+    if (!threadUsed[i]) continue;
+    fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", (int)i);
+    writeString(fp, names[i].c_str());
+    fprintf(fp, "}}");
+  }
+  for (i=0; i<entries.size(); i++) {
+    const traceEntry_t &e = entries[i];
+    ts = epicsTimeDiffInSeconds(&e.time, &entries[0].time) * 1e6;
+    fprintf(fp, ",\n{\"name\":");
+    if ((e.event == NDFrameTraceEnqueue) || (e.event == NDFrameTraceDequeue)) {
+      std::string name = std::string(e.portName) + " queue";
+      writeString(fp, name.c_str());
+      fprintf(fp, ",\"cat\":\"queue\",\"id\":%d", e.uniqueId);
+    } else if (e.event == NDFrameTraceCallback) {
+      std::string name = std::string(e.portName) + " callback";
+      writeString(fp, name.c_str());
+      fprintf(fp, ",\"cat\":\"callback\",\"s\":\"t\"");
+    } else {
+      writeString(fp, e.portName);
+      fprintf(fp, ",\"cat\":\"process\"");
+    }
+    fprintf(fp, ",\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"uniqueId\":%d}}",
+            phases[e.event], e.thread, ts, e.uniqueId);
+  }
+  fprintf(fp, "\n],\n\"displayTimeUnit\":\"ms\"");
+  if (!entries.empty()) {
+    epicsTimeToStrftime(timeString, sizeof(timeString), "%Y/%m/%d %H:%M:%S.%06f", &entries[0].time);
+    fprintf(fp, ",\n\"otherData\":{\"startTime\":\"%s\"}", timeString);
+  }
+  fprintf(fp, "\n}\n");
+  return (int)entries.size();
+}
+
+/** Writes the trace to a file, see NDFrameTrace::dump().
+  * \param[in] fileName The file to write, or NULL or "" to write to stdout.
+  * \param[in] clear If not 0 the ring is emptied after it is written.
+  */
+extern "C" int NDFrameTraceDump(const char *fileName, int clear)
+{
+  FILE *fp = stdout;
+  int numEvents;
+  static const char *functionName = "NDFrameTraceDump";
+
+  if (fileName && fileName[0]) {
+    fp = fopen(fileName, "w");
+    if (!fp) {
+      printf("%s::%s cannot open file %s\n", driverName, functionName, fileName);
+      return -1;
+    }
+  }
+  numEvents = NDFrameTrace::dump(fp);
+  if (fp != stdout) {
+    fclose(fp);
+    printf("%s::%s wrote %d events to %s\n", driverName, functionName, numEvents, fileName);
+  }
+  if (clear) NDFrameTrace::clear();
+  return 0;
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg dumpArg0 = { "fileName",iocshArgString};
+static const iocshArg dumpArg1 = { "clear",iocshArgInt};
+static const iocshArg * const dumpArgs[] = {&dumpArg0,
+                                            &dumpArg1};
+static const iocshFuncDef dumpFuncDef = {"NDFrameTraceDump",2,dumpArgs};
+static void dumpCallFunc(const iocshArgBuf *args)
+{
+  NDFrameTraceDump(args[0].sval, args[1].ival);
+}
+
+extern "C" void NDFrameTraceRegister(void)
+{
+  iocshRegister(&dumpFuncDef,dumpCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDFrameTraceRegister);
+}
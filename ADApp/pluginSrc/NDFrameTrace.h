@@ -0,0 +1,38 @@
+#ifndef NDFRAMETRACE_H
+#define NDFRAMETRACE_H
+
+#include <stdio.h>
+
+#include <epicsTime.h>
+#include <shareLib.h>
+
+/** The events which NDPluginDriver records for a traced NDArray */
+typedef enum {
+  NDFrameTraceEnqueue,       /**< driverCallback() put the NDArray on the input queue */
+  NDFrameTraceDequeue,       /**< A plugin thread received the NDArray from the queue */
+  NDFrameTraceProcessStart,  /**< processCallbacks() was called */
+  NDFrameTraceProcessEnd,    /**< processCallbacks() returned */
+  NDFrameTraceCallback       /**< The plugin passed an output NDArray to the downstream plugins */
+} NDFrameTraceEvent_t;
+
+/** Maximum length of a port name in a trace event, longer names are truncated */
+#define ND_FRAME_TRACE_NAME_LEN 40
+
+/** A ring buffer shared by all plugins of the timestamps of the NDArrays they process, see NDFrameTraceSample.
+  * Only the NDArrays whose uniqueId is a multiple of NDFrameTraceSample are traced, so every plugin traces the
+  * same NDArrays and the trace shows each of them passing through the plugin graph.
+  * Recording an event does not take a lock; each event claims the next slot with an epicsAtomic increment,
+  * and the oldest events are overwritten when the ring is full.
+  * dump() writes the events in the Chrome trace event format, which chrome://tracing and Perfetto display
+  * as a timeline with a row for each thread.
+  */
+class epicsShareClass NDFrameTrace {
+public:
+  static bool sampled(int uniqueId);
+  static void record(NDFrameTraceEvent_t event, const char *portName, int uniqueId,
+                     const epicsTimeStamp *pTime=NULL);
+  static int dump(FILE *fp);
+  static void clear();
+};
+
+#endif
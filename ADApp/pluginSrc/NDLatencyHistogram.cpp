@@ -0,0 +1,155 @@
+/*
+ * NDLatencyHistogram.cpp
+ *
+ * Histogram of latencies with logarithmic bins which threads can add to without a lock.
+ *
+ * Created October 18, 2026
+ */
+
+#include <epicsAtomic.h>
+
+#include <epicsExport.h>
+#include "NDLatencyHistogram.h"
+
+/* The number of bits in ND_LATENCY_HIST_SUB_BINS */
+#define SUB_BIN_BITS 4
+
+/* The longest latency in microseconds which is not in the last bin */
+static const double maxBinnedUs = 2147483647.;
+
+/** Constructor for NDLatencyHistogram; the histogram is empty */
+NDLatencyHistogram::NDLatencyHistogram()
+{
+  reset();
+}
+
+/** Returns the bin of a latency.
+  * \param[in] us The latency in microseconds. */
+int NDLatencyHistogram::binIndex(epicsUInt32 us)
+{
+  int msb = 0;
+  int bin;
+
+  if (us < 2*ND_LATENCY_HIST_SUB_BINS) return (int)us;
+  while ((us >> msb) > 1) msb++;
+  // The bits after the most significant bit select the sub-bin
+  bin = (msb - SUB_BIN_BITS + 1) * ND_LATENCY_HIST_SUB_BINS +
+        (int)((us >> (msb - SUB_BIN_BITS)) & (ND_LATENCY_HIST_SUB_BINS - 1));
+  if (bin >= ND_LATENCY_HIST_BINS) bin = ND_LATENCY_HIST_BINS - 1;
+  return bin;
+}
+
+/** Returns the shortest latency in microseconds in a bin */
+epicsUInt32 NDLatencyHistogram::binLowerEdge(int bin)
+{
+  int shift;
+
+  if (bin < 2*ND_LATENCY_HIST_SUB_BINS) return (epicsUInt32)bin;
+  shift = bin / ND_LATENCY_HIST_SUB_BINS - 1;
+  return (epicsUInt32)(ND_LATENCY_HIST_SUB_BINS + bin % ND_LATENCY_HIST_SUB_BINS) << shift;
+}
+
+/** Copies the lower edges of the bins in microseconds.
+  * \param[out] pEdges The lower edges.
+  * \param[in] maxBins The size of pEdges.
+  * \return Returns the number of edges copied. */
+size_t NDLatencyHistogram::getLowerEdges(epicsInt32 *pEdges, size_t maxBins)
+{
+  size_t i;
+
+  if (maxBins > ND_LATENCY_HIST_BINS) maxBins = ND_LATENCY_HIST_BINS;
+  for (i=0; i<maxBins; i++) {
+    pEdges[i] = (epicsInt32)binLowerEdge((int)i);
+  }
+  return maxBins;
+}
+
+/** Adds a latency to the histogram.
+  * \param[in] seconds The latency in seconds; negative values are counted as 0. */
+void NDLatencyHistogram::add(double seconds)
+{
+  double us = seconds * 1e6;
+  int maxUs, value;
+
+  if (!(us >= 0.)) us = 0.;
+  if (us > maxBinnedUs) us = maxBinnedUs;
+  value = (int)us;
+  epicsAtomicIncrIntT(&counts_[binIndex((epicsUInt32)value)]);
+  /* Replace the maximum unless another thread has stored a larger one */
+  maxUs = epicsAtomicGetIntT(&maxUs_);
+  while (value > maxUs) {
+    if (epicsAtomicCmpAndSwapIntT(&maxUs_, maxUs, value) == maxUs) break;
+    maxUs = epicsAtomicGetIntT(&maxUs_);
+  }
+}
+
+/** Adds the latency from pStart to pEnd to the histogram */
+void NDLatencyHistogram::add(const epicsTimeStamp *pEnd, const epicsTimeStamp *pStart)
+{
+  add(epicsTimeDiffInSeconds(pEnd, pStart));
+}
+
+/** Empties the histogram.  Latencies which are being added at the same time may be lost. */
+void NDLatencyHistogram::reset()
+{
+  int i;
+
+  for (i=0; i<ND_LATENCY_HIST_BINS; i++) epicsAtomicSetIntT(&counts_[i], 0);
+  epicsAtomicSetIntT(&maxUs_, 0);
+}
+
+/** Returns the number of latencies in the histogram */
+int NDLatencyHistogram::count()
+{
+  int total = 0;
+  int i;
+
+  for (i=0; i<ND_LATENCY_HIST_BINS; i++) total += epicsAtomicGetIntT(&counts_[i]);
+  return total;
+}
+
+/** Copies the number of latencies in each bin.
+  * \param[out] pCounts The counts.
+  * \param[in] maxBins The size of pCounts.
+  * \return Returns the number of bins copied. */
+size_t NDLatencyHistogram::getCounts(epicsInt32 *pCounts, size_t maxBins)
+{
+  size_t i;
+
+  if (maxBins > ND_LATENCY_HIST_BINS) maxBins = ND_LATENCY_HIST_BINS;
+  for (i=0; i<maxBins; i++) pCounts[i] = epicsAtomicGetIntT(&counts_[i]);
+  return maxBins;
+}
+
+/** Computes the percentiles and maximum of the latencies in microseconds, see NDLatencyPercentile_t.
+  * A percentile is the upper edge of the bin which contains it, so it is at most 1/ND_LATENCY_HIST_SUB_BINS
+  * too long, and is never more than the maximum.  All values are 0 if the histogram is empty.
+  * \param[out] pValues The values.
+  * \param[in] maxValues The size of pValues.
+  * \return Returns the number of values copied. */
+size_t NDLatencyHistogram::getPercentiles(epicsInt32 *pValues, size_t maxValues)
+{
+  static const double fractions[NDLatencyMax] = {0.50, 0.95, 0.99};
+  epicsInt32 counts[ND_LATENCY_HIST_BINS];
+  epicsInt32 values[ND_LATENCY_NUM_PERCENTILES];
+  double total = 0., sum;
+  int maxUs = epicsAtomicGetIntT(&maxUs_);
+  int bin, i;
+  size_t n;
+
+  getCounts(counts, ND_LATENCY_HIST_BINS);
+  for (bin=0; bin<ND_LATENCY_HIST_BINS; bin++) total += counts[bin];
+  for (i=0; i<NDLatencyMax; i++) {
+    values[i] = 0;
+    if (total == 0.) continue;
+    for (bin=0, sum=0.; bin<ND_LATENCY_HIST_BINS-1; bin++) {
+      sum += counts[bin];
+      if (sum >= fractions[i] * total) break;
+    }
+    values[i] = (bin < ND_LATENCY_HIST_BINS-1) ? (epicsInt32)binLowerEdge(bin+1) - 1 : maxUs;
+    if (values[i] > maxUs) values[i] = maxUs;
+  }
+  values[NDLatencyMax] = maxUs;
+  for (n=0; (n<maxValues) && (n<ND_LATENCY_NUM_PERCENTILES); n++) pValues[n] = values[n];
+  return n;
+}
@@ -0,0 +1,46 @@
+#ifndef NDLATENCYHISTOGRAM_H
+#define NDLATENCYHISTOGRAM_H
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <shareLib.h>
+
+/** Number of linear sub-bins in each power of 2 of an NDLatencyHistogram */
+#define ND_LATENCY_HIST_SUB_BINS 16
+/** Number of bins of an NDLatencyHistogram.  Times of less than 2*ND_LATENCY_HIST_SUB_BINS microseconds have
+  * a bin for each microsecond.  Each longer power of 2 is divided into ND_LATENCY_HIST_SUB_BINS bins, so a bin is
+  * never more than 1/ND_LATENCY_HIST_SUB_BINS of its lower edge wide.  The last bin counts all times longer than
+  * 31*2^22 microseconds (130 seconds). */
+#define ND_LATENCY_HIST_BINS 384
+
+/** The elements of the array returned by NDLatencyHistogram::getPercentiles() */
+typedef enum {
+  NDLatencyP50,
+  NDLatencyP95,
+  NDLatencyP99,
+  NDLatencyMax,
+  ND_LATENCY_NUM_PERCENTILES
+} NDLatencyPercentile_t;
+
+/** A histogram of latencies in microseconds with logarithmic bins, in the style of HdrHistogram.
+  * add() only uses epicsAtomic operations, so any number of threads can add to the histogram while others read it.
+  */
+class epicsShareClass NDLatencyHistogram {
+public:
+  NDLatencyHistogram();
+  void add(double seconds);
+  void add(const epicsTimeStamp *pEnd, const epicsTimeStamp *pStart);
+  void reset();
+  int count();
+  size_t getCounts(epicsInt32 *pCounts, size_t maxBins);
+  size_t getPercentiles(epicsInt32 *pValues, size_t maxValues);
+  static int binIndex(epicsUInt32 us);
+  static epicsUInt32 binLowerEdge(int bin);
+  static size_t getLowerEdges(epicsInt32 *pEdges, size_t maxBins);
+
+private:
+  int counts_[ND_LATENCY_HIST_BINS];
+  int maxUs_;   /**< The longest latency added since the last reset, in microseconds */
+};
+
+#endif
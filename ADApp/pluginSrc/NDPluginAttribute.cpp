@@ -56,7 +56,6 @@ void NDPluginAttribute::processCallbacks(NDArray *pArray)
   int TSAcquiring;
   double valueSum;
   int i;
-  char attrName[MAX_ATTR_NAME_] = {0};
   NDAttribute *pAttribute = NULL;
   NDAttributeList *pAttrList = NULL;
   epicsFloat64 attrValue = 0.0;
@@ -74,29 +73,30 @@ void NDPluginAttribute::processCallbacks(NDArray *pArray)
   getIntegerParam(NDPluginAttributeTSAcquiring,    &TSAcquiring);
 
   for (i=0; i<maxAttributes_; i++) {
-    getStringParam(i, NDPluginAttributeAttrName, MAX_ATTR_NAME_, attrName);
+    /* The keys were looked up when the attribute names were written, so there is no string handling here */
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "Finding attribute %d, key %d\n", i, attrKeys_[i].id);
 
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "Finding the attribute %s\n", attrName);
-
-    if (strcmp(attrName, UNIQUE_ID_NAME_) == 0) {
+    if (attrKeys_[i].id < 0) {
+      continue;
+    } else if (attrKeys_[i].id == uniqueIdKey_.id) {
       attrValue = (epicsFloat64) pArray->uniqueId;
-    } else if (strcmp(attrName, TIMESTAMP_NAME_) == 0) {
+    } else if (attrKeys_[i].id == timeStampKey_.id) {
       attrValue = pArray->timeStamp;
-    } else if (strcmp(attrName, EPICS_TS_SEC_NAME_) == 0) {
+    } else if (attrKeys_[i].id == epicsTSSecKey_.id) {
       attrValue = (epicsFloat64)pArray->epicsTS.secPastEpoch;
-    } else if (strcmp(attrName, EPICS_TS_NSEC_NAME_) == 0) {
+    } else if (attrKeys_[i].id == epicsTSNsecKey_.id) {
       attrValue = (epicsFloat64)pArray->epicsTS.nsec;
     } else {
-      pAttribute = pAttrList->find(attrName);
+      pAttribute = pAttrList->find(attrKeys_[i]);
       if (pAttribute) {
         status = pAttribute->getValue(NDAttrFloat64, &attrValue);
         if (status != asynSuccess) {
-          asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: Error reading value for NDAttribute %s. \n", functionName, attrName);
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: Error reading value for NDAttribute %s. \n", functionName, pAttribute->getName());
           continue;
         }
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "Attribute %s value is %f\n", attrName, attrValue);
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "Attribute %s value is %f\n", pAttribute->getName(), attrValue);
       } else {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: Error finding NDAttribute %s. \n", functionName, attrName);
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s: Error finding NDAttribute %d. \n", functionName, i);
         continue;
       }
     }
@@ -207,6 +207,28 @@ asynStatus NDPluginAttribute::writeInt32(asynUser *pasynUser, epicsInt32 value)
   return status;
 }
 
+/** Called when asyn clients call pasynOctet->write().
+  * Calls NDPluginDriver::writeOctet() and looks up the key of the attribute when
+  * NDPluginAttributeAttrName is written, so processCallbacks() does not use the name.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Address of the string to write.
+  * \param[in] nChars Number of characters to write.
+  * \param[out] nActual Number of characters actually written. */
+asynStatus NDPluginAttribute::writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual)
+{
+  int function = pasynUser->reason;
+  int addr = 0;
+  asynStatus status = asynSuccess;
+
+  status = NDPluginDriver::writeOctet(pasynUser, value, nChars, nActual);
+  if ((status == asynSuccess) && (function == NDPluginAttributeAttrName)) {
+    getAddress(pasynUser, &addr);
+    attrKeys_[addr] = NDAttributeList::getKey(value);
+    setAttributesUsed(false, std::vector<NDAttributeKey>(attrKeys_, attrKeys_ + maxAttributes_));
+  }
+  return status;
+}
+
 
 /** Constructor for NDPluginAttribute; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
   *
@@ -257,6 +279,12 @@ NDPluginAttribute::NDPluginAttribute(const char *portName, int queueSize, int bl
   /* Set the plugin type string */
   setStringParam(NDPluginDriverPluginType, "NDPluginAttribute");
 
+  uniqueIdKey_    = NDAttributeList::getKey(UNIQUE_ID_NAME_);
+  timeStampKey_   = NDAttributeList::getKey(TIMESTAMP_NAME_);
+  epicsTSSecKey_  = NDAttributeList::getKey(EPICS_TS_SEC_NAME_);
+  epicsTSNsecKey_ = NDAttributeList::getKey(EPICS_TS_NSEC_NAME_);
+  attrKeys_ = new NDAttributeKey[maxAttributes_];
+
   setIntegerParam(NDPluginAttributeTSNumPoints, DEFAULT_NUM_TSPOINTS);
   pTSArray_ = static_cast<epicsFloat64 **>(calloc(maxAttributes_, sizeof(epicsFloat64 *)));
   if (pTSArray_ == NULL) {
@@ -268,6 +296,7 @@ NDPluginAttribute::NDPluginAttribute(const char *portName, int queueSize, int bl
     setDoubleParam(i, NDPluginAttributeVal, 0.0);
     setDoubleParam(i, NDPluginAttributeValSum, 0.0);
     setStringParam(i, NDPluginAttributeAttrName, "");
+    attrKeys_[i] = NDAttributeList::getKey("");
     if (pTSArray_[i] == NULL) {
       perror(functionName);
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s: Error from calloc for pTSArray_.\n", functionName);
@@ -279,6 +308,9 @@ NDPluginAttribute::NDPluginAttribute(const char *portName, int queueSize, int bl
   // This plugin currently does not do array callbacks, so make the setting reflect the behavior
   setIntegerParam(NDArrayCallbacks, 0);
 
+  /* This plugin only reads the attributes named by NDPluginAttributeAttrName */
+  setAttributesUsed(false);
+
   /* Try to connect to the array port */
   connectToArrayPort();
 
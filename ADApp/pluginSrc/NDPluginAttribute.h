@@ -27,6 +27,7 @@ public:
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
 
 protected:
     int NDPluginAttributeAttrName;
@@ -51,6 +52,11 @@ private:
 
     int maxAttributes_;
     epicsFloat64 **pTSArray_;
+    NDAttributeKey *attrKeys_;      /**< Keys of the attribute names, indexed by asyn address */
+    NDAttributeKey uniqueIdKey_;
+    NDAttributeKey timeStampKey_;
+    NDAttributeKey epicsTSSecKey_;
+    NDAttributeKey epicsTSNsecKey_;
 
 };
     
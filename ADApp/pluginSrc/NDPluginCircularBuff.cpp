@@ -34,7 +34,6 @@ static const char *driverName="NDPluginCircularBuff";
 asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
 {
     NDAttribute *trigger;
-    char triggerString[256];
     double triggerValue;
     double calcResult;
     int status;
@@ -55,16 +54,14 @@ asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
     triggerCalcArgs_[4] = currentImage;
     triggerCalcArgs_[5] = triggered;
 
-    getStringParam(NDCircBuffTriggerA, sizeof(triggerString), triggerString);
-    trigger = pArray->pAttributeList->find(triggerString);
+    trigger = pArray->pAttributeList->find(triggerAKey_);
     if (trigger != NULL) {
         status = trigger->getValue(NDAttrFloat64, &triggerValue);
         if (status == asynSuccess) {
             triggerCalcArgs_[0] = triggerValue;
         }
     }
-    getStringParam(NDCircBuffTriggerB, sizeof(triggerString), triggerString);
-    trigger = pArray->pAttributeList->find(triggerString);
+    trigger = pArray->pAttributeList->find(triggerBKey_);
     if (trigger != NULL) {
         status = trigger->getValue(NDAttrFloat64, &triggerValue);
         if (status == asynSuccess) {
@@ -141,8 +138,14 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
         }
       }
 
-      // First copy the buffer into our buffer pool so we can release the resource on the driver
-      pArrayCpy = this->pNDArrayPool->copy(pArray, NULL, 1);
+      // First copy the buffer into our buffer pool so we can release the resource on the driver.
+      // If the driver pool is not limited then holding its buffers cannot stall the driver,
+      // so keep the array (or a view of it if other plugins are using it) and don't copy the data.
+      if ((pArray->pNDArrayPool->maxBuffers() <= 0) && (pArray->pNDArrayPool->maxMemory() == 0)) {
+        pArrayCpy = NDPluginDriver::makeWritable(pArray, false);
+      } else {
+        pArrayCpy = this->pNDArrayPool->copy(pArray, NULL, 1);
+      }
 
       if (pArrayCpy){
 
@@ -338,6 +341,16 @@ asynStatus NDPluginCircularBuff::writeOctet(asynUser *pasynUser, const char *val
     }
   } 
   
+  else if ((function == NDCircBuffTriggerA) || (function == NDCircBuffTriggerB)) {
+    // Look up the attribute key here rather than the name for each array
+    if (function == NDCircBuffTriggerA) triggerAKey_ = NDAttributeList::getKey(value);
+    else                                triggerBKey_ = NDAttributeList::getKey(value);
+    std::vector<NDAttributeKey> keys;
+    keys.push_back(triggerAKey_);
+    keys.push_back(triggerBKey_);
+    setAttributesUsed(false, keys);
+  }
+
   else if (function < FIRST_NDPLUGIN_CIRC_BUFF_PARAM) {
       /* If this parameter belongs to a base class call its method */
       status = NDPluginDriver::writeOctet(pasynUser, value, nChars, nActual);
@@ -391,6 +404,8 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
 {
     //const char *functionName = "NDPluginCircularBuff";
     preBuffer_ = NULL;
+    triggerAKey_ = NDAttributeList::getKey(NULL);
+    triggerBKey_ = NDAttributeList::getKey(NULL);
 
     maxBuffers_ = maxBuffers;
 
@@ -437,6 +452,9 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
     setIntegerParam(NDArrayCallbacks, 1);
 
+    // This plugin only reads the TriggerA and TriggerB attributes
+    setAttributesUsed(false);
+
     // Try to connect to the array port
     connectToArrayPort();
 }
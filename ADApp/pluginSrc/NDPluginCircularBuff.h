@@ -73,6 +73,8 @@ private:
     char triggerCalcInfix_[MAX_INFIX_SIZE];
     char triggerCalcPostfix_[MAX_POSTFIX_SIZE];
     double triggerCalcArgs_[CALCPERFORM_NARGS];
+    NDAttributeKey triggerAKey_;
+    NDAttributeKey triggerBKey_;
 };
     
 #endif
@@ -62,9 +62,9 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
     NDAttribute *pAttribute;
      
     getIntegerParam(NDPluginColorConvertColorModeOut, (int *)&colorModeOut);
-    pAttribute = pArray->pAttributeList->find("ColorMode");
+    pAttribute = pArray->pAttributeList->find(colorModeKey_);
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
-    pAttribute = pArray->pAttributeList->find("BayerPattern");
+    pAttribute = pArray->pAttributeList->find(bayerPatternKey_);
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &bayerPattern);
     
     /* if we have int8 data then check for false color */
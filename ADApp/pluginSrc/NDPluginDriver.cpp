@@ -12,8 +12,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <math.h>
 
 #include <epicsTypes.h>
+#include <epicsAtomic.h>
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
 #include <epicsEvent.h>
@@ -25,15 +27,19 @@
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
 
+/* The decisions of autoScale() */
 typedef enum {
-    ToThreadMessageData,
-    ToThreadMessageExit
-} ToThreadMessageType_t;
-
-typedef struct {
-    ToThreadMessageType_t messageType;
-    NDArray *pArray;    
-} ToThreadMessage_t;
+    AutoScaleHold,
+    AutoScaleGrow,
+    AutoScaleShrink
+} AutoScaleAction_t;
+
+/* When the plugin is falling behind it grows to keep its threads at most this busy */
+static const double autoScaleGrowBusy = 0.8;
+/* It only shrinks by one thread if the remaining threads would have been less than this busy ... */
+static const double autoScaleShrinkBusy = 0.6;
+/* ... for this many consecutive periods */
+static const int autoScaleShrinkPeriods = 3;
 
 typedef enum {
     FromThreadMessageEnter,
@@ -50,6 +56,27 @@ static const char *driverName="NDPluginDriver";
 sortedListElement::sortedListElement(NDArray *pArray, epicsTimeStamp time)
     : pArray_(pArray), insertionTime_(time) {}
 
+/* The NDArray whose queue reference is owned by the processCallbacks() running in this thread */
+static epicsThreadOnceId ownedArrayOnce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId ownedArrayId;
+
+static void ownedArrayInit(void *)
+{
+    ownedArrayId = epicsThreadPrivateCreate();
+}
+
+static NDArray* getOwnedArray()
+{
+    epicsThreadOnce(&ownedArrayOnce, ownedArrayInit, NULL);
+    return (NDArray *)epicsThreadPrivateGet(ownedArrayId);
+}
+
+static void setOwnedArray(NDArray *pArray)
+{
+    epicsThreadOnce(&ownedArrayOnce, ownedArrayInit, NULL);
+    epicsThreadPrivateSet(ownedArrayId, pArray);
+}
+
 static void sortingTaskC(void *drvPvt)
 {
     NDPluginDriver *pPvt = (NDPluginDriver *)drvPvt;
@@ -94,12 +121,23 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
           interruptMask | asynInt32Mask | asynFloat64Mask | asynOctetMask | asynInt32ArrayMask,
           asynFlags, autoConnect, priority, stackSize),
     pPrevInputArray_(0),
+    acceptsStridedArrays_(false),
+    numThreads_(0),
     pluginStarted_(false),
     firstOutputArray_(true),
-    pToThreadMsgQ_(NULL),
+    pToThreadQueue_(NULL),
     pFromThreadMsgQ_(NULL),
+    pExecutor_(NULL),
+    numExecutorTasks_(0),
+    numRunningTasks_(0),
+    numSorted_(0),
     prevUniqueId_(-1000),
-    sortingThreadId_(0)  
+    sortingThreadId_(0),
+    sortingThreadExit_(false),
+    pArrayPortDriver_(NULL),
+    pUpstreamPlugin_(NULL),
+    outputCallbackThread_(NULL),
+    usesAllAttributes_(true)
 {
     asynUser *pasynUser;
     //static const char *functionName = "NDPluginDriver";
@@ -109,10 +147,16 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     /* Initialize some members to 0 */
     memset(&this->lastProcessTime_, 0, sizeof(this->lastProcessTime_));
     memset(&this->dimsPrev_, 0, sizeof(this->dimsPrev_));
+    resetAutoScale(&this->lastProcessTime_);
+    this->autoScaleShrinkCount_ = 0;
+    this->sortingEvent_ = epicsEventCreate(epicsEventEmpty);
+    this->sortingExitEvent_ = epicsEventCreate(epicsEventEmpty);
     this->pasynGenericPointer_ = NULL;
     this->asynGenericPointerPvt_ = NULL;
     this->asynGenericPointerInterruptPvt_ = NULL;
     this->connectedToArrayPort_ = false;
+    this->colorModeKey_ = NDAttributeList::getKey("ColorMode");
+    this->bayerPatternKey_ = NDAttributeList::getKey("BayerPattern");
     
     if (maxThreads < 1) maxThreads = 1;
     
@@ -138,9 +182,23 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     createParam(NDPluginDriverDroppedOutputArraysString,  asynParamInt32, &NDPluginDriverDroppedOutputArrays);
     createParam(NDPluginDriverEnableCallbacksString,   asynParamInt32, &NDPluginDriverEnableCallbacks);
     createParam(NDPluginDriverBlockingCallbacksString, asynParamInt32, &NDPluginDriverBlockingCallbacks);
+    createParam(NDPluginDriverFusedString,             asynParamInt32, &NDPluginDriverFused);
     createParam(NDPluginDriverProcessPluginString,     asynParamInt32, &NDPluginDriverProcessPlugin);
     createParam(NDPluginDriverExecutionTimeString,     asynParamFloat64, &NDPluginDriverExecutionTime);
     createParam(NDPluginDriverMinCallbackTimeString,   asynParamFloat64, &NDPluginDriverMinCallbackTime);
+    createParam(NDPluginDriverAutoScaleString,         asynParamInt32, &NDPluginDriverAutoScale);
+    createParam(NDPluginDriverAutoScalePeriodString,   asynParamFloat64, &NDPluginDriverAutoScalePeriod);
+    createParam(NDPluginDriverArrivalRateString,       asynParamFloat64, &NDPluginDriverArrivalRate);
+    createParam(NDPluginDriverThreadLoadString,        asynParamFloat64, &NDPluginDriverThreadLoad);
+    createParam(NDPluginDriverAutoScaleActionString,   asynParamInt32, &NDPluginDriverAutoScaleAction);
+    createParam(NDPluginDriverLatencyResetString,      asynParamInt32, &NDPluginDriverLatencyReset);
+    createParam(NDPluginDriverLatencyHistBinsString,   asynParamInt32Array, &NDPluginDriverLatencyHistBins);
+    createParam(NDPluginDriverQueueWaitHistString,     asynParamInt32Array, &NDPluginDriverQueueWaitHist);
+    createParam(NDPluginDriverQueueWaitPercentilesString, asynParamInt32Array, &NDPluginDriverQueueWaitPercentiles);
+    createParam(NDPluginDriverProcessHistString,       asynParamInt32Array, &NDPluginDriverProcessHist);
+    createParam(NDPluginDriverProcessPercentilesString, asynParamInt32Array, &NDPluginDriverProcessPercentiles);
+    createParam(NDPluginDriverEndToEndHistString,      asynParamInt32Array, &NDPluginDriverEndToEndHist);
+    createParam(NDPluginDriverEndToEndPercentilesString, asynParamInt32Array, &NDPluginDriverEndToEndPercentiles);
 
     /* Here we set the values of read-only parameters and of read/write parameters that cannot
      * or should not get their values from the database.  Note that values set here will override
@@ -157,6 +215,13 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     setIntegerParam(NDPluginDriverMaxThreads, maxThreads);
     setIntegerParam(NDPluginDriverNumThreads, 1);
     setIntegerParam(NDPluginDriverBlockingCallbacks, blockingCallbacks);
+    setIntegerParam(NDPluginDriverFused, 0);
+    setIntegerParam(NDPluginDriverAutoScale, 0);
+    setDoubleParam (NDPluginDriverAutoScalePeriod, 1.0);
+    setDoubleParam (NDPluginDriverArrivalRate, 0.);
+    setDoubleParam (NDPluginDriverThreadLoad, 0.);
+    setIntegerParam(NDPluginDriverAutoScaleAction, AutoScaleHold);
+    setIntegerParam(NDPluginDriverLatencyReset, 0);
     
     /* Create the callback threads, unless blocking callbacks are disabled with
      * the blockingCallbacks argument here. Even then, if they are enabled
@@ -177,6 +242,16 @@ NDPluginDriver::~NDPluginDriver()
   // mutex must be unlocked before deleting it.
   this->lock();
   deleteCallbackThreads();
+  // Stop the sorting thread before releasing the arrays in the sort ring which it outputs
+  if (deleteSortingThread() == asynSuccess) {
+    epicsEventDestroy(sortingEvent_);
+    epicsEventDestroy(sortingExitEvent_);
+  }
+  for (size_t i=0; i<sortRing_.size(); i++) {
+    if (sortRing_[i].pArray_) sortRing_[i].pArray_->release();
+  }
+  sortRing_.clear();
+  numSorted_ = 0;
   this->unlock();
 }
 
@@ -196,9 +271,9 @@ NDPluginDriver::~NDPluginDriver()
     int colorMode=NDColorModeMono, bayerPattern=NDBayerRGGB;
     //static const char *functionName="beginProcessCallbacks";
 
-    pAttribute = pArray->pAttributeList->find("ColorMode");
+    pAttribute = pArray->pAttributeList->find(colorModeKey_);
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
-    pAttribute = pArray->pAttributeList->find("BayerPattern");
+    pAttribute = pArray->pAttributeList->find(bayerPatternKey_);
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &bayerPattern);
     
     getIntegerParam(NDArrayCounter, &arrayCounter);
@@ -239,8 +314,10 @@ NDPluginDriver::~NDPluginDriver()
   * \param[in] readAttributes This flag must be true if the derived class has not yet called readAttributes() for pArray.
   *
   * This method does NDArray callbacks to downstream plugins if NDArrayCallbacks is true and SortMode is Unsorted.
-  * If SortMode is sorted it inserts the NDArray into the std::multilist for callbacks in SortThread(). 
-  * It keeps track of DisorderedArrays and DroppedOutputArrays. 
+  * If SortMode is Sorted it does the callbacks at once if the NDArray is the next one in uniqueId order,
+  * followed by any NDArrays in the sort ring which follow it.  Otherwise it adds the NDArray to the sort ring,
+  * where it waits for the NDArrays before it for at most SortTime, see sortingTask().
+  * It keeps track of DisorderedArrays. 
   * It caches the most recent NDArray in pArrays[0]. */ 
 asynStatus NDPluginDriver::endProcessCallbacks(NDArray *pArray, bool copyArray, bool readAttributes)
 {
@@ -261,7 +338,8 @@ asynStatus NDPluginDriver::endProcessCallbacks(NDArray *pArray, bool copyArray,
 
     getIntegerParam(NDPluginDriverSortMode, &callbacksSorted);
     if (copyArray) {
-        pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 1);
+        // Only the attributes are changed, so the data are not copied
+        pArrayOut = makeWritable(pArray, false);
     }
     if (NULL != pArrayOut) {
         if (readAttributes) {
@@ -277,44 +355,63 @@ asynStatus NDPluginDriver::endProcessCallbacks(NDArray *pArray, bool copyArray,
         return asynError;
     }
     if (callbacksSorted) {
-        int sortSize;
-        int listSize = (int)sortedNDArrayList_.size();
+        int sortSize = 0;
+        int slot;
         getIntegerParam(NDPluginDriverSortSize, &sortSize);
-        setIntegerParam(NDPluginDriverSortFree, sortSize-listSize);
-        if (listSize >= sortSize) {
-            int droppedOutputArrays;
-            getIntegerParam(NDPluginDriverDroppedOutputArrays, &droppedOutputArrays);
-            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, 
-                "%s::%s std::multilist size exceeded, dropped array uniqueId=%d\n",
-                driverName, functionName, pArrayOut->uniqueId);
-            droppedOutputArrays++;
-            setIntegerParam(NDPluginDriverDroppedOutputArrays, droppedOutputArrays);
+        if (sortSize < 1) sortSize = 1;
+        if (sortSize != (int)sortRing_.size()) resizeSortRing(sortSize);
+        // This is the next array, or it is late and waiting would not put it in order
+        bool outputNow = !firstOutputArray_ && (pArrayOut->uniqueId <= prevUniqueId_+1);
+        slot = sortSlot(pArrayOut->uniqueId);
+        if (!outputNow && sortRing_[slot].pArray_) {
+            // The slot is in use so the ring is full, stop waiting for the arrays before the one in the slot
+            while (sortRing_[slot].pArray_) {
+                outputSortedArray(lowestSortedSlot());
+                outputNextSortedArrays();
+            }
+            outputNow = (pArrayOut->uniqueId <= prevUniqueId_+1);
+        }
+        if (outputNow) {
+            doOutputCallbacks(pArrayOut);
+            outputNextSortedArrays();
         } else {
-            epicsTimeStamp now;
-            epicsTimeGetCurrent(&now);
             pArrayOut->reserve();
-            sortedListElement *pListElement = new sortedListElement(pArrayOut, now);
-            sortedNDArrayList_.insert(*pListElement);
+            epicsTimeGetCurrent(&sortRing_[slot].insertionTime_);
+            sortRing_[slot].pArray_ = pArrayOut;
+            if (numSorted_++ == 0) epicsEventSignal(sortingEvent_);
         }
+        setIntegerParam(NDPluginDriverSortFree, sortSize-numSorted_);
     } else {
-        doCallbacksGenericPointer(pArrayOut, NDArrayData, 0);
-        bool orderOK = (pArrayOut->uniqueId == prevUniqueId_)   ||
-                       (pArrayOut->uniqueId == prevUniqueId_+1);
-        if (!firstOutputArray_ && !orderOK) {
-            int disorderedArrays;
-            getIntegerParam(NDPluginDriverDisorderedArrays, &disorderedArrays);
-            disorderedArrays++;
-            setIntegerParam(NDPluginDriverDisorderedArrays, disorderedArrays);
-            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, 
-                "%s::%s disordered array found uniqueId=%d, prevUniqueId_=%d, orderOK=%d, disorderedArrays=%d\n",
-                driverName, functionName, pArrayOut->uniqueId, prevUniqueId_, orderOK, disorderedArrays);
-        }
-        firstOutputArray_ = false;
-        prevUniqueId_ = pArrayOut->uniqueId;
+        doOutputCallbacks(pArrayOut);
     }
     return asynSuccess;
 }
 
+/** Returns a version of an NDArray which processCallbacks() may modify, see NDArrayPool::makeWritable().
+  * This method must be called with the lock held.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[in] copyData This flag should be true if the data will be modified, and false if only the
+  *            attributes or other fields of the NDArray will be modified.
+  * \return The NDArray to modify, which the caller must release, or NULL if it could not be allocated.
+  *
+  * The references to pArray held by this plugin (the queue reference and pPrevInputArray_) are not
+  * counted as other users of pArray, so if no downstream plugin or driver holds pArray it is returned
+  * rather than a copy.  If the data of pArray will be modified in place then it is no longer
+  * saved for ProcessPlugin. */
+NDArray* NDPluginDriver::makeWritable(NDArray *pArray, bool copyData)
+{
+    NDArray *pArrayOut;
+    int numOwned = 0;
+
+    if (getOwnedArray() == pArray) numOwned++;
+    if (pPrevInputArray_ == pArray) numOwned++;
+    pArrayOut = this->pNDArrayPool->makeWritable(pArray, numOwned, copyData);
+    if (copyData && (pArrayOut == pArray) && (pPrevInputArray_ == pArray)) {
+        pPrevInputArray_->release();
+        pPrevInputArray_ = 0;
+    }
+    return pArrayOut;
+}
 
 extern "C" {static void driverCallback(void *drvPvt, asynUser *pasynUser, void *genericPointer)
 {
@@ -327,6 +424,9 @@ extern "C" {static void driverCallback(void *drvPvt, asynUser *pasynUser, void *
   * derived class.
   * It can either do the callbacks directly (if NDPluginDriverBlockingCallbacks=1) or by queueing
   * the arrays to be processed by a background task (if NDPluginDriverBlockingCallbacks=0).
+  * If NDPluginDriverFused=1 and the arrays come from another plugin they are also processed directly,
+  * in the thread of that plugin, so a chain of plugins runs without queueing between them.
+  * The upstream plugin's lock is released while they are processed.
   * In the latter case arrays can be dropped if the queue is full.  This method should really
   * be private, but it must be called from a C-linkage callback function, so it must be public.
   * \param[in] pasynUser  The pasynUser from the asyn client.
@@ -335,18 +435,26 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
 {
      
     NDArray *pArray = (NDArray *)genericPointer;
-    epicsTimeStamp tNow, tEnd;
+    epicsTimeStamp tNow, tEnd, arrayTime;
     double minCallbackTime, deltaTime;
     int status=0;
     int blockingCallbacks;
+    int fused;
+    int autoScaleEnabled;
     int droppedArrays, queueSize, queueFree;
     bool ignoreQueueFull = false;
+    bool contiguousCopy = false;
+    NDArray *pInput = pArray;
+    NDPluginDriver *pUpstream = NULL;
+    int uniqueId = pArray->uniqueId;
+    bool traced = NDFrameTrace::sampled(uniqueId);
     static const char *functionName = "driverCallback";
 
     this->lock();
 
     status |= getDoubleParam(NDPluginDriverMinCallbackTime, &minCallbackTime);
     status |= getIntegerParam(NDPluginDriverBlockingCallbacks, &blockingCallbacks);
+    status |= getIntegerParam(NDPluginDriverFused, &fused);
     status |= getIntegerParam(NDPluginDriverQueueSize, &queueSize);
     
     epicsTimeGetCurrent(&tNow);
@@ -362,25 +470,66 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
          * If blocking we call processCallbacks directly, executing them
          * in the detector callback thread.
          * If non-blocking we put the array on the queue and it executes
-         * in our background thread. */
+         * in our background thread.
+         * A fused plugin whose arrays come from another plugin is called from that plugin's processing
+         * thread, so it also calls processCallbacks directly.  The array is still in that thread's caches,
+         * and there is no queue or thread wake-up between the two plugins. */
         /* Update the time we last posted an array */
         epicsTimeGetCurrent(&tNow);
         memcpy(&this->lastProcessTime_, &tNow, sizeof(tNow));
-        if (blockingCallbacks) {
-            processCallbacks(pArray);
+        if (blockingCallbacks || (fused && pUpstreamPlugin_)) {
+            arrayTime = pArray->epicsTS;
+            if (fused && pUpstreamPlugin_) {
+                /* Release the lock of the upstream plugin while we process, as if the array had been queued.
+                 * The reservation keeps the array valid until the upstream plugin has the lock again. */
+                pUpstream = pUpstreamPlugin_;
+                pInput->reserve();
+                if (!pUpstream->unlockForFusedCallback()) {
+                    pInput->release();
+                    pUpstream = NULL;
+                }
+            }
+            /* If the array is a view whose data is not contiguous and this plugin cannot handle that
+             * then use a contiguous copy */
+            if (!acceptsStridedArrays_ && !pArray->isContiguous()) {
+                pArray = pArray->pNDArrayPool->makeContiguous(pArray);
+                contiguousCopy = true;
+            }
+            if (pArray) {
+                /* The driver owns pArray unless it is our contiguous copy.  This may be called from the
+                 * processCallbacks() of an upstream plugin in the same thread, so restore its owned array. */
+                NDArray *pPrevOwned = getOwnedArray();
+                setOwnedArray(contiguousCopy ? pArray : NULL);
+                if (traced) NDFrameTrace::record(NDFrameTraceProcessStart, portName, uniqueId, &tNow);
+                processCallbacks(pArray);
+                setOwnedArray(pPrevOwned);
+                if (contiguousCopy) pArray->release();
+            } else {
+                asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                    "%s::%s error allocating contiguous copy of array\n",
+                    driverName, functionName);
+            }
             epicsTimeGetCurrent(&tEnd);
             setDoubleParam(NDPluginDriverExecutionTime, epicsTimeDiffInSeconds(&tEnd, &tNow)*1e3);
+            addLatencies(&arrayTime, &tNow, &tEnd);
+            if (traced) NDFrameTrace::record(NDFrameTraceProcessEnd, portName, uniqueId, &tEnd);
         } else {
             /* Increase the reference count again on this array
              * It will be released in the background task when processing is done */
             pArray->reserve();
-            /* Try to put this array on the message queue.  If there is no room then return
+            /* Try to put this array on the queue.  If there is no room then return
              * immediately. */
-            ToThreadMessage_t msg = {ToThreadMessageData, pArray};
-            status = pToThreadMsgQ_->trySend(&msg, sizeof(msg));
-            queueFree = queueSize - pToThreadMsgQ_->pending();
+            bool queued = pToThreadQueue_->trySend(pArray, &tNow);
+            /* pArray may already have been processed and released by a plugin thread */
+            if (queued && traced) NDFrameTrace::record(NDFrameTraceEnqueue, portName, uniqueId, &tNow);
+            queueFree = queueSize - pToThreadQueue_->pending();
             setIntegerParam(NDPluginDriverQueueFree, queueFree);
-            if (status) {
+            autoScaleArrivals_++;
+            if (queued && (queueSize - queueFree - 1 > autoScaleMaxBacklog_)) {
+                autoScaleMaxBacklog_ = queueSize - queueFree - 1;
+            }
+            if (!queued) {
+                autoScaleDropped_++;
                 pasynUser->auxStatus = asynOverflow;
                 if (!ignoreQueueFull) {
                     status |= getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
@@ -392,30 +541,41 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
                 }
                 /* This buffer needs to be released */
                 pArray->release();
+            } else if (pExecutor_) {
+                submitExecutorTask();
             }
+            getIntegerParam(NDPluginDriverAutoScale, &autoScaleEnabled);
+            if (autoScaleEnabled) autoScale(&tNow, queueSize);
         }
     }
     callParamCallbacks();
     this->unlock();
+    /* Relock the upstream plugin only after our lock is released, so the locks are always taken upstream first */
+    if (pUpstream) {
+        pUpstream->relockAfterFusedCallback();
+        pInput->release();
+    }
 }
 
-/** Method runs as a separate thread, waiting for NDArrays to arrive in a message queue
+/** Method runs as a separate thread, waiting for NDArrays to arrive in the input queue
   * and processing them.
-  * This thread is used when NDPluginDriverBlockingCallbacks=0.
+  * This thread is used when NDPluginDriverBlockingCallbacks=0 and the shared executor is not used.
   * This method should really be private, but it must be called from a 
   * C-linkage callback function, so it must be public. */ 
 void NDPluginDriver::processTask()
 {
     /* This thread processes a new array when it arrives */
-    int queueSize, queueFree;
-    epicsTimeStamp tStart, tEnd;
-    int numBytes;
     int status;
+    int index;
     NDArray *pArray=0;
-    ToThreadMessage_t toMsg;
+    epicsTimeStamp sendTime;
     FromThreadMessage_t fromMsg = {FromThreadMessageEnter, epicsThreadGetIdSelf()};
     static const char *functionName = "processTask";
 
+    for (index=0; index<(int)pThreads_.size(); index++) {
+        if (pThreads_[index]->getId() == fromMsg.threadId) break;
+    }
+
     // Send event indicating that the thread has started. Must do this before taking lock.
     status = pFromThreadMsgQ_->send(&fromMsg, sizeof(fromMsg));
     if (status) {
@@ -423,54 +583,227 @@ void NDPluginDriver::processTask()
             "%s::%s error sending enter message thread %s\n",
             driverName, functionName, epicsThreadGetNameSelf());
     }
-    this->lock();
+    /* Keep a per-thread cache of free NDArrays so that alloc() and release() in this thread
+     * do not contend for the NDArrayPool lock with the other plugin threads */
+    NDArrayPool::setThreadCache(1);
     /* Loop forever */
     while (1) {
 
-        /* Wait for an array to arrive from the queue. Release the lock while  waiting. */
-        this->unlock();   
-        numBytes = pToThreadMsgQ_->receive(&toMsg, sizeof(toMsg));
-        if (numBytes != sizeof(toMsg)) {
-            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
-                "%s::%s error reading message queue, expected size=%d, actual=%d\n",
-                driverName, functionName, (int)sizeof(toMsg), numBytes);
+        /* If AutoScale has reduced the number of threads below this one wait until it is needed again */
+        while (index >= epicsAtomicGetIntT(&numThreads_)) {
+            epicsEventWait(threadEvents_[index]);
         }
-        switch (toMsg.messageType) {
-            case ToThreadMessageExit:
-                asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
-                    "%s::%s received exit message, thread=%s\n", 
-                    driverName, functionName, epicsThreadGetNameSelf());
-                fromMsg.messageType = FromThreadMessageExit;
-                pFromThreadMsgQ_->send(&fromMsg, sizeof(fromMsg));
-                return; // shutdown thread if special message
-                break;
-            case ToThreadMessageData:
-                pArray = toMsg.pArray;
-                break;
-            default:
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
-                    "%s::%s unknown message type = %d\n",
-                    driverName, functionName, toMsg.messageType);
+
+        /* Wait for an array to arrive from the queue. The lock is not held while waiting. */
+        pArray = pToThreadQueue_->receive(&sendTime);
+        if (!pArray) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
+                "%s::%s received exit message, thread=%s\n", 
+                driverName, functionName, epicsThreadGetNameSelf());
+            NDArrayPool::setThreadCache(0);
+            fromMsg.messageType = FromThreadMessageExit;
+            pFromThreadMsgQ_->send(&fromMsg, sizeof(fromMsg));
+            return; // shutdown thread if special message
         }
-        
-        // Note: the lock must not be taken until after the thread exit logic above    
-        this->lock();
-        epicsTimeGetCurrent(&tStart);
-        getIntegerParam(NDPluginDriverQueueSize, &queueSize);
-        queueFree = queueSize - pToThreadMsgQ_->pending();
-        setIntegerParam(NDPluginDriverQueueFree, queueFree);
-
-        /* Call the function that does the business of this callback.
-         * This function should release the lock during time-consuming operations,
-         * but of course it must not access any class data when the lock is released. */
-        processCallbacks(pArray); 
-        
-        /* We are done with this array buffer */
+        processQueuedArray(pArray, &sendTime);
+    }
+}
+
+/** Processes an NDArray received from the input queue, in a plugin thread or a task of the shared executor.
+  * This method is called with the lock released; it takes the lock and releases it again before returning.
+  * \param[in] pArray  The NDArray, which is released when it has been processed.
+  * \param[in] pSendTime  The time driverCallback() put the NDArray on the queue. */
+void NDPluginDriver::processQueuedArray(NDArray *pArray, const epicsTimeStamp *pSendTime)
+{
+    int queueSize, queueFree;
+    epicsTimeStamp tStart, tEnd, arrayTime;
+    int uniqueId = pArray->uniqueId;
+    bool traced = NDFrameTrace::sampled(uniqueId);
+    static const char *functionName = "processQueuedArray";
+
+    if (traced) NDFrameTrace::record(NDFrameTraceDequeue, portName, uniqueId);
+
+    /* If the array is a view whose data is not contiguous and this plugin cannot handle that
+     * then use a contiguous copy.  The copy is shared by all plugins which need it. */
+    if (!acceptsStridedArrays_ && !pArray->isContiguous()) {
+        NDArray *pContiguous = pArray->pNDArrayPool->makeContiguous(pArray);
         pArray->release();
-        epicsTimeGetCurrent(&tEnd);
-        setDoubleParam(NDPluginDriverExecutionTime, epicsTimeDiffInSeconds(&tEnd, &tStart)*1e3);
-        callParamCallbacks();
+        pArray = pContiguous;
+    }
+
+    this->lock();
+    if (!pArray) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error allocating contiguous copy of array\n",
+            driverName, functionName);
+        this->unlock();
+        return;
+    }
+    epicsTimeGetCurrent(&tStart);
+    if (pSendTime->secPastEpoch) queueWaitHist_.add(&tStart, pSendTime);
+    arrayTime = pArray->epicsTS;
+    getIntegerParam(NDPluginDriverQueueSize, &queueSize);
+    queueFree = queueSize - pToThreadQueue_->pending();
+    setIntegerParam(NDPluginDriverQueueFree, queueFree);
+
+    /* Call the function that does the business of this callback.
+     * This function should release the lock during time-consuming operations,
+     * but of course it must not access any class data when the lock is released. */
+    setOwnedArray(pArray);
+    if (traced) NDFrameTrace::record(NDFrameTraceProcessStart, portName, uniqueId, &tStart);
+    processCallbacks(pArray); 
+    setOwnedArray(NULL);
+    
+    /* We are done with this array buffer */
+    pArray->release();
+    epicsTimeGetCurrent(&tEnd);
+    setDoubleParam(NDPluginDriverExecutionTime, epicsTimeDiffInSeconds(&tEnd, &tStart)*1e3);
+    autoScaleExecTime_ += epicsTimeDiffInSeconds(&tEnd, &tStart);
+    autoScaleExecCount_++;
+    addLatencies(&arrayTime, &tStart, &tEnd);
+    if (traced) NDFrameTrace::record(NDFrameTraceProcessEnd, portName, uniqueId, &tEnd);
+    callParamCallbacks();
+    this->unlock();
+}
+
+/** Adds the processing time and the end to end time of an NDArray to their histograms.
+  * \param[in] pArrayTime  The NDArray::epicsTS of the array; the end to end time is not added if it is 0,
+  *            or if it is later than pEnd because the driver set it from another clock.
+  * \param[in] pStart  The time processing started.
+  * \param[in] pEnd  The time processing ended. */
+void NDPluginDriver::addLatencies(const epicsTimeStamp *pArrayTime, const epicsTimeStamp *pStart,
+                                  const epicsTimeStamp *pEnd)
+{
+    double endToEnd;
+
+    processHist_.add(pEnd, pStart);
+    if (pArrayTime->secPastEpoch == 0) return;
+    endToEnd = epicsTimeDiffInSeconds(pEnd, pArrayTime);
+    if (endToEnd >= 0.) endToEndHist_.add(endToEnd);
+}
+
+/** Submits a task to the shared executor to process the input queue, unless numThreads_ tasks
+  * have already been submitted.  Those tasks run until the input queue is empty. */
+void NDPluginDriver::submitExecutorTask()
+{
+    int numTasks;
+
+    while ((numTasks = epicsAtomicGetIntT(&numExecutorTasks_)) < numThreads_) {
+        if (epicsAtomicCmpAndSwapIntT(&numExecutorTasks_, numTasks, numTasks+1) == numTasks) {
+            pExecutor_->submit(this);
+            return;
+        }
+    }
+}
+
+/** Processes one NDArray from the input queue in a worker thread of the shared executor.
+  * If there are more NDArrays in the queue the task is submitted again behind the other tasks of the
+  * worker, so the plugins which share the worker take turns and idle workers can steal the task. */
+void NDPluginDriver::runTask()
+{
+    NDArray *pArray;
+    epicsTimeStamp sendTime;
+
+    epicsAtomicIncrIntT(&numRunningTasks_);
+    if (pToThreadQueue_->tryReceive(&pArray, &sendTime)) {
+        processQueuedArray(pArray, &sendTime);
+    }
+    if (pToThreadQueue_->pending() > 0) {
+        pExecutor_->submit(this, true);
+    } else {
+        epicsAtomicDecrIntT(&numExecutorTasks_);
+        // An NDArray sent before the decrement may have found numThreads_ tasks, so check again
+        if (pToThreadQueue_->pending() > 0) submitExecutorTask();
+    }
+    // deleteCallbackThreads() waits for this, so it must be the last access to this object
+    epicsAtomicDecrIntT(&numRunningTasks_);
+}
+
+/** Sets the number of threads which process input arrays, or the number of executor tasks.
+  * Threads with an index >= numThreads wait on their event in processTask(), and are woken here
+  * when they are needed again. */
+void NDPluginDriver::setActiveThreads(int numThreads)
+{
+    int prevThreads = numThreads_;
+    int i;
+
+    epicsAtomicSetIntT(&numThreads_, numThreads);
+    for (i=prevThreads; (i<numThreads) && (i<(int)threadEvents_.size()); i++) {
+        epicsEventSignal(threadEvents_[i]);
+    }
+}
+
+/** Starts a new autoscale period */
+void NDPluginDriver::resetAutoScale(const epicsTimeStamp *pNow)
+{
+    autoScaleTime_ = *pNow;
+    autoScaleArrivals_ = 0;
+    autoScaleDropped_ = 0;
+    autoScaleMaxBacklog_ = 0;
+    autoScaleExecTime_ = 0.;
+    autoScaleExecCount_ = 0;
+}
+
+/** Adjusts the number of threads to the load when AutoScale=1, once every AutoScalePeriod.
+  * This is called from driverCallback() with the lock held.
+  * The load is the arrival rate of input arrays times their mean execution time, which is the number of threads
+  * that are busy on average.  If arrays were dropped or the queue was more than half full the plugin is falling
+  * behind, and grows by at least one thread, to keep the threads at most autoScaleGrowBusy busy.  It only shrinks
+  * by one thread after autoScaleShrinkPeriods consecutive periods in which the queue stayed less than a quarter full
+  * and the remaining threads would have been less than autoScaleShrinkBusy busy.  The gap between the two
+  * conditions is the hysteresis which stops the number of threads from oscillating.
+  * The number of threads is between 1 and MaxThreads, and is shown in NumThreads.
+  * \param[in] pNow The time the current input array arrived.
+  * \param[in] queueSize The size of the input queue. */
+void NDPluginDriver::autoScale(const epicsTimeStamp *pNow, int queueSize)
+{
+    double period, elapsed, arrivalRate, execTime, load;
+    int maxThreads;
+    int numThreads = numThreads_;
+    int action = AutoScaleHold;
+
+    getDoubleParam(NDPluginDriverAutoScalePeriod, &period);
+    elapsed = epicsTimeDiffInSeconds(pNow, &autoScaleTime_);
+    if ((elapsed <= 0.) || (elapsed < period)) return;
+
+    getIntegerParam(NDPluginDriverMaxThreads, &maxThreads);
+    arrivalRate = autoScaleArrivals_ / elapsed;
+    if (autoScaleExecCount_ > 0) {
+        execTime = autoScaleExecTime_ / autoScaleExecCount_;
+    } else {
+        getDoubleParam(NDPluginDriverExecutionTime, &execTime);
+        execTime /= 1000.;
+    }
+    load = arrivalRate * execTime;
+
+    if ((autoScaleDropped_ > 0) || (autoScaleMaxBacklog_*2 > queueSize)) {
+        autoScaleShrinkCount_ = 0;
+        numThreads = (int)ceil(load / autoScaleGrowBusy);
+        if (numThreads <= numThreads_) numThreads = numThreads_ + 1;
+    } else if ((numThreads_ > 1) && (autoScaleMaxBacklog_*4 < queueSize) &&
+               (load < (numThreads_ - 1) * autoScaleShrinkBusy)) {
+        if (++autoScaleShrinkCount_ >= autoScaleShrinkPeriods) {
+            autoScaleShrinkCount_ = 0;
+            numThreads = numThreads_ - 1;
+        }
+    } else {
+        autoScaleShrinkCount_ = 0;
+    }
+    if (numThreads > maxThreads) numThreads = maxThreads;
+    if (numThreads < 1) numThreads = 1;
+    if (numThreads > numThreads_) action = AutoScaleGrow;
+    if (numThreads < numThreads_) action = AutoScaleShrink;
+    if (action != AutoScaleHold) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::autoScale arrival rate=%f/s, execution time=%f ms, dropped=%d, backlog=%d, threads %d -> %d\n",
+            driverName, arrivalRate, execTime*1e3, autoScaleDropped_, autoScaleMaxBacklog_, numThreads_, numThreads);
+        setActiveThreads(numThreads);
+        setIntegerParam(NDPluginDriverNumThreads, numThreads);
     }
+    setDoubleParam(NDPluginDriverArrivalRate, arrivalRate);
+    setDoubleParam(NDPluginDriverThreadLoad, load);
+    setIntegerParam(NDPluginDriverAutoScaleAction, action);
+    resetAutoScale(pNow);
 }
 
 /** Register or unregister to receive asynGenericPointer (NDArray) callbacks from the driver.
@@ -531,6 +864,11 @@ asynStatus NDPluginDriver::connectToArrayPort(void)
      * currently connected. */
     pasynManager->disconnect(this->pasynUserGenericPointer_);
     this->connectedToArrayPort_ = false;
+    epicsMutexLock(this->attributeInterestLock_);
+    if (this->pArrayPortDriver_) this->pArrayPortDriver_->clearAttributeInterest(this);
+    this->pArrayPortDriver_ = NULL;
+    this->pUpstreamPlugin_ = NULL;
+    epicsMutexUnlock(this->attributeInterestLock_);
 
     /* Connect to the array port driver */
     status = pasynManager->connectDevice(this->pasynUserGenericPointer_, arrayPort.c_str(), arrayAddr);
@@ -553,13 +891,177 @@ asynStatus NDPluginDriver::connectToArrayPort(void)
     asynGenericPointerPvt_ = pasynInterface->drvPvt;
     connectedToArrayPort_ = true;
 
+    /* Tell the driver which attributes we and our clients use */
+    epicsMutexLock(this->attributeInterestLock_);
+    this->pArrayPortDriver_ = dynamic_cast<asynNDArrayDriver *>((asynPortDriver *)findAsynPortDriver(arrayPort.c_str()));
+    this->pUpstreamPlugin_ = dynamic_cast<NDPluginDriver *>(this->pArrayPortDriver_);
+    epicsMutexUnlock(this->attributeInterestLock_);
+    declareAttributeInterest();
+
     /* Enable or disable interrupt callbacks */
     status = setArrayInterrupt(enableCallbacks);
 
     return(status);
 }   
 
-/** Method runs as a separate thread, periodically doing NDArray callbacks to downstream plugins.
+/** Sets the attributes that the derived class reads from the NDArrays passed to processCallbacks().
+  * By default a plugin is assumed to use all attributes.  Plugins which only use some attributes, or none,
+  * call this so that when NDAttributesOnDemand is set the driver does not update and copy attributes which neither
+  * this plugin nor the plugins it does callbacks to use.  The ColorMode and BayerPattern attributes which
+  * beginProcessCallbacks() reads are always included.
+  * \param[in] allAttributes True if the plugin uses all attributes.
+  * \param[in] keys The keys of the attributes the plugin uses, see NDAttributeList::getKey().
+  */
+void NDPluginDriver::setAttributesUsed(bool allAttributes, const std::vector<NDAttributeKey> &keys)
+{
+    epicsMutexLock(this->attributeInterestLock_);
+    this->usesAllAttributes_ = allAttributes;
+    this->attributesUsed_ = keys;
+    epicsMutexUnlock(this->attributeInterestLock_);
+    declareAttributeInterest();
+}
+
+/** Called when the attributes used by the plugins we do callbacks to change; passes the change on to the
+  * driver we get arrays from. */
+void NDPluginDriver::attributeInterestChanged()
+{
+    declareAttributeInterest();
+}
+
+/** Tells the driver we get arrays from which attributes this plugin and the plugins it does callbacks to use.
+  * attributeInterestLock_ is held while the driver is called, so that changes are passed on in order;
+  * locks are always taken in the direction from a plugin to the driver it gets arrays from. */
+void NDPluginDriver::declareAttributeInterest()
+{
+    bool allAttributes;
+    std::vector<NDAttributeKey> keys;
+
+    epicsMutexLock(this->attributeInterestLock_);
+    if (this->pArrayPortDriver_) {
+        getAttributeInterest(&allAttributes, keys);
+        allAttributes = allAttributes || this->usesAllAttributes_;
+        keys.insert(keys.end(), this->attributesUsed_.begin(), this->attributesUsed_.end());
+        keys.push_back(this->colorModeKey_);
+        keys.push_back(this->bayerPatternKey_);
+        this->pArrayPortDriver_->setAttributeInterest(this, allAttributes, keys);
+    }
+    epicsMutexUnlock(this->attributeInterestLock_);
+}
+
+/** Does the NDArray callbacks to downstream plugins for an output NDArray.
+  * Keeps track of DisorderedArrays. */
+void NDPluginDriver::doOutputCallbacks(NDArray *pArray)
+{
+    static const char *functionName = "doOutputCallbacks";
+
+    if (NDFrameTrace::sampled(pArray->uniqueId)) {
+        NDFrameTrace::record(NDFrameTraceCallback, portName, pArray->uniqueId);
+    }
+    /* Check the order before the callbacks, because fused plugins may release our lock while they process */
+    bool orderOK = (pArray->uniqueId == prevUniqueId_)   ||
+                   (pArray->uniqueId == prevUniqueId_+1);
+    if (!firstOutputArray_ && !orderOK) {
+        int disorderedArrays;
+        getIntegerParam(NDPluginDriverDisorderedArrays, &disorderedArrays);
+        disorderedArrays++;
+        setIntegerParam(NDPluginDriverDisorderedArrays, disorderedArrays);
+        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, 
+            "%s::%s disordered array found uniqueId=%d, prevUniqueId_=%d, orderOK=%d, disorderedArrays=%d\n",
+            driverName, functionName, pArray->uniqueId, prevUniqueId_, orderOK, disorderedArrays);
+    }
+    firstOutputArray_ = false;
+    prevUniqueId_ = pArray->uniqueId;
+    epicsAtomicSetPtrT(&outputCallbackThread_, (void *)epicsThreadGetIdSelf());
+    doCallbacksGenericPointer(pArray, NDArrayData, 0);
+    epicsAtomicSetPtrT(&outputCallbackThread_, NULL);
+}
+
+/** Called by a fused downstream plugin in driverCallback() before it processes an array which
+  * this plugin passed to doOutputCallbacks().
+  * If the calling thread is in doOutputCallbacks() holding our lock then the lock is released,
+  * so that the downstream plugin does not block access to this plugin while it processes.
+  * \return true if the lock was released, in which case relockAfterFusedCallback() must be called */
+bool NDPluginDriver::unlockForFusedCallback()
+{
+    if (epicsAtomicGetPtrT(&outputCallbackThread_) != (void *)epicsThreadGetIdSelf()) return false;
+    epicsAtomicSetPtrT(&outputCallbackThread_, NULL);
+    this->unlock();
+    return true;
+}
+
+/** Takes the lock again after unlockForFusedCallback() returned true, before doOutputCallbacks()
+  * calls the next client. */
+void NDPluginDriver::relockAfterFusedCallback()
+{
+    this->lock();
+    epicsAtomicSetPtrT(&outputCallbackThread_, (void *)epicsThreadGetIdSelf());
+}
+
+/** Returns the slot in the sort ring for a uniqueId */
+int NDPluginDriver::sortSlot(int uniqueId)
+{
+    int size = (int)sortRing_.size();
+    int slot = uniqueId % size;
+
+    if (slot < 0) slot += size;
+    return slot;
+}
+
+/** Returns the slot in the sort ring of the NDArray with the lowest uniqueId, -1 if the ring is empty */
+int NDPluginDriver::lowestSortedSlot()
+{
+    int slot = -1;
+    int i;
+
+    if (numSorted_ == 0) return -1;
+    for (i=0; i<(int)sortRing_.size(); i++) {
+        if (!sortRing_[i].pArray_) continue;
+        if ((slot < 0) || (sortRing_[i].pArray_->uniqueId < sortRing_[slot].pArray_->uniqueId)) slot = i;
+    }
+    return slot;
+}
+
+/** Removes the NDArray in a slot of the sort ring and does the callbacks for it */
+void NDPluginDriver::outputSortedArray(int slot)
+{
+    NDArray *pArray = sortRing_[slot].pArray_;
+
+    sortRing_[slot].pArray_ = 0;
+    numSorted_--;
+    doOutputCallbacks(pArray);
+    pArray->release();
+}
+
+/** Does the callbacks for the NDArrays in the sort ring which follow the last output NDArray in uniqueId order */
+void NDPluginDriver::outputNextSortedArrays()
+{
+    int slot;
+
+    while (numSorted_ > 0) {
+        slot = sortSlot(prevUniqueId_+1);
+        if (!sortRing_[slot].pArray_ || (sortRing_[slot].pArray_->uniqueId != prevUniqueId_+1)) break;
+        outputSortedArray(slot);
+    }
+}
+
+/** Does the callbacks for all NDArrays in the sort ring in uniqueId order, and then changes its size.
+  * The ring is only allocated here, so adding NDArrays to it does not allocate memory.
+  * \param[in] sortSize The new number of slots. */
+void NDPluginDriver::resizeSortRing(int sortSize)
+{
+    epicsTimeStamp zero;
+
+    while (numSorted_ > 0) {
+        outputSortedArray(lowestSortedSlot());
+    }
+    memset(&zero, 0, sizeof(zero));
+    sortRing_.assign(sortSize, sortedListElement(NULL, zero));
+}
+
+/** Method runs as a separate thread, doing NDArray callbacks to downstream plugins for NDArrays in the sort ring
+  * which have waited SortTime for the NDArrays before them.
+  * It waits on an event while the ring is empty, and otherwise until the oldest NDArray in the ring times out,
+  * so it adds no latency to NDArrays which arrive in order; endProcessCallbacks() does their callbacks.
   * This thread is used when SortMode=1.
   * This method should really be private, but it must be called from a 
   * C-linkage callback function, so it must be public. */ 
@@ -569,51 +1071,51 @@ void NDPluginDriver::sortingTask()
     epicsTimeStamp now;
     int sortSize;
     double deltaTime;
-    int listSize;
-    std::multiset<sortedListElement>::iterator pListElement;
+    double timeout;
+    int numSorted;
+    int i, oldest;
     static const char *functionName = "sortingTask";
 
     lock();
-    while (1) {
+    while (!sortingThreadExit_) {
         getDoubleParam(NDPluginDriverSortTime, &sortTime);
-        unlock();
-        epicsThreadSleep(sortTime);
-        lock();
         epicsTimeGetCurrent(&now);
-        getIntegerParam(NDPluginDriverSortSize, &sortSize);
-        while ((listSize=(int)sortedNDArrayList_.size()) > 0) {
-            bool orderOK;
-            pListElement = sortedNDArrayList_.begin();
-            deltaTime = epicsTimeDiffInSeconds(&now, &pListElement->insertionTime_);
-            asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, 
-                "%s::%s, deltaTime=%f, list size=%d, uniqueId=%d\n", 
-                driverName, functionName, deltaTime, listSize, pListElement->pArray_->uniqueId);            
-            orderOK = (pListElement->pArray_->uniqueId == prevUniqueId_)   ||
-                      (pListElement->pArray_->uniqueId == prevUniqueId_+1);
-            if ((!firstOutputArray_ && orderOK) || (deltaTime > sortTime)) {
-                doCallbacksGenericPointer(pListElement->pArray_, NDArrayData, 0);
-                if (!firstOutputArray_ && !orderOK) {
-                    int disorderedArrays;
-                    getIntegerParam(NDPluginDriverDisorderedArrays, &disorderedArrays);
-                    disorderedArrays++;
-                    setIntegerParam(NDPluginDriverDisorderedArrays, disorderedArrays);
-                    asynPrint(pasynUserSelf, ASYN_TRACE_WARNING, 
-                        "%s::%s disordered array found uniqueId=%d, prevUniqueId_=%d, orderOK=%d, disorderedArrays=%d\n",
-                        driverName, functionName, pListElement->pArray_->uniqueId, prevUniqueId_, 
-                        orderOK, disorderedArrays);
+        timeout = sortTime;
+        while (numSorted_ > 0) {
+            oldest = -1;
+            for (i=0; i<(int)sortRing_.size(); i++) {
+                if (!sortRing_[i].pArray_) continue;
+                if ((oldest < 0) || 
+                    (epicsTimeDiffInSeconds(&sortRing_[i].insertionTime_, &sortRing_[oldest].insertionTime_) < 0)) {
+                    oldest = i;
                 }
-                prevUniqueId_ = pListElement->pArray_->uniqueId;
-                pListElement->pArray_->release();
-                sortedNDArrayList_.erase(pListElement);
-                firstOutputArray_ = false;
-            } else  {
+            }
+            deltaTime = epicsTimeDiffInSeconds(&now, &sortRing_[oldest].insertionTime_);
+            asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, 
+                "%s::%s, deltaTime=%f, numSorted=%d, uniqueId=%d\n", 
+                driverName, functionName, deltaTime, numSorted_, sortRing_[oldest].pArray_->uniqueId);
+            if (deltaTime < sortTime) {
+                timeout = sortTime - deltaTime;
                 break;
             }
+            // Stop waiting for the arrays before the lowest uniqueId in the ring
+            outputSortedArray(lowestSortedSlot());
+            outputNextSortedArrays();
         }
-        listSize=(int)sortedNDArrayList_.size();
-        setIntegerParam(NDPluginDriverSortFree, sortSize-listSize);
+        numSorted = numSorted_;
+        sortSize = (int)sortRing_.size();
+        setIntegerParam(NDPluginDriverSortFree, sortSize-numSorted);
         callParamCallbacks();
-    }    
+        unlock();
+        if (numSorted == 0) epicsEventWait(sortingEvent_);
+        else epicsEventWaitWithTimeout(sortingEvent_, timeout);
+        lock();
+    }
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+        "%s::%s exiting\n",
+        driverName, functionName);
+    unlock();
+    epicsEventSignal(sortingExitEvent_);
 }
 
 /** Called when asyn clients call pasynInt32->write().
@@ -626,6 +1128,7 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
 {
     int function = pasynUser->reason;
     int addr=0;
+    int autoScaleEnabled, maxThreads;
     asynStatus status = asynSuccess;
     static const char* functionName = "writeInt32";
 
@@ -636,6 +1139,7 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
 
     status = getAddress(pasynUser, &addr); 
     if (status != asynSuccess) goto done;
+    getIntegerParam(NDPluginDriverAutoScale, &autoScaleEnabled);
 
     /* Set the parameter in the parameter library. */
     status = (asynStatus) setIntegerParam(addr, function, value);
@@ -673,8 +1177,19 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
         this->lock();
         if (status != asynSuccess) goto done;
 
+    } else if ((function == NDPluginDriverNumThreads) && pToThreadQueue_ && (autoScaleEnabled || pExecutor_)) {
+        /* With AutoScale=1 all MaxThreads threads exist, and the executor has no threads of our own,
+         * so just set how many are used */
+        getIntegerParam(NDPluginDriverMaxThreads, &maxThreads);
+        if (value > maxThreads) value = maxThreads;
+        if (value < 1) value = 1;
+        setActiveThreads(value);
+        setIntegerParam(NDPluginDriverNumThreads, value);
+        if (pExecutor_ && (pToThreadQueue_->pending() > 0)) submitExecutorTask();
+
     } else if ((function == NDPluginDriverQueueSize) ||
-               (function == NDPluginDriverNumThreads)) {
+               (function == NDPluginDriverNumThreads) ||
+               ((function == NDPluginDriverAutoScale) && pToThreadQueue_)) {
         if ((status = deleteCallbackThreads())) goto done;
         if ((status = createCallbackThreads())) goto done;
 
@@ -682,6 +1197,12 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
                (value == 1)) {
         status = createSortingThread();
 
+    } else if (function == NDPluginDriverLatencyReset) {
+        queueWaitHist_.reset();
+        processHist_.reset();
+        endToEndHist_.reset();
+        setIntegerParam(NDPluginDriverLatencyReset, 0);
+
     } else if (function == NDPluginDriverProcessPlugin) {
         if (pPrevInputArray_) {
             driverCallback(pasynUserSelf, pPrevInputArray_);
@@ -755,7 +1276,7 @@ asynStatus NDPluginDriver::writeOctet(asynUser *pasynUser, const char *value,
 }
 
 /** Called when asyn clients call pasynInt32Array->read().
-  * Returns the value of the array dimensions for the last NDArray.  
+  * Returns the value of the array dimensions for the last NDArray, or the latency histograms.
   * \param[in] pasynUser pasynUser structure that encodes the reason and address.
   * \param[in] value Pointer to the array to read.
   * \param[in] nElements Number of elements to read.
@@ -775,6 +1296,20 @@ asynStatus NDPluginDriver::readInt32Array(asynUser *pasynUser, epicsInt32 *value
             if (nElements < ncopy) ncopy = nElements;
             memcpy(value, this->dimsPrev_, ncopy*sizeof(*this->dimsPrev_));
             *nIn = ncopy;
+    } else if (function == NDPluginDriverLatencyHistBins) {
+        *nIn = NDLatencyHistogram::getLowerEdges(value, nElements);
+    } else if (function == NDPluginDriverQueueWaitHist) {
+        *nIn = queueWaitHist_.getCounts(value, nElements);
+    } else if (function == NDPluginDriverQueueWaitPercentiles) {
+        *nIn = queueWaitHist_.getPercentiles(value, nElements);
+    } else if (function == NDPluginDriverProcessHist) {
+        *nIn = processHist_.getCounts(value, nElements);
+    } else if (function == NDPluginDriverProcessPercentiles) {
+        *nIn = processHist_.getPercentiles(value, nElements);
+    } else if (function == NDPluginDriverEndToEndHist) {
+        *nIn = endToEndHist_.getCounts(value, nElements);
+    } else if (function == NDPluginDriverEndToEndPercentiles) {
+        *nIn = endToEndHist_.getPercentiles(value, nElements);
     } else {
         /* If this parameter belongs to a base class call its method */
         if (function < FIRST_NDPLUGIN_PARAM) 
@@ -814,7 +1349,7 @@ asynStatus NDPluginDriver::startCallbackThreads(void)
     FromThreadMessage_t fromMsg;
     static const char *functionName = "startCallbackThreads";
 
-    for (i=0; i<numThreads_; i++) {
+    for (i=0; i<(int)pThreads_.size(); i++) {
         pThreads_[i]->start();
   
         // Wait for the thread to say its running
@@ -840,24 +1375,27 @@ asynStatus NDPluginDriver::startCallbackThreads(void)
     return status;
 }
     
-/** Starts the thread that receives NDArrays from the epicsMessageQueue. */ 
+/** Starts the thread that receives NDArrays from the input queue. */ 
 void NDPluginDriver::run()
 {
     this->processTask();
 }
 
-/** Creates the plugin threads.  
+/** Creates the plugin threads, or uses the shared executor instead if NDPluginExecutorThreads is not 0.
   * This method is called when BlockingCallbacks is 0, and whenever QueueSize or NumThreads is changed. */ 
 asynStatus NDPluginDriver::createCallbackThreads()
 {
     assert(this->pThreads_.size() == 0);
-    assert(this->pToThreadMsgQ_ == 0);
+    assert(this->pToThreadQueue_ == 0);
     assert(this->pFromThreadMsgQ_ == 0);
     
     int queueSize;
     int numThreads;
     int maxThreads;
     int enableCallbacks;
+    int autoScaleEnabled;
+    int numCreate;
+    epicsTimeStamp now;
     int i;
     int status = asynSuccess;
     static const char *functionName = "createCallbackThreads";
@@ -865,6 +1403,7 @@ asynStatus NDPluginDriver::createCallbackThreads()
     getIntegerParam(NDPluginDriverMaxThreads, &maxThreads);
     getIntegerParam(NDPluginDriverNumThreads, &numThreads);
     getIntegerParam(NDPluginDriverQueueSize, &queueSize);
+    getIntegerParam(NDPluginDriverAutoScale, &autoScaleEnabled);
     if (numThreads > maxThreads) {
         asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, 
             "%s::%s error, numThreads=%d must be <= maxThreads=%d, setting to %d\n",
@@ -890,26 +1429,34 @@ asynStatus NDPluginDriver::createCallbackThreads()
         setIntegerParam(NDPluginDriverQueueSize, queueSize);
     }
   
-    pThreads_.resize(numThreads);
-
-    /* Create the message queue for the input arrays */
-    pToThreadMsgQ_ = new epicsMessageQueue(queueSize, sizeof(ToThreadMessage_t));
-    if (!pToThreadMsgQ_) {
-        /* We don't handle memory errors above, so no point in handling this. */
-        cantProceed("NDPluginDriver::createCallbackThreads epicsMessageQueueCreate failure\n");
-    }
-    pFromThreadMsgQ_ = new epicsMessageQueue(numThreads, sizeof(FromThreadMessage_t));
-    if (!pFromThreadMsgQ_) {
-        /* We don't handle memory errors above, so no point in handling this. */
-        cantProceed("NDPluginDriver::createCallbackThreads epicsMessageQueueCreate failure\n");
-    }
+    /* Create the queue for the input arrays */
+    pToThreadQueue_ = new NDArrayQueue(queueSize);
+
+    /* If there is a shared executor it processes the arrays in up to numThreads tasks at a time */
+    pExecutor_ = NDPluginExecutor::getInstance();
+    if (!pExecutor_) {
+        /* With AutoScale all MaxThreads threads are created, and those after the first numThreads
+         * wait in processTask() until they are needed */
+        numCreate = autoScaleEnabled ? maxThreads : numThreads;
+        pThreads_.resize(numCreate);
+        threadEvents_.resize(numCreate);
+        pFromThreadMsgQ_ = new epicsMessageQueue(numCreate, sizeof(FromThreadMessage_t));
+        if (!pFromThreadMsgQ_) {
+            /* We don't handle memory errors above, so no point in handling this. */
+            cantProceed("NDPluginDriver::createCallbackThreads epicsMessageQueueCreate failure\n");
+        }
 
-    for (i=0; i<numThreads; i++) {
-        /* Create the thread (but not start). */
-        char taskName[256];
-        epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Plugin_%d", portName, i+1);
-        pThreads_[i] = new epicsThread(*this, taskName, this->threadStackSize_, this->threadPriority_);
+        for (i=0; i<numCreate; i++) {
+            /* Create the thread (but not start). */
+            char taskName[256];
+            threadEvents_[i] = epicsEventMustCreate(epicsEventEmpty);
+            epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Plugin_%d", portName, i+1);
+            pThreads_[i] = new epicsThread(*this, taskName, this->threadStackSize_, this->threadPriority_);
+        }
     }
+    epicsTimeGetCurrent(&now);
+    resetAutoScale(&now);
+    autoScaleShrinkCount_ = 0;
 
     /* If start() was already run, we also need to start the threads. */
     if (this->pluginStarted_) {
@@ -925,7 +1472,6 @@ asynStatus NDPluginDriver::createCallbackThreads()
   * This method is called from the destructor and whenever QueueSize or NumThreads is changed. */ 
 asynStatus NDPluginDriver::deleteCallbackThreads()
 {
-    ToThreadMessage_t toMsg = {ToThreadMessageExit, 0};
     FromThreadMessage_t fromMsg;
     asynStatus status = asynSuccess;
     int i;
@@ -933,24 +1479,29 @@ asynStatus NDPluginDriver::deleteCallbackThreads()
     int numBytes;
     static const char *functionName = "deleteCallbackThreads";
     
-    //  Disable callbacks from driver so the threads will empty the message queue
-    if (pToThreadMsgQ_ != 0) {
+    //  Disable callbacks from driver so the threads will empty the input queue
+    if (pToThreadQueue_ != 0) {
         this->unlock();
         this->setArrayInterrupt(0);
-        while ((pending=pToThreadMsgQ_->pending()) > 0) {
+        while ((pending=pToThreadQueue_->pending()) > 0) {
             asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
                 "%s::%s waiting for queue to empty, pending=%d\n", 
                 driverName, functionName, pending);
             epicsThreadSleep(0.05);
         }
+        // Wait for the executor tasks to finish.  The queue is empty, so no more tasks are submitted.
+        while ((epicsAtomicGetIntT(&numExecutorTasks_) > 0) || (epicsAtomicGetIntT(&numRunningTasks_) > 0)) {
+            epicsThreadSleep(0.01);
+        }
+        pExecutor_ = NULL;
+        // Wake any threads that AutoScale has made inactive so that they receive the exit message
+        setActiveThreads((int)pThreads_.size());
         // Send a kill message to the threads and wait for reply.
         // Must do this with lock released else the threads may not be able to receive the message
-        for (i=0; i<numThreads_; i++) {
-            if (pToThreadMsgQ_->send(&toMsg, sizeof(toMsg)) != 0) {
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s::%s error sending plugin thread %d exit message\n",
-                    driverName, functionName, i);
-                status = asynError;
+        // The queue may be smaller than the number of threads, so wait for room as the threads exit
+        for (i=0; i<(int)pThreads_.size(); i++) {
+            while (!pToThreadQueue_->trySend(NULL)) {
+                epicsThreadSleep(0.01);
             }
             asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, 
                 "%s::%s sent exit message %d\n", 
@@ -970,12 +1521,14 @@ asynStatus NDPluginDriver::deleteCallbackThreads()
         }
         this->lock();
         // All threads have now been stopped.  Delete them.
-        for (i=0; i<numThreads_; i++) {
+        for (i=0; i<(int)pThreads_.size(); i++) {
             delete pThreads_[i]; // The epicsThread destructor waits for the thread to return
+            epicsEventDestroy(threadEvents_[i]);
         }
         pThreads_.resize(0);
-        delete pToThreadMsgQ_;
-        pToThreadMsgQ_ = 0;
+        threadEvents_.resize(0);
+        delete pToThreadQueue_;
+        pToThreadQueue_ = 0;
     }
     if (pFromThreadMsgQ_) {
         delete pFromThreadMsgQ_;
@@ -1010,4 +1563,28 @@ asynStatus NDPluginDriver::createSortingThread()
     return asynSuccess;
 }
 
+/** Stops the sorting thread if it is running.
+  * This method is called with the lock held, and releases it while waiting for the thread to exit.
+  * \return asynError if the thread did not exit, in which case it may still use sortingEvent_ and sortingExitEvent_. */
+asynStatus NDPluginDriver::deleteSortingThread()
+{
+    static const char *functionName = "deleteSortingThread";
+
+    if (sortingThreadId_ == 0) return asynSuccess;
+    sortingThreadExit_ = true;
+    epicsEventSignal(sortingEvent_);
+    this->unlock();
+    if (epicsEventWaitWithTimeout(sortingExitEvent_, 2.0) != epicsEventWaitOK) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s timeout waiting for sorting thread to exit\n",
+            driverName, functionName);
+        this->lock();
+        return asynError;
+    }
+    this->lock();
+    sortingThreadId_ = 0;
+    sortingThreadExit_ = false;
+    return asynSuccess;
+}
+
 
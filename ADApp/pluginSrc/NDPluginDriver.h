@@ -1,18 +1,23 @@
 #ifndef NDPluginDriver_H
 #define NDPluginDriver_H
 
-#include <set>
+#include <vector>
 #include <epicsTypes.h>
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
+#include <epicsEvent.h>
 #include <epicsTime.h>
 
 #include "asynNDArrayDriver.h"
+#include "NDArrayQueue.h"
+#include "NDPluginExecutor.h"
+#include "NDLatencyHistogram.h"
+#include "NDFrameTrace.h"
 
 
-// This class defines the object that is contained in the std::multilist for sorting output NDArrays
-// It contains a pointer to the NDArray and the time that the object was added to the list
-// It defines the < operator to use the NDArray::uniqueId field as the sort key
+// This class defines the slots of the ring buffer for sorting output NDArrays
+// It contains a pointer to the NDArray, NULL if the slot is empty, and the time that the NDArray was added to the ring
+// NDArrays are stored in the slot NDArray::uniqueId modulo SortSize
 
 // We would like to hide this class definition in NDPluginDriver.cpp and just forward reference it here.
 // That works on Visual Studio, and on gcc if instantiating plugins as heap variables with "new", but fails on gcc
@@ -22,9 +27,6 @@
 class sortedListElement {
     public:
         sortedListElement(NDArray *pArray, epicsTimeStamp time);
-        friend bool operator<(const sortedListElement& lhs, const sortedListElement& rhs) {
-            return (lhs.pArray_->uniqueId < rhs.pArray_->uniqueId);
-        }
         NDArray *pArray_;
         epicsTimeStamp insertionTime_;
 };
@@ -39,18 +41,33 @@ class sortedListElement {
 #define NDPluginDriverNumThreadsString          "NUM_THREADS"           /**< (asynInt32,    r/w) Number of threads */
 #define NDPluginDriverSortModeString            "SORT_MODE"             /**< (asynInt32,    r/w) sorted callback mode */
 #define NDPluginDriverSortTimeString            "SORT_TIME"             /**< (asynFloat64,  r/w) sorted callback time */
-#define NDPluginDriverSortSizeString            "SORT_SIZE"             /**< (asynInt32,    r/o) std::multiset maximum # elements */
-#define NDPluginDriverSortFreeString            "SORT_FREE"             /**< (asynInt32,    r/o) std::multiset free elements */
+#define NDPluginDriverSortSizeString            "SORT_SIZE"             /**< (asynInt32,    r/w) Number of slots in the sort ring buffer */
+#define NDPluginDriverSortFreeString            "SORT_FREE"             /**< (asynInt32,    r/o) Free slots in the sort ring buffer */
 #define NDPluginDriverDisorderedArraysString    "DISORDERED_ARRAYS"     /**< (asynInt32,    r/o) Number of out of order output arrays */
 #define NDPluginDriverDroppedOutputArraysString "DROPPED_OUTPUT_ARRAYS" /**< (asynInt32,    r/o) Number of dropped output arrays */
 #define NDPluginDriverEnableCallbacksString     "ENABLE_CALLBACKS"      /**< (asynInt32,    r/w) Enable callbacks from driver (1=Yes, 0=No) */
 #define NDPluginDriverBlockingCallbacksString   "BLOCKING_CALLBACKS"    /**< (asynInt32,    r/w) Callbacks block (1=Yes, 0=No) */
+#define NDPluginDriverFusedString               "FUSED"                 /**< (asynInt32,    r/w) Process in the thread of an upstream plugin (1=Yes, 0=No) */
 #define NDPluginDriverProcessPluginString       "PROCESS_PLUGIN"        /**< (asynInt32,    r/w) Process plugin with last callback array */
 #define NDPluginDriverExecutionTimeString       "EXECUTION_TIME"        /**< (asynFloat64,  r/o) The last execution time (milliseconds) */
 #define NDPluginDriverMinCallbackTimeString     "MIN_CALLBACK_TIME"     /**< (asynFloat64,  r/w) Minimum time between calling processCallbacks 
                                                                          *  to execute plugin code */
+#define NDPluginDriverAutoScaleString           "AUTO_SCALE"            /**< (asynInt32,    r/w) Adjust NumThreads to the load (1=Yes, 0=No) */
+#define NDPluginDriverAutoScalePeriodString     "AUTO_SCALE_PERIOD"     /**< (asynFloat64,  r/w) Time between autoscale decisions (seconds) */
+#define NDPluginDriverArrivalRateString         "ARRIVAL_RATE"          /**< (asynFloat64,  r/o) Input arrays per second in the last period */
+#define NDPluginDriverThreadLoadString          "THREAD_LOAD"           /**< (asynFloat64,  r/o) Arrival rate times mean execution time */
+#define NDPluginDriverAutoScaleActionString     "AUTO_SCALE_ACTION"     /**< (asynInt32,    r/o) Last decision (0=Hold, 1=Grow, 2=Shrink) */
+#define NDPluginDriverLatencyResetString        "LATENCY_RESET"         /**< (asynInt32,    r/w) Empty the latency histograms */
+#define NDPluginDriverLatencyHistBinsString     "LATENCY_HIST_BINS"     /**< (asynInt32Array, r/o) Lower edges of the histogram bins (microseconds) */
+#define NDPluginDriverQueueWaitHistString       "QUEUE_WAIT_HIST"       /**< (asynInt32Array, r/o) Histogram of the time arrays wait in the queue */
+#define NDPluginDriverQueueWaitPercentilesString "QUEUE_WAIT_PERCENTILES" /**< (asynInt32Array, r/o) p50, p95, p99, max queue wait (microseconds) */
+#define NDPluginDriverProcessHistString         "PROCESS_HIST"          /**< (asynInt32Array, r/o) Histogram of the execution time */
+#define NDPluginDriverProcessPercentilesString  "PROCESS_PERCENTILES"   /**< (asynInt32Array, r/o) p50, p95, p99, max execution time (microseconds) */
+#define NDPluginDriverEndToEndHistString        "END_TO_END_HIST"       /**< (asynInt32Array, r/o) Histogram of the time from the array timestamp
+                                                                         *  to the end of processing */
+#define NDPluginDriverEndToEndPercentilesString "END_TO_END_PERCENTILES" /**< (asynInt32Array, r/o) p50, p95, p99, max end to end time (microseconds) */
 /** Class from which actual plugin drivers are derived; derived from asynNDArrayDriver */
-class epicsShareClass NDPluginDriver : public asynNDArrayDriver, public epicsThreadRunable {
+class epicsShareClass NDPluginDriver : public asynNDArrayDriver, public epicsThreadRunable, public NDPluginExecutorTask {
 public:
     NDPluginDriver(const char *portName, int queueSize, int blockingCallbacks, 
                    const char *NDArrayPort, int NDArrayAddr, int maxAddr,
@@ -68,6 +85,7 @@ public:
     /* These are the methods that are new to this class */
     virtual void driverCallback(asynUser *pasynUser, void *genericPointer);
     virtual void run(void);
+    virtual void runTask(void);
     virtual asynStatus start(void);
     void sortingTask();
 
@@ -75,8 +93,12 @@ protected:
     virtual void processCallbacks(NDArray *pArray) = 0;
     virtual void beginProcessCallbacks(NDArray *pArray);
     virtual asynStatus endProcessCallbacks(NDArray *pArray, bool copyArray=false, bool readAttributes=true);
+    NDArray* makeWritable(NDArray *pArray, bool copyData);
     virtual asynStatus connectToArrayPort(void);    
     virtual asynStatus setArrayInterrupt(int connect);
+    virtual void attributeInterestChanged();
+    void setAttributesUsed(bool allAttributes,
+                           const std::vector<NDAttributeKey> &keys = std::vector<NDAttributeKey>());
 
 protected:
     int NDPluginDriverArrayPort;
@@ -96,18 +118,52 @@ protected:
     int NDPluginDriverDroppedOutputArrays;
     int NDPluginDriverEnableCallbacks;
     int NDPluginDriverBlockingCallbacks;
+    int NDPluginDriverFused;
     int NDPluginDriverProcessPlugin;
     int NDPluginDriverExecutionTime;
     int NDPluginDriverMinCallbackTime;
+    int NDPluginDriverAutoScale;
+    int NDPluginDriverAutoScalePeriod;
+    int NDPluginDriverArrivalRate;
+    int NDPluginDriverThreadLoad;
+    int NDPluginDriverAutoScaleAction;
+    int NDPluginDriverLatencyReset;
+    int NDPluginDriverLatencyHistBins;
+    int NDPluginDriverQueueWaitHist;
+    int NDPluginDriverQueueWaitPercentiles;
+    int NDPluginDriverProcessHist;
+    int NDPluginDriverProcessPercentiles;
+    int NDPluginDriverEndToEndHist;
+    int NDPluginDriverEndToEndPercentiles;
 
     NDArray *pPrevInputArray_;
+    bool acceptsStridedArrays_;   /**< Set by derived classes whose processCallbacks() handles views
+                                    *  which are not contiguous (NDDimension_t::stride) */
+    NDAttributeKey colorModeKey_;     /**< Key of the ColorMode attribute */
+    NDAttributeKey bayerPatternKey_;  /**< Key of the BayerPattern attribute */
 
 private:
     void processTask();
+    void processQueuedArray(NDArray *pArray, const epicsTimeStamp *pSendTime);
+    void addLatencies(const epicsTimeStamp *pArrayTime, const epicsTimeStamp *pStart, const epicsTimeStamp *pEnd);
+    void submitExecutorTask();
+    void setActiveThreads(int numThreads);
+    void resetAutoScale(const epicsTimeStamp *pNow);
+    void autoScale(const epicsTimeStamp *pNow, int queueSize);
     asynStatus createCallbackThreads();
     asynStatus startCallbackThreads();
     asynStatus deleteCallbackThreads();
     asynStatus createSortingThread();
+    asynStatus deleteSortingThread();
+    void doOutputCallbacks(NDArray *pArray);
+    bool unlockForFusedCallback();
+    void relockAfterFusedCallback();
+    int sortSlot(int uniqueId);
+    int lowestSortedSlot();
+    void outputSortedArray(int slot);
+    void outputNextSortedArrays();
+    void resizeSortRing(int sortSize);
+    void declareAttributeInterest();
      
     /* The asyn interfaces we access as a client */
     void *asynGenericPointerInterruptPvt_;
@@ -121,13 +177,39 @@ private:
     asynGenericPointer *pasynGenericPointer_;    /**< asyn interface for connecting to NDArray driver */
     bool connectedToArrayPort_;
     std::vector<epicsThread*>pThreads_;
-    epicsMessageQueue *pToThreadMsgQ_;
+    std::vector<epicsEventId> threadEvents_;     /**< Wake the threads with index >= numThreads_, which wait
+                                                   *  while AutoScale has made them inactive */
+    NDArrayQueue *pToThreadQueue_;               /**< Input NDArrays for the plugin threads, NULL tells a thread to exit */
     epicsMessageQueue *pFromThreadMsgQ_;
-    std::multiset<sortedListElement> sortedNDArrayList_;
+    NDPluginExecutor *pExecutor_;                /**< The shared executor which processes the input NDArrays
+                                                   *  instead of pThreads_, NULL if it is not used */
+    int numExecutorTasks_;                       /**< Number of executor tasks submitted and not finished,
+                                                   *  at most numThreads_ */
+    int numRunningTasks_;                        /**< Number of executor tasks in runTask() */
+    epicsTimeStamp autoScaleTime_;               /**< Start of the current autoscale period */
+    int autoScaleArrivals_;                      /**< Input arrays for the threads in this period */
+    int autoScaleDropped_;                       /**< Input arrays dropped in this period */
+    int autoScaleMaxBacklog_;                    /**< Most arrays waiting ahead of a new input array in this period */
+    double autoScaleExecTime_;                   /**< Total execution time in this period (seconds) */
+    int autoScaleExecCount_;                     /**< Number of arrays in autoScaleExecTime_ */
+    int autoScaleShrinkCount_;                   /**< Consecutive periods in which fewer threads would have done */
+    NDLatencyHistogram queueWaitHist_;           /**< Time from driverCallback() queueing an array to a thread receiving it */
+    NDLatencyHistogram processHist_;             /**< Time from the start to the end of processing an array */
+    NDLatencyHistogram endToEndHist_;            /**< Time from NDArray::epicsTS to the end of processing an array */
+    std::vector<sortedListElement> sortRing_;  /**< Output NDArrays waiting for earlier uniqueIds when SortMode=1 */
+    int numSorted_;                            /**< Number of NDArrays in sortRing_ */
     int prevUniqueId_;
     epicsThreadId sortingThreadId_;
+    epicsEventId sortingEvent_;                /**< Wakes sortingTask() when the first NDArray is added to sortRing_ */
+    epicsEventId sortingExitEvent_;            /**< Signalled by sortingTask() when it exits */
+    bool sortingThreadExit_;                   /**< Tells sortingTask() to exit */
     epicsTimeStamp lastProcessTime_;
     int dimsPrev_[ND_ARRAY_MAX_DIMS];
+    asynNDArrayDriver *pArrayPortDriver_;         /**< The driver we get arrays from, NULL if it is not an asynNDArrayDriver */
+    NDPluginDriver *pUpstreamPlugin_;             /**< pArrayPortDriver_ if it is an NDPluginDriver, else NULL, see NDPluginDriverFused */
+    void *outputCallbackThread_;                  /**< The thread in doOutputCallbacks() while it holds the lock, else NULL */
+    bool usesAllAttributes_;                      /**< True unless the derived class has called setAttributesUsed() */
+    std::vector<NDAttributeKey> attributesUsed_;  /**< The attributes the derived class uses, see setAttributesUsed() */
 };
 
     
@@ -0,0 +1,243 @@
+/*
+ * NDPluginExecutor.cpp
+ *
+ * Worker threads shared by the plugins in an IOC, which run plugin tasks from work-stealing deques.
+ *
+ * Created October 18, 2026
+ */
+
+#include <stdio.h>
+#include <deque>
+
+#include <epicsAtomic.h>
+#include <epicsMutex.h>
+#include <epicsStdio.h>
+#include <epicsExit.h>
+#include <cantProceed.h>
+
+#include <epicsExport.h>
+#include "NDArray.h"
+#include "NDPluginExecutor.h"
+
+static const char *driverName = "NDPluginExecutor";
+
+/** NDPluginExecutorThreads is a global variable that sets the number of worker threads of the executor
+  * that is shared by all plugins.  The default value is 0, which gives each plugin its own NumThreads threads.
+  * A value greater than 0 creates that many workers, and a value less than 0 creates one per CPU.
+  * The executor is created by the first plugin that creates its threads with BlockingCallbacks=0,
+  * so this must be set before the plugins are configured. For example:
+  *   var NDPluginExecutorThreads -1
+  * Plugins then submit a task for each NDArray they receive, and NumThreads is the maximum number of
+  * NDArrays that the plugin processes at the same time.
+  */
+volatile int NDPluginExecutorThreads=0;
+extern "C" {epicsExportAddress(int, NDPluginExecutorThreads);}
+
+/** NDPluginExecutorPriority and NDPluginExecutorStackSize are global variables that set the priority and
+  * stack size of the worker threads of the executor shared by all plugins.  The workers run the tasks of
+  * every plugin, so they do not use the priority and stackSize arguments of the plugins.
+  * The defaults of 0 use epicsThreadPriorityMedium and epicsThreadStackBig.  Like NDPluginExecutorThreads
+  * they must be set before the plugins are configured.
+  */
+volatile int NDPluginExecutorPriority=0;
+extern "C" {epicsExportAddress(int, NDPluginExecutorPriority);}
+volatile int NDPluginExecutorStackSize=0;
+extern "C" {epicsExportAddress(int, NDPluginExecutorStackSize);}
+
+/** The deque of tasks of a worker thread */
+struct NDExecutorWorker {
+  NDPluginExecutor *pExecutor;
+  int index;
+  epicsMutexId lock;
+  epicsEventId exitEvent;           /**< Signalled by the worker thread when it exits */
+  std::deque<NDPluginExecutorTask*> tasks;
+};
+
+static void workerTaskC(void *drvPvt)
+{
+  NDExecutorWorker *pWorker = (NDExecutorWorker *)drvPvt;
+  pWorker->pExecutor->workerTask(pWorker);
+}
+
+/** Constructor for NDPluginExecutor; creates and starts the worker threads.
+  * \param[in] numWorkers The number of worker threads; values less than 1 are treated as 1.
+  * \param[in] priority The priority of the worker threads.
+  * \param[in] stackSize The stack size of the worker threads.
+  */
+NDPluginExecutor::NDPluginExecutor(int numWorkers, unsigned int priority, unsigned int stackSize)
+  : nextWorker_(0), numQueued_(0), numWaiting_(0), exiting_(0)
+{
+  NDExecutorWorker *pWorker;
+  char threadName[32];
+  int i;
+  static const char *functionName = "NDPluginExecutor";
+
+  if (numWorkers < 1) numWorkers = 1;
+  workerId_ = epicsThreadPrivateCreate();
+  event_ = epicsEventMustCreate(epicsEventEmpty);
+  // All the deques exist before any worker can look at them
+  for (i=0; i<numWorkers; i++) {
+    pWorker = new NDExecutorWorker;
+    pWorker->pExecutor = this;
+    pWorker->index = i;
+    pWorker->lock = epicsMutexMustCreate();
+    pWorker->exitEvent = epicsEventMustCreate(epicsEventEmpty);
+    workers_.push_back(pWorker);
+  }
+  for (i=0; i<numWorkers; i++) {
+    epicsSnprintf(threadName, sizeof(threadName), "NDExecutor%d", i);
+    if (!epicsThreadCreate(threadName, priority, stackSize, workerTaskC, workers_[i])) {
+      cantProceed("%s::%s: cannot create thread %s\n", driverName, functionName, threadName);
+    }
+  }
+}
+
+/** Destructor for NDPluginExecutor; calls shutdown() and deletes the deques.
+  * Tasks which have not been run are not deleted. */
+NDPluginExecutor::~NDPluginExecutor()
+{
+  size_t i;
+
+  shutdown();
+  for (i=0; i<workers_.size(); i++) {
+    epicsMutexDestroy(workers_[i]->lock);
+    epicsEventDestroy(workers_[i]->exitEvent);
+    delete workers_[i];
+  }
+  epicsEventDestroy(event_);
+  epicsThreadPrivateDelete(workerId_);
+}
+
+/** Stops the worker threads and waits for them to exit.  A worker which is running a task exits when the task
+  * returns.  Tasks which have not been run, and tasks submitted afterwards, are not run.
+  * Must not be called from a worker thread.
+  */
+void NDPluginExecutor::shutdown()
+{
+  size_t i;
+
+  if (epicsAtomicCmpAndSwapIntT(&exiting_, 0, 1) != 0) return;
+  // Each worker that exits signals the event again to wake the next one
+  epicsEventSignal(event_);
+  for (i=0; i<workers_.size(); i++) {
+    epicsEventMustWait(workers_[i]->exitEvent);
+  }
+}
+
+static NDPluginExecutor *pInstance;
+static epicsThreadOnceId instanceOnce = EPICS_THREAD_ONCE_INIT;
+
+/** Stops the workers of the executor shared by the plugins when the IOC exits.
+  * The executor is not deleted, because plugins may still submit tasks to it. */
+static void instanceExit(void *)
+{
+  pInstance->shutdown();
+}
+
+static void instanceInit(void *)
+{
+  int numWorkers = NDPluginExecutorThreads;
+  unsigned int priority = NDPluginExecutorPriority;
+  unsigned int stackSize = NDPluginExecutorStackSize;
+
+  if (numWorkers == 0) return;
+  if (numWorkers < 0) numWorkers = epicsThreadGetCPUs();
+  if (NDPluginExecutorPriority <= 0) priority = epicsThreadPriorityMedium;
+  if (NDPluginExecutorStackSize <= 0) stackSize = epicsThreadGetStackSize(epicsThreadStackBig);
+  pInstance = new NDPluginExecutor(numWorkers, priority, stackSize);
+  epicsAtExit(instanceExit, NULL);
+}
+
+/** Returns the executor shared by the plugins, creating it the first time if NDPluginExecutorThreads is not 0.
+  * \return Returns NULL if NDPluginExecutorThreads was 0 when this was first called. */
+NDPluginExecutor* NDPluginExecutor::getInstance()
+{
+  epicsThreadOnce(&instanceOnce, instanceInit, NULL);
+  return pInstance;
+}
+
+/** Submits a task to be run once by a worker thread.
+  * \param[in] pTask The task; it must not be deleted until it has run.
+  * \param[in] runLater If called from a worker thread, false runs the task next in this thread and true runs it
+  *   after the other tasks of this thread, which is fairer for a task which submits itself again.
+  */
+void NDPluginExecutor::submit(NDPluginExecutorTask *pTask, bool runLater)
+{
+  NDExecutorWorker *pWorker = (NDExecutorWorker *)epicsThreadPrivateGet(workerId_);
+
+  if (!pWorker) {
+    pWorker = workers_[(unsigned int)epicsAtomicIncrIntT(&nextWorker_) % workers_.size()];
+  }
+  epicsMutexLock(pWorker->lock);
+  if (runLater) pWorker->tasks.push_front(pTask);
+  else pWorker->tasks.push_back(pTask);
+  epicsMutexUnlock(pWorker->lock);
+  // Both increments are full barriers, so either a worker which is about to wait sees this task,
+  // or this sees that the worker is waiting
+  epicsAtomicIncrIntT(&numQueued_);
+  if (epicsAtomicGetIntT(&numWaiting_) > 0) epicsEventSignal(event_);
+}
+
+/** Returns the newest task of a worker, or else the oldest task of another worker, or NULL if there are none */
+NDPluginExecutorTask* NDPluginExecutor::takeTask(NDExecutorWorker *pWorker)
+{
+  NDPluginExecutorTask *pTask = NULL;
+  NDExecutorWorker *pVictim;
+  size_t i;
+
+  epicsMutexLock(pWorker->lock);
+  if (!pWorker->tasks.empty()) {
+    pTask = pWorker->tasks.back();
+    pWorker->tasks.pop_back();
+  }
+  epicsMutexUnlock(pWorker->lock);
+  for (i=1; !pTask && (i<workers_.size()); i++) {
+    pVictim = workers_[(pWorker->index + i) % workers_.size()];
+    epicsMutexLock(pVictim->lock);
+    if (!pVictim->tasks.empty()) {
+      pTask = pVictim->tasks.front();
+      pVictim->tasks.pop_front();
+    }
+    epicsMutexUnlock(pVictim->lock);
+  }
+  if (!pTask) return NULL;
+  // The event only remembers one signal, so if more tasks were submitted while several workers
+  // were waiting wake another one
+  if ((epicsAtomicDecrIntT(&numQueued_) > 0) && (epicsAtomicGetIntT(&numWaiting_) > 0)) {
+    epicsEventSignal(event_);
+  }
+  return pTask;
+}
+
+/** The loop of a worker thread, which runs tasks and waits when there are none, until shutdown() is called.
+  * This method should really be private, but it must be called from a C-linkage function. */
+void NDPluginExecutor::workerTask(NDExecutorWorker *pWorker)
+{
+  NDPluginExecutorTask *pTask;
+
+  epicsThreadPrivateSet(workerId_, pWorker);
+  /* Keep a per-thread cache of free NDArrays, as the threads of each plugin do */
+  NDArrayPool::setThreadCache(1);
+  while (!epicsAtomicGetIntT(&exiting_)) {
+    pTask = takeTask(pWorker);
+    if (pTask) {
+      pTask->runTask();
+      continue;
+    }
+    epicsAtomicIncrIntT(&numWaiting_);
+    // Check again after saying we are waiting, a task may have been submitted before submit() saw numWaiting_.
+    // numQueued_ can briefly be less than 0 if a task is taken before submit() counts it.
+    if ((epicsAtomicGetIntT(&numQueued_) <= 0) && !epicsAtomicGetIntT(&exiting_)) epicsEventWait(event_);
+    epicsAtomicDecrIntT(&numWaiting_);
+  }
+  NDArrayPool::setThreadCache(0);
+  // Wake the next waiting worker so that it also sees exiting_
+  epicsEventSignal(event_);
+  epicsEventSignal(pWorker->exitEvent);
+}
+
+/** Returns the number of worker threads */
+int NDPluginExecutor::numWorkers()
+{
+  return (int)workers_.size();
+}
@@ -0,0 +1,51 @@
+#ifndef NDPLUGINEXECUTOR_H
+#define NDPLUGINEXECUTOR_H
+
+#include <vector>
+
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <shareLib.h>
+
+/** A task which is run by an NDPluginExecutor worker thread.
+  * The executor does not delete tasks; a task may be submitted again while it is running. */
+class epicsShareClass NDPluginExecutorTask {
+public:
+  virtual ~NDPluginExecutorTask() {}
+  virtual void runTask() = 0;
+};
+
+struct NDExecutorWorker;
+
+/** A fixed set of worker threads shared by the plugins in the IOC, see NDPluginExecutorThreads.
+  * Each worker has its own deque of tasks.  A task submitted from a worker thread, e.g. by a plugin
+  * passing an NDArray to the next plugin, goes on the back of that worker's deque and is run next by the
+  * same thread, whose caches hold the NDArray.  Tasks submitted from other threads are shared round-robin
+  * between the workers.  A worker with no tasks steals the oldest task from the front of another worker's
+  * deque, so a busy plugin can use all of the workers while idle plugins use none.
+  * Idle workers wait on an epicsEvent, which is only signalled when a worker is waiting.
+  * shutdown() stops the workers; the executor shared by the plugins is shut down when the IOC exits.
+  */
+class epicsShareClass NDPluginExecutor {
+public:
+  NDPluginExecutor(int numWorkers, unsigned int priority, unsigned int stackSize);
+  ~NDPluginExecutor();
+  static NDPluginExecutor* getInstance();
+  void submit(NDPluginExecutorTask *pTask, bool runLater=false);
+  void shutdown();
+  int numWorkers();
+  void workerTask(struct NDExecutorWorker *pWorker);
+
+private:
+  NDPluginExecutorTask* takeTask(struct NDExecutorWorker *pWorker);
+
+  std::vector<struct NDExecutorWorker*> workers_;
+  epicsThreadPrivateId workerId_;   /**< The NDExecutorWorker of the current thread, NULL if not a worker */
+  epicsEventId event_;
+  int nextWorker_;                  /**< Counter to choose the worker for tasks submitted from other threads */
+  int numQueued_;                   /**< Number of tasks in the deques */
+  int numWaiting_;                  /**< Number of workers waiting for a task */
+  int exiting_;                     /**< Set by shutdown() to make the workers exit */
+};
+
+#endif
@@ -81,6 +81,9 @@ NDPluginFFT::NDPluginFFT(const char *portName, int queueSize, int blockingCallba
   /* Set the plugin type string */
   setStringParam(NDPluginDriverPluginType, "NDPluginFFT");
   
+  /* This plugin does not read any attributes */
+  setAttributesUsed(false);
+
   /* Try to connect to the array port */
   connectToArrayPort();
 
@@ -314,8 +314,14 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
   /* Call the base class method */
   NDPluginDriver::beginProcessCallbacks(pArray);
 
-  /* Copy the input array so we can modify it. */
-  pOutput = this->pNDArrayPool->copy(pArray, NULL, 1);
+  /* Get an array we can modify.  This is the input array itself if no other plugin is using it. */
+  pOutput = NDPluginDriver::makeWritable(pArray, true);
+  if (!pOutput) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s::%s error allocating output array\n",
+      driverName, functionName);
+    return;
+  }
   
   /* Get information about the array needed later */
   pOutput->getInfo(&arrayInfo);
@@ -51,14 +51,16 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
     NDDimension_t dims[ND_ARRAY_MAX_DIMS], tempDim, *pDim;
     size_t userDims[ND_ARRAY_MAX_DIMS];
     NDArrayInfo arrayInfo, scratchInfo;
-    NDArray *pScratch, *pOutput;
+    NDArray *pScratch, *pOutput = NULL;
     NDColorMode_t colorMode;
     double *pData;
     int enableScale, enableDim[3], autoSize[3];
     size_t i;
     double scale;
     int collapseDims;
-    //static const char* functionName = "processCallbacks";
+    int enableView;
+    bool makeView;
+    static const char* functionName = "processCallbacks";
     
     memset(dims, 0, sizeof(NDDimension_t) * ND_ARRAY_MAX_DIMS);
 
@@ -79,6 +81,7 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
     getIntegerParam(NDPluginROIEnableScale,  &enableScale);
     getDoubleParam(NDPluginROIScale, &scale);
     getIntegerParam(NDPluginROICollapseDims, &collapseDims);
+    getIntegerParam(NDPluginROIEnableView,   &enableView);
 
     /* Call the base class method */
     NDPluginDriver::beginProcessCallbacks(pArray);
@@ -166,7 +169,17 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
         dims[2] = tempDim;
     }
     
-    if (enableScale && (scale != 0) && (scale != 1)) {
+    /* If views are enabled and the ROI is only a region of the input array, without binning, reversal,
+     * scaling or data type conversion, then output a view of the input array, which does not copy the data */
+    makeView = enableView && (dataType == (int)pArray->dataType) && !(enableScale && (scale != 0) && (scale != 1));
+    for (dim=0; dim<pArray->ndims; dim++) {
+        if ((dims[dim].binning != 1) || dims[dim].reverse) makeView = false;
+    }
+
+    if (makeView) {
+        pOutput = this->pNDArrayPool->createView(pArray, dims);
+    }
+    else if (enableScale && (scale != 0) && (scale != 1)) {
         /* This is tricky.  We want to do the operation to avoid errors due to integer truncation.
          * For example, if an image with all pixels=1 is binned 3x3 with scale=9 (divide by 9), then
          * the output should also have all pixels=1. 
@@ -182,6 +195,13 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
     else {        
         this->pNDArrayPool->convert(pArray, &pOutput, (NDDataType_t)dataType, dims);
     }
+    if (!pOutput) {
+        this->lock();
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error allocating output array\n",
+            driverName, functionName);
+        return;
+    }
 
     /* If we selected just one color from the array, then we need to collapse the
      * dimensions and set the color mode to mono */
@@ -355,10 +375,20 @@ NDPluginROI::NDPluginROI(const char *portName, int queueSize, int blockingCallba
     createParam(NDPluginROIEnableScaleString,       asynParamInt32, &NDPluginROIEnableScale);
     createParam(NDPluginROIScaleString,             asynParamFloat64, &NDPluginROIScale);
     createParam(NDPluginROICollapseDimsString,      asynParamInt32, &NDPluginROICollapseDims);
+    createParam(NDPluginROIEnableViewString,        asynParamInt32, &NDPluginROIEnableView);
+
+    /* A view keeps the whole input array in use, so views are only output if enabled */
+    setIntegerParam(NDPluginROIEnableView, 0);
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginROI");
 
+    /* convert() and NDArrayPool::createView() handle input arrays which are views */
+    acceptsStridedArrays_ = true;
+
+    /* This plugin does not read any attributes */
+    setAttributesUsed(false);
+
     /* Try to connect to the array port */
     connectToArrayPort();
 }
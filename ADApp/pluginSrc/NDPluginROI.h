@@ -32,6 +32,7 @@
 #define NDPluginROIEnableScaleString        "ENABLE_SCALE"      /* (asynInt32,   r/w) Disable/Enable scaling */
 #define NDPluginROIScaleString              "SCALE_VALUE"       /* (asynFloat64, r/w) Scaling value, used as divisor */
 #define NDPluginROICollapseDimsString       "COLLAPSE_DIMS"     /* (asynInt32,   r/w) Collapse dimensions of size 1 */
+#define NDPluginROIEnableViewString         "ENABLE_VIEW"       /* (asynInt32,   r/w) Output a view of the input array when possible */
 
 /** Extract Regions-Of-Interest (ROI) from NDArray data; the plugin can be a source of NDArray callbacks for
   * other plugins, passing these sub-arrays. 
@@ -77,6 +78,7 @@ protected:
     int NDPluginROIEnableScale;
     int NDPluginROIScale;
     int NDPluginROICollapseDims;
+    int NDPluginROIEnableView;
 
 private:
     int requestedSize_[3];
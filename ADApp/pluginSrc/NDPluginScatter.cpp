@@ -41,7 +41,8 @@ void NDPluginScatter::processCallbacks(NDArray *pArray)
 
     getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
     if (arrayCallbacks == 1) {
-        NDArray *pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 1);
+        // Only the attributes are changed, so the data are not copied
+        NDArray *pArrayOut = NDPluginDriver::makeWritable(pArray, false);
         if (NULL != pArrayOut) {
             this->getAttributes(pArrayOut->pAttributeList);
             this->unlock();
@@ -932,6 +932,9 @@ NDPluginStats::NDPluginStats(const char *portName, int queueSize, int blockingCa
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginStats");
 
+    /* This plugin does not read any attributes */
+    setAttributesUsed(false);
+
     /* Try to connect to the array port */
     connectToArrayPort();
 }
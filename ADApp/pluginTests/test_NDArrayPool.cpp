@@ -0,0 +1,883 @@
+/*
+ * test_NDArrayPool.cpp
+ *
+ *  Tests and benchmarks for NDArrayPool.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and EPICS dependencies
+#include <NDArray.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+static const int numThreads = 8;
+static const int numLoops = 200000;
+
+// Old behaviour of NDArrayPool::reserve()/release(): a pool-wide mutex around every
+// reference count change.  Used as the baseline for the contention benchmark.
+struct LockedRefCount
+{
+    epicsMutexId lock;
+    int count;
+};
+
+struct RefCountThreadArgs
+{
+    NDArray *pArray;
+    LockedRefCount *pLocked;
+    int loops;
+    epicsEventId start;
+    epicsEventId done;
+};
+
+static void atomicRefCountThread(void *arg)
+{
+    RefCountThreadArgs *pArgs = (RefCountThreadArgs *)arg;
+    epicsEventWait(pArgs->start);
+    for (int i=0; i<pArgs->loops; i++) {
+        pArgs->pArray->reserve();
+        pArgs->pArray->release();
+    }
+    epicsEventSignal(pArgs->done);
+}
+
+static void lockedRefCountThread(void *arg)
+{
+    RefCountThreadArgs *pArgs = (RefCountThreadArgs *)arg;
+    epicsEventWait(pArgs->start);
+    for (int i=0; i<pArgs->loops; i++) {
+        epicsMutexLock(pArgs->pLocked->lock);
+        pArgs->pLocked->count++;
+        epicsMutexUnlock(pArgs->pLocked->lock);
+        epicsMutexLock(pArgs->pLocked->lock);
+        pArgs->pLocked->count--;
+        epicsMutexUnlock(pArgs->pLocked->lock);
+    }
+    epicsEventSignal(pArgs->done);
+}
+
+// Starts numThreads threads running func, waits for them all to finish and returns the elapsed time
+static double runRefCountThreads(EPICSTHREADFUNC func, NDArray *pArray, LockedRefCount *pLocked, int loops)
+{
+    vector<RefCountThreadArgs> args(numThreads);
+    epicsTimeStamp tStart, tEnd;
+    char threadName[32];
+    int i;
+
+    for (i=0; i<numThreads; i++) {
+        args[i].pArray = pArray;
+        args[i].pLocked = pLocked;
+        args[i].loops = loops;
+        args[i].start = epicsEventMustCreate(epicsEventEmpty);
+        args[i].done = epicsEventMustCreate(epicsEventEmpty);
+        epicsSnprintf(threadName, sizeof(threadName), "refCount%d", i);
+        epicsThreadCreate(threadName, epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          func, &args[i]);
+    }
+    epicsTimeGetCurrent(&tStart);
+    for (i=0; i<numThreads; i++) epicsEventSignal(args[i].start);
+    for (i=0; i<numThreads; i++) epicsEventWait(args[i].done);
+    epicsTimeGetCurrent(&tEnd);
+    for (i=0; i<numThreads; i++) {
+        epicsEventDestroy(args[i].start);
+        epicsEventDestroy(args[i].done);
+    }
+    return epicsTimeDiffInSeconds(&tEnd, &tStart);
+}
+
+BOOST_AUTO_TEST_CASE(test_ReferenceCount)
+{
+    NDArrayPool pool(10, 0);
+    size_t dims[2] = {64, 64};
+
+    NDArray *pArray = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArray != NULL);
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 1);
+    BOOST_CHECK_EQUAL(pool.numFree(), 0);
+
+    // Concurrent reserve/release pairs must leave the count unchanged
+    runRefCountThreads(atomicRefCountThread, pArray, NULL, 10000);
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 1);
+    BOOST_CHECK_EQUAL(pool.numFree(), 0);
+
+    pArray->reserve();
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 2);
+    pArray->release();
+    BOOST_CHECK_EQUAL(pool.numFree(), 0);
+
+    // Releasing the last reference returns the array to the free list
+    pArray->release();
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 0);
+    BOOST_CHECK_EQUAL(pool.numFree(), 1);
+
+    // ... from which it is reused
+    NDArray *pArray2 = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    BOOST_CHECK(pArray2 == pArray);
+    BOOST_CHECK_EQUAL(pArray2->getReferenceCount(), 1);
+    BOOST_CHECK_EQUAL(pool.numBuffers(), 1);
+    pArray2->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_ReferenceCountContention)
+{
+    NDArrayPool pool(10, 0);
+    size_t dims[2] = {64, 64};
+    LockedRefCount locked;
+    double lockedTime, atomicTime;
+
+    NDArray *pArray = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArray != NULL);
+
+    locked.lock = epicsMutexMustCreate();
+    locked.count = 1;
+    lockedTime = runRefCountThreads(lockedRefCountThread, NULL, &locked, numLoops);
+    BOOST_CHECK_EQUAL(locked.count, 1);
+    epicsMutexDestroy(locked.lock);
+
+    atomicTime = runRefCountThreads(atomicRefCountThread, pArray, NULL, numLoops);
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 1);
+
+    BOOST_TEST_MESSAGE("reserve/release contention, " << numThreads << " threads x " << numLoops << " pairs:");
+    BOOST_TEST_MESSAGE("  pool mutex:       " << lockedTime << " s, "
+                       << lockedTime*1e9/(numThreads*numLoops) << " ns/pair");
+    BOOST_TEST_MESSAGE("  atomic refcount:  " << atomicTime << " s, "
+                       << atomicTime*1e9/(numThreads*numLoops) << " ns/pair");
+    pArray->release();
+    BOOST_CHECK_EQUAL(pool.numFree(), 1);
+}
+
+struct AllocThreadArgs
+{
+    NDArrayPool *pPool;
+    int threadCache;
+    int numArrays;
+    int loops;
+    int numFailed;
+    epicsEventId start;
+    epicsEventId done;
+};
+
+static void allocThread(void *arg)
+{
+    AllocThreadArgs *pArgs = (AllocThreadArgs *)arg;
+    vector<NDArray *> arrays(pArgs->numArrays);
+    size_t dims[2] = {64, 64};
+    int i, j;
+
+    if (pArgs->threadCache) NDArrayPool::setThreadCache(1);
+    epicsEventWait(pArgs->start);
+    for (i=0; i<pArgs->loops; i++) {
+        for (j=0; j<pArgs->numArrays; j++) {
+            arrays[j] = pArgs->pPool->alloc(2, dims, NDUInt8, 0, NULL);
+            if (!arrays[j]) pArgs->numFailed++;
+        }
+        for (j=0; j<pArgs->numArrays; j++) {
+            if (arrays[j]) arrays[j]->release();
+        }
+    }
+    if (pArgs->threadCache) NDArrayPool::setThreadCache(0);
+    epicsEventSignal(pArgs->done);
+}
+
+// Starts numThreads threads running allocThread, waits for them all to finish and returns the elapsed time
+static double runAllocThreads(NDArrayPool *pPool, int threadCache, int numArrays, int loops, int *pNumFailed)
+{
+    vector<AllocThreadArgs> args(numThreads);
+    epicsTimeStamp tStart, tEnd;
+    char threadName[32];
+    int i;
+
+    *pNumFailed = 0;
+    for (i=0; i<numThreads; i++) {
+        args[i].pPool = pPool;
+        args[i].threadCache = threadCache;
+        args[i].numArrays = numArrays;
+        args[i].loops = loops;
+        args[i].numFailed = 0;
+        args[i].start = epicsEventMustCreate(epicsEventEmpty);
+        args[i].done = epicsEventMustCreate(epicsEventEmpty);
+        epicsSnprintf(threadName, sizeof(threadName), "alloc%d", i);
+        epicsThreadCreate(threadName, epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          allocThread, &args[i]);
+    }
+    epicsTimeGetCurrent(&tStart);
+    for (i=0; i<numThreads; i++) epicsEventSignal(args[i].start);
+    for (i=0; i<numThreads; i++) epicsEventWait(args[i].done);
+    epicsTimeGetCurrent(&tEnd);
+    for (i=0; i<numThreads; i++) {
+        *pNumFailed += args[i].numFailed;
+        epicsEventDestroy(args[i].start);
+        epicsEventDestroy(args[i].done);
+    }
+    return epicsTimeDiffInSeconds(&tEnd, &tStart);
+}
+
+BOOST_AUTO_TEST_CASE(test_ThreadCache)
+{
+    NDArrayPool pool(4, 0);
+    size_t dims[2] = {64, 64};
+    NDArray *pArrays[4];
+    int numFailed;
+    int i;
+
+    // Arrays released by a thread with the thread cache enabled stay in its magazine,
+    // but are still counted as free by the pool
+    NDArrayPool::setThreadCache(1);
+    for (i=0; i<4; i++) {
+        pArrays[i] = pool.alloc(2, dims, NDUInt8, 0, NULL);
+        BOOST_REQUIRE(pArrays[i] != NULL);
+    }
+    for (i=0; i<4; i++) pArrays[i]->release();
+    BOOST_CHECK_EQUAL(pool.numBuffers(), 4);
+    BOOST_CHECK_EQUAL(pool.numFree(), 4);
+
+    // The magazine is used again by the same thread
+    pArrays[0] = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    BOOST_CHECK(pArrays[0] == pArrays[3]);
+    BOOST_CHECK_EQUAL(pool.numFree(), 3);
+    pArrays[0]->release();
+
+    // Another thread at the maxBuffers limit reclaims the arrays in the magazine
+    runAllocThreads(&pool, 0, 4, 1, &numFailed);
+    BOOST_CHECK_EQUAL(numFailed, 0);
+    BOOST_CHECK_EQUAL(pool.numBuffers(), 4);
+    BOOST_CHECK_EQUAL(pool.numFree(), 4);
+
+    NDArrayPool::setThreadCache(0);
+    BOOST_CHECK_EQUAL(pool.numFree(), 4);
+    BOOST_CHECK_EQUAL(pool.memorySize(), (size_t)4*64*64);
+}
+
+BOOST_AUTO_TEST_CASE(test_ThreadCacheReleaseOnly)
+{
+    NDArrayPool pool(0, 0);
+    size_t dims[2] = {64, 64};
+    NDArray *pArrays[2];
+    NDArray *pArray;
+    int i;
+
+    // A thread which has not allocated from the pool returns the arrays it releases to the free list,
+    // which gives out the array that was released first, rather than to a magazine, which gives out the last
+    for (i=0; i<2; i++) {
+        pArrays[i] = pool.alloc(2, dims, NDUInt8, 0, NULL);
+        BOOST_REQUIRE(pArrays[i] != NULL);
+    }
+    NDArrayPool::setThreadCache(1);
+    for (i=0; i<2; i++) pArrays[i]->release();
+    pArray = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    BOOST_CHECK(pArray == pArrays[0]);
+    pArray->release();
+    NDArrayPool::setThreadCache(0);
+    BOOST_CHECK_EQUAL(pool.numFree(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_ThreadCacheDeletedPool)
+{
+    NDArrayPool *pPool = new NDArrayPool(0, 0);
+    size_t dims[2] = {64, 64};
+    NDArray *pArray;
+
+    // A pool can be deleted while a thread still has a magazine for it
+    NDArrayPool::setThreadCache(1);
+    pArray = pPool->alloc(2, dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArray != NULL);
+    pArray->release();
+    BOOST_CHECK_EQUAL(pPool->numFree(), 1);
+    delete pPool;
+    NDArrayPool::flushThreadCache();
+
+    // A new pool does not use the magazine of the deleted one, even if it is at the same address
+    pPool = new NDArrayPool(0, 0);
+    pArray = pPool->alloc(2, dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArray != NULL);
+    BOOST_CHECK(pArray->pNDArrayPool == pPool);
+    pArray->release();
+    NDArrayPool::setThreadCache(0);
+    BOOST_CHECK_EQUAL(pPool->numFree(), 1);
+    delete pPool;
+}
+
+BOOST_AUTO_TEST_CASE(test_ThreadCacheContention)
+{
+    NDArrayPool pool(0, 0);
+    double lockedTime, cachedTime;
+    int numFailed;
+    int loops = numLoops/10;
+
+    lockedTime = runAllocThreads(&pool, 0, 4, loops, &numFailed);
+    BOOST_CHECK_EQUAL(numFailed, 0);
+    BOOST_CHECK_EQUAL(pool.numFree(), pool.numBuffers());
+
+    cachedTime = runAllocThreads(&pool, 1, 4, loops, &numFailed);
+    BOOST_CHECK_EQUAL(numFailed, 0);
+    BOOST_CHECK_EQUAL(pool.numFree(), pool.numBuffers());
+
+    BOOST_TEST_MESSAGE("alloc/release contention, " << numThreads << " threads x " << loops*4 << " arrays:");
+    BOOST_TEST_MESSAGE("  pool free list:   " << lockedTime << " s, "
+                       << lockedTime*1e9/(numThreads*loops*4) << " ns/array");
+    BOOST_TEST_MESSAGE("  thread cache:     " << cachedTime << " s, "
+                       << cachedTime*1e9/(numThreads*loops*4) << " ns/array");
+}
+
+BOOST_AUTO_TEST_CASE(test_View)
+{
+    NDArrayPool pool(0, 0);
+    size_t dims[2] = {8, 6};
+    NDDimension_t viewDims[2];
+    epicsUInt16 *pData;
+    size_t x, y;
+
+    NDArray *pArray = pool.alloc(2, dims, NDUInt16, 0, NULL);
+    BOOST_REQUIRE(pArray != NULL);
+    pData = (epicsUInt16 *)pArray->pData;
+    for (y=0; y<dims[1]; y++) {
+        for (x=0; x<dims[0]; x++) pData[y*dims[0] + x] = (epicsUInt16)(100*y + x);
+    }
+    BOOST_CHECK(!pArray->isView());
+    BOOST_CHECK(pArray->isContiguous());
+    size_t memorySize = pool.memorySize();
+
+    // A rectangular region is a view which is not contiguous and references the parent data
+    pArray->initDimension(&viewDims[0], 3);
+    pArray->initDimension(&viewDims[1], 4);
+    viewDims[0].offset = 2;
+    viewDims[1].offset = 1;
+    NDArray *pView = pool.createView(pArray, viewDims);
+    BOOST_REQUIRE(pView != NULL);
+    BOOST_CHECK(pView->isView());
+    BOOST_CHECK(!pView->isContiguous());
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 2);
+    BOOST_CHECK_EQUAL(pool.memorySize(), memorySize);
+    BOOST_CHECK_EQUAL(pView->dims[0].size, 3);
+    BOOST_CHECK_EQUAL(pView->dims[1].size, 4);
+    BOOST_CHECK_EQUAL(pView->dims[0].offset, 2);
+    BOOST_CHECK_EQUAL(pView->dims[1].offset, 1);
+    BOOST_CHECK_EQUAL(pView->dims[0].stride, 1);
+    BOOST_CHECK_EQUAL(pView->dims[1].stride, 8);
+    BOOST_CHECK(pView->pData == (void *)&pData[1*8 + 2]);
+
+    // makeContiguous() copies it once
+    NDArray *pContig = pool.makeContiguous(pView);
+    BOOST_REQUIRE(pContig != NULL);
+    BOOST_CHECK(pContig != pView);
+    BOOST_CHECK(pContig->isContiguous());
+    BOOST_CHECK(!pContig->isView());
+    BOOST_CHECK_EQUAL(pContig->dims[1].stride, 0);
+    epicsUInt16 *pCopy = (epicsUInt16 *)pContig->pData;
+    for (y=0; y<4; y++) {
+        for (x=0; x<3; x++) BOOST_CHECK_EQUAL(pCopy[y*3 + x], 100*(y+1) + x+2);
+    }
+    NDArray *pContig2 = pool.makeContiguous(pView);
+    BOOST_CHECK(pContig2 == pContig);
+    pContig2->release();
+    pContig->release();
+
+    // convert() reads the view through its strides
+    NDArray *pConverted;
+    BOOST_REQUIRE_EQUAL(pool.convert(pView, &pConverted, NDFloat64), ND_SUCCESS);
+    epicsFloat64 *pDouble = (epicsFloat64 *)pConverted->pData;
+    for (y=0; y<4; y++) {
+        for (x=0; x<3; x++) BOOST_CHECK_EQUAL(pDouble[y*3 + x], 100*(y+1) + x+2);
+    }
+    BOOST_CHECK_EQUAL(pConverted->dims[0].offset, 2);
+    pConverted->release();
+
+    // A view of a view references the array which owns the data
+    pArray->initDimension(&viewDims[0], 2);
+    pArray->initDimension(&viewDims[1], 1);
+    viewDims[0].offset = 1;
+    viewDims[1].offset = 2;
+    NDArray *pView2 = pool.createView(pView, viewDims);
+    BOOST_REQUIRE(pView2 != NULL);
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 3);
+    BOOST_CHECK_EQUAL(pView2->dims[0].offset, 3);
+    BOOST_CHECK_EQUAL(pView2->dims[1].offset, 3);
+    BOOST_CHECK(pView2->isContiguous());
+    BOOST_CHECK_EQUAL(((epicsUInt16 *)pView2->pData)[1], 304);
+
+    // Releasing the views releases the parent
+    pView->release();
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 2);
+    pView2->release();
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 1);
+
+    // A band of full rows is contiguous
+    pArray->initDimension(&viewDims[0], 8);
+    pArray->initDimension(&viewDims[1], 2);
+    viewDims[1].offset = 3;
+    NDArray *pBand = pool.createView(pArray, viewDims);
+    BOOST_REQUIRE(pBand != NULL);
+    BOOST_CHECK(pBand->isContiguous());
+    BOOST_CHECK(pool.makeContiguous(pBand) == pBand);
+    BOOST_CHECK_EQUAL(pBand->getReferenceCount(), 2);
+    pBand->release();
+    pBand->release();
+
+    // Invalid regions are rejected
+    viewDims[1].offset = 5;
+    BOOST_CHECK(pool.createView(pArray, viewDims) == NULL);
+
+    pArray->release();
+    BOOST_CHECK_EQUAL(pool.numFree(), pool.numBuffers());
+}
+
+BOOST_AUTO_TEST_CASE(test_MakeWritable)
+{
+    NDArrayPool pool(0, 0);
+    size_t dims[2] = {4, 3};
+
+    NDArray *pArray = pool.alloc(2, dims, NDInt32, 0, NULL);
+    BOOST_REQUIRE(pArray != NULL);
+    memset(pArray->pData, 0, pArray->dataSize);
+    pArray->uniqueId = 7;
+
+    // If the caller holds the only reference then the array itself is returned
+    NDArray *pOut = pool.makeWritable(pArray, 1, 1);
+    BOOST_CHECK(pOut == pArray);
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 2);
+    pOut->release();
+
+    // If another reference exists then the data are copied
+    pArray->reserve();
+    pOut = pool.makeWritable(pArray, 1, 1);
+    BOOST_REQUIRE(pOut != NULL);
+    BOOST_CHECK(pOut != pArray);
+    BOOST_CHECK(pOut->pData != pArray->pData);
+    BOOST_CHECK_EQUAL(pOut->uniqueId, 7);
+    ((epicsInt32 *)pOut->pData)[0] = 1;
+    BOOST_CHECK_EQUAL(((epicsInt32 *)pArray->pData)[0], 0);
+    pOut->release();
+
+    // unless only the metadata will be changed, then a view shares the data
+    pOut = pool.makeWritable(pArray, 1, 0);
+    BOOST_REQUIRE(pOut != NULL);
+    BOOST_CHECK(pOut != pArray);
+    BOOST_CHECK(pOut->isView());
+    BOOST_CHECK(pOut->isContiguous());
+    BOOST_CHECK(pOut->pData == pArray->pData);
+    BOOST_CHECK_EQUAL(pOut->dims[0].size, 4);
+    BOOST_CHECK_EQUAL(pOut->dims[1].size, 3);
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 3);
+    pOut->uniqueId = 8;
+    BOOST_CHECK_EQUAL(pArray->uniqueId, 7);
+
+    // The data of a view belong to another array so they are always copied
+    NDArray *pOut2 = pool.makeWritable(pOut, 1, 1);
+    BOOST_REQUIRE(pOut2 != NULL);
+    BOOST_CHECK(pOut2 != pOut);
+    BOOST_CHECK(!pOut2->isView());
+    pOut2->release();
+    pOut2 = pool.makeWritable(pOut, 1, 0);
+    BOOST_CHECK(pOut2 == pOut);
+    pOut2->release();
+
+    pOut->release();
+    pArray->release();
+    BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 1);
+    pArray->release();
+    BOOST_CHECK_EQUAL(pool.numFree(), pool.numBuffers());
+}
+
+// Reference implementations of the conversions, used to check NDArrayPool::convert() and to compare its speed
+template <typename dataTypeIn, typename dataTypeOut> static void referenceConvert(const dataTypeIn *pIn, dataTypeOut *pOut,
+                                                                                size_t nElements)
+{
+    for (size_t i=0; i<nElements; i++) pOut[i] = (dataTypeOut)pIn[i];
+}
+
+template <typename dataTypeIn, typename dataTypeOut> static void referenceBin(const dataTypeIn *pIn, dataTypeOut *pOut,
+                                                                            size_t sizeX, size_t sizeY, int binning)
+{
+    size_t x, y;
+    memset(pOut, 0, (sizeX/binning)*(sizeY/binning)*sizeof(dataTypeOut));
+    for (y=0; y<sizeY/binning*binning; y++) {
+        for (x=0; x<sizeX/binning*binning; x++) {
+            pOut[(y/binning)*(sizeX/binning) + x/binning] += (dataTypeOut)pIn[y*sizeX + x];
+        }
+    }
+}
+
+static const int convertLoops = 20;
+
+// Global variables in NDArrayPool.cpp which control the threads used by NDArrayPool::convert()
+extern volatile int NDArrayPoolConvertThreads;
+extern volatile int NDArrayPoolConvertThreshold;
+extern volatile int NDArrayPoolMemoryBudget;
+
+// Times convertLoops calls to NDArrayPool::convert() and to the reference conversion, and checks the results are the same
+template <typename dataTypeIn, typename dataTypeOut> static void checkConvert(NDArrayPool *pPool, NDArray *pIn,
+                                                                            NDDataType_t outType, int binning,
+                                                                            const char *name)
+{
+    NDDimension_t dims[2];
+    size_t sizeX = pIn->dims[0].size, sizeY = pIn->dims[1].size;
+    size_t nOut = (sizeX/binning) * (sizeY/binning);
+    vector<dataTypeOut> reference(nOut);
+    NDArray *pOut = 0;
+    epicsTimeStamp tStart, tEnd;
+    double convertTime, referenceTime;
+    int i;
+
+    for (i=0; i<2; i++) {
+        pIn->initDimension(&dims[i], pIn->dims[i].size);
+        dims[i].binning = binning;
+    }
+    epicsTimeGetCurrent(&tStart);
+    for (i=0; i<convertLoops; i++) {
+        if (pOut) pOut->release();
+        BOOST_REQUIRE_EQUAL(pPool->convert(pIn, &pOut, outType, dims), ND_SUCCESS);
+    }
+    epicsTimeGetCurrent(&tEnd);
+    convertTime = epicsTimeDiffInSeconds(&tEnd, &tStart);
+    epicsTimeGetCurrent(&tStart);
+    for (i=0; i<convertLoops; i++) {
+        if (binning == 1) referenceConvert((dataTypeIn *)pIn->pData, &reference[0], nOut);
+        else referenceBin((dataTypeIn *)pIn->pData, &reference[0], sizeX, sizeY, binning);
+    }
+    epicsTimeGetCurrent(&tEnd);
+    referenceTime = epicsTimeDiffInSeconds(&tEnd, &tStart);
+    BOOST_CHECK_EQUAL(pOut->dims[0].size, sizeX/binning);
+    BOOST_CHECK(memcmp(pOut->pData, &reference[0], nOut*sizeof(dataTypeOut)) == 0);
+    BOOST_TEST_MESSAGE(name << ": convert " << convertTime/convertLoops*1e3 << " ms, reference loop "
+                       << referenceTime/convertLoops*1e3 << " ms");
+    pOut->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_Convert)
+{
+    NDArrayPool pool(0, 0);
+    size_t dims[2] = {1024, 1024};
+    size_t i;
+
+    NDArray *pUInt16 = pool.alloc(2, dims, NDUInt16, 0, NULL);
+    NDArray *pUInt8 = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    NDArray *pInt32 = pool.alloc(2, dims, NDInt32, 0, NULL);
+    NDArray *pFloat64 = pool.alloc(2, dims, NDFloat64, 0, NULL);
+    BOOST_REQUIRE(pUInt16 && pUInt8 && pInt32 && pFloat64);
+    for (i=0; i<dims[0]*dims[1]; i++) {
+        ((epicsUInt16 *)pUInt16->pData)[i] = (epicsUInt16)(i*7);
+        ((epicsUInt8 *)pUInt8->pData)[i] = (epicsUInt8)(i*3);
+        ((epicsInt32 *)pInt32->pData)[i] = (epicsInt32)(i*1001) - 500000000;
+        ((epicsFloat64 *)pFloat64->pData)[i] = (epicsFloat64)(i % 60000) + 0.25;
+    }
+
+    BOOST_TEST_MESSAGE("NDArrayPool::convert() for " << dims[0] << "x" << dims[1] << " arrays");
+    checkConvert<epicsUInt16, epicsFloat32>(&pool, pUInt16, NDFloat32, 1, "UInt16 to Float32");
+    checkConvert<epicsUInt16, epicsFloat64>(&pool, pUInt16, NDFloat64, 1, "UInt16 to Float64");
+    checkConvert<epicsUInt8, epicsFloat32>(&pool, pUInt8, NDFloat32, 1, "UInt8 to Float32");
+    checkConvert<epicsInt32, epicsFloat64>(&pool, pInt32, NDFloat64, 1, "Int32 to Float64");
+    checkConvert<epicsFloat64, epicsUInt16>(&pool, pFloat64, NDUInt16, 1, "Float64 to UInt16");
+    checkConvert<epicsFloat64, epicsInt32>(&pool, pFloat64, NDInt32, 1, "Float64 to Int32");
+    checkConvert<epicsUInt16, epicsUInt32>(&pool, pUInt16, NDUInt32, 2, "UInt16 to UInt32 2x2 binning");
+    checkConvert<epicsUInt16, epicsUInt32>(&pool, pUInt16, NDUInt32, 4, "UInt16 to UInt32 4x4 binning");
+    checkConvert<epicsUInt16, epicsFloat32>(&pool, pUInt16, NDFloat32, 2, "UInt16 to Float32 2x2 binning");
+    checkConvert<epicsFloat64, epicsFloat64>(&pool, pFloat64, NDFloat64, 4, "Float64 4x4 binning");
+
+    pUInt16->release();
+    pUInt8->release();
+    pInt32->release();
+    pFloat64->release();
+
+    // Conversions from floating point to integer types saturate, and NaN converts to 0
+    size_t satDims[1] = {5};
+    epicsFloat64 satValues[5] = {-5., 70000., 1.75, 65535., 0.};
+    satValues[4] = sqrt(-1.);
+    NDArray *pSat = pool.alloc(1, satDims, NDFloat64, 0, NULL);
+    NDArray *pOut;
+    BOOST_REQUIRE(pSat != NULL);
+    memcpy(pSat->pData, satValues, sizeof(satValues));
+    BOOST_REQUIRE_EQUAL(pool.convert(pSat, &pOut, NDUInt16), ND_SUCCESS);
+    epicsUInt16 *pUInt16Out = (epicsUInt16 *)pOut->pData;
+    BOOST_CHECK_EQUAL(pUInt16Out[0], 0);
+    BOOST_CHECK_EQUAL(pUInt16Out[1], 65535);
+    BOOST_CHECK_EQUAL(pUInt16Out[2], 1);
+    BOOST_CHECK_EQUAL(pUInt16Out[3], 65535);
+    BOOST_CHECK_EQUAL(pUInt16Out[4], 0);
+    pOut->release();
+    BOOST_REQUIRE_EQUAL(pool.convert(pSat, &pOut, NDInt8), ND_SUCCESS);
+    epicsInt8 *pInt8Out = (epicsInt8 *)pOut->pData;
+    BOOST_CHECK_EQUAL(pInt8Out[0], -5);
+    BOOST_CHECK_EQUAL(pInt8Out[1], 127);
+    BOOST_CHECK_EQUAL(pInt8Out[4], 0);
+    pOut->release();
+    pSat->release();
+}
+
+// Converts pIn with the given dimensions using numConvertThreads threads and returns the time per conversion
+static double timeConvert(NDArrayPool *pPool, NDArray *pIn, NDDataType_t outType, NDDimension_t *dims,
+                          int numConvertThreads, NDArray **ppOut)
+{
+    epicsTimeStamp tStart, tEnd;
+    int i;
+
+    NDArrayPoolConvertThreads = numConvertThreads;
+    *ppOut = 0;
+    epicsTimeGetCurrent(&tStart);
+    for (i=0; i<convertLoops; i++) {
+        if (*ppOut) (*ppOut)->release();
+        BOOST_REQUIRE_EQUAL(pPool->convert(pIn, ppOut, outType, dims), ND_SUCCESS);
+    }
+    epicsTimeGetCurrent(&tEnd);
+    return epicsTimeDiffInSeconds(&tEnd, &tStart)/convertLoops;
+}
+
+BOOST_AUTO_TEST_CASE(test_ConvertThreads)
+{
+    NDArrayPool pool(0, 0);
+    size_t dims[3] = {3, 2048, 2047};
+    NDDimension_t outDims[3];
+    NDArray *pSingle, *pThreaded;
+    NDArrayInfo_t arrayInfo;
+    double singleTime, threadedTime;
+    int savedThreads = NDArrayPoolConvertThreads;
+    int savedThreshold = NDArrayPoolConvertThreshold;
+    size_t i;
+    int test;
+
+    NDArray *pIn = pool.alloc(3, dims, NDUInt16, 0, NULL);
+    BOOST_REQUIRE(pIn != NULL);
+    for (i=0; i<dims[0]*dims[1]*dims[2]; i++) ((epicsUInt16 *)pIn->pData)[i] = (epicsUInt16)(i*13);
+    NDArrayPoolConvertThreshold = 1000;
+
+    // The result with threads must be identical to the result without threads, for type conversion,
+    // and for binning with a region and reversal where the output size is not a multiple of the number of threads
+    for (test=0; test<2; test++) {
+        for (i=0; i<3; i++) pIn->initDimension(&outDims[i], dims[i]);
+        if (test == 1) {
+            outDims[1].binning = 2;
+            outDims[2].offset = 5;
+            outDims[2].size = 2001;
+            outDims[2].binning = 3;
+            outDims[2].reverse = 1;
+        }
+        singleTime = timeConvert(&pool, pIn, NDFloat32, outDims, 1, &pSingle);
+        threadedTime = timeConvert(&pool, pIn, NDFloat32, outDims, 4, &pThreaded);
+        pSingle->getInfo(&arrayInfo);
+        BOOST_CHECK_EQUAL(pThreaded->dims[2].size, pSingle->dims[2].size);
+        BOOST_CHECK(memcmp(pThreaded->pData, pSingle->pData, arrayInfo.totalBytes) == 0);
+        BOOST_TEST_MESSAGE((test ? "Binned" : "UInt16 to Float32") << " conversion: 1 thread " << singleTime*1e3
+                           << " ms, 4 threads " << threadedTime*1e3 << " ms");
+        pSingle->release();
+        pThreaded->release();
+    }
+
+    NDArrayPoolConvertThreads = savedThreads;
+    NDArrayPoolConvertThreshold = savedThreshold;
+    pIn->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_PreAllocate)
+{
+    NDArrayPool pool(0, 0);
+    size_t dims[2] = {1024, 512};
+    NDArray *pArrays[3];
+    int i;
+
+    // The pre-allocated arrays are in the free list, and are used by alloc()
+    BOOST_CHECK_EQUAL(pool.preAllocate(3, 2, dims, NDUInt16, 0), ND_SUCCESS);
+    BOOST_CHECK_EQUAL(pool.numBuffers(), 3);
+    BOOST_CHECK_EQUAL(pool.numFree(), 3);
+    BOOST_CHECK_EQUAL(pool.memorySize(), 3*dims[0]*dims[1]*sizeof(epicsUInt16));
+    for (i=0; i<3; i++) {
+        pArrays[i] = pool.alloc(2, dims, NDUInt16, 0, NULL);
+        BOOST_REQUIRE(pArrays[i] != NULL);
+    }
+    BOOST_CHECK_EQUAL(pool.numBuffers(), 3);
+    BOOST_CHECK_EQUAL(pool.numFree(), 0);
+    for (i=0; i<3; i++) pArrays[i]->release();
+
+    // Pre-allocating more arrays than maxBuffers fails, but leaves the arrays it allocated in the free list
+    NDArrayPool smallPool(2, 0);
+    BOOST_CHECK_EQUAL(smallPool.preAllocate(3, 2, dims, NDUInt16, 0), ND_ERROR);
+    BOOST_CHECK_EQUAL(smallPool.numBuffers(), 2);
+    BOOST_CHECK_EQUAL(smallPool.numFree(), 2);
+}
+
+struct DelayedReleaseArgs
+{
+    NDArray *pArray;
+    double delay;
+    epicsEventId done;
+};
+
+static void delayedReleaseThread(void *arg)
+{
+    DelayedReleaseArgs *pArgs = (DelayedReleaseArgs *)arg;
+    epicsThreadSleep(pArgs->delay);
+    pArgs->pArray->release();
+    epicsEventSignal(pArgs->done);
+}
+
+BOOST_AUTO_TEST_CASE(test_AllocTimeout)
+{
+    NDArrayPool pool(1, 0);
+    size_t dims[2] = {64, 64};
+    DelayedReleaseArgs args;
+    epicsTimeStamp tStart, tEnd;
+    NDArray *pArray, *pArray2;
+
+    // Without a timeout alloc() fails immediately when maxBuffers is reached
+    BOOST_CHECK_EQUAL(pool.allocTimeout(), 0.);
+    pArray = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArray != NULL);
+    BOOST_CHECK(pool.alloc(2, dims, NDUInt8, 0, NULL) == NULL);
+    BOOST_CHECK_EQUAL(pool.numAllocWaits(), 0);
+
+    // With a timeout alloc() gets the array released by another thread
+    pool.setAllocTimeout(5.0);
+    args.pArray = pArray;
+    args.delay = 0.1;
+    args.done = epicsEventCreate(epicsEventEmpty);
+    epicsThreadCreate("delayedRelease", epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackSmall),
+                      delayedReleaseThread, &args);
+    epicsTimeGetCurrent(&tStart);
+    pArray2 = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    epicsTimeGetCurrent(&tEnd);
+    BOOST_REQUIRE(pArray2 != NULL);
+    BOOST_CHECK(epicsTimeDiffInSeconds(&tEnd, &tStart) < 5.0);
+    BOOST_CHECK_EQUAL(pool.numAllocWaits(), 1);
+    BOOST_CHECK_EQUAL(pool.numAllocTimeouts(), 0);
+    epicsEventWait(args.done);
+
+    // If no array is released it fails after the timeout
+    pool.setAllocTimeout(0.2);
+    epicsTimeGetCurrent(&tStart);
+    BOOST_CHECK(pool.alloc(2, dims, NDUInt8, 0, NULL) == NULL);
+    epicsTimeGetCurrent(&tEnd);
+    BOOST_CHECK(epicsTimeDiffInSeconds(&tEnd, &tStart) >= 0.19);
+    BOOST_CHECK_EQUAL(pool.numAllocWaits(), 2);
+    BOOST_CHECK_EQUAL(pool.numAllocTimeouts(), 1);
+
+    pArray2->release();
+    epicsEventDestroy(args.done);
+}
+
+BOOST_AUTO_TEST_CASE(test_Stats)
+{
+    NDArrayPool pool(2, 2*4096);
+    size_t dims[1] = {4096};
+    size_t bigDims[1] = {8192};
+    NDArrayPoolStats_t stats;
+    NDArray *pArrays[2];
+    int i, sum;
+
+    pool.setCollectTiming(1);
+    for (i=0; i<2; i++) pArrays[i] = pool.alloc(1, dims, NDInt8, 0, NULL);
+    BOOST_CHECK(pool.alloc(1, dims, NDInt8, 0, NULL) == NULL);
+    for (i=0; i<2; i++) pArrays[i]->release();
+    // Reusing a free array does not allocate memory
+    pArrays[0] = pool.alloc(1, dims, NDInt8, 0, NULL);
+    pArrays[0]->release();
+    // The buffers of the free arrays must be freed to stay within maxMemory
+    pArrays[0] = pool.alloc(1, bigDims, NDInt8, 0, NULL);
+    BOOST_REQUIRE(pArrays[0] != NULL);
+    pArrays[0]->release();
+
+    pool.getStats(&stats);
+    BOOST_CHECK_EQUAL(stats.numAllocs, 4);
+    BOOST_CHECK_EQUAL(stats.numMallocs, 3);
+    BOOST_CHECK_EQUAL(stats.numEvictions, 1);
+    BOOST_CHECK_EQUAL(stats.numAllocFailures, 1);
+    BOOST_CHECK_EQUAL(stats.peakBuffersInUse, 2);
+    BOOST_CHECK_EQUAL(stats.peakMemory, (size_t)(2*4096));
+    for (sum=0, i=0; i<ND_ARRAY_POOL_HIST_BINS; i++) sum += stats.allocTimeHist[i];
+    BOOST_CHECK_EQUAL(sum, 5);
+    for (sum=0, i=0; i<ND_ARRAY_POOL_HIST_BINS; i++) sum += stats.lockWaitHist[i];
+    BOOST_CHECK_EQUAL(sum, 5);
+    BOOST_CHECK(stats.maxAllocTimeNs > 0);
+
+    // Resetting sets the peak values to the current values
+    pool.resetStats();
+    pool.getStats(&stats);
+    BOOST_CHECK_EQUAL(stats.numAllocs, 0);
+    BOOST_CHECK_EQUAL(stats.peakBuffersInUse, 0);
+    BOOST_CHECK_EQUAL(stats.peakMemory, (size_t)8192);
+}
+
+// Restores NDArrayPoolMemoryBudget when a test ends, including when a BOOST_REQUIRE fails
+struct MemoryBudgetGuard
+{
+    MemoryBudgetGuard() : savedBudget(NDArrayPoolMemoryBudget) {}
+    ~MemoryBudgetGuard() { NDArrayPoolMemoryBudget = savedBudget; }
+    int savedBudget;
+};
+
+BOOST_AUTO_TEST_CASE(test_MemoryBudget)
+{
+    MemoryBudgetGuard guard;
+    NDArrayPool pool1(0, 0);
+    NDArrayPool pool2(0, 0);
+    NDArrayPool pool3(0, 0);
+    size_t dims[1];
+    size_t baseMemory, room, numFit;
+    std::vector<NDArray *> arrays;
+    NDArray *pArrays[4];
+    NDArray *pArray;
+    int i;
+
+    // Free the unused buffers of the other pools in this test program, so that the rest of their
+    // memory is in use and only the buffers of the pools in this test are freed to stay within the budget
+    {
+        NDArrayPool flushPool(0, 0);
+        NDArrayPoolMemoryBudget = 1;
+        dims[0] = 1048576;
+        pArray = flushPool.alloc(1, dims, NDInt8, 0, NULL);
+        if (pArray) pArray->release();
+    }
+
+    // The budget leaves room for 8 arrays besides the memory of the other pools
+    baseMemory = NDArrayPool::totalMemorySize();
+    NDArrayPoolMemoryBudget = (int)(baseMemory / 1048576) + 2;
+    room = (size_t)NDArrayPoolMemoryBudget * 1048576 - baseMemory;
+    dims[0] = room / 8;
+    numFit = room / dims[0];
+    BOOST_REQUIRE_EQUAL(numFit, (size_t)8);
+
+    // pool1 uses all of the budget, and keeps the buffers in its free list
+    for (i=0; i<(int)numFit; i++) {
+        arrays.push_back(pool1.alloc(1, dims, NDInt8, 0, NULL));
+        BOOST_REQUIRE(arrays.back() != NULL);
+    }
+    BOOST_CHECK(pool1.alloc(1, dims, NDInt8, 0, NULL) == NULL);
+    BOOST_CHECK(pool2.alloc(1, dims, NDInt8, 0, NULL) == NULL);
+    for (i=0; i<(int)numFit; i++) arrays[i]->release();
+
+    // pool2 gets memory by freeing the unused buffers of pool1
+    for (i=0; i<4; i++) {
+        pArrays[i] = pool2.alloc(1, dims, NDInt8, 0, NULL);
+        BOOST_REQUIRE(pArrays[i] != NULL);
+    }
+    BOOST_CHECK_EQUAL(pool1.memorySize(), (numFit-4)*dims[0]);
+    BOOST_CHECK(NDArrayPool::totalMemorySize() <= (size_t)NDArrayPoolMemoryBudget * 1048576);
+
+    // The unused buffers of the pool which exceeds its share of the budget by the most are freed first.
+    // pool1 and pool2 have the same memory, but pool1 has 4 times the weight of pool2 and so a larger share
+    pool1.setMemoryWeight(2.0);
+    pool2.setMemoryWeight(0.5);
+    for (i=0; i<4; i++) pArrays[i]->release();
+    arrays.clear();
+    for (i=0; i<2; i++) arrays.push_back(pool3.alloc(1, dims, NDInt8, 0, NULL));
+    BOOST_CHECK_EQUAL(pool1.memorySize(), (numFit-4)*dims[0]);
+    BOOST_CHECK_EQUAL(pool2.memorySize(), 2*dims[0]);
+    // Once the buffers of all pools are in use allocations fail
+    while ((pArray = pool3.alloc(1, dims, NDInt8, 0, NULL)) != NULL) arrays.push_back(pArray);
+    BOOST_CHECK_EQUAL(arrays.size(), numFit);
+    BOOST_CHECK_EQUAL(pool1.memorySize(), (size_t)0);
+    BOOST_CHECK_EQUAL(pool2.memorySize(), (size_t)0);
+    for (i=0; i<(int)arrays.size(); i++) arrays[i]->release();
+}
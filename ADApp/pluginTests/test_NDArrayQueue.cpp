@@ -0,0 +1,255 @@
+/*
+ * test_NDArrayQueue.cpp
+ *
+ *  Tests for NDArrayQueue, the input queue of NDPluginDriver.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and EPICS dependencies
+#include <NDArrayQueue.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMessageQueue.h>
+#include <epicsTime.h>
+
+#include <string.h>
+
+using namespace std;
+
+static const int numSenders = 4;
+static const int numReceivers = 4;
+static const int numPerSender = 100000;
+static const int numHops = 100000;
+static const int queueSize = 20;
+
+// The queue does not dereference the pointers, so the tests send integers
+static NDArray* toArray(size_t i)
+{
+  return (NDArray *)i;
+}
+
+BOOST_AUTO_TEST_CASE(test_SendReceive)
+{
+  NDArrayQueue queue(3);
+  NDArray *pArray;
+  size_t i, j;
+
+  BOOST_CHECK_EQUAL(queue.capacity(), 3);
+  BOOST_CHECK_EQUAL(queue.pending(), 0);
+  BOOST_CHECK(!queue.tryReceive(&pArray));
+  for (i=1; i<=3; i++) {
+    BOOST_CHECK(queue.trySend(toArray(i)));
+  }
+  BOOST_CHECK(!queue.trySend(toArray(4)));
+  BOOST_CHECK_EQUAL(queue.pending(), 3);
+  for (i=1; i<=3; i++) {
+    BOOST_CHECK(queue.receive() == toArray(i));
+  }
+  BOOST_CHECK_EQUAL(queue.pending(), 0);
+  BOOST_CHECK(!queue.tryReceive(&pArray));
+
+  // The capacity is not a power of 2, so check it is kept as the queue wraps round its cells
+  for (i=0; i<1000; i++) {
+    for (j=1; j<=3; j++) BOOST_REQUIRE(queue.trySend(toArray(i*3 + j)));
+    BOOST_REQUIRE(!queue.trySend(toArray(1)));
+    for (j=1; j<=3; j++) BOOST_REQUIRE(queue.receive() == toArray(i*3 + j));
+  }
+
+  // NULL can be sent
+  BOOST_CHECK(queue.trySend(NULL));
+  BOOST_CHECK(queue.tryReceive(&pArray));
+  BOOST_CHECK(pArray == NULL);
+
+  // The send time is returned with the NDArray, and is 0 if none was sent
+  epicsTimeStamp sendTime, receiveTime;
+  epicsTimeGetCurrent(&sendTime);
+  BOOST_CHECK(queue.trySend(toArray(1), &sendTime));
+  BOOST_CHECK(queue.trySend(toArray(2)));
+  BOOST_CHECK(queue.receive(&receiveTime) == toArray(1));
+  BOOST_CHECK(epicsTimeEqual(&receiveTime, &sendTime));
+  BOOST_CHECK(queue.tryReceive(&pArray, &receiveTime));
+  BOOST_CHECK_EQUAL(receiveTime.secPastEpoch, 0u);
+}
+
+typedef struct {
+  NDArrayQueue *pQueue;
+  int sender;
+  size_t sum;
+  int count;
+  epicsEventId doneEvent;
+} queueThreadArgs;
+
+static void senderTask(void *arg)
+{
+  queueThreadArgs *pArgs = (queueThreadArgs *)arg;
+  int i;
+
+  for (i=0; i<numPerSender; i++) {
+    // Every value is different and not 0
+    while (!pArgs->pQueue->trySend(toArray((size_t)pArgs->sender*numPerSender + i + 1))) {
+      epicsThreadSleep(0.);
+    }
+  }
+  epicsEventSignal(pArgs->doneEvent);
+}
+
+static void receiverTask(void *arg)
+{
+  queueThreadArgs *pArgs = (queueThreadArgs *)arg;
+  NDArray *pArray;
+
+  while ((pArray = pArgs->pQueue->receive()) != NULL) {
+    pArgs->sum += (size_t)pArray;
+    pArgs->count++;
+  }
+  epicsEventSignal(pArgs->doneEvent);
+}
+
+BOOST_AUTO_TEST_CASE(test_MultipleThreads)
+{
+  NDArrayQueue queue(queueSize);
+  queueThreadArgs senders[numSenders], receivers[numReceivers];
+  size_t n = (size_t)numSenders*numPerSender;
+  size_t sum = 0;
+  int count = 0;
+  int i;
+
+  for (i=0; i<numReceivers; i++) {
+    memset(&receivers[i], 0, sizeof(receivers[i]));
+    receivers[i].pQueue = &queue;
+    receivers[i].doneEvent = epicsEventCreate(epicsEventEmpty);
+    epicsThreadCreate("receiver", epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium), receiverTask, &receivers[i]);
+  }
+  for (i=0; i<numSenders; i++) {
+    memset(&senders[i], 0, sizeof(senders[i]));
+    senders[i].pQueue = &queue;
+    senders[i].sender = i;
+    senders[i].doneEvent = epicsEventCreate(epicsEventEmpty);
+    epicsThreadCreate("sender", epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium), senderTask, &senders[i]);
+  }
+  for (i=0; i<numSenders; i++) {
+    epicsEventWait(senders[i].doneEvent);
+    epicsEventDestroy(senders[i].doneEvent);
+  }
+  // Tell the receivers to exit the way NDPluginDriver does
+  for (i=0; i<numReceivers; i++) {
+    while (!queue.trySend(NULL)) epicsThreadSleep(0.);
+  }
+  for (i=0; i<numReceivers; i++) {
+    epicsEventWait(receivers[i].doneEvent);
+    epicsEventDestroy(receivers[i].doneEvent);
+    sum += receivers[i].sum;
+    count += receivers[i].count;
+  }
+  // Each value was received exactly once
+  BOOST_CHECK_EQUAL(count, (int)n);
+  BOOST_CHECK_EQUAL(sum, n*(n+1)/2);
+  BOOST_CHECK_EQUAL(queue.pending(), 0);
+}
+
+/* Queue hops: one thread sends NDArrays as fast as the receivers take them,
+ * like a driver at a high frame rate, to numReceivers threads like a plugin with MaxThreads > 1.
+ * The time each NDArray spends in the queue is measured with NDArray::timeStamp. */
+typedef struct {
+  NDArrayQueue *pQueue;
+  epicsMessageQueue *pMsgQ;
+  double latency;
+  int count;
+  size_t sum;
+  epicsEventId doneEvent;
+} hopThreadArgs;
+
+static double now()
+{
+  epicsTimeStamp t;
+  epicsTimeGetCurrent(&t);
+  return t.secPastEpoch + t.nsec/1.e9;
+}
+
+static void hopReceiverTask(void *arg)
+{
+  hopThreadArgs *pArgs = (hopThreadArgs *)arg;
+  NDArray *pArray;
+
+  while (1) {
+    if (pArgs->pQueue) {
+      pArray = pArgs->pQueue->receive();
+    } else {
+      pArgs->pMsgQ->receive(&pArray, sizeof(pArray));
+    }
+    if (!pArray) break;
+    pArgs->latency += now() - pArray->timeStamp;
+    pArgs->count++;
+    pArgs->sum += (size_t)pArray;
+  }
+  epicsEventSignal(pArgs->doneEvent);
+}
+
+static double measureHops(NDArrayQueue *pQueue, epicsMessageQueue *pMsgQ)
+{
+  NDArray arrays[queueSize*4];
+  hopThreadArgs receivers[numReceivers];
+  double latency = 0.;
+  int count = 0;
+  size_t sum = 0, sentSum = 0;
+  NDArray *pArray;
+  int i;
+  bool sent;
+
+  for (i=0; i<numReceivers; i++) {
+    memset(&receivers[i], 0, sizeof(receivers[i]));
+    receivers[i].pQueue = pQueue;
+    receivers[i].pMsgQ = pMsgQ;
+    receivers[i].doneEvent = epicsEventCreate(epicsEventEmpty);
+    epicsThreadCreate("hopReceiver", epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium), hopReceiverTask, &receivers[i]);
+  }
+  for (i=0; i<numHops; i++) {
+    // Reuse the NDArrays as a driver reuses its buffers; there are more than the queue can hold
+    pArray = &arrays[i % (queueSize*4)];
+    do {
+      pArray->timeStamp = now();
+      if (pQueue) sent = pQueue->trySend(pArray);
+      else sent = (pMsgQ->trySend(&pArray, sizeof(pArray)) == 0);
+      if (!sent) epicsThreadSleep(0.);
+    } while (!sent);
+    sentSum += (size_t)pArray;
+  }
+  pArray = NULL;
+  for (i=0; i<numReceivers; i++) {
+    if (pQueue) {
+      while (!pQueue->trySend(NULL)) epicsThreadSleep(0.);
+    } else {
+      pMsgQ->send(&pArray, sizeof(pArray));
+    }
+  }
+  for (i=0; i<numReceivers; i++) {
+    epicsEventWait(receivers[i].doneEvent);
+    epicsEventDestroy(receivers[i].doneEvent);
+    latency += receivers[i].latency;
+    count += receivers[i].count;
+    sum += receivers[i].sum;
+  }
+  // Every NDArray that was sent was received once, although the NDArrays are reused while they are queued
+  BOOST_CHECK_EQUAL(count, numHops);
+  BOOST_CHECK_EQUAL(sum, sentSum);
+  return latency/count;
+}
+
+BOOST_AUTO_TEST_CASE(test_Hops)
+{
+  NDArrayQueue queue(queueSize);
+  epicsMessageQueue msgQ(queueSize, sizeof(NDArray *));
+  double queueLatency, msgQLatency;
+
+  msgQLatency = measureHops(NULL, &msgQ);
+  queueLatency = measureHops(&queue, NULL);
+  BOOST_CHECK_EQUAL(queue.pending(), 0);
+  BOOST_TEST_MESSAGE("Queue hop latency with " << numReceivers << " receivers, epicsMessageQueue: "
+                     << msgQLatency*1e6 << " us, NDArrayQueue: " << queueLatency*1e6 << " us");
+}
@@ -0,0 +1,348 @@
+/*
+ * test_NDAttributeList.cpp
+ *
+ *  Tests for NDAttributeList.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and EPICS dependencies
+#include <NDAttributeList.h>
+
+#include <string.h>
+
+using namespace std;
+
+static const int numAttributes = 250;
+static const int numCopies = 3;
+
+static void addAttributes(NDAttributeList *pList, int num)
+{
+    char name[32];
+    epicsInt32 value;
+    int i;
+
+    for (i=0; i<num; i++) {
+        sprintf(name, "Attribute%d", i);
+        value = i;
+        pList->add(name, "", NDAttrInt32, &value);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_FindAddRemove)
+{
+    NDAttributeList list;
+    NDAttribute *pAttribute;
+    epicsInt32 value;
+    char name[32];
+    int i;
+
+    BOOST_CHECK(list.find("Attribute0") == NULL);
+    addAttributes(&list, numAttributes);
+    BOOST_CHECK_EQUAL(list.count(), numAttributes);
+    for (i=0; i<numAttributes; i++) {
+        sprintf(name, "Attribute%d", i);
+        pAttribute = list.find(name);
+        BOOST_REQUIRE(pAttribute != NULL);
+        BOOST_CHECK_EQUAL(strcmp(pAttribute->getName(), name), 0);
+        pAttribute->getValue(NDAttrInt32, &value);
+        BOOST_CHECK_EQUAL(value, i);
+    }
+    // The search is case sensitive
+    BOOST_CHECK(list.find("attribute0") == NULL);
+
+    // Adding an attribute with an existing name replaces it, and moves it to the end of the list
+    value = -1;
+    list.add(new NDAttribute("Attribute10", "", NDAttrSourceDriver, "Driver", NDAttrInt32, &value));
+    BOOST_CHECK_EQUAL(list.count(), numAttributes);
+    list.find("Attribute10")->getValue(NDAttrInt32, &value);
+    BOOST_CHECK_EQUAL(value, -1);
+
+    // The list keeps the order in which the attributes were added
+    pAttribute = list.next(NULL);
+    for (i=0; i<numAttributes; i++) {
+        if (i == 10) continue;
+        sprintf(name, "Attribute%d", i);
+        BOOST_REQUIRE(pAttribute != NULL);
+        BOOST_CHECK_EQUAL(strcmp(pAttribute->getName(), name), 0);
+        pAttribute = list.next(pAttribute);
+    }
+    BOOST_CHECK_EQUAL(strcmp(pAttribute->getName(), "Attribute10"), 0);
+
+    BOOST_CHECK_EQUAL(list.remove("Attribute20"), ND_SUCCESS);
+    BOOST_CHECK_EQUAL(list.remove("Attribute20"), ND_ERROR);
+    BOOST_CHECK(list.find("Attribute20") == NULL);
+    BOOST_CHECK(list.find("Attribute21") != NULL);
+    BOOST_CHECK_EQUAL(list.count(), numAttributes-1);
+
+    list.clear();
+    BOOST_CHECK_EQUAL(list.count(), 0);
+    BOOST_CHECK(list.find("Attribute21") == NULL);
+    addAttributes(&list, 3);
+    BOOST_CHECK(list.find("Attribute2") != NULL);
+}
+
+BOOST_AUTO_TEST_CASE(test_Copy)
+{
+    NDAttributeList listIn, listOut;
+    NDAttribute *pAttribute;
+    epicsInt32 value;
+    int i;
+
+    addAttributes(&listIn, numAttributes);
+    value = 1;
+    listOut.add("Existing", "", NDAttrInt32, &value);
+    listIn.copy(&listOut);
+    BOOST_CHECK_EQUAL(listOut.count(), numAttributes+1);
+    BOOST_REQUIRE((pAttribute = listOut.find("Attribute100")) != NULL);
+    pAttribute->getValue(NDAttrInt32, &value);
+    BOOST_CHECK_EQUAL(value, 100);
+
+    // Copying to a list which already has the attributes only copies the values, as for each NDArray
+    for (i=0; i<numCopies; i++) {
+        value = 1000+i;
+        listIn.find("Attribute100")->setValue(&value);
+        listIn.copy(&listOut);
+        BOOST_CHECK_EQUAL(listOut.count(), numAttributes+1);
+        BOOST_CHECK_EQUAL(listOut.find("Attribute100"), pAttribute);
+        pAttribute->getValue(NDAttrInt32, &value);
+        BOOST_CHECK_EQUAL(value, 1000+i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_FindByKey)
+{
+    NDAttributeList list, listOut;
+    NDAttributeKey key, key2;
+    NDAttribute *pAttribute;
+    epicsInt32 value;
+
+    // Keys do not depend on the list, and the same name always has the same key
+    key = NDAttributeList::getKey("Attribute42");
+    BOOST_CHECK(key.id >= 0);
+    BOOST_CHECK_EQUAL(NDAttributeList::getKey("Attribute42").id, key.id);
+    BOOST_CHECK(NDAttributeList::getKey("Attribute43").id != key.id);
+    BOOST_CHECK_EQUAL(NDAttributeList::getKey("").id, -1);
+    BOOST_CHECK_EQUAL(NDAttributeList::getKey(NULL).id, -1);
+    BOOST_CHECK(list.find(NDAttributeList::getKey("")) == NULL);
+
+    BOOST_CHECK(list.find(key) == NULL);
+    addAttributes(&list, numAttributes);
+    BOOST_REQUIRE((pAttribute = list.find(key)) != NULL);
+    BOOST_CHECK_EQUAL(pAttribute, list.find("Attribute42"));
+
+    // A key for a name which was never added to a list
+    key2 = NDAttributeList::getKey("NotInTheList");
+    BOOST_CHECK(list.find(key2) == NULL);
+
+    // Replacing, removing and clearing attributes updates the table indexed by key
+    value = -1;
+    list.add(new NDAttribute("Attribute42", "", NDAttrSourceDriver, "Driver", NDAttrInt32, &value));
+    list.find(key)->getValue(NDAttrInt32, &value);
+    BOOST_CHECK_EQUAL(value, -1);
+    list.remove("Attribute42");
+    BOOST_CHECK(list.find(key) == NULL);
+    list.add("Attribute42", "", NDAttrInt32, &value);
+    BOOST_CHECK(list.find(key) != NULL);
+    list.clear();
+    BOOST_CHECK(list.find(key) == NULL);
+
+    // Copies of attributes can be found by key in the output list
+    addAttributes(&list, numAttributes);
+    list.copy(&listOut);
+    BOOST_REQUIRE((pAttribute = listOut.find(key)) != NULL);
+    pAttribute->getValue(NDAttrInt32, &value);
+    BOOST_CHECK_EQUAL(value, 42);
+    BOOST_CHECK_EQUAL(list.find(key), list.find("Attribute42"));
+}
+
+BOOST_AUTO_TEST_CASE(test_CopyReplace)
+{
+    NDAttributeList listIn, listOut;
+    NDAttribute *pAttribute, *pFirst;
+    epicsInt32 value;
+    epicsFloat64 dvalue;
+    char name[32];
+    int i;
+
+    addAttributes(&listIn, numAttributes);
+    value = 1;
+    listOut.add("Existing", "", NDAttrInt32, &value);
+    listIn.copy(&listOut, true);
+    BOOST_CHECK_EQUAL(listOut.count(), numAttributes);
+    BOOST_CHECK(listOut.find("Existing") == NULL);
+    pAttribute = listOut.next(NULL);
+    for (i=0; i<numAttributes; i++) {
+        sprintf(name, "Attribute%d", i);
+        BOOST_REQUIRE(pAttribute != NULL);
+        BOOST_CHECK_EQUAL(strcmp(pAttribute->getName(), name), 0);
+        pAttribute->getValue(NDAttrInt32, &value);
+        BOOST_CHECK_EQUAL(value, i);
+        pAttribute = listOut.next(pAttribute);
+    }
+
+    // Copying the same list again reuses the attributes in the output list and copies the values
+    pFirst = listOut.next(NULL);
+    value = 1000;
+    listIn.find("Attribute0")->setValue(&value);
+    listIn.copy(&listOut, true);
+    BOOST_CHECK_EQUAL(listOut.next(NULL), pFirst);
+    pFirst->getValue(NDAttrInt32, &value);
+    BOOST_CHECK_EQUAL(value, 1000);
+
+    // Changing the data type, removing and adding attributes are all copied
+    dvalue = 2.5;
+    listIn.add(new NDAttribute("Attribute5", "", NDAttrSourceDriver, "Driver", NDAttrFloat64, &dvalue));
+    listIn.remove("Attribute7");
+    listIn.copy(&listOut, true);
+    BOOST_CHECK_EQUAL(listOut.count(), listIn.count());
+    BOOST_CHECK(listOut.find("Attribute7") == NULL);
+    BOOST_REQUIRE((pAttribute = listOut.find("Attribute5")) != NULL);
+    pAttribute->getValue(NDAttrFloat64, &dvalue);
+    BOOST_CHECK_EQUAL(dvalue, 2.5);
+    pAttribute = listOut.next(NULL);
+    for (pFirst = listIn.next(NULL); pFirst; pFirst = listIn.next(pFirst)) {
+        BOOST_REQUIRE(pAttribute != NULL);
+        BOOST_CHECK_EQUAL(strcmp(pAttribute->getName(), pFirst->getName()), 0);
+        pAttribute = listOut.next(pAttribute);
+    }
+
+    // Copying the same list repeatedly, as for each NDArray, keeps the same attributes
+    pFirst = listOut.next(NULL);
+    for (i=0; i<numCopies; i++) {
+        listIn.copy(&listOut, true);
+        BOOST_CHECK_EQUAL(listOut.count(), listIn.count());
+        BOOST_CHECK_EQUAL(listOut.next(NULL), pFirst);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_Reset)
+{
+    NDAttributeList listIn, listOut;
+    NDAttribute *pAttribute, *pOld;
+    epicsInt32 value;
+    epicsFloat64 dvalue;
+    long numLookups;
+    int i;
+
+    addAttributes(&listOut, numAttributes);
+    pOld = listOut.find("Attribute3");
+    listOut.reset();
+    BOOST_CHECK_EQUAL(listOut.count(), 0);
+    BOOST_CHECK(listOut.find("Attribute3") == NULL);
+    BOOST_CHECK(listOut.next(NULL) == NULL);
+
+    // Adding an attribute with the same name and data type reuses the old one
+    value = 33;
+    pAttribute = listOut.add("Attribute3", "New description", NDAttrInt32, &value);
+    BOOST_CHECK_EQUAL(pAttribute, pOld);
+    BOOST_CHECK_EQUAL(strcmp(pAttribute->getDescription(), "New description"), 0);
+    pAttribute->getValue(NDAttrInt32, &value);
+    BOOST_CHECK_EQUAL(value, 33);
+    BOOST_CHECK_EQUAL(listOut.find(NDAttributeList::getKey("Attribute3")), pAttribute);
+
+    // A different data type creates a new attribute
+    dvalue = 1.5;
+    pAttribute = listOut.add("Attribute4", "", NDAttrFloat64, &dvalue);
+    pAttribute->getValue(NDAttrFloat64, &dvalue);
+    BOOST_CHECK_EQUAL(dvalue, 1.5);
+    BOOST_CHECK_EQUAL(pAttribute->getDataType(), NDAttrFloat64);
+
+    // Copying attributes into a list after reset() reuses the attributes of the same class and type
+    addAttributes(&listIn, numAttributes);
+    listOut.reset();
+    listIn.copy(&listOut);
+    BOOST_CHECK_EQUAL(listOut.count(), numAttributes);
+    BOOST_CHECK_EQUAL(listOut.find("Attribute3"), pOld);
+    listOut.find("Attribute4")->getValue(NDAttrInt32, &value);
+    BOOST_CHECK_EQUAL(value, 4);
+    BOOST_CHECK_EQUAL(listOut.find("Attribute4")->getDataType(), NDAttrInt32);
+
+    // Adding the same attributes after reset(), as a driver does for each frame, reuses them
+    // without creating attributes or looking up the keys of their names
+    {
+        NDAttributeList list;
+        NDAttribute *pAttributes[3];
+        const char *names[3] = {"ShortName", "AMuchLongerAttributeName", "AnotherLongAttributeName"};
+
+        for (i=0; i<3; i++) {
+            value = i;
+            pAttributes[i] = list.add(names[i], "", NDAttrInt32, &value);
+        }
+        numLookups = NDAttributeList::numKeyLookups();
+        list.reset();
+        for (i=0; i<3; i++) {
+            value = 10+i;
+            pAttribute = list.add(names[i], "", NDAttrInt32, &value);
+            BOOST_CHECK_EQUAL(pAttribute, pAttributes[i]);
+            pAttribute->getValue(NDAttrInt32, &value);
+            BOOST_CHECK_EQUAL(value, 10+i);
+        }
+        BOOST_CHECK_EQUAL(NDAttributeList::numKeyLookups(), numLookups);
+        BOOST_CHECK_EQUAL(list.count(), 3);
+        BOOST_CHECK_EQUAL(list.find(NDAttributeList::getKey(names[1])), pAttributes[1]);
+
+        // A retired attribute of another data type is replaced, which needs the key
+        list.reset();
+        dvalue = 0.5;
+        pAttribute = list.add(names[0], "", NDAttrFloat64, &dvalue);
+        BOOST_CHECK_EQUAL(pAttribute->getDataType(), NDAttrFloat64);
+        BOOST_CHECK_EQUAL(list.find(NDAttributeList::getKey(names[0])), pAttribute);
+        BOOST_CHECK(list.find(names[1]) == NULL);
+    }
+
+    // clear() deletes the attributes kept by reset()
+    listOut.reset();
+    listOut.clear();
+    addAttributes(&listOut, 1);
+    BOOST_CHECK_EQUAL(listOut.count(), 1);
+
+    // As for each NDArray from the pool when eraseNDAttributes is set, the attributes are reused
+    // without looking up their keys
+    listOut.reset();
+    listIn.copy(&listOut);
+    pOld = listOut.find("Attribute3");
+    numLookups = NDAttributeList::numKeyLookups();
+    for (i=0; i<numCopies; i++) {
+        listOut.reset();
+        listIn.copy(&listOut);
+        BOOST_CHECK_EQUAL(listOut.count(), numAttributes);
+        BOOST_CHECK_EQUAL(listOut.find("Attribute3"), pOld);
+    }
+    BOOST_CHECK_EQUAL(NDAttributeList::numKeyLookups(), numLookups);
+}
+
+BOOST_AUTO_TEST_CASE(test_KeyMask)
+{
+    NDAttributeList listIn, listOut;
+    std::vector<bool> keyMask;
+    NDAttributeKey key;
+    char name[32];
+    int i;
+
+    addAttributes(&listIn, numAttributes);
+    // Only copy the attributes with even numbers
+    for (i=0; i<numAttributes; i+=2) {
+        sprintf(name, "Attribute%d", i);
+        key = NDAttributeList::getKey(name);
+        if ((size_t)key.id >= keyMask.size()) keyMask.resize(key.id+1, false);
+        keyMask[key.id] = true;
+    }
+    BOOST_CHECK_EQUAL(listIn.updateValues(&keyMask), ND_SUCCESS);
+    listIn.copy(&listOut, false, &keyMask);
+    BOOST_CHECK_EQUAL(listOut.count(), numAttributes/2);
+    BOOST_CHECK(listOut.find("Attribute10") != NULL);
+    BOOST_CHECK(listOut.find("Attribute11") == NULL);
+
+    listIn.copy(&listOut, true, &keyMask);
+    BOOST_CHECK_EQUAL(listOut.count(), numAttributes/2);
+    BOOST_CHECK(listOut.find("Attribute248") != NULL);
+    BOOST_CHECK(listOut.find("Attribute249") == NULL);
+
+    // An empty mask copies nothing
+    keyMask.clear();
+    listIn.copy(&listOut, true, &keyMask);
+    BOOST_CHECK_EQUAL(listOut.count(), 0);
+}
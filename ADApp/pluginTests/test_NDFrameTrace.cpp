@@ -0,0 +1,92 @@
+/*
+ * test_NDFrameTrace.cpp
+ *
+ *  Tests for NDFrameTrace, the trace of the NDArrays passing through the plugins.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and EPICS dependencies
+#include <NDFrameTrace.h>
+#include <epicsTime.h>
+
+using namespace std;
+
+// Defined in NDFrameTrace.cpp
+extern volatile int NDFrameTraceSample;
+
+/* Returns what NDFrameTrace::dump() writes, and the number of events */
+static string dumpTrace(int *pNumEvents)
+{
+  FILE *fp = tmpfile();
+  string text;
+  char buffer[1024];
+  size_t n;
+
+  BOOST_REQUIRE(fp != NULL);
+  *pNumEvents = NDFrameTrace::dump(fp);
+  rewind(fp);
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) text.append(buffer, n);
+  fclose(fp);
+  return text;
+}
+
+static int countOf(const string &text, const char *pattern)
+{
+  int count = 0;
+  size_t pos = 0;
+
+  while ((pos = text.find(pattern, pos)) != string::npos) {
+    count++;
+    pos += strlen(pattern);
+  }
+  return count;
+}
+
+BOOST_AUTO_TEST_CASE(test_Sampling)
+{
+  NDFrameTraceSample = 0;
+  BOOST_CHECK(!NDFrameTrace::sampled(0));
+  NDFrameTraceSample = 10;
+  BOOST_CHECK(NDFrameTrace::sampled(0));
+  BOOST_CHECK(NDFrameTrace::sampled(20));
+  BOOST_CHECK(!NDFrameTrace::sampled(21));
+  NDFrameTraceSample = 0;
+}
+
+BOOST_AUTO_TEST_CASE(test_Dump)
+{
+  epicsTimeStamp t0, t1;
+  string text;
+  int numEvents, i;
+
+  NDFrameTrace::clear();
+  epicsTimeGetCurrent(&t0);
+  t1 = t0;
+  epicsTimeAddSeconds(&t1, 0.001);
+  for (i=0; i<3; i++) {
+    // Recorded out of order, as by the threads of different plugins
+    NDFrameTrace::record(NDFrameTraceProcessEnd, "STATS1", i, &t1);
+    NDFrameTrace::record(NDFrameTraceProcessStart, "STATS1", i, &t0);
+    NDFrameTrace::record(NDFrameTraceEnqueue, "ROI1", i, &t0);
+    NDFrameTrace::record(NDFrameTraceDequeue, "ROI1", i, &t1);
+    NDFrameTrace::record(NDFrameTraceCallback, "ROI1", i);
+  }
+  text = dumpTrace(&numEvents);
+  BOOST_CHECK_EQUAL(numEvents, 15);
+  BOOST_CHECK_EQUAL(countOf(text, "\"name\":\"STATS1\",\"cat\":\"process\",\"ph\":\"B\""), 3);
+  BOOST_CHECK_EQUAL(countOf(text, "\"name\":\"STATS1\",\"cat\":\"process\",\"ph\":\"E\""), 3);
+  BOOST_CHECK_EQUAL(countOf(text, "\"name\":\"ROI1 queue\",\"cat\":\"queue\",\"id\":2,\"ph\":\"b\""), 1);
+  BOOST_CHECK_EQUAL(countOf(text, "\"ph\":\"i\""), 3);
+  // The events are sorted by time, so all the starts come before the ends
+  BOOST_CHECK_LT(text.rfind("\"ph\":\"B\""), text.find("\"ph\":\"E\""));
+
+  NDFrameTrace::clear();
+  text = dumpTrace(&numEvents);
+  BOOST_CHECK_EQUAL(numEvents, 0);
+  BOOST_CHECK_EQUAL(countOf(text, "\"traceEvents\""), 1);
+}
@@ -0,0 +1,70 @@
+/*
+ * test_NDLatencyHistogram.cpp
+ *
+ *  Tests for NDLatencyHistogram, the latency histograms of the plugins.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDLatencyHistogram.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(test_Bins)
+{
+  epicsUInt32 us;
+  int bin;
+
+  // Each latency is in the bin whose edges surround it, and the bins are never wider than 1/16 of their edge
+  for (us=0; us<(1u<<26); us += 1 + us/64) {
+    bin = NDLatencyHistogram::binIndex(us);
+    BOOST_REQUIRE_LE(NDLatencyHistogram::binLowerEdge(bin), us);
+    BOOST_REQUIRE_GT(NDLatencyHistogram::binLowerEdge(bin+1), us);
+    BOOST_REQUIRE_LE(NDLatencyHistogram::binLowerEdge(bin+1) - NDLatencyHistogram::binLowerEdge(bin),
+                     NDLatencyHistogram::binLowerEdge(bin)/ND_LATENCY_HIST_SUB_BINS + 1);
+  }
+  BOOST_CHECK_EQUAL(NDLatencyHistogram::binIndex(31), 31);
+  BOOST_CHECK_EQUAL(NDLatencyHistogram::binIndex(32), 32);
+  BOOST_CHECK_EQUAL(NDLatencyHistogram::binIndex(34), 33);
+  BOOST_CHECK_EQUAL(NDLatencyHistogram::binIndex(0xffffffffu), ND_LATENCY_HIST_BINS-1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Percentiles)
+{
+  NDLatencyHistogram hist;
+  epicsInt32 values[ND_LATENCY_NUM_PERCENTILES];
+  epicsInt32 counts[ND_LATENCY_HIST_BINS];
+  int i, total;
+
+  BOOST_CHECK_EQUAL(hist.getPercentiles(values, ND_LATENCY_NUM_PERCENTILES), (size_t)ND_LATENCY_NUM_PERCENTILES);
+  BOOST_CHECK_EQUAL(values[NDLatencyP50], 0);
+  BOOST_CHECK_EQUAL(values[NDLatencyMax], 0);
+
+  // 1 to 1000 microseconds
+  for (i=1; i<=1000; i++) hist.add(i * 1e-6);
+  BOOST_CHECK_EQUAL(hist.count(), 1000);
+  hist.getPercentiles(values, ND_LATENCY_NUM_PERCENTILES);
+  BOOST_CHECK_EQUAL(values[NDLatencyMax], 1000);
+  BOOST_CHECK_GE(values[NDLatencyP50], 500);
+  BOOST_CHECK_LE(values[NDLatencyP50], 500 + 500/ND_LATENCY_HIST_SUB_BINS);
+  BOOST_CHECK_GE(values[NDLatencyP95], 950);
+  BOOST_CHECK_LE(values[NDLatencyP95], 1000);
+  BOOST_CHECK_GE(values[NDLatencyP99], 990);
+  BOOST_CHECK_LE(values[NDLatencyP99], 1000);
+
+  hist.getCounts(counts, ND_LATENCY_HIST_BINS);
+  for (i=0, total=0; i<ND_LATENCY_HIST_BINS; i++) total += counts[i];
+  BOOST_CHECK_EQUAL(total, 1000);
+
+  // Negative latencies, e.g. from a driver with a bad clock, count as 0, and huge ones go in the last bin
+  hist.reset();
+  hist.add(-1.);
+  hist.add(1e6);
+  hist.getCounts(counts, ND_LATENCY_HIST_BINS);
+  BOOST_CHECK_EQUAL(counts[0], 1);
+  BOOST_CHECK_EQUAL(counts[ND_LATENCY_HIST_BINS-1], 1);
+  BOOST_CHECK_EQUAL(hist.count(), 2);
+}
@@ -0,0 +1,452 @@
+/*
+ * test_NDPluginDriver.cpp
+ *
+ *  Tests for the sorted output and the fused callbacks of NDPluginDriver,
+ *  using NDPluginROI as the plugin under test.
+ */
+
+#include <stdio.h>
+
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsAtomic.h>
+
+#include <string.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "ROIPluginWrapper.h"
+#include "AsynException.h"
+
+
+// The uniqueIds of the output arrays in the order of the callbacks.
+// The callbacks are done with the lock of the plugin held, so it is read with the lock held.
+static std::vector<int> outputIds;
+
+static void outputCallback(void *userPvt, asynUser *pasynUser, void *pointer)
+{
+  outputIds.push_back(((NDArray *)pointer)->uniqueId);
+}
+
+struct SortFixture
+{
+  NDArrayPool *arrayPool;
+  boost::shared_ptr<asynPortDriver> driver;
+  boost::shared_ptr<ROIPluginWrapper> roi;
+  boost::shared_ptr<asynGenericPointerClient> client;
+  std::vector<NDArray*> arrays;
+
+  SortFixture()
+  {
+    arrayPool = new NDArrayPool(100, 0);
+    outputIds.clear();
+
+    std::string simport("simSort"), testport("Sort");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(testport);
+
+    // We need some upstream driver for our test plugin so that calls to connectArrayPort
+    // don't fail, but we can then ignore it and send arrays by calling processCallbacks directly.
+    driver = boost::shared_ptr<asynPortDriver>(new asynPortDriver(simport.c_str(),
+                                                                     1, 1,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 2000000));
+
+    // The ROI plugin outputs a copy of the complete input array, with the same uniqueId
+    roi = boost::shared_ptr<ROIPluginWrapper>(new ROIPluginWrapper(testport.c_str(),
+                                                                      50,
+                                                                      1,
+                                                                      simport.c_str(),
+                                                                      0,
+                                                                      0,
+                                                                      0,
+                                                                      2000000,
+                                                                      1));
+    roi->start();
+    roi->write(NDPluginDriverEnableCallbacksString, 1);
+    roi->write(NDPluginDriverBlockingCallbacksString, 1);
+    roi->write(NDPluginROIDim0EnableString, 0);
+    roi->write(NDPluginROIDim1EnableString, 0);
+    roi->write(NDPluginROIDim0ReverseString, 0);
+    roi->write(NDPluginROIDim1ReverseString, 0);
+    roi->write(NDPluginROIDataTypeString, -1);
+    roi->write(NDPluginROIEnableScaleString, 0);
+    roi->write(NDArrayCallbacksString, 1);
+
+    client = boost::shared_ptr<asynGenericPointerClient>(new asynGenericPointerClient(testport.c_str(), 0, NDArrayDataString));
+    client->registerInterruptUser(&outputCallback);
+
+    std::vector<size_t> dims(2, 8);
+    arrays.resize(1);
+    fillNDArraysFromPool(dims, NDUInt8, arrays, arrayPool);
+  }
+
+  ~SortFixture()
+  {
+    client.reset();
+    // The destructor stops the sorting thread and releases the arrays that are still waiting in the sort ring
+    roi.reset();
+    driver.reset();
+    arrays[0]->release();
+    delete arrayPool;
+  }
+
+  void process(int uniqueId)
+  {
+    arrays[0]->uniqueId = uniqueId;
+    roi->lock();
+    roi->processCallbacks(arrays[0]);
+    roi->unlock();
+  }
+
+  std::vector<int> outputs()
+  {
+    std::vector<int> ids;
+    roi->lock();
+    ids = outputIds;
+    roi->unlock();
+    return ids;
+  }
+
+  // Waits for the sorting thread to output numOutputs arrays
+  std::vector<int> waitForOutputs(size_t numOutputs, double timeout)
+  {
+    std::vector<int> ids;
+    epicsTimeStamp tStart, now;
+
+    epicsTimeGetCurrent(&tStart);
+    do {
+      ids = outputs();
+      if (ids.size() >= numOutputs) break;
+      epicsThreadSleep(0.01);
+      epicsTimeGetCurrent(&now);
+    } while (epicsTimeDiffInSeconds(&now, &tStart) < timeout);
+    return ids;
+  }
+
+  // Enables sorting and outputs the first array, which always waits SortTime
+  // because the plugin does not know if an array before it will arrive
+  void startSorting(int sortSize, int firstId)
+  {
+    roi->write(NDPluginDriverSortSizeString, sortSize);
+    roi->write(NDPluginDriverSortTimeString, 0.05);
+    roi->write(NDPluginDriverSortModeString, 1);
+    process(firstId);
+    BOOST_REQUIRE_EQUAL(waitForOutputs(1, 5.0).size(), (size_t)1);
+    // Later arrays only wait if one before them is missing, so a long SortTime must not delay them
+    roi->write(NDPluginDriverSortTimeString, 10.0);
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(SortTests, SortFixture)
+
+BOOST_AUTO_TEST_CASE(in_order_without_delay)
+{
+  std::vector<int> ids;
+  int i;
+
+  startSorting(10, 1);
+  // Each array is output by processCallbacks(), before it returns
+  for (i=2; i<=20; i++) {
+    process(i);
+    ids = outputs();
+    BOOST_REQUIRE_EQUAL(ids.size(), (size_t)i);
+    BOOST_CHECK_EQUAL(ids.back(), i);
+  }
+  BOOST_CHECK_EQUAL(roi->readInt(NDPluginDriverSortFreeString), 10);
+}
+
+BOOST_AUTO_TEST_CASE(reorder)
+{
+  std::vector<int> ids;
+
+  startSorting(10, 1);
+  process(3);
+  process(4);
+  ids = outputs();
+  BOOST_CHECK_EQUAL(ids.size(), (size_t)1);
+  BOOST_CHECK_EQUAL(roi->readInt(NDPluginDriverSortFreeString), 8);
+
+  // The missing array releases the arrays waiting for it
+  process(2);
+  ids = outputs();
+  BOOST_REQUIRE_EQUAL(ids.size(), (size_t)4);
+  BOOST_CHECK_EQUAL(ids[1], 2);
+  BOOST_CHECK_EQUAL(ids[2], 3);
+  BOOST_CHECK_EQUAL(ids[3], 4);
+  BOOST_CHECK_EQUAL(roi->readInt(NDPluginDriverSortFreeString), 10);
+}
+
+BOOST_AUTO_TEST_CASE(gap_timeout)
+{
+  std::vector<int> ids;
+  epicsTimeStamp tStart, tEnd;
+  double sortTime = 0.2;
+
+  startSorting(10, 1);
+  roi->write(NDPluginDriverSortTimeString, sortTime);
+  epicsTimeGetCurrent(&tStart);
+  process(3);
+  process(4);
+  BOOST_CHECK_EQUAL(outputs().size(), (size_t)1);
+
+  // Array 2 never arrives, so the sorting thread outputs 3 and 4 after SortTime
+  ids = waitForOutputs(3, 5.0);
+  epicsTimeGetCurrent(&tEnd);
+  BOOST_REQUIRE_EQUAL(ids.size(), (size_t)3);
+  BOOST_CHECK_EQUAL(ids[1], 3);
+  BOOST_CHECK_EQUAL(ids[2], 4);
+  BOOST_CHECK_GE(epicsTimeDiffInSeconds(&tEnd, &tStart), sortTime*0.9);
+
+  // The next array is output at once
+  process(5);
+  ids = outputs();
+  BOOST_REQUIRE_EQUAL(ids.size(), (size_t)4);
+  BOOST_CHECK_EQUAL(ids[3], 5);
+}
+
+BOOST_AUTO_TEST_CASE(ring_overflow)
+{
+  std::vector<int> ids;
+
+  // With 4 slots the ring holds uniqueIds 3 to 5 while waiting for 2
+  startSorting(4, 1);
+  process(3);
+  process(4);
+  process(5);
+  BOOST_CHECK_EQUAL(outputs().size(), (size_t)1);
+  BOOST_CHECK_EQUAL(roi->readInt(NDPluginDriverSortFreeString), 1);
+
+  // 7 needs the slot of 3, so the plugin stops waiting for 2 rather than dropping 7, which waits for 6
+  process(7);
+  ids = outputs();
+  BOOST_REQUIRE_EQUAL(ids.size(), (size_t)4);
+  BOOST_CHECK_EQUAL(ids[1], 3);
+  BOOST_CHECK_EQUAL(ids[2], 4);
+  BOOST_CHECK_EQUAL(ids[3], 5);
+  BOOST_CHECK_EQUAL(roi->readInt(NDPluginDriverSortFreeString), 3);
+
+  process(6);
+  ids = outputs();
+  BOOST_REQUIRE_EQUAL(ids.size(), (size_t)6);
+  BOOST_CHECK_EQUAL(ids[4], 6);
+  BOOST_CHECK_EQUAL(ids[5], 7);
+  BOOST_CHECK_EQUAL(roi->readInt(NDPluginDriverDroppedOutputArraysString), 0);
+}
+
+BOOST_AUTO_TEST_CASE(delete_with_waiting_arrays)
+{
+  // Arrays 3 and 4 are still waiting for 2 when the fixture deletes the plugin
+  startSorting(10, 1);
+  process(3);
+  process(4);
+  BOOST_CHECK_EQUAL(outputs().size(), (size_t)1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+
+// The thread which did the most recent output callbacks of the upstream and downstream plugins
+static epicsThreadId upstreamThread, downstreamThread;
+static int numUpstreamCallbacks, numDownstreamCallbacks;
+
+static void upstreamCallback(void *userPvt, asynUser *pasynUser, void *pointer)
+{
+  upstreamThread = epicsThreadGetIdSelf();
+  epicsAtomicIncrIntT(&numUpstreamCallbacks);
+}
+
+static void downstreamCallback(void *userPvt, asynUser *pasynUser, void *pointer)
+{
+  downstreamThread = epicsThreadGetIdSelf();
+  epicsAtomicIncrIntT(&numDownstreamCallbacks);
+}
+
+// Reads a parameter of the upstream plugin from another thread during a downstream callback,
+// which waits for the upstream plugin's lock
+static ROIPluginWrapper *pLockCheckPlugin;
+static epicsEventId lockCheckDone;
+static bool lockCheckReadInCallback;
+static int numLockChecks;
+
+static void lockCheckTask(void *drvPvt)
+{
+  pLockCheckPlugin->readInt(NDPluginDriverFusedString);
+  epicsEventSignal(lockCheckDone);
+}
+
+static void lockCheckCallback(void *userPvt, asynUser *pasynUser, void *pointer)
+{
+  epicsThreadCreate("lockCheck", epicsThreadPriorityMedium,
+                    epicsThreadGetStackSize(epicsThreadStackMedium), lockCheckTask, NULL);
+  lockCheckReadInCallback = (epicsEventWaitWithTimeout(lockCheckDone, 2.0) == epicsEventWaitOK);
+  epicsAtomicIncrIntT(&numLockChecks);
+}
+
+// A chain of 2 ROI plugins with non-blocking callbacks: the driver calls upstream, which calls downstream
+struct FusedFixture
+{
+  NDArrayPool *arrayPool;
+  asynUser *pasynUser;
+  boost::shared_ptr<asynPortDriver> driver;
+  boost::shared_ptr<ROIPluginWrapper> upstream;
+  boost::shared_ptr<ROIPluginWrapper> downstream;
+  boost::shared_ptr<asynGenericPointerClient> upstreamClient;
+  boost::shared_ptr<asynGenericPointerClient> downstreamClient;
+  std::vector<NDArray*> arrays;
+  std::string downstreamPort;
+
+  FusedFixture()
+  {
+    arrayPool = new NDArrayPool(100, 0);
+    pasynUser = pasynManager->createAsynUser(0, 0);
+    upstreamThread = 0;
+    downstreamThread = 0;
+    numUpstreamCallbacks = 0;
+    numDownstreamCallbacks = 0;
+
+    std::string simport("simFused"), upstreamPort("FusedUp");
+    downstreamPort = "FusedDown";
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(upstreamPort);
+    uniqueAsynPortName(downstreamPort);
+
+    driver = boost::shared_ptr<asynPortDriver>(new asynPortDriver(simport.c_str(),
+                                                                     1, 1,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 2000000));
+    upstream = createPlugin(upstreamPort, simport);
+    downstream = createPlugin(downstreamPort, upstreamPort);
+
+    upstreamClient = boost::shared_ptr<asynGenericPointerClient>(new asynGenericPointerClient(upstreamPort.c_str(), 0, NDArrayDataString));
+    upstreamClient->registerInterruptUser(&upstreamCallback);
+    downstreamClient = boost::shared_ptr<asynGenericPointerClient>(new asynGenericPointerClient(downstreamPort.c_str(), 0, NDArrayDataString));
+    downstreamClient->registerInterruptUser(&downstreamCallback);
+
+    std::vector<size_t> dims(2, 8);
+    arrays.resize(1);
+    fillNDArraysFromPool(dims, NDUInt8, arrays, arrayPool);
+  }
+
+  ~FusedFixture()
+  {
+    upstreamClient.reset();
+    downstreamClient.reset();
+    downstream.reset();
+    upstream.reset();
+    driver.reset();
+    arrays[0]->release();
+    pasynManager->freeAsynUser(pasynUser);
+    delete arrayPool;
+  }
+
+  boost::shared_ptr<ROIPluginWrapper> createPlugin(const std::string& port, const std::string& arrayPort)
+  {
+    boost::shared_ptr<ROIPluginWrapper> plugin(new ROIPluginWrapper(port.c_str(),
+                                                                      50,
+                                                                      0,
+                                                                      arrayPort.c_str(),
+                                                                      0,
+                                                                      0,
+                                                                      0,
+                                                                      2000000,
+                                                                      1));
+    plugin->start();
+    plugin->write(NDPluginROIDim0EnableString, 0);
+    plugin->write(NDPluginROIDim1EnableString, 0);
+    plugin->write(NDPluginROIDim0ReverseString, 0);
+    plugin->write(NDPluginROIDim1ReverseString, 0);
+    plugin->write(NDPluginROIDataTypeString, -1);
+    plugin->write(NDPluginROIEnableScaleString, 0);
+    plugin->write(NDArrayCallbacksString, 1);
+    plugin->write(NDPluginDriverEnableCallbacksString, 1);
+    return plugin;
+  }
+
+  // Passes an array to the upstream plugin as the driver would, from the thread of the test
+  void driverCallback()
+  {
+    upstream->driverCallback(pasynUser, arrays[0]);
+  }
+
+  bool waitForCallbacks(int *pCount, int count)
+  {
+    int i;
+
+    for (i=0; i<500; i++) {
+      if (epicsAtomicGetIntT(pCount) >= count) return true;
+      epicsThreadSleep(0.01);
+    }
+    return false;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(FusedTests, FusedFixture)
+
+BOOST_AUTO_TEST_CASE(unfused_chain_queues)
+{
+  BOOST_CHECK_EQUAL(downstream->readInt(NDPluginDriverFusedString), 0);
+  driverCallback();
+  BOOST_REQUIRE(waitForCallbacks(&numDownstreamCallbacks, 1));
+  BOOST_CHECK(upstreamThread != epicsThreadGetIdSelf());
+  BOOST_CHECK(downstreamThread != upstreamThread);
+}
+
+BOOST_AUTO_TEST_CASE(fused_chain_runs_in_upstream_thread)
+{
+  int i;
+
+  downstream->write(NDPluginDriverFusedString, 1);
+  for (i=1; i<=5; i++) {
+    driverCallback();
+    BOOST_REQUIRE(waitForCallbacks(&numDownstreamCallbacks, i));
+    BOOST_CHECK(upstreamThread != epicsThreadGetIdSelf());
+    // The downstream plugin processed the array in the thread of the upstream plugin, without its queue
+    BOOST_CHECK(downstreamThread == upstreamThread);
+  }
+  BOOST_CHECK_EQUAL(downstream->readInt(NDPluginDriverDroppedArraysString), 0);
+}
+
+BOOST_AUTO_TEST_CASE(fused_releases_upstream_lock)
+{
+  // The upstream plugin can be accessed while the fused downstream plugin processes
+  boost::shared_ptr<asynGenericPointerClient> lockCheckClient(new asynGenericPointerClient(downstreamPort.c_str(), 0, NDArrayDataString));
+  pLockCheckPlugin = upstream.get();
+  lockCheckDone = epicsEventMustCreate(epicsEventEmpty);
+  lockCheckReadInCallback = false;
+  numLockChecks = 0;
+  lockCheckClient->registerInterruptUser(&lockCheckCallback);
+
+  downstream->write(NDPluginDriverFusedString, 1);
+  driverCallback();
+  BOOST_REQUIRE(waitForCallbacks(&numLockChecks, 1));
+  BOOST_CHECK(lockCheckReadInCallback);
+  // The read finished after the callback if the upstream plugin held its lock
+  if (!lockCheckReadInCallback) epicsEventMustWait(lockCheckDone);
+  lockCheckClient.reset();
+  epicsEventDestroy(lockCheckDone);
+}
+
+BOOST_AUTO_TEST_CASE(fused_falls_back_to_queue_from_driver)
+{
+  // The upstream plugin gets its arrays from a driver, so Fused has no effect and the arrays are queued
+  upstream->write(NDPluginDriverFusedString, 1);
+  driverCallback();
+  BOOST_REQUIRE(waitForCallbacks(&numUpstreamCallbacks, 1));
+  BOOST_CHECK(upstreamThread != epicsThreadGetIdSelf());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
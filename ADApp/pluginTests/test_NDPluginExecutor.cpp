@@ -0,0 +1,136 @@
+/*
+ * test_NDPluginExecutor.cpp
+ *
+ *  Tests for NDPluginExecutor, the worker threads which plugins can share.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and EPICS dependencies
+#include <NDPluginExecutor.h>
+#include <epicsAtomic.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+
+using namespace std;
+
+static const int numWorkers = 4;
+static const int numTasks = 100000;
+
+// The executors which are not shut down are not deleted, and the tasks are static so that
+// they exist while a worker may still be running them
+static NDPluginExecutor *newExecutor()
+{
+  return new NDPluginExecutor(numWorkers, epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium));
+}
+
+/* Counts how many times it runs, and signals each time it has run another numRuns times */
+class CountingTask : public NDPluginExecutorTask {
+public:
+  CountingTask(int numRuns) : numRuns_(numRuns), count_(0) {
+    doneEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  }
+  ~CountingTask() {
+    epicsEventDestroy(doneEvent_);
+  }
+  virtual void runTask() {
+    if (epicsAtomicIncrIntT(&count_) % numRuns_ == 0) epicsEventSignal(doneEvent_);
+  }
+  bool wait(double timeout) {
+    return epicsEventWaitWithTimeout(doneEvent_, timeout) == epicsEventWaitOK;
+  }
+  int count() {
+    return epicsAtomicGetIntT(&count_);
+  }
+private:
+  int numRuns_;
+  int count_;
+  epicsEventId doneEvent_;
+};
+
+/* Submits the next task of a chain from a worker thread, like a plugin passing an NDArray to the next plugin */
+class ChainTask : public NDPluginExecutorTask {
+public:
+  ChainTask(NDPluginExecutor *pExecutor, NDPluginExecutorTask *pNext, int numChildren)
+    : pExecutor_(pExecutor), pNext_(pNext), numChildren_(numChildren) {}
+  virtual void runTask() {
+    int i;
+    for (i=0; i<numChildren_; i++) pExecutor_->submit(pNext_);
+  }
+private:
+  NDPluginExecutor *pExecutor_;
+  NDPluginExecutorTask *pNext_;
+  int numChildren_;
+};
+
+BOOST_AUTO_TEST_CASE(test_SubmitFromOtherThread)
+{
+  NDPluginExecutor *pExecutor = newExecutor();
+  static CountingTask task(numTasks);
+  int i;
+
+  BOOST_CHECK_EQUAL(pExecutor->numWorkers(), numWorkers);
+  // The same task may be submitted again before it has run
+  for (i=0; i<numTasks; i++) pExecutor->submit(&task);
+  BOOST_REQUIRE(task.wait(10.));
+  epicsThreadSleep(0.01);
+  BOOST_CHECK_EQUAL(task.count(), numTasks);
+}
+
+BOOST_AUTO_TEST_CASE(test_SubmitFromWorker)
+{
+  NDPluginExecutor *pExecutor = newExecutor();
+  const int numChildren = 10;
+  static CountingTask last(numTasks*numChildren);
+  ChainTask first(pExecutor, &last, numChildren);
+  int i;
+
+  // Each task run by a worker submits more tasks to that worker, which the other workers steal
+  for (i=0; i<numTasks; i++) pExecutor->submit(&first);
+  BOOST_REQUIRE(last.wait(10.));
+  epicsThreadSleep(0.01);
+  BOOST_CHECK_EQUAL(last.count(), numTasks*numChildren);
+
+  // Tasks submitted to run later are also run
+  for (i=0; i<numTasks; i++) pExecutor->submit(&first, true);
+  BOOST_REQUIRE(last.wait(10.));
+  epicsThreadSleep(0.01);
+  BOOST_CHECK_EQUAL(last.count(), 2*numTasks*numChildren);
+}
+
+BOOST_AUTO_TEST_CASE(test_Idle)
+{
+  NDPluginExecutor *pExecutor = newExecutor();
+  static CountingTask task(1);
+
+  // A task submitted after the workers have started waiting wakes one of them
+  epicsThreadSleep(0.1);
+  pExecutor->submit(&task);
+  BOOST_REQUIRE(task.wait(10.));
+  BOOST_CHECK_EQUAL(task.count(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Shutdown)
+{
+  NDPluginExecutor *pExecutor = newExecutor();
+  static CountingTask task(numTasks);
+  static CountingTask late(1);
+  int i;
+
+  // The workers exit when they are idle and when they are running tasks
+  pExecutor->shutdown();
+  delete pExecutor;
+  pExecutor = newExecutor();
+  for (i=0; i<numTasks; i++) pExecutor->submit(&task);
+  pExecutor->shutdown();
+  BOOST_CHECK(task.count() <= numTasks);
+
+  // Tasks submitted after shutdown() are not run
+  pExecutor->submit(&late);
+  BOOST_CHECK(!late.wait(0.1));
+  BOOST_CHECK_EQUAL(late.count(), 0);
+  delete pExecutor;
+}
@@ -32,10 +32,13 @@ using namespace std;
 
 static int callbackCount = 0;
 static void *cbPtr = 0;
+static bool cbIsView = false;
 
 void ROI_callback(void *userPvt, asynUser *pasynUser, void *pointer)
 {
   cbPtr = pointer;
+  // The output array is released by the plugin after the callbacks, so check it now
+  cbIsView = ((NDArray *)pointer)->isView();
   callbackCount++;
 }
 
@@ -259,5 +262,46 @@ BOOST_AUTO_TEST_CASE(basic_roi_operation)
   }
 }
 
+BOOST_AUTO_TEST_CASE(view_output)
+{
+  // Test case 2 is a 10x1x10 region of a 10x10x10 array, which needs no binning or conversion
+  ROITestCaseStr *pStr = &ROITestCaseStrs[1];
+  int startCount = callbackCount;
+
+  BOOST_CHECK_NO_THROW(roi->write(NDPluginROIDim0MinString,  pStr->roiStart[0]));
+  BOOST_CHECK_NO_THROW(roi->write(NDPluginROIDim0SizeString, pStr->roiSize[0]));
+  BOOST_CHECK_NO_THROW(roi->write(NDPluginROIDim1MinString,  pStr->roiStart[1]));
+  BOOST_CHECK_NO_THROW(roi->write(NDPluginROIDim1SizeString, pStr->roiSize[1]));
+  BOOST_CHECK_NO_THROW(roi->write(NDPluginROIDim2MinString,  pStr->roiStart[2]));
+  BOOST_CHECK_NO_THROW(roi->write(NDPluginROIDim2SizeString, pStr->roiSize[2]));
+  for (int dim=0; dim<3; dim++) {
+    const char *enableStrings[3] = {NDPluginROIDim0EnableString, NDPluginROIDim1EnableString, NDPluginROIDim2EnableString};
+    const char *binStrings[3] = {NDPluginROIDim0BinString, NDPluginROIDim1BinString, NDPluginROIDim2BinString};
+    const char *reverseStrings[3] = {NDPluginROIDim0ReverseString, NDPluginROIDim1ReverseString, NDPluginROIDim2ReverseString};
+    const char *autoSizeStrings[3] = {NDPluginROIDim0AutoSizeString, NDPluginROIDim1AutoSizeString, NDPluginROIDim2AutoSizeString};
+    BOOST_CHECK_NO_THROW(roi->write(enableStrings[dim],   1));
+    BOOST_CHECK_NO_THROW(roi->write(binStrings[dim],      1));
+    BOOST_CHECK_NO_THROW(roi->write(reverseStrings[dim],  0));
+    BOOST_CHECK_NO_THROW(roi->write(autoSizeStrings[dim], 0));
+  }
+  BOOST_CHECK_NO_THROW(roi->write(NDArrayCallbacksString, 1));
+
+  // Views are disabled by default, so the ROI is copied
+  BOOST_CHECK_EQUAL(roi->readInt(NDPluginROIEnableViewString), 0);
+  roi->lock();
+  BOOST_CHECK_NO_THROW(roi->processCallbacks(pStr->pArrays[0]));
+  roi->unlock();
+  BOOST_REQUIRE_EQUAL(callbackCount, startCount+1);
+  BOOST_CHECK(!cbIsView);
+
+  // With views enabled the output references the data of the input array
+  BOOST_CHECK_NO_THROW(roi->write(NDPluginROIEnableViewString, 1));
+  roi->lock();
+  BOOST_CHECK_NO_THROW(roi->processCallbacks(pStr->pArrays[0]));
+  roi->unlock();
+  BOOST_REQUIRE_EQUAL(callbackCount, startCount+2);
+  BOOST_CHECK(cbIsView);
+}
+
 
 BOOST_AUTO_TEST_SUITE_END() // Done!
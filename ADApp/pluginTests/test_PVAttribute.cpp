@@ -0,0 +1,221 @@
+/*
+ * test_PVAttribute.cpp
+ *
+ *  Tests for PVAttribute and PVAttributeGroup.
+ *  The monitor callbacks are called directly, so the PVs do not need to exist.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and EPICS dependencies
+#include <PVAttribute.h>
+#include <epicsTime.h>
+
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+static const int numAttributes = 250;
+static const int numFrames = 2000;
+
+static PVAttribute *createAttribute(int i, NDAttrDataType_t dataType, PVAttributeGroup *pGroup)
+{
+    char name[32], source[64];
+    PVAttribute *pAttribute;
+
+    sprintf(name, "PVAttribute%d", i);
+    sprintf(source, "ADCoreTest:NoSuchPV%d", i);
+    pAttribute = new PVAttribute(name, "", source, DBR_NATIVE, pGroup);
+    // The PV never connects so set the data type that the connection callback would have set
+    pAttribute->setDataType(dataType);
+    return pAttribute;
+}
+
+static void postValue(PVAttribute *pAttribute, const void *pValue)
+{
+    struct event_handler_args eha;
+
+    memset(&eha, 0, sizeof(eha));
+    eha.status = ECA_NORMAL;
+    eha.dbr = pValue;
+    pAttribute->monitorCallback(eha);
+}
+
+static epicsFloat64 getFloat64(PVAttribute *pAttribute)
+{
+    epicsFloat64 value = -1.;
+    pAttribute->getValue(NDAttrFloat64, &value);
+    return value;
+}
+
+BOOST_AUTO_TEST_CASE(test_GroupSnapshot)
+{
+    PVAttributeGroup group;
+    PVAttribute *pA = createAttribute(0, NDAttrFloat64, &group);
+    PVAttribute *pB = createAttribute(1, NDAttrFloat64, &group);
+    epicsFloat64 value;
+
+    value = 1.; postValue(pA, &value);
+    value = 2.; postValue(pB, &value);
+    group.update();
+    pA->updateValue();
+    pB->updateValue();
+    BOOST_CHECK_EQUAL(getFloat64(pA), 1.);
+    BOOST_CHECK_EQUAL(getFloat64(pB), 2.);
+
+    // New values are not seen until the group takes another snapshot
+    value = 10.; postValue(pA, &value);
+    pA->updateValue();
+    BOOST_CHECK_EQUAL(getFloat64(pA), 1.);
+
+    // Only the last of several callbacks between snapshots is used
+    value = 3.; postValue(pA, &value);
+    value = 4.; postValue(pA, &value);
+    group.update();
+    pA->updateValue();
+    pB->updateValue();
+    BOOST_CHECK_EQUAL(getFloat64(pA), 4.);
+    BOOST_CHECK_EQUAL(getFloat64(pB), 2.);
+
+    delete pA;
+    delete pB;
+}
+
+BOOST_AUTO_TEST_CASE(test_StringSnapshot)
+{
+    PVAttributeGroup group;
+    PVAttribute *pA = createAttribute(0, NDAttrString, &group);
+    std::string value;
+
+    postValue(pA, "first");
+    postValue(pA, "second");
+    group.update();
+    pA->updateValue();
+    pA->getValue(value);
+    BOOST_CHECK_EQUAL(value, "second");
+
+    postValue(pA, "third");
+    group.update();
+    pA->updateValue();
+    pA->getValue(value);
+    BOOST_CHECK_EQUAL(value, "third");
+
+    delete pA;
+}
+
+BOOST_AUTO_TEST_CASE(test_OwnGroup)
+{
+    // An attribute created without a group takes its own snapshot in updateValue()
+    PVAttribute *pA = createAttribute(0, NDAttrFloat64, NULL);
+    epicsFloat64 value = 5.;
+
+    postValue(pA, &value);
+    pA->updateValue();
+    BOOST_CHECK_EQUAL(getFloat64(pA), 5.);
+
+    delete pA;
+}
+
+BOOST_AUTO_TEST_CASE(test_DeletePending)
+{
+    PVAttributeGroup group;
+    PVAttribute *pA = createAttribute(0, NDAttrFloat64, &group);
+    PVAttribute *pB = createAttribute(1, NDAttrFloat64, &group);
+    epicsFloat64 value = 6.;
+
+    // Deleting an attribute with a pending value must remove it from the group
+    postValue(pA, &value);
+    postValue(pB, &value);
+    delete pA;
+    group.update();
+    pB->updateValue();
+    BOOST_CHECK_EQUAL(getFloat64(pB), 6.);
+
+    delete pB;
+}
+
+BOOST_AUTO_TEST_CASE(test_AttributeListUpdate)
+{
+    // An NDAttributeList with the group's update function takes the snapshot in updateValues(),
+    // as asynNDArrayDriver does, so callers of updateValues() see the new values
+    PVAttributeGroup group;
+    NDAttributeList list;
+    PVAttribute *pA = createAttribute(0, NDAttrFloat64, &group);
+    PVAttribute *pB = createAttribute(1, NDAttrString, &group);
+    std::string svalue;
+    epicsFloat64 value;
+
+    list.setUpdateFunction(PVAttributeGroup::updateFunction, &group);
+    list.add(pA);
+    list.add(pB);
+    value = 7.; postValue(pA, &value);
+    postValue(pB, "seven");
+    list.updateValues();
+    BOOST_CHECK_EQUAL(getFloat64(pA), 7.);
+    pB->getValue(svalue);
+    BOOST_CHECK_EQUAL(svalue, "seven");
+
+    value = 8.; postValue(pA, &value);
+    postValue(pB, "eight");
+    list.updateValues();
+    BOOST_CHECK_EQUAL(getFloat64(pA), 8.);
+    pB->getValue(svalue);
+    BOOST_CHECK_EQUAL(svalue, "eight");
+
+    // The list deletes the attributes, which must be done before the group is deleted
+    list.clear();
+}
+
+/* Many attributes, of which one changes for each frame, updated with one group for each attribute
+ * and with a group shared by all of them, must have the same values.  The times are reported. */
+BOOST_AUTO_TEST_CASE(test_ManyAttributes)
+{
+    PVAttributeGroup group;
+    std::vector<PVAttribute *> shared, own;
+    epicsTimeStamp tStart, tEnd;
+    epicsFloat64 value;
+    double elapsed;
+    int i, frame;
+
+    for (i=0; i<numAttributes; i++) {
+        shared.push_back(createAttribute(i, NDAttrFloat64, &group));
+        own.push_back(createAttribute(i, NDAttrFloat64, NULL));
+    }
+
+    // Each frame one attribute has changed
+    epicsTimeGetCurrent(&tStart);
+    for (frame=0; frame<numFrames; frame++) {
+        value = frame;
+        postValue(own[frame % numAttributes], &value);
+        for (i=0; i<numAttributes; i++) own[i]->updateValue();
+    }
+    epicsTimeGetCurrent(&tEnd);
+    elapsed = epicsTimeDiffInSeconds(&tEnd, &tStart);
+    BOOST_TEST_MESSAGE("Update of " << numAttributes << " PVAttributes, one group each: " << elapsed/numFrames*1e6 << " us");
+
+    epicsTimeGetCurrent(&tStart);
+    for (frame=0; frame<numFrames; frame++) {
+        value = frame;
+        postValue(shared[frame % numAttributes], &value);
+        group.update();
+        for (i=0; i<numAttributes; i++) shared[i]->updateValue();
+    }
+    epicsTimeGetCurrent(&tEnd);
+    elapsed = epicsTimeDiffInSeconds(&tEnd, &tStart);
+    BOOST_TEST_MESSAGE("Update of " << numAttributes << " PVAttributes, shared group: " << elapsed/numFrames*1e6 << " us");
+
+    // Each attribute has the value of the last frame in which it changed
+    for (i=0; i<numAttributes; i++) {
+        frame = numFrames - 1 - (numFrames - 1 - i) % numAttributes;
+        BOOST_CHECK_EQUAL(getFloat64(own[i]), frame);
+        BOOST_CHECK_EQUAL(getFloat64(shared[i]), frame);
+    }
+
+    for (i=0; i<numAttributes; i++) {
+        delete shared[i];
+        delete own[i];
+    }
+}